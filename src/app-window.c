@@ -8,6 +8,7 @@
 #include "device-list-widget.h"
 #include "event-widget.h"
 #include "joystick.h"
+#include "stats-widget.h"
 
 #include "app-window.h"
 
@@ -35,6 +36,7 @@ GtkWidget *app_window_new(GtkApplication *app)
     GtkWidget *box;
     GtkWidget *scan_btn;
     GtkWidget *event_widget;
+    GtkWidget *stats_widget;
     int        row = 0;
 
     window = gtk_application_window_new(app);
@@ -44,13 +46,13 @@ GtkWidget *app_window_new(GtkApplication *app)
     grid = gtk_grid_new();
 
     device_list = device_list_widget_new();
-    gtk_grid_attach(GTK_GRID(grid), device_list, 0, row++, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), device_list, 0, row++, 2, 1);
 
     box = gtk_button_box_new(GTK_ORIENTATION_HORIZONTAL);
     gtk_box_set_spacing(GTK_BOX(box), 8);
     scan_btn = gtk_button_new_with_label("Rescan devices");
     gtk_box_pack_start(GTK_BOX(box), scan_btn, FALSE, FALSE, 0);
-    gtk_grid_attach(GTK_GRID(grid), box, 0, row++, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), box, 0, row++, 2, 1);
     g_signal_connect(G_OBJECT(scan_btn),
                      "clicked",
                      G_CALLBACK(on_scan_clicked),
@@ -59,13 +61,17 @@ GtkWidget *app_window_new(GtkApplication *app)
     event_widget = event_widget_new();
     gtk_widget_set_valign(event_widget, GTK_ALIGN_START);
     gtk_widget_set_vexpand(event_widget, TRUE);
-    gtk_grid_attach(GTK_GRID(grid), event_widget, 0, row++, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), event_widget, 0, row, 1, 1);
+
+    stats_widget = stats_widget_new();
+    gtk_widget_set_valign(stats_widget, GTK_ALIGN_START);
+    gtk_grid_attach(GTK_GRID(grid), stats_widget, 1, row++, 1, 1);
 
     statusbar = gtk_statusbar_new();
     gtk_widget_set_valign(statusbar, GTK_ALIGN_END);
     gtk_widget_set_vexpand(statusbar, FALSE);
     gtk_statusbar_push(GTK_STATUSBAR(statusbar), 0, "OK.");
-    gtk_grid_attach(GTK_GRID(grid), statusbar, 0, row, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), statusbar, 0, row, 2, 1);
 
 
     gtk_container_add(GTK_CONTAINER(window), grid);
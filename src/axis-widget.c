@@ -82,6 +82,14 @@ void joy_axis_widget_set_value(GtkWidget *widget, int32_t value)
 }
 
 
+/* reuse widget for another axis, resets the value as well */
+void joy_axis_widget_set_range(GtkWidget *widget, int32_t minimum, int32_t maximum)
+{
+    gtk_range_set_range(GTK_RANGE(widget), (double)minimum, (double)maximum);
+    gtk_range_set_value(GTK_RANGE(widget), 0.0);
+}
+
+
 /* call on program exit */
 void joy_axis_widget_shutdown(void)
 {
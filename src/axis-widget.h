@@ -11,6 +11,7 @@
 
 GtkWidget *joy_axis_widget_new      (int32_t minimum, int32_t maximum);
 void       joy_axis_widget_set_value(GtkWidget *widget, int32_t value);
+void       joy_axis_widget_set_range(GtkWidget *widget, int32_t minimum, int32_t maximum);
 void       joy_axis_widget_shutdown (void);
 
 #endif
@@ -0,0 +1,778 @@
+/** \file   bench.c
+ * \brief   Benchmarks of the joystick polling engine
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ * Creates a virtual joystick through uinput, injects events into it and
+ * measures how the polling engine delivers them to a subscriber: the number
+ * of events per second and the latency from write() to delivery.
+ *
+ * The virtual joystick either has a default layout or mirrors the buttons,
+ * axes and hats of a real device or of the device a capture file was
+ * recorded from.
+ *
+ * Each read method is run through three dispatch paths:
+ *
+ * - timer:  joy_poll_dispatch() without waiting at a fixed interval, like an
+ *           emulator polling once per frame or scanline
+ * - fd:     poll() on the engine's fd and dispatching when readable, like a
+ *           main loop integration with \c g_unix_fd_add()
+ * - thread: the engine's reader thread
+ *
+ * Latency is measured by encoding a frame sequence number in the value of a
+ * carrier axis and looking up the time the frame was written when the axis
+ * event arrives. This is exact while fewer than \c BENCH_LATENCY_SLOTS frames
+ * are in flight, which always holds unless flooding a slow path.
+ *
+ * Requires write access to /dev/uinput and read access to the created
+ * event node, so usually needs to be run as root.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libevdev/libevdev.h>
+#include <libevdev/libevdev-uinput.h>
+#include <linux/input.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "event-capture.h"
+#include "joystick.h"
+#include "joy-cache.h"
+#include "vice.h"
+
+
+/** \brief  Default number of frames to write per run */
+#define BENCH_DEFAULT_FRAMES    200000ul
+
+/** \brief  Default number of frames written per write() call */
+#define BENCH_DEFAULT_BURST     16u
+
+/** \brief  Maximum number of frames written per write() call */
+#define BENCH_MAX_BURST         256u
+
+/** \brief  Maximum number of events per frame: carrier, button, SYN_REPORT */
+#define BENCH_FRAME_EVENTS_MAX  3u
+
+/** \brief  Default interval of the timer path in microseconds */
+#define BENCH_DEFAULT_INTERVAL  1000u
+
+/** \brief  Time without events after the writer is done to end a run */
+#define BENCH_IDLE_TIMEOUT_MS   200
+
+/** \brief  Maximum number of frame write times kept for latency lookup */
+#define BENCH_LATENCY_SLOTS     65536u
+
+/** \brief  Minimum range of a profile axis to be used as carrier */
+#define BENCH_MIN_CARRIER_SPAN  256
+
+/** \brief  Dispatch paths */
+typedef enum {
+    BENCH_PATH_TIMER,   /**< non-blocking dispatch at a fixed interval */
+    BENCH_PATH_FD,      /**< poll() on the engine fd */
+    BENCH_PATH_THREAD,  /**< engine's reader thread */
+    BENCH_PATH_COUNT    /**< number of paths */
+} bench_path_t;
+
+/** \brief  Axis carrying the frame sequence number */
+typedef struct carrier_s {
+    uint16_t code;      /**< axis code */
+    int32_t  minimum;   /**< value of sequence number 0 */
+    uint32_t slots;     /**< number of distinct sequence values */
+} carrier_t;
+
+/** \brief  Writer thread parameters */
+typedef struct writer_args_s {
+    int           fd;           /**< uinput fd */
+    unsigned long frames;       /**< number of frames to write */
+    unsigned int  burst;        /**< frames per write() */
+    unsigned long rate;         /**< frames per second, 0 to flood */
+    int           button;       /**< button toggled each frame, -1 for none */
+    unsigned long written;      /**< number of events written */
+} writer_args_t;
+
+
+/** \brief  Names of the dispatch paths, indexed by path */
+static const char *const path_names[BENCH_PATH_COUNT] = {
+    [BENCH_PATH_TIMER]  = "timer",
+    [BENCH_PATH_FD]     = "fd",
+    [BENCH_PATH_THREAD] = "thread"
+};
+
+/** \brief  Carrier axis of the virtual joystick */
+static carrier_t            carrier;
+
+/** \brief  Write times of frames in nanoseconds, indexed by sequence slot */
+static _Atomic uint64_t    *send_times;
+
+/** \brief  Latency samples in nanoseconds
+ *
+ * Only written by the thread dispatching events, only read after the run.
+ */
+static uint64_t            *samples;
+
+/** \brief  Number of elements in \c samples */
+static size_t               samples_size;
+
+/** \brief  Number of latency samples taken */
+static size_t               samples_count;
+
+/** \brief  Events received by the subscriber */
+static atomic_ulong         events_received;
+
+/** \brief  Time the last event was received, in nanoseconds */
+static _Atomic uint64_t     last_received;
+
+/** \brief  Writer thread has written all frames */
+static atomic_bool          writer_done;
+
+
+/** \brief  Get monotonic time in nanoseconds
+ *
+ * \return  time in nanoseconds
+ */
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/** \brief  Sleep for a number of milliseconds
+ *
+ * \param[in]   ms  milliseconds
+ */
+static void sleep_ms(long ms)
+{
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+
+    nanosleep(&ts, NULL);
+}
+
+/** \brief  Polling engine callback counting events and taking latency samples
+ *
+ * \param[in]   device  device (unused)
+ * \param[in]   events  events
+ * \param[in]   num     number of events
+ * \param[in]   data    extra data (unused)
+ */
+static void on_events(joy_dev_info_t           *device,
+                      const struct input_event *events,
+                      size_t                    num,
+                      void                     *data)
+{
+    uint64_t t = now_ns();
+    size_t   i;
+
+    (void)device;
+    (void)data;
+    for (i = 0; i < num; i++) {
+        const struct input_event *ev = &events[i];
+
+        if (ev->type == EV_ABS && ev->code == carrier.code &&
+                samples_count < samples_size) {
+            uint32_t slot = (uint32_t)((int64_t)ev->value - carrier.minimum);
+
+            if (slot < carrier.slots) {
+                uint64_t sent = atomic_load_explicit(&send_times[slot],
+                                                     memory_order_acquire);
+                if (sent != 0 && sent <= t) {
+                    samples[samples_count++] = t - sent;
+                }
+            }
+        }
+    }
+    atomic_fetch_add(&events_received, num);
+    atomic_store(&last_received, t);
+}
+
+/** \brief  Select carrier axis of a profile
+ *
+ * Uses the axis with the widest range. If the profile doesn't have an axis
+ * with a usable range, a free axis code is used and added to the virtual
+ * joystick.
+ *
+ * \param[in]   profile profile to mirror, \c NULL for the default layout
+ *
+ * \return  \c true when the carrier needs to be added to the device
+ */
+static bool carrier_select(const joy_dev_info_t *profile)
+{
+    int64_t      best_span = 0;
+    unsigned int code;
+    unsigned int i;
+
+    carrier.code    = ABS_X;
+    carrier.minimum = INT16_MIN;
+    carrier.slots   = BENCH_LATENCY_SLOTS;
+    if (profile == NULL) {
+        return false;
+    }
+
+    for (i = 0; i < profile->num_axes; i++) {
+        const joy_abs_info_t *axis = &(profile->axis_map[i]);
+        int64_t               span = (int64_t)axis->maximum - axis->minimum + 1;
+
+        if (span > best_span) {
+            best_span       = span;
+            carrier.code    = axis->code;
+            carrier.minimum = axis->minimum;
+        }
+    }
+    if (best_span >= BENCH_MIN_CARRIER_SPAN) {
+        if (best_span < BENCH_LATENCY_SLOTS) {
+            carrier.slots = (uint32_t)best_span;
+        }
+        return false;
+    }
+
+    /* find an axis code the profile doesn't use */
+    for (code = ABS_X; code <= ABS_MISC; code++) {
+        bool used = joy_dev_info_axis_index(profile, code) >= 0;
+
+        for (i = 0; i < profile->num_hats * 2u && !used; i++) {
+            used = profile->hat_map[i].code == code;
+        }
+        if (!used) {
+            carrier.code    = (uint16_t)code;
+            carrier.minimum = INT16_MIN;
+            return true;
+        }
+    }
+    fprintf(stderr, "error: no free axis code for the latency carrier\n");
+    exit(EXIT_FAILURE);
+}
+
+/** \brief  Enable an axis on a libevdev device
+ *
+ * Fuzz is left at 0 so the input core doesn't drop any injected events.
+ *
+ * \param[in]   dev     libevdev device
+ * \param[in]   axis    axis data
+ */
+static void enable_axis(struct libevdev *dev, const joy_abs_info_t *axis)
+{
+    struct input_absinfo abs;
+
+    memset(&abs, 0, sizeof abs);
+    abs.minimum    = axis->minimum;
+    abs.maximum    = axis->maximum;
+    abs.flat       = axis->flat;
+    abs.resolution = axis->resolution;
+    libevdev_enable_event_code(dev, EV_ABS, axis->code, &abs);
+}
+
+/** \brief  Create virtual joystick
+ *
+ * \param[in]   profile device to mirror, \c NULL for the default layout
+ *
+ * \return  uinput device or \c NULL on failure
+ */
+static struct libevdev_uinput *create_uinput_device(const joy_dev_info_t *profile)
+{
+    struct libevdev        *dev;
+    struct libevdev_uinput *uidev = NULL;
+    joy_abs_info_t          axis;
+    bool                    add_carrier;
+    unsigned int            i;
+    int                     rc;
+
+    add_carrier = carrier_select(profile);
+
+    dev = libevdev_new();
+    libevdev_set_id_bustype(dev, BUS_VIRTUAL);
+    libevdev_enable_event_type(dev, EV_ABS);
+    libevdev_enable_event_type(dev, EV_KEY);
+
+    memset(&axis, 0, sizeof axis);
+    axis.minimum = INT16_MIN;
+    axis.maximum = INT16_MAX;
+
+    if (profile == NULL) {
+        libevdev_set_name(dev, "evdev-js-test benchmark joystick");
+        libevdev_set_id_vendor(dev, 0x1209);
+        libevdev_set_id_product(dev, 0x0001);
+        libevdev_set_id_version(dev, 1);
+        for (axis.code = ABS_X; axis.code <= ABS_RZ; axis.code++) {
+            enable_axis(dev, &axis);
+        }
+        for (i = BTN_A; i <= BTN_THUMBR; i++) {
+            libevdev_enable_event_code(dev, EV_KEY, i, NULL);
+        }
+    } else {
+        char name[256];
+
+        snprintf(name, sizeof name, "evdev-js-test benchmark: %s", profile->name);
+        libevdev_set_name(dev, name);
+        libevdev_set_id_vendor(dev, profile->vendor);
+        libevdev_set_id_product(dev, profile->product);
+        libevdev_set_id_version(dev, profile->version);
+        for (i = 0; i < profile->num_axes; i++) {
+            enable_axis(dev, &(profile->axis_map[i]));
+        }
+        for (i = 0; i < profile->num_hats * 2u; i++) {
+            enable_axis(dev, &(profile->hat_map[i]));
+        }
+        for (i = 0; i < profile->num_buttons; i++) {
+            libevdev_enable_event_code(dev, EV_KEY, profile->button_map[i], NULL);
+        }
+        if (add_carrier) {
+            axis.code = carrier.code;
+            enable_axis(dev, &axis);
+        }
+    }
+
+    rc = libevdev_uinput_create_from_device(dev,
+                                            LIBEVDEV_UINPUT_OPEN_MANAGED,
+                                            &uidev);
+    libevdev_free(dev);
+    if (rc < 0) {
+        fprintf(stderr, "error: failed to create uinput device: %s\n",
+                strerror(-rc));
+        return NULL;
+    }
+    return uidev;
+}
+
+/** \brief  Writer thread injecting events into the virtual joystick
+ *
+ * Each frame sets the carrier axis to the frame's sequence value, toggles a
+ * button if the device has one and ends with a \c SYN_REPORT. Successive
+ * carrier values always differ, so the kernel doesn't drop any frame.
+ *
+ * \param[in]   arg writer arguments
+ *
+ * \return  \c NULL
+ */
+static void *writer_thread(void *arg)
+{
+    writer_args_t      *args = arg;
+    struct input_event  events[BENCH_MAX_BURST * BENCH_FRAME_EVENTS_MAX];
+    struct timespec     next;
+    uint64_t            period = 0;
+    unsigned long       frame = 0;
+
+    memset(events, 0, sizeof events);
+    if (args->rate > 0) {
+        period = (uint64_t)args->burst * 1000000000u / args->rate;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while (frame < args->frames) {
+        unsigned int burst = args->burst;
+        unsigned int num   = 0;
+        unsigned int f;
+        uint64_t     t;
+        size_t       bytes;
+
+        if (args->frames - frame < burst) {
+            burst = (unsigned int)(args->frames - frame);
+        }
+        if (period > 0) {
+            uint64_t ns = (uint64_t)next.tv_nsec + period;
+
+            next.tv_sec  += (time_t)(ns / 1000000000u);
+            next.tv_nsec  = (long)(ns % 1000000000u);
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+
+        for (f = 0; f < burst; f++) {
+            uint32_t slot = (uint32_t)((frame + f) % carrier.slots);
+
+            events[num].type  = EV_ABS;
+            events[num].code  = carrier.code;
+            events[num].value = carrier.minimum + (int32_t)slot;
+            num++;
+            if (args->button >= 0) {
+                events[num].type  = EV_KEY;
+                events[num].code  = (uint16_t)args->button;
+                events[num].value = (int32_t)((frame + f) & 1u);
+                num++;
+            }
+            events[num].type  = EV_SYN;
+            events[num].code  = SYN_REPORT;
+            events[num].value = 0;
+            num++;
+        }
+
+        t = now_ns();
+        for (f = 0; f < burst; f++) {
+            atomic_store_explicit(&send_times[(frame + f) % carrier.slots], t,
+                                  memory_order_release);
+        }
+        bytes = num * sizeof events[0];
+        if (write(args->fd, events, bytes) != (ssize_t)bytes) {
+            fprintf(stderr, "error: writing to uinput failed: %s\n",
+                    strerror(errno));
+            break;
+        }
+        args->written += num;
+        frame += burst;
+    }
+    atomic_store(&writer_done, true);
+    return NULL;
+}
+
+/** \brief  Determine if a run is done
+ *
+ * \return  \c true when the writer is done and no events arrived for
+ *          \c BENCH_IDLE_TIMEOUT_MS
+ */
+static bool run_idle(void)
+{
+    uint64_t last;
+
+    if (!atomic_load(&writer_done)) {
+        return false;
+    }
+    last = atomic_load(&last_received);
+    return now_ns() - last > (uint64_t)BENCH_IDLE_TIMEOUT_MS * 1000000u;
+}
+
+/** \brief  Dispatch events through a path until the run is done
+ *
+ * \param[in]   path        dispatch path
+ * \param[in]   interval    interval of the timer path in microseconds
+ */
+static void run_path(bench_path_t path, unsigned int interval)
+{
+    struct pollfd   pfd;
+    struct timespec ts;
+
+    switch (path) {
+        case BENCH_PATH_TIMER:
+            ts.tv_sec  = (time_t)(interval / 1000000u);
+            ts.tv_nsec = (long)(interval % 1000000u) * 1000L;
+            do {
+                nanosleep(&ts, NULL);
+                joy_poll_dispatch(0);
+            } while (!run_idle());
+            break;
+
+        case BENCH_PATH_FD:
+            pfd.fd     = joy_poll_get_fd();
+            pfd.events = POLLIN;
+            do {
+                if (poll(&pfd, 1, BENCH_IDLE_TIMEOUT_MS) > 0) {
+                    joy_poll_dispatch(0);
+                }
+            } while (!run_idle());
+            break;
+
+        case BENCH_PATH_THREAD:
+            if (!joy_poll_thread_start()) {
+                fprintf(stderr, "error: failed to start reader thread\n");
+                return;
+            }
+            do {
+                sleep_ms(10);
+            } while (!run_idle());
+            /* joins the reader thread, samples are safe to read after */
+            joy_poll_thread_stop();
+            break;
+
+        default:
+            break;
+    }
+}
+
+/** \brief  Compare latency samples for qsort()
+ *
+ * \param[in]   p1  sample
+ * \param[in]   p2  sample
+ *
+ * \return  <0, 0 or >0
+ */
+static int compar_samples(const void *p1, const void *p2)
+{
+    uint64_t s1 = *(const uint64_t *)p1;
+    uint64_t s2 = *(const uint64_t *)p2;
+
+    return (s1 > s2) - (s1 < s2);
+}
+
+/** \brief  Get latency percentile in microseconds from sorted samples
+ *
+ * \param[in]   percentile  percentile (0-100)
+ *
+ * \return  latency in microseconds
+ */
+static double percentile_us(unsigned int percentile)
+{
+    size_t index;
+
+    if (samples_count == 0) {
+        return 0.0;
+    }
+    index = samples_count * percentile / 100u;
+    if (index >= samples_count) {
+        index = samples_count - 1u;
+    }
+    return (double)samples[index] / 1e3;
+}
+
+/** \brief  Run benchmark for a read method and dispatch path
+ *
+ * \param[in]   method      read method
+ * \param[in]   path        dispatch path
+ * \param[in]   device      virtual joystick device info
+ * \param[in]   uidev       virtual joystick uinput device
+ * \param[in]   args        writer parameters
+ * \param[in]   interval    interval of the timer path in microseconds
+ */
+static void bench_run(joy_read_method_t       method,
+                      bench_path_t            path,
+                      joy_dev_info_t         *device,
+                      struct libevdev_uinput *uidev,
+                      writer_args_t          *args,
+                      unsigned int            interval)
+{
+    pthread_t           writer;
+    uint64_t            start;
+    uint64_t            last;
+    double              elapsed;
+    unsigned long       received;
+    joy_poll_latency_t  latency;
+    size_t              i;
+    int                 sub_id;
+
+    atomic_store(&events_received, 0);
+    atomic_store(&writer_done, false);
+    for (i = 0; i < carrier.slots; i++) {
+        atomic_store(&send_times[i], 0);
+    }
+    samples_count = 0;
+    args->written = 0;
+
+    joy_poll_set_read_method(method);
+    sub_id = joy_poll_subscribe_raw(device, on_events, NULL, NULL);
+    if (sub_id < 0) {
+        return;
+    }
+    /* per run latency estimate */
+    joy_poll_reset_device_stats(device);
+    /* drop anything left over from the previous run */
+    joy_poll_dispatch(0);
+    atomic_store(&events_received, 0);
+    samples_count = 0;
+
+    args->fd = libevdev_uinput_get_fd(uidev);
+    start    = now_ns();
+    atomic_store(&last_received, start);
+    pthread_create(&writer, NULL, writer_thread, args);
+    run_path(path, interval);
+    pthread_join(writer, NULL);
+    joy_poll_unsubscribe(sub_id);
+
+    received = atomic_load(&events_received);
+    last     = atomic_load(&last_received);
+    elapsed  = (double)(last - start) / 1e9;
+    qsort(samples, samples_count, sizeof samples[0], compar_samples);
+
+    printf("%-6s %-8s: %9lu of %9lu events in %7.3f s: %10.0f events/s,"
+           " latency p50 %8.1f us, p99 %8.1f us, max %8.1f us\n",
+           path_names[path],
+           method == JOY_READ_RAW ? "raw" : "libevdev",
+           received, args->written, elapsed,
+           elapsed > 0.0 ? (double)received / elapsed : 0.0,
+           percentile_us(50), percentile_us(99),
+           samples_count > 0 ? (double)samples[samples_count - 1u] / 1e3 : 0.0);
+    if (joy_poll_get_device_latency(device, &latency) && latency.samples > 0) {
+        printf("%-15s  kernel timestamp to read (%s clock): avg %.1f us, jitter %.1f us\n",
+               "", joy_poll_clock_name(latency.clock_id),
+               latency.average_us, latency.jitter_us);
+    }
+}
+
+/** \brief  Load profile to mirror
+ *
+ * \param[in]   node    event node of a device, or \c NULL
+ * \param[in]   capture capture file, or \c NULL
+ * \param[out]  play    capture opened, owns the profile when set
+ *
+ * \return  profile, \c NULL for the default layout
+ */
+static joy_dev_info_t *profile_load(const char      *node,
+                                    const char      *capture,
+                                    capture_play_t **play)
+{
+    joy_dev_info_t *profile = NULL;
+
+    *play = NULL;
+    if (node != NULL) {
+        profile = joy_dev_info_new_from_path(node);
+    } else if (capture != NULL) {
+        *play = capture_play_open(capture);
+        if (*play != NULL) {
+            profile = capture_play_get_device(*play);
+        }
+    } else {
+        return NULL;
+    }
+    if (profile == NULL) {
+        fprintf(stderr, "error: failed to load profile\n");
+        exit(EXIT_FAILURE);
+    }
+    return profile;
+}
+
+/** \brief  Show usage message
+ *
+ * \param[in]   prog    program name
+ */
+static void usage(const char *prog)
+{
+    printf("Usage: %s [options]\n"
+           "  -f <frames>   number of frames to write per run (default %lu)\n"
+           "  -b <burst>    frames per write() call, 1-%u (default %u)\n"
+           "  -r <rate>     frames per second, 0 to write as fast as possible (default 0)\n"
+           "  -t <usec>     interval of the timer path (default %u)\n"
+           "  -p <node>     mirror the layout of an event device\n"
+           "  -c <file>     mirror the layout of the device a capture was recorded from\n"
+           "  -m <method>   read method: raw, libevdev or all (default all)\n"
+           "  -P <path>     dispatch path: timer, fd, thread or all (default all)\n",
+           prog, BENCH_DEFAULT_FRAMES, BENCH_MAX_BURST, BENCH_DEFAULT_BURST,
+           BENCH_DEFAULT_INTERVAL);
+}
+
+/** \brief  Program entry point
+ *
+ * \param[in]   argc    argument count
+ * \param[in]   argv    argument vector
+ *
+ * \return  0 on success
+ */
+int main(int argc, char *argv[])
+{
+    struct libevdev_uinput *uidev;
+    joy_dev_info_t         *device;
+    joy_dev_info_t         *profile;
+    capture_play_t         *play;
+    writer_args_t           args;
+    joy_poll_options_t      options;
+    const char             *devnode;
+    const char             *profile_node = NULL;
+    const char             *profile_capture = NULL;
+    const char             *method_name = "all";
+    const char             *path_name = "all";
+    unsigned int            interval = BENCH_DEFAULT_INTERVAL;
+    unsigned int            m;
+    unsigned int            p;
+    int                     opt;
+
+    memset(&args, 0, sizeof args);
+    args.frames = BENCH_DEFAULT_FRAMES;
+    args.burst  = BENCH_DEFAULT_BURST;
+
+    while ((opt = getopt(argc, argv, "f:b:r:t:p:c:m:P:h")) != -1) {
+        switch (opt) {
+            case 'f':
+                args.frames = strtoul(optarg, NULL, 10);
+                break;
+            case 'b':
+                args.burst = (unsigned int)strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                args.rate = strtoul(optarg, NULL, 10);
+                break;
+            case 't':
+                interval = (unsigned int)strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                profile_node = optarg;
+                break;
+            case 'c':
+                profile_capture = optarg;
+                break;
+            case 'm':
+                method_name = optarg;
+                break;
+            case 'P':
+                path_name = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (args.frames == 0 || args.burst == 0 || args.burst > BENCH_MAX_BURST ||
+            interval == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    profile = profile_load(profile_node, profile_capture, &play);
+    uidev = create_uinput_device(profile);
+    if (uidev == NULL) {
+        return EXIT_FAILURE;
+    }
+    devnode = libevdev_uinput_get_devnode(uidev);
+    /* give udev a moment to set up the node's permissions */
+    sleep_ms(200);
+
+    device = joy_dev_info_new_from_path(devnode);
+    if (device == NULL || !joy_poll_init()) {
+        libevdev_uinput_destroy(uidev);
+        return EXIT_FAILURE;
+    }
+    /* carrier values near the center must not be flattened or dropped */
+    joy_poll_options_init(&options);
+    options.abs_fuzz = 0;
+    options.abs_flat = 0;
+    if (!joy_poll_add_device_with_options(device, &options)) {
+        joy_poll_shutdown();
+        libevdev_uinput_destroy(uidev);
+        return EXIT_FAILURE;
+    }
+    args.button = device->num_buttons > 0 ? device->button_map[0] : -1;
+
+    send_times   = lib_calloc(carrier.slots, sizeof *send_times);
+    samples_size = args.frames;
+    samples      = lib_malloc(samples_size * sizeof *samples);
+
+    printf("Virtual joystick at %s: %u axes, %u buttons, %u hats\n",
+           devnode, device->num_axes, device->num_buttons, device->num_hats);
+    printf("%lu frames of %u events per run, %u frames per write, ",
+           args.frames, args.button >= 0 ? 3u : 2u, args.burst);
+    if (args.rate > 0) {
+        printf("%lu frames/s\n", args.rate);
+    } else {
+        printf("as fast as possible (latency includes queueing)\n");
+    }
+
+    for (m = 0; m < 2; m++) {
+        joy_read_method_t method = m == 0 ? JOY_READ_LIBEVDEV : JOY_READ_RAW;
+        const char       *name   = m == 0 ? "libevdev" : "raw";
+
+        if (strcmp(method_name, "all") != 0 && strcmp(method_name, name) != 0) {
+            continue;
+        }
+        for (p = 0; p < BENCH_PATH_COUNT; p++) {
+            if (strcmp(path_name, "all") != 0 && strcmp(path_name, path_names[p]) != 0) {
+                continue;
+            }
+            bench_run(method, (bench_path_t)p, device, uidev, &args, interval);
+        }
+    }
+
+    joy_poll_shutdown();
+    joy_cache_close();
+    joy_dev_info_free(device);
+    if (play != NULL) {
+        capture_play_close(play);
+    } else {
+        joy_dev_info_free(profile);
+    }
+    lib_free(samples);
+    lib_free(send_times);
+    libevdev_uinput_destroy(uidev);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,506 @@
+/** \file   check.c
+ * \brief   Self checks of the parts that don't need a device
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ * Run by `make check`. Checks that the axis normalization gives the same
+ * results whatever implementation joy_axis_normalize() uses, by running it
+ * side by side with the scalar version over edge case ranges and values,
+ * and that controller mappings in the gamecontrollerdb.txt format translate
+ * events as SDL would.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "joystick.h"
+#include "joy-axis.h"
+#include "joy-mapping.h"
+
+
+#define ARRAY_LEN(arr)  (sizeof arr / sizeof arr[0])
+
+/** \brief  Number of rounds of values fed to the normalization */
+#define CHECK_AXIS_ROUNDS   2000u
+
+/** \brief  Axis ranges checked, cycled over the axes */
+static const joy_abs_info_t check_ranges[] = {
+    /* code, minimum, maximum, fuzz, flat, resolution */
+    { ABS_X,  -32768,    32767,  16,  128, 0 },
+    { ABS_Y,       0,      255,   0,   15, 0 },
+    { ABS_Z,     100,     -100,   0,    0, 0 },  /* inverted */
+    { ABS_RX,      5,        5,   0,    0, 0 },  /* empty */
+    { ABS_RY,    -10,       10,   0,   10, 0 },  /* flat == half */
+    { ABS_RZ,    -10,       10,   2,   50, 0 },  /* flat > half */
+    { ABS_THROTTLE, INT32_MIN, INT32_MAX, 0, 0, 0 },
+    { ABS_RUDDER,   INT32_MIN, INT32_MAX, 1000, 1 << 30, 0 },
+    { ABS_WHEEL,   0,        1,   0,    0, 0 },
+    { ABS_GAS,    -1,        0,   0,    0, 0 },
+    { ABS_BRAKE, -512,     511, 600,    0, 0 },  /* fuzz beyond the range */
+    { ABS_HAT0X, INT32_MIN + 1, -1, 3, 7, 0 },
+    { ABS_HAT0Y,      1, INT32_MAX, 3, 7, 0 }
+};
+
+/** \brief  GUID of the pad in the sample mapping database */
+#define CHECK_PAD_GUID      "030000003412000078560000cdab0000"
+
+/** \brief  GUID of the stick in the sample mapping database */
+#define CHECK_STICK_GUID    "05000000341200000100000000010000"
+
+/** \brief  Sample mapping database
+ *
+ * The pad's entry for another platform and the one only matching without
+ * the CRC must lose against its exact Linux entry, whatever the order.
+ */
+static const char check_mapping_db[] =
+    "# sample gamecontrollerdb.txt\n"
+    "030000003412000078560000cdab0000,Check Pad Windows,a:b1,b:b0,platform:Windows,\n"
+    "03004242341200007856000000000000,Check Pad CRC,a:b2,platform:Linux,\n"
+    "030000003412000078560000cdab0000,Check Pad,a:b0,b:b1,x:b3,y:b2,"
+    "back:b6,start:b7,guide:b8,leftshoulder:b4,rightshoulder:b5,"
+    "leftstick:b9,rightstick:b10,misc1:b11,leftx:a0,lefty:a1,lefttrigger:a2,"
+    "rightx:a3,righty:a4~,righttrigger:a5,"
+    "dpup:h0.1,dpdown:h0.4,dpleft:h0.8,dpright:h0.2,platform:Linux,\r\n"
+    "03004242341200007856000000000000,Check Pad CRC 2,a:b2,platform:Linux,\n"
+    "05000000341200000100000000010000,Check Stick,a:b0,b:b1,"
+    "dpup:-a1,dpdown:+a1,dpleft:-a0,dpright:+a0,"
+    "-leftx:h0.8,+leftx:h0.2,-lefty:h0.1,+lefty:h0.4,lefttrigger:+a2,"
+    "righttrigger:-a2,unknown:b3,rightx:a9,x:b12,\n";
+
+/** \brief  Buttons of the pad, a button below \c BTN_JOYSTICK first
+ *
+ * SDL numbers this one after the joystick buttons, so it is b11.
+ */
+static const uint16_t check_pad_buttons[] = {
+    BTN_0,
+    BTN_SOUTH, BTN_EAST, BTN_NORTH, BTN_WEST, BTN_TL, BTN_TR,
+    BTN_SELECT, BTN_START, BTN_MODE, BTN_THUMBL, BTN_THUMBR
+};
+
+/** \brief  Axes of the pad */
+static const joy_abs_info_t check_pad_axes[] = {
+    { ABS_X,  -32768, 32767, 0, 0, 0 },
+    { ABS_Y,  -32768, 32767, 0, 0, 0 },
+    { ABS_Z,       0,   255, 0, 0, 0 },
+    { ABS_RX, -32768, 32767, 0, 0, 0 },
+    { ABS_RY, -32768, 32767, 0, 0, 0 },
+    { ABS_RZ,      0,   255, 0, 0, 0 }
+};
+
+/** \brief  Buttons of the stick */
+static const uint16_t check_stick_buttons[] = {
+    BTN_TRIGGER, BTN_THUMB, BTN_THUMB2
+};
+
+/** \brief  Axes of the stick */
+static const joy_abs_info_t check_stick_axes[] = {
+    { ABS_X,    0, 1023, 0, 0, 0 },
+    { ABS_Y,    0, 1023, 0, 0, 0 },
+    { ABS_Z, -100,  100, 0, 0, 0 }
+};
+
+/** \brief  Hat of both devices */
+static const joy_abs_info_t check_hats[] = {
+    { ABS_HAT0X, -1, 1, 0, 0, 0 },
+    { ABS_HAT0Y, -1, 1, 0, 0, 0 }
+};
+
+/** \brief  Event and the control events it must translate to */
+typedef struct check_translation_s {
+    uint16_t            type;       /**< event type */
+    uint16_t            code;       /**< event code */
+    int32_t             value;      /**< event value */
+    size_t              num;        /**< number of control events */
+    joy_control_event_t controls[JOY_MAPPING_MAX_OUTPUTS];
+                                    /**< control events */
+} check_translation_t;
+
+/** \brief  Translations of the pad's events */
+static const check_translation_t check_pad_translations[] = {
+    { EV_KEY, BTN_SOUTH,  1,      1, { { JOY_CONTROL_A,          1 } } },
+    { EV_KEY, BTN_SOUTH,  0,      1, { { JOY_CONTROL_A,          0 } } },
+    { EV_KEY, BTN_NORTH,  1,      1, { { JOY_CONTROL_Y,          1 } } },
+    { EV_KEY, BTN_WEST,   1,      1, { { JOY_CONTROL_X,          1 } } },
+    { EV_KEY, BTN_THUMBR, 1,      1, { { JOY_CONTROL_RIGHTSTICK, 1 } } },
+    { EV_KEY, BTN_0,      1,      1, { { JOY_CONTROL_MISC1,      1 } } },
+    { EV_KEY, BTN_1,      1,      0, { { 0, 0 } } },
+    { EV_ABS, ABS_X,      32767,  1, { { JOY_CONTROL_LEFTX,      32767 } } },
+    { EV_ABS, ABS_X,     -32768,  1, { { JOY_CONTROL_LEFTX,     -32768 } } },
+    { EV_ABS, ABS_RY,     32767,  1, { { JOY_CONTROL_RIGHTY,    -32768 } } },
+    { EV_ABS, ABS_Z,      0,      1, { { JOY_CONTROL_LEFTTRIGGER, 0 } } },
+    { EV_ABS, ABS_Z,      255,    1, { { JOY_CONTROL_LEFTTRIGGER, 32767 } } },
+    { EV_ABS, ABS_HAT0Y, -1,      2, { { JOY_CONTROL_DPUP,       1 },
+                                       { JOY_CONTROL_DPDOWN,     0 } } },
+    { EV_ABS, ABS_HAT0Y,  1,      2, { { JOY_CONTROL_DPUP,       0 },
+                                       { JOY_CONTROL_DPDOWN,     1 } } },
+    { EV_ABS, ABS_HAT0X,  1,      2, { { JOY_CONTROL_DPLEFT,     0 },
+                                       { JOY_CONTROL_DPRIGHT,    1 } } },
+    { EV_ABS, ABS_MISC,   1,      0, { { 0, 0 } } }
+};
+
+/** \brief  Translations of the stick's events */
+static const check_translation_t check_stick_translations[] = {
+    { EV_KEY, BTN_THUMB,  1,      1, { { JOY_CONTROL_B,          1 } } },
+    { EV_KEY, BTN_THUMB2, 1,      0, { { 0, 0 } } },
+    { EV_ABS, ABS_Y,      0,      2, { { JOY_CONTROL_DPUP,       1 },
+                                       { JOY_CONTROL_DPDOWN,     0 } } },
+    { EV_ABS, ABS_Y,      1023,   2, { { JOY_CONTROL_DPUP,       0 },
+                                       { JOY_CONTROL_DPDOWN,     1 } } },
+    { EV_ABS, ABS_X,      1023,   2, { { JOY_CONTROL_DPLEFT,     0 },
+                                       { JOY_CONTROL_DPRIGHT,    1 } } },
+    { EV_ABS, ABS_HAT0X, -1,      1, { { JOY_CONTROL_LEFTX,     -32768 } } },
+    { EV_ABS, ABS_HAT0X,  1,      1, { { JOY_CONTROL_LEFTX,      32767 } } },
+    { EV_ABS, ABS_HAT0X,  0,      1, { { JOY_CONTROL_LEFTX,      0 } } },
+    { EV_ABS, ABS_HAT0Y,  1,      1, { { JOY_CONTROL_LEFTY,      32767 } } },
+    { EV_ABS, ABS_Z,      100,    2, { { JOY_CONTROL_LEFTTRIGGER, 32767 },
+                                       { JOY_CONTROL_RIGHTTRIGGER, 0 } } },
+    { EV_ABS, ABS_Z,      0,      2, { { JOY_CONTROL_LEFTTRIGGER, 0 },
+                                       { JOY_CONTROL_RIGHTTRIGGER, 0 } } },
+    { EV_ABS, ABS_Z,     -100,    2, { { JOY_CONTROL_LEFTTRIGGER, 0 },
+                                       { JOY_CONTROL_RIGHTTRIGGER, 32767 } } }
+};
+
+/** \brief  State of the pseudo random number generator */
+static uint32_t check_seed = 1u;
+
+/** \brief  Number of checks that failed */
+static unsigned int check_failures;
+
+
+/** \brief  Get next pseudo random number
+ *
+ * \return  32-bit number
+ */
+static uint32_t check_random(void)
+{
+    /* xorshift32, reproducible across runs and platforms */
+    check_seed ^= check_seed << 13;
+    check_seed ^= check_seed >> 17;
+    check_seed ^= check_seed << 5;
+    return check_seed;
+}
+
+/** \brief  Pick a value for an axis, mostly near the interesting points
+ *
+ * \param[in]   axis    axis info
+ *
+ * \return  raw value
+ */
+static int32_t check_axis_value(const joy_abs_info_t *axis)
+{
+    int64_t center = ((int64_t)axis->minimum + axis->maximum) / 2;
+    int64_t base;
+    int64_t value;
+
+    switch (check_random() % 8u) {
+        case 0:
+            return INT32_MIN;
+        case 1:
+            return INT32_MAX;
+        case 2:
+            base = axis->minimum;
+            break;
+        case 3:
+            base = axis->maximum;
+            break;
+        case 4:
+            base = center - axis->flat;
+            break;
+        case 5:
+            base = center + axis->flat;
+            break;
+        case 6:
+            base = center;
+            break;
+        default:
+            return (int32_t)check_random();
+    }
+    value = base + (int64_t)(check_random() % 65u) - 32;
+    if (value < INT32_MIN) {
+        value = INT32_MIN;
+    } else if (value > INT32_MAX) {
+        value = INT32_MAX;
+    }
+    return (int32_t)value;
+}
+
+/** \brief  Report a failed check
+ *
+ * \param[in]   what    what was checked
+ * \param[in]   round   round
+ * \param[in]   axis    axis index
+ * \param[in]   value   raw value
+ */
+static void check_fail(const char *what, unsigned int round, unsigned int axis, int32_t value)
+{
+    if (check_failures++ < 10u) {
+        fprintf(stderr, "error: %s differs in round %u, axis %u, value %d\n",
+                what, round, axis, (int)value);
+    }
+}
+
+/** \brief  Check joy_axis_normalize() against the scalar version
+ *
+ * Both get the same values round after round, so the hysteresis is
+ * exercised too, and the held values and results must match bit for bit.
+ * The number of axes isn't a multiple of \c JOY_AXIS_LANES, to also cover
+ * the unused lanes.
+ *
+ * \return  number of checks done
+ */
+static unsigned int check_axis_normalize(void)
+{
+    joy_abs_info_t  axes[JOY_STATE_MAX_AXES];
+    joy_axis_norm_t norm;
+    int32_t         raw[JOY_STATE_MAX_AXES];
+    int32_t         held_vector[JOY_STATE_MAX_AXES];
+    int32_t         held_scalar[JOY_STATE_MAX_AXES];
+    float           out_vector[JOY_STATE_MAX_AXES];
+    float           out_scalar[JOY_STATE_MAX_AXES];
+    unsigned int    num_axes = (unsigned int)ARRAY_LEN(check_ranges) * 2u + 1u;
+    unsigned int    lanes    = (num_axes + JOY_AXIS_LANES - 1u) / JOY_AXIS_LANES * JOY_AXIS_LANES;
+    unsigned int    checks   = 0;
+    unsigned int    round;
+    unsigned int    i;
+
+    for (i = 0; i < num_axes; i++) {
+        axes[i] = check_ranges[i % (unsigned int)ARRAY_LEN(check_ranges)];
+    }
+    joy_axis_norm_init(&norm, axes, num_axes);
+    joy_axis_hold_init(&norm, held_vector);
+    joy_axis_hold_init(&norm, held_scalar);
+    memset(raw, 0, sizeof raw);
+
+    for (round = 0; round < CHECK_AXIS_ROUNDS; round++) {
+        for (i = 0; i < num_axes; i++) {
+            raw[i] = check_axis_value(&axes[i]);
+        }
+        joy_axis_normalize(&norm, raw, held_vector, out_vector);
+        joy_axis_normalize_scalar(&norm, raw, held_scalar, out_scalar);
+
+        /* the lanes processed, the rest of the arrays isn't touched */
+        for (i = 0; i < lanes; i++) {
+            float single;
+
+            checks++;
+            if (held_vector[i] != held_scalar[i]) {
+                check_fail("held value", round, i, raw[i]);
+            }
+            if (memcmp(&out_vector[i], &out_scalar[i], sizeof out_vector[i]) != 0) {
+                check_fail("normalized value", round, i, raw[i]);
+            }
+            if (!(out_scalar[i] >= -1.0f && out_scalar[i] <= 1.0f)) {
+                check_fail("range of normalized value", round, i, raw[i]);
+            }
+            if (i < num_axes) {
+                single = joy_axis_normalize_value(&norm, i, held_scalar[i]);
+                if (memcmp(&single, &out_scalar[i], sizeof single) != 0) {
+                    check_fail("single normalized value", round, i, held_scalar[i]);
+                }
+            }
+        }
+    }
+    return checks;
+}
+
+/** \brief  Check the end points of a normal range
+ *
+ * \return  number of checks done
+ */
+static unsigned int check_axis_limits(void)
+{
+    const joy_abs_info_t *axis = &check_ranges[0];
+    joy_axis_norm_t       norm;
+
+    joy_axis_norm_init(&norm, axis, 1u);
+    if (joy_axis_normalize_value(&norm, 0, axis->minimum) != -1.0f) {
+        check_fail("minimum", 0, 0, axis->minimum);
+    }
+    if (joy_axis_normalize_value(&norm, 0, axis->maximum) != 1.0f) {
+        check_fail("maximum", 0, 0, axis->maximum);
+    }
+    if (joy_axis_normalize_value(&norm, 0, axis->flat / 2) != 0.0f) {
+        check_fail("deadzone", 0, 0, axis->flat / 2);
+    }
+    return 3;
+}
+
+/** \brief  Set up a device for the mapping checks
+ *
+ * \param[out]  device      device info
+ * \param[in]   guid_str    GUID string
+ * \param[in]   buttons     button codes
+ * \param[in]   num_buttons number of \a buttons
+ * \param[in]   axes        axes
+ * \param[in]   num_axes    number of \a axes
+ */
+static void check_device_init(joy_dev_info_t       *device,
+                              const char           *guid_str,
+                              const uint16_t       *buttons,
+                              size_t                num_buttons,
+                              const joy_abs_info_t *axes,
+                              size_t                num_axes)
+{
+    size_t i;
+
+    memset(device, 0, sizeof *device);
+    memset(device->button_index, 0xff, sizeof device->button_index);
+    memset(device->axis_index,   0xff, sizeof device->axis_index);
+    snprintf(device->guid_str, sizeof device->guid_str, "%s", guid_str);
+    device->num_buttons = (uint16_t)num_buttons;
+    device->num_axes    = (uint16_t)num_axes;
+    device->num_hats    = 1;
+    device->button_map  = (uint16_t *)(uintptr_t)buttons;
+    device->axis_map    = (joy_abs_info_t *)(uintptr_t)axes;
+    device->hat_map     = (joy_abs_info_t *)(uintptr_t)check_hats;
+    for (i = 0; i < num_buttons; i++) {
+        device->button_index[buttons[i] - JOY_BUTTON_CODE_MIN] = (int16_t)i;
+    }
+    for (i = 0; i < num_axes; i++) {
+        device->axis_index[axes[i].code] = (int16_t)i;
+    }
+    joy_axis_norm_init(&(device->axis_norm), axes, (unsigned int)num_axes);
+    device->mapping = joy_mapping_find(device);
+}
+
+/** \brief  Check the translations of a device's events
+ *
+ * \param[in]   device          device info
+ * \param[in]   name            expected mapping name
+ * \param[in]   translations    events and their expected control events
+ * \param[in]   num             number of \a translations
+ *
+ * \return  number of checks done
+ */
+static unsigned int check_translations(const joy_dev_info_t      *device,
+                                       const char                *name,
+                                       const check_translation_t *translations,
+                                       size_t                     num)
+{
+    size_t i;
+
+    if (device->mapping == NULL) {
+        fprintf(stderr, "error: no mapping found for %s\n", name);
+        check_failures++;
+        return 1;
+    }
+    if (strcmp(joy_mapping_get_name(device->mapping), name) != 0) {
+        fprintf(stderr, "error: mapping '%s' found instead of '%s'\n",
+                joy_mapping_get_name(device->mapping), name);
+        check_failures++;
+    }
+
+    for (i = 0; i < num; i++) {
+        const check_translation_t *t = &translations[i];
+        struct input_event         event;
+        joy_control_event_t        controls[JOY_MAPPING_MAX_OUTPUTS];
+        size_t                     n;
+        size_t                     c;
+        bool                       ok;
+
+        memset(&event, 0, sizeof event);
+        event.type  = t->type;
+        event.code  = t->code;
+        event.value = t->value;
+        n  = joy_mapping_translate(device, &event, controls);
+        ok = n == t->num;
+        for (c = 0; ok && c < n; c++) {
+            ok = controls[c].control == t->controls[c].control &&
+                 controls[c].value   == t->controls[c].value;
+        }
+        if (!ok) {
+            fprintf(stderr, "error: %s: event %u/%u value %d gives",
+                    name, (unsigned int)t->type, (unsigned int)t->code, (int)t->value);
+            for (c = 0; c < n; c++) {
+                fprintf(stderr, " %s=%d",
+                        joy_control_name((joy_control_t)controls[c].control),
+                        (int)controls[c].value);
+            }
+            fprintf(stderr, "\n");
+            check_failures++;
+        }
+    }
+    return (unsigned int)num + 1u;
+}
+
+/** \brief  Check parsing and translation of the sample mapping database
+ *
+ * \return  number of checks done
+ */
+static unsigned int check_mappings(void)
+{
+    joy_dev_info_t pad;
+    joy_dev_info_t stick;
+    const char    *tmpdir = getenv("TMPDIR");
+    char           path[256];
+    unsigned int   checks = 0;
+    bool           written;
+    int            fd;
+
+    /* joy_mapping_open() maps a file */
+    snprintf(path, sizeof path, "%s/evdev-js-check-XXXXXX",
+             tmpdir != NULL && *tmpdir != '\0' ? tmpdir : "/tmp");
+    fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "error: failed to create %s\n", path);
+        check_failures++;
+        return 1;
+    }
+    written = write(fd, check_mapping_db, sizeof check_mapping_db - 1u) ==
+              (ssize_t)(sizeof check_mapping_db - 1u);
+    close(fd);
+    if (!written || !joy_mapping_open(path)) {
+        fprintf(stderr, "error: failed to open mapping database %s\n", path);
+        unlink(path);
+        check_failures++;
+        return 1;
+    }
+    unlink(path);
+
+    check_device_init(&pad, CHECK_PAD_GUID,
+                      check_pad_buttons, ARRAY_LEN(check_pad_buttons),
+                      check_pad_axes, ARRAY_LEN(check_pad_axes));
+    check_device_init(&stick, CHECK_STICK_GUID,
+                      check_stick_buttons, ARRAY_LEN(check_stick_buttons),
+                      check_stick_axes, ARRAY_LEN(check_stick_axes));
+    checks += check_translations(&pad, "Check Pad",
+                                 check_pad_translations,
+                                 ARRAY_LEN(check_pad_translations));
+    checks += check_translations(&stick, "Check Stick",
+                                 check_stick_translations,
+                                 ARRAY_LEN(check_stick_translations));
+    joy_mapping_close();
+    return checks;
+}
+
+
+/** \brief  Program driver
+ *
+ * \param[in]   argc    argument count (unused)
+ * \param[in]   argv    argument vector (unused)
+ *
+ * \return  EXIT_SUCCESS if all checks passed
+ */
+int main(int argc, char *argv[])
+{
+    unsigned int checks = 0;
+    unsigned int failures;
+
+    (void)argc;
+    (void)argv;
+
+    checks += check_axis_normalize();
+    checks += check_axis_limits();
+    printf("axis normalization (%s): %u checks, %u failed\n",
+           joy_axis_normalize_impl(), checks, check_failures);
+
+    failures = check_failures;
+    checks   = check_mappings();
+    printf("controller mappings: %u checks, %u failed\n",
+           checks, check_failures - failures);
+
+    return check_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
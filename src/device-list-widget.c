@@ -4,6 +4,7 @@
  */
 
 #include <gtk/gtk.h>
+#include <glib-unix.h>
 #include <stdbool.h>
 #include "app-window.h"
 #include "joystick.h"
@@ -16,6 +17,9 @@ static GtkWidget       *device_view = NULL;
 static joy_dev_info_t **scanned_devices = NULL;
 static joy_dev_info_t  *current_device = NULL;
 
+/** \brief  GSource ID of the hotplug fd watch, 0 if not watching */
+static guint            hotplug_source_id = 0;
+
 
 
 static GString *get_axis_names(const joy_dev_info_t *device)
@@ -69,93 +73,124 @@ static GString *get_hat_names(const joy_dev_info_t *device)
 }
 
 
-static GtkWidget *create_inner_widget(const joy_dev_info_t *device)
+/** \brief  Add property row to the details grid
+ *
+ * \param[in]   grid    details grid
+ * \param[in]   row     grid row
+ * \param[in]   name    property name
+ * \param[in]   value   property value
+ */
+static void details_add_row(GtkWidget  *grid,
+                            gint        row,
+                            const char *name,
+                            const char *value)
 {
-    GtkWidget         *tree;
-    GtkListStore      *model;
-    GtkCellRenderer   *renderer;
-    GtkTreeViewColumn *column;
-    GtkTreeIter        iter;
-    GString           *names;
-    GString           *temp;
-
-    model    = gtk_list_store_new(2, G_TYPE_STRING, G_TYPE_STRING);
-    tree     = gtk_tree_view_new_with_model(GTK_TREE_MODEL(model));
-    renderer = gtk_cell_renderer_text_new();
-    column   = gtk_tree_view_column_new_with_attributes("property",
-                                                        renderer,
-                                                        "text", 0,
-                                                        NULL);
-    gtk_tree_view_append_column(GTK_TREE_VIEW(tree), column);
-    column   = gtk_tree_view_column_new_with_attributes("value",
-                                                        renderer,
-                                                        "text", 1,
-                                                        NULL);
-    gtk_tree_view_append_column(GTK_TREE_VIEW(tree), column);
-
-    gtk_list_store_append(GTK_LIST_STORE(model), &iter);
-    gtk_list_store_set(model, &iter, 0, "GUID", 1, device->guid_str, -1);
-    gtk_list_store_append(GTK_LIST_STORE(model), &iter);
-    gtk_list_store_set(model, &iter, 0, "device node", 1, device->path, -1);
-
-    gtk_list_store_append(GTK_LIST_STORE(model), &iter);
-    if (device->num_buttons > 0) {
-        names = get_button_names(device);
-        temp  = g_string_new(NULL);
-        g_string_printf(temp, "%u (%s)", device->num_buttons, names->str);
-        gtk_list_store_set(model, &iter, 0, "buttons", 1, temp->str, -1);
-        g_string_free(names, TRUE);
-        g_string_free(temp, TRUE);
-    } else {
-        gtk_list_store_set(model, &iter, 0, "buttons", 1, "None", -1);
-    }
+    GtkWidget *label;
 
-    gtk_list_store_append(GTK_LIST_STORE(model), &iter);
-    if (device->num_axes > 0) {
-        names = get_axis_names(device);
-        temp  = g_string_new(NULL);
-        g_string_printf(temp, "%u (%s)", device->num_axes, names->str);
-        gtk_list_store_set(model, &iter, 0, "axes", 1, temp->str, -1);
-        g_string_free(names, TRUE);
-        g_string_free(temp, TRUE);
-    } else {
-        gtk_list_store_set(model, &iter, 0, "axes", 1, "None", -1);
-    }
+    label = gtk_label_new(name);
+    gtk_widget_set_halign(label, GTK_ALIGN_START);
+    gtk_widget_set_valign(label, GTK_ALIGN_START);
+    gtk_grid_attach(GTK_GRID(grid), label, 0, row, 1, 1);
 
-    gtk_list_store_append(GTK_LIST_STORE(model), &iter);
-    if (device->num_hats > 0) {
-        names = get_hat_names(device);
-        temp  = g_string_new(NULL);
-        g_string_printf(temp, "%u (%s)", device->num_hats, names->str);
-        gtk_list_store_set(model, &iter, 0, "hats", 1, temp->str, -1);
-        g_string_free(names, TRUE);
-        g_string_free(temp, TRUE);
+    label = gtk_label_new(value);
+    gtk_widget_set_halign(label, GTK_ALIGN_START);
+    gtk_widget_set_hexpand(label, TRUE);
+    gtk_label_set_xalign(GTK_LABEL(label), 0.0);
+    gtk_label_set_line_wrap(GTK_LABEL(label), TRUE);
+    gtk_label_set_selectable(GTK_LABEL(label), TRUE);
+    gtk_grid_attach(GTK_GRID(grid), label, 1, row, 1, 1);
+}
+
+/** \brief  Add property row with a count and names to the details grid
+ *
+ * \param[in]   grid    details grid
+ * \param[in]   row     grid row
+ * \param[in]   name    property name
+ * \param[in]   count   number of items
+ * \param[in]   names   names of the items, freed
+ */
+static void details_add_names(GtkWidget    *grid,
+                              gint          row,
+                              const char   *name,
+                              unsigned int  count,
+                              GString      *names)
+{
+    gchar *value;
+
+    if (count > 0) {
+        value = g_strdup_printf("%u (%s)", count, names->str);
+        details_add_row(grid, row, name, value);
+        g_free(value);
     } else {
-        gtk_list_store_set(model, &iter, 0, "hats", 1, "None", -1);
+        details_add_row(grid, row, name, "None");
     }
+    g_string_free(names, TRUE);
+}
 
-    gtk_tree_view_set_headers_visible(GTK_TREE_VIEW(tree), FALSE);
-    gtk_tree_view_set_grid_lines(GTK_TREE_VIEW(tree), GTK_TREE_VIEW_GRID_LINES_BOTH);
-    gtk_widget_set_hexpand(tree, TRUE);
+/** \brief  Create widget with the details of a device
+ *
+ * Only created when a row is expanded, and destroyed again when collapsed,
+ * so the list itself stays cheap no matter how many devices there are.
+ *
+ * \param[in]   device  joystick device
+ *
+ * \return  GtkGrid
+ */
+static GtkWidget *create_inner_widget(const joy_dev_info_t *device)
+{
+    GtkWidget *grid;
+
+    grid = gtk_grid_new();
+    gtk_grid_set_column_spacing(GTK_GRID(grid), 16);
+    gtk_grid_set_row_spacing(GTK_GRID(grid), 4);
+    gtk_widget_set_margin_start(grid, 16);
+    gtk_widget_set_margin_bottom(grid, 8);
+
+    details_add_row(grid, 0, "GUID", device->guid_str);
+    details_add_row(grid, 1, "device node", device->path);
+    details_add_names(grid, 2, "buttons", device->num_buttons, get_button_names(device));
+    details_add_names(grid, 3, "axes",    device->num_axes,    get_axis_names(device));
+    details_add_names(grid, 4, "hats",    device->num_hats,    get_hat_names(device));
 
-    gtk_widget_show_all(tree);
-    return tree;
+    gtk_widget_show_all(grid);
+    return grid;
 }
 
-static void on_expander_expanded(G_GNUC_UNUSED GObject    *self,
+/** \brief  Handler for the 'notify::expanded' event of a row's expander
+ *
+ * Builds the details widget and starts polling the device on expand, and
+ * destroys the details widget on collapse.
+ *
+ * \param[in]   self        expander
+ * \param[in]   param_spec  property (unused)
+ * \param[in]   data        joystick device
+ */
+static void on_expander_expanded(              GObject    *self,
                                  G_GNUC_UNUSED GParamSpec *param_spec,
                                                gpointer    data)
 {
-    event_widget_start_poll(data);
-}
+    GtkWidget *child = gtk_bin_get_child(GTK_BIN(self));
 
-static void on_expander_destroy(G_GNUC_UNUSED GtkWidget *self,
-                                G_GNUC_UNUSED gpointer data)
-{
-//    joy_dev_info_free(data);
+    if (gtk_expander_get_expanded(GTK_EXPANDER(self))) {
+        if (child == NULL) {
+            gtk_container_add(GTK_CONTAINER(self), create_inner_widget(data));
+        }
+        event_widget_start_poll(data);
+    } else if (child != NULL) {
+        gtk_widget_destroy(child);
+    }
 }
 
 
+/** \brief  Create row for a device
+ *
+ * The row only holds an expander with the device name, the details are
+ * added when it is expanded.
+ *
+ * \param[in]   device  joystick device
+ *
+ * \return  GtkListBoxRow
+ */
 static GtkWidget *box_row_new(joy_dev_info_t *device)
 {
     GtkWidget *row;
@@ -163,26 +198,85 @@ static GtkWidget *box_row_new(joy_dev_info_t *device)
 
     row      = gtk_list_box_row_new();
     expander = gtk_expander_new(device->name);
-    gtk_container_add(GTK_CONTAINER(expander), create_inner_widget(device));
     gtk_container_add(GTK_CONTAINER(row), expander);
 
     g_signal_connect(G_OBJECT(expander),
                      "notify::expanded",
                      G_CALLBACK(on_expander_expanded),
                      (gpointer)device);
-    g_signal_connect(G_OBJECT(expander),
-                     "destroy",
-                     G_CALLBACK(on_expander_destroy),
-                     (gpointer)device);
-
     gtk_widget_show_all(row);
     return row;
 }
 
 
+/** \brief  Hotplug callback for added devices
+ *
+ * Insert a row for \a device at \a index, leaving the other rows alone.
+ *
+ * \param[in]   device  device added
+ * \param[in]   index   index of \a device in the devices list
+ * \param[in]   data    extra data (unused)
+ */
+static void on_hotplug_added(joy_dev_info_t *device,
+                             int             index,
+                             G_GNUC_UNUSED void *data)
+{
+    scanned_devices = joy_get_devices_list();
+    gtk_list_box_insert(GTK_LIST_BOX(device_view), box_row_new(device), index);
+    g_print("Device %s added.\n", device->name);
+}
+
+/** \brief  Hotplug callback for removed devices
+ *
+ * Destroy the row of \a device, leaving the other rows alone.
+ *
+ * \param[in]   device  device being removed
+ * \param[in]   index   index of \a device in the devices list
+ * \param[in]   data    extra data (unused)
+ */
+static void on_hotplug_removed(joy_dev_info_t *device,
+                               int             index,
+                               G_GNUC_UNUSED void *data)
+{
+    GtkListBoxRow *row;
+
+    g_print("Device %s removed.\n", device->name);
+    if (device == current_device) {
+        current_device = NULL;
+    }
+    row = gtk_list_box_get_row_at_index(GTK_LIST_BOX(device_view), index);
+    if (row != NULL) {
+        gtk_widget_destroy(GTK_WIDGET(row));
+    }
+}
+
+/** \brief  Handler for readable hotplug fd
+ *
+ * \param[in]   fd          hotplug fd (unused)
+ * \param[in]   condition   I/O condition (unused)
+ * \param[in]   data        extra data (unused)
+ *
+ * \return  \c G_SOURCE_CONTINUE
+ */
+static gboolean on_hotplug_fd_ready(G_GNUC_UNUSED gint         fd,
+                                    G_GNUC_UNUSED GIOCondition condition,
+                                    G_GNUC_UNUSED gpointer     data)
+{
+    joy_hotplug_dispatch();
+    /* removing the last device reallocates the list */
+    scanned_devices = joy_get_devices_list();
+    return G_SOURCE_CONTINUE;
+}
+
+
 static void on_device_list_widget_destroy(G_GNUC_UNUSED GtkWidget *self,
                                           G_GNUC_UNUSED gpointer data)
 {
+    if (hotplug_source_id > 0) {
+        g_source_remove(hotplug_source_id);
+        hotplug_source_id = 0;
+    }
+    joy_hotplug_shutdown();
     if (scanned_devices != NULL) {
         joy_free_devices_list();
         scanned_devices = NULL;
@@ -237,6 +331,17 @@ GtkWidget *device_list_widget_new(void)
         g_print("Found %d devices.\n", num);
     }
 
+    /* keep list up to date without rescanning */
+    if (joy_hotplug_init(JOY_INPUT_NODES_PATH,
+                         on_hotplug_added,
+                         on_hotplug_removed,
+                         NULL)) {
+        hotplug_source_id = g_unix_fd_add(joy_hotplug_get_fd(),
+                                          G_IO_IN,
+                                          on_hotplug_fd_ready,
+                                          NULL);
+    }
+
     g_signal_connect(G_OBJECT(grid),
                      "destroy",
                      G_CALLBACK(on_device_list_widget_destroy),
@@ -276,7 +381,7 @@ int device_list_scan_devices(void)
     if (scanned_devices != NULL) {
         joy_free_devices_list();
     }
-    num = joy_scan_devices("/dev/input/by-id", &scanned_devices);
+    num = joy_scan_devices(JOY_INPUT_NODES_PATH, &scanned_devices);
 
     device_list_clear();
     for (i = 0; i < num; i++) {
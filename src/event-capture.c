@@ -0,0 +1,386 @@
+/** \file   event-capture.c
+ * \brief   Recording and replaying of input event streams
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ * A capture file holds the device the events were recorded from and the raw
+ * events with their timestamps, so sessions can be replayed through the
+ * same code paths as live events without the hardware present:
+ *
+ * - header (\c capture_header_t)
+ * - the device's joystick info block, padded to 8 bytes
+ * - events (\c capture_event_t)
+ *
+ * The file is specific to the host (native byte order and struct layout of
+ * \c joy_dev_info_t). Recording subscribes to the polling engine and writes
+ * from the reader thread through a large stdio buffer. Playback maps the
+ * file into memory and hands out events by their time offset, so the caller
+ * decides the playback speed.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <linux/input.h>
+
+#include "vice.h"
+#include "joystick.h"
+
+#include "event-capture.h"
+
+
+/** \brief  Capture file header */
+typedef struct capture_header_s {
+    char     magic[8];      /**< CAPTURE_MAGIC, NUL-terminated */
+    uint32_t version;       /**< CAPTURE_VERSION */
+    uint32_t struct_size;   /**< sizeof(joy_dev_info_t), to reject files
+                                 from builds with a different layout */
+    uint64_t device_size;   /**< size of the device block */
+    uint64_t num_events;    /**< number of events, 0 if the recording
+                                 wasn't stopped properly */
+} capture_header_t;
+
+/** \brief  Recording in progress */
+struct capture_rec_s {
+    FILE          *fp;          /**< capture file */
+    char          *buffer;      /**< stdio buffer of \c fp */
+    int            sub_id;      /**< polling engine subscription ID */
+    unsigned long  num_events;  /**< number of events written */
+    bool           failed;      /**< a write failed, stop writing */
+};
+
+/** \brief  Capture file opened for playback */
+struct capture_play_s {
+    void                  *map;         /**< mapped file */
+    size_t                 map_size;    /**< size of \c map */
+    joy_dev_info_t        *device;      /**< device recorded */
+    const capture_event_t *events;      /**< events in \c map */
+    size_t                 num_events;  /**< number of events */
+    size_t                 next;        /**< index of next event to play */
+};
+
+
+/** \brief  Round up offset of the events to their alignment
+ *
+ * \param[in]   size    size in bytes
+ *
+ * \return  aligned size
+ */
+static size_t capture_align(size_t size)
+{
+    return (size + 7u) & ~(size_t)7u;
+}
+
+/** \brief  Polling engine callback writing events to the capture file
+ *
+ * Called on the polling engine's reader thread.
+ *
+ * \param[in]   device  device (unused)
+ * \param[in]   events  events
+ * \param[in]   num     number of \a events
+ * \param[in]   data    recording
+ */
+static void on_rec_events(joy_dev_info_t           *device,
+                          const struct input_event *events,
+                          size_t                    num,
+                          void                     *data)
+{
+    capture_rec_t *rec = data;
+    size_t         i;
+
+    (void)device;
+    if (rec->failed) {
+        return;
+    }
+    for (i = 0; i < num; i++) {
+        capture_event_t ev;
+
+        ev.time  = (uint64_t)events[i].input_event_sec * 1000000u +
+                   (uint64_t)events[i].input_event_usec;
+        ev.type  = events[i].type;
+        ev.code  = events[i].code;
+        ev.value = events[i].value;
+        if (fwrite(&ev, sizeof ev, 1, rec->fp) != 1) {
+            fprintf(stderr, "error: failed to write capture: %s\n", strerror(errno));
+            rec->failed = true;
+            return;
+        }
+    }
+    rec->num_events += num;
+}
+
+
+/** \brief  Start recording events of a device
+ *
+ * \param[in]   path    capture file path
+ * \param[in]   device  device to record, must be opened by the polling engine
+ *
+ * \return  recording or \c NULL on failure
+ */
+capture_rec_t *capture_rec_start(const char *path, joy_dev_info_t *device)
+{
+    static const char  padding[8] = { 0 };
+    capture_header_t   header;
+    capture_rec_t     *rec;
+    size_t             pad;
+
+    rec = lib_calloc(1, sizeof *rec);
+    rec->fp = fopen(path, "wb");
+    if (rec->fp == NULL) {
+        fprintf(stderr, "error: failed to create %s: %s\n", path, strerror(errno));
+        lib_free(rec);
+        return NULL;
+    }
+    /* reader thread shouldn't block on the disk for every event */
+    rec->buffer = lib_malloc(CAPTURE_BUFFER_SIZE);
+    setvbuf(rec->fp, rec->buffer, _IOFBF, CAPTURE_BUFFER_SIZE);
+
+    memset(&header, 0, sizeof header);
+    memcpy(header.magic, CAPTURE_MAGIC, sizeof header.magic);
+    header.version     = CAPTURE_VERSION;
+    header.struct_size = (uint32_t)sizeof *device;
+    header.device_size = device->size;
+    header.num_events  = 0;
+    pad = capture_align(device->size) - device->size;
+    if (fwrite(&header, sizeof header, 1, rec->fp) != 1 ||
+            fwrite(device, device->size, 1, rec->fp) != 1 ||
+            fwrite(padding, 1, pad, rec->fp) != pad) {
+        fprintf(stderr, "error: failed to write %s: %s\n", path, strerror(errno));
+        fclose(rec->fp);
+        lib_free(rec->buffer);
+        lib_free(rec);
+        return NULL;
+    }
+
+    /* the capture is the stream as read, before change suppression */
+    rec->sub_id = joy_poll_subscribe_raw(device, on_rec_events, NULL, rec);
+    if (rec->sub_id < 0) {
+        fclose(rec->fp);
+        lib_free(rec->buffer);
+        lib_free(rec);
+        return NULL;
+    }
+    return rec;
+}
+
+
+/** \brief  Stop recording and close the capture file
+ *
+ * \param[in]   rec recording
+ *
+ * \return  number of events recorded
+ */
+unsigned long capture_rec_stop(capture_rec_t *rec)
+{
+    unsigned long num_events;
+    uint64_t      count;
+
+    /* no more callbacks once this returns */
+    joy_poll_unsubscribe(rec->sub_id);
+
+    num_events = rec->num_events;
+    count      = num_events;
+    if (!rec->failed &&
+            fseek(rec->fp, (long)offsetof(capture_header_t, num_events), SEEK_SET) == 0) {
+        fwrite(&count, sizeof count, 1, rec->fp);
+    }
+    if (fclose(rec->fp) != 0) {
+        fprintf(stderr, "error: failed to close capture: %s\n", strerror(errno));
+    }
+    lib_free(rec->buffer);
+    lib_free(rec);
+    return num_events;
+}
+
+
+/** \brief  Open capture file for playback
+ *
+ * \param[in]   path    capture file path
+ *
+ * \return  playback object or \c NULL on failure
+ */
+capture_play_t *capture_play_open(const char *path)
+{
+    capture_header_t  header;
+    capture_play_t   *play;
+    struct stat       st;
+    size_t            events_offset;
+    void             *map;
+    int               fd;
+
+    fd = open(path, O_RDONLY|O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "error: failed to open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof header) {
+        fprintf(stderr, "error: %s is not a capture file\n", path);
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "error: failed to map %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    memcpy(&header, map, sizeof header);
+    if (memcmp(header.magic, CAPTURE_MAGIC, sizeof header.magic) != 0 ||
+            header.version != CAPTURE_VERSION ||
+            header.struct_size != sizeof(joy_dev_info_t) ||
+            header.device_size > (size_t)st.st_size - sizeof header) {
+        fprintf(stderr, "error: %s is not a capture file of this build\n", path);
+        munmap(map, (size_t)st.st_size);
+        return NULL;
+    }
+
+    play = lib_calloc(1, sizeof *play);
+    play->map      = map;
+    play->map_size = (size_t)st.st_size;
+    play->device   = joy_dev_info_new_from_block((const unsigned char *)map + sizeof header,
+                                                 (size_t)header.device_size);
+    if (play->device == NULL) {
+        fprintf(stderr, "error: %s has an invalid device header\n", path);
+        capture_play_close(play);
+        return NULL;
+    }
+
+    events_offset = sizeof header + capture_align((size_t)header.device_size);
+    if (events_offset > play->map_size) {
+        events_offset = play->map_size;
+    }
+    play->events     = (const capture_event_t *)(void *)((unsigned char *)map + events_offset);
+    play->num_events = (play->map_size - events_offset) / sizeof *(play->events);
+    /* a recording that wasn't stopped has no count, use what's there */
+    if (header.num_events > 0 && header.num_events < play->num_events) {
+        play->num_events = (size_t)header.num_events;
+    }
+    posix_madvise(map, play->map_size, POSIX_MADV_SEQUENTIAL);
+    return play;
+}
+
+
+/** \brief  Close capture file
+ *
+ * \param[in]   play    playback object
+ */
+void capture_play_close(capture_play_t *play)
+{
+    if (play == NULL) {
+        return;
+    }
+    joy_dev_info_free(play->device);
+    munmap(play->map, play->map_size);
+    lib_free(play);
+}
+
+
+/** \brief  Get device the capture was recorded from
+ *
+ * \param[in]   play    playback object
+ *
+ * \return  joystick info, owned by \a play
+ */
+joy_dev_info_t *capture_play_get_device(capture_play_t *play)
+{
+    return play->device;
+}
+
+
+/** \brief  Get number of events in capture
+ *
+ * \param[in]   play    playback object
+ *
+ * \return  number of events
+ */
+size_t capture_play_get_count(const capture_play_t *play)
+{
+    return play->num_events;
+}
+
+
+/** \brief  Get duration of capture
+ *
+ * \param[in]   play    playback object
+ *
+ * \return  time between first and last event in microseconds
+ */
+uint64_t capture_play_get_duration(const capture_play_t *play)
+{
+    if (play->num_events < 2) {
+        return 0;
+    }
+    return play->events[play->num_events - 1u].time - play->events[0].time;
+}
+
+
+/** \brief  Get next events of the capture
+ *
+ * Returns the events up to \a until microseconds after the first event, in
+ * the events' original timestamps. Pass \c UINT64_MAX to play as fast as
+ * possible.
+ *
+ * \param[in]   play    playback object
+ * \param[in]   until   time offset in microseconds
+ * \param[out]  events  events
+ * \param[in]   max     maximum number of \a events
+ *
+ * \return  number of events stored in \a events
+ */
+size_t capture_play_next(capture_play_t     *play,
+                         uint64_t            until,
+                         struct input_event *events,
+                         size_t              max)
+{
+    uint64_t start;
+    size_t   num = 0;
+
+    if (play->num_events == 0) {
+        return 0;
+    }
+    start = play->events[0].time;
+    while (num < max && play->next < play->num_events) {
+        const capture_event_t *ev = &(play->events[play->next]);
+
+        if (ev->time - start > until) {
+            break;
+        }
+        events[num].input_event_sec  = (time_t)(ev->time / 1000000u);
+        events[num].input_event_usec = (suseconds_t)(ev->time % 1000000u);
+        events[num].type             = ev->type;
+        events[num].code             = ev->code;
+        events[num].value            = ev->value;
+        num++;
+        play->next++;
+    }
+    return num;
+}
+
+
+/** \brief  Determine if all events have been played
+ *
+ * \param[in]   play    playback object
+ *
+ * \return  \c true when done
+ */
+bool capture_play_done(const capture_play_t *play)
+{
+    return play->next >= play->num_events;
+}
+
+
+/** \brief  Restart playback from the first event
+ *
+ * \param[in]   play    playback object
+ */
+void capture_play_rewind(capture_play_t *play)
+{
+    play->next = 0;
+}
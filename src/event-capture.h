@@ -0,0 +1,54 @@
+/** \file   event-capture.h
+ * \brief   Recording and replaying of input event streams - header
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+#ifndef EVENT_CAPTURE_H
+#define EVENT_CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/input.h>
+
+#include "joystick.h"
+
+/** \brief  Magic bytes at the start of a capture file */
+#define CAPTURE_MAGIC       "EJSREC1"
+
+/** \brief  Capture file format version */
+#define CAPTURE_VERSION     1u
+
+/** \brief  Size of the stdio buffer used for recording */
+#define CAPTURE_BUFFER_SIZE (256 * 1024)
+
+/** \brief  Event as stored in a capture file, in host byte order */
+typedef struct capture_event_s {
+    uint64_t time;      /**< event time in microseconds */
+    uint16_t type;      /**< event type */
+    uint16_t code;      /**< event code */
+    int32_t  value;     /**< event value */
+} capture_event_t;
+
+/** \brief  Recording in progress */
+typedef struct capture_rec_s capture_rec_t;
+
+/** \brief  Capture file opened for playback */
+typedef struct capture_play_s capture_play_t;
+
+capture_rec_t  *capture_rec_start(const char *path, joy_dev_info_t *device);
+unsigned long   capture_rec_stop (capture_rec_t *rec);
+
+capture_play_t *capture_play_open(const char *path);
+void            capture_play_close(capture_play_t *play);
+joy_dev_info_t *capture_play_get_device(capture_play_t *play);
+size_t          capture_play_get_count(const capture_play_t *play);
+uint64_t        capture_play_get_duration(const capture_play_t *play);
+size_t          capture_play_next(capture_play_t     *play,
+                                  uint64_t            until,
+                                  struct input_event *events,
+                                  size_t              max);
+bool            capture_play_done(const capture_play_t *play);
+void            capture_play_rewind(capture_play_t *play);
+
+#endif
@@ -0,0 +1,424 @@
+/** \file   event-log.c
+ * \brief   Batched logging of input events
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ * Logging an event only copies it into a preallocated ring, formatting and
+ * writing is done by a background thread which drains the ring at a fixed
+ * interval and writes the whole batch with a single write() call. So the
+ * cost of logging on the UI thread is a level check and a ring push, and
+ * nothing at all with logging turned off.
+ *
+ * The interval only runs while there is data: with the ring empty the log
+ * thread blocks on an eventfd, which event_log_event() signals when it
+ * pushes into the ring the thread is waiting on.
+ *
+ * Only a single thread may call event_log_event(), the ring is a
+ * single-producer/single-consumer ring.
+ */
+
+#include <errno.h>
+#include <libevdev/libevdev.h>
+#include <linux/input.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "event-ring.h"
+
+#include "event-log.h"
+
+
+/** \brief  Names of the verbosity levels, indexed by level */
+static const char *const level_names[] = {
+    [EVENT_LOG_OFF]     = "off",
+    [EVENT_LOG_BUTTONS] = "buttons",
+    [EVENT_LOG_INPUT]   = "input",
+    [EVENT_LOG_ALL]     = "all"
+};
+
+
+/** \brief  Events logged but not yet written */
+static event_ring_t     log_ring;
+
+/** \brief  Output buffer, only used with \c log_flush_lock held */
+static char             log_buffer[EVENT_LOG_BUFFER_SIZE];
+
+/** \brief  Lock serializing flushes, the ring only allows one consumer */
+static pthread_mutex_t  log_flush_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** \brief  Output file descriptor, -1 if not initialized */
+static int              log_fd = -1;
+
+/** \brief  Current verbosity level */
+static atomic_int       log_level = EVENT_LOG_ALL;
+
+/** \brief  Current output format */
+static atomic_int       log_mode = EVENT_LOG_TEXT;
+
+/** \brief  Binary magic has been written */
+static bool             log_magic_written;
+
+/** \brief  Number of ring overruns reported so far */
+static unsigned long    log_overruns_reported;
+
+/** \brief  Log thread */
+static pthread_t        log_thread;
+
+/** \brief  Log thread is running */
+static bool             log_thread_running;
+
+/** \brief  Tell the log thread to exit */
+static atomic_bool      log_thread_quit;
+
+/** \brief  Log thread waits for the ring to become non-empty */
+static atomic_bool      log_thread_idle;
+
+/** \brief  Eventfd waking the log thread, -1 if not initialized */
+static int              log_wake_fd = -1;
+
+
+/** \brief  Write buffer to the output, retrying on partial writes
+ *
+ * \param[in]   data    data
+ * \param[in]   size    number of bytes in \a data
+ */
+static void log_write(const char *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t written = write(log_fd, data, size);
+
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            /* nothing sensible to do, drop the batch */
+            return;
+        }
+        data += written;
+        size -= (size_t)written;
+    }
+}
+
+/** \brief  Format event as text
+ *
+ * \param[out]  buffer  output buffer
+ * \param[in]   size    size of \a buffer
+ * \param[in]   ev      event
+ *
+ * \return  number of characters written, excluding the NUL
+ */
+static size_t log_format_text(char *buffer, size_t size, const struct input_event *ev)
+{
+    int len;
+
+    if (ev->type == EV_SYN) {
+        len = snprintf(buffer, size,
+                       "Event: time %ld.%06ld, +++ %s +++\n",
+                       (long)ev->input_event_sec,
+                       (long)ev->input_event_usec,
+                       libevdev_event_type_get_name(ev->type));
+    } else {
+        const char *code_name = libevdev_event_code_get_name(ev->type, ev->code);
+
+        len = snprintf(buffer, size,
+                       "Event: time %ld.%06ld, type %d (%s), code %d (%s), value %d\n",
+                       (long)ev->input_event_sec,
+                       (long)ev->input_event_usec,
+                       ev->type,
+                       libevdev_event_type_get_name(ev->type),
+                       ev->code,
+                       code_name != NULL ? code_name : "?",
+                       ev->value);
+    }
+    if (len < 0) {
+        return 0;
+    }
+    return (size_t)len < size ? (size_t)len : size - 1u;
+}
+
+/** \brief  Drain the ring into the output
+ *
+ * Must be called with \c log_flush_lock held.
+ */
+static void log_drain(void)
+{
+    struct input_event events[64];
+    unsigned long      overruns;
+    size_t             used = 0;
+    size_t             num;
+
+    overruns = event_ring_get_overruns(&log_ring);
+    if (overruns != log_overruns_reported &&
+            atomic_load(&log_mode) == EVENT_LOG_TEXT) {
+        int len = snprintf(log_buffer, sizeof log_buffer,
+                           "Event log: %lu events dropped\n",
+                           overruns - log_overruns_reported);
+        used = len > 0 ? (size_t)len : 0;
+    }
+    log_overruns_reported = overruns;
+
+    do {
+        size_t i;
+
+        num = event_ring_pop(&log_ring, events, sizeof events / sizeof events[0]);
+        for (i = 0; i < num; i++) {
+            const struct input_event *ev = &events[i];
+
+            /* room for the longest line or record, otherwise write out */
+            if (sizeof log_buffer - used < 256u) {
+                log_write(log_buffer, used);
+                used = 0;
+            }
+            if (atomic_load(&log_mode) == EVENT_LOG_BINARY) {
+                event_log_record_t rec;
+
+                if (!log_magic_written) {
+                    memcpy(log_buffer + used, EVENT_LOG_BINARY_MAGIC,
+                           sizeof EVENT_LOG_BINARY_MAGIC);
+                    used += sizeof EVENT_LOG_BINARY_MAGIC;
+                    log_magic_written = true;
+                }
+                rec.sec   = (uint32_t)ev->input_event_sec;
+                rec.usec  = (uint32_t)ev->input_event_usec;
+                rec.type  = ev->type;
+                rec.code  = ev->code;
+                rec.value = ev->value;
+                memcpy(log_buffer + used, &rec, sizeof rec);
+                used += sizeof rec;
+            } else {
+                used += log_format_text(log_buffer + used,
+                                        sizeof log_buffer - used,
+                                        ev);
+            }
+        }
+    } while (num > 0);
+
+    if (used > 0) {
+        log_write(log_buffer, used);
+    }
+}
+
+/** \brief  Wake the log thread
+ */
+static void log_wake(void)
+{
+    uint64_t one = 1;
+
+    if (write(log_wake_fd, &one, sizeof one) < 0) {
+        /* EAGAIN: counter saturated, the thread wakes up anyway */
+    }
+}
+
+/** \brief  Block until the log thread is woken
+ */
+static void log_wait(void)
+{
+    uint64_t count;
+
+    while (read(log_wake_fd, &count, sizeof count) < 0 && errno == EINTR) {
+        /* retry */
+    }
+}
+
+/** \brief  Log thread
+ *
+ * \param[in]   arg unused
+ *
+ * \return  \c NULL
+ */
+static void *log_thread_main(void *arg)
+{
+    struct timespec interval = {
+        0, EVENT_LOG_FLUSH_INTERVAL_MS * 1000000L
+    };
+
+    (void)arg;
+    while (!atomic_load(&log_thread_quit)) {
+        /* no wakeups while the ring stays empty: announce being idle before
+         * checking, so a push after the check sees the flag and signals */
+        atomic_store(&log_thread_idle, true);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (event_ring_fill(&log_ring) == 0) {
+            log_wait();
+        }
+        atomic_store(&log_thread_idle, false);
+        if (atomic_load(&log_thread_quit)) {
+            break;
+        }
+
+        /* collect a batch */
+        nanosleep(&interval, NULL);
+        pthread_mutex_lock(&log_flush_lock);
+        log_drain();
+        pthread_mutex_unlock(&log_flush_lock);
+    }
+    return NULL;
+}
+
+
+/** \brief  Initialize event log and start the log thread
+ *
+ * \param[in]   fd  file descriptor to write the log to
+ *
+ * \return  \c true on success
+ */
+bool event_log_init(int fd)
+{
+    int rc;
+
+    if (log_thread_running) {
+        event_log_shutdown();
+    }
+    event_ring_init(&log_ring);
+    log_fd                = fd;
+    log_magic_written     = false;
+    log_overruns_reported = 0;
+    atomic_store(&log_thread_quit, false);
+    atomic_store(&log_thread_idle, false);
+
+    log_wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (log_wake_fd < 0) {
+        fprintf(stderr, "error: failed to create eventfd: %s\n", strerror(errno));
+        log_fd = -1;
+        return false;
+    }
+    rc = pthread_create(&log_thread, NULL, log_thread_main, NULL);
+    if (rc != 0) {
+        fprintf(stderr, "error: failed to create log thread: %s\n", strerror(rc));
+        close(log_wake_fd);
+        log_wake_fd = -1;
+        log_fd      = -1;
+        return false;
+    }
+    log_thread_running = true;
+    return true;
+}
+
+
+/** \brief  Flush pending events and stop the log thread
+ */
+void event_log_shutdown(void)
+{
+    if (!log_thread_running) {
+        return;
+    }
+    atomic_store(&log_thread_quit, true);
+    log_wake();
+    pthread_join(log_thread, NULL);
+    log_thread_running = false;
+    event_log_flush();
+    close(log_wake_fd);
+    log_wake_fd = -1;
+    log_fd      = -1;
+}
+
+
+/** \brief  Set verbosity level
+ *
+ * \param[in]   level   verbosity level
+ */
+void event_log_set_level(event_log_level_t level)
+{
+    atomic_store(&log_level, (int)level);
+}
+
+
+/** \brief  Get verbosity level
+ *
+ * \return  verbosity level
+ */
+event_log_level_t event_log_get_level(void)
+{
+    return (event_log_level_t)atomic_load(&log_level);
+}
+
+
+/** \brief  Parse name of verbosity level
+ *
+ * \param[in]   name    level name ("off", "buttons", "input" or "all")
+ * \param[out]  level   verbosity level
+ *
+ * \return  \c true if \a name is a valid level name
+ */
+bool event_log_parse_level(const char *name, event_log_level_t *level)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof level_names / sizeof level_names[0]; i++) {
+        if (strcasecmp(name, level_names[i]) == 0) {
+            *level = (event_log_level_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/** \brief  Set output format
+ *
+ * \param[in]   mode    output format
+ */
+void event_log_set_mode(event_log_mode_t mode)
+{
+    atomic_store(&log_mode, (int)mode);
+}
+
+
+/** \brief  Log event
+ *
+ * Only stores \a event, formatting and writing is done by the log thread,
+ * which is woken if it was waiting for the ring to fill. Events arriving
+ * while the ring is full are dropped and counted.
+ *
+ * \param[in]   event   event
+ */
+void event_log_event(const struct input_event *event)
+{
+    int level = atomic_load_explicit(&log_level, memory_order_relaxed);
+
+    if (level == EVENT_LOG_OFF || log_fd < 0) {
+        return;
+    }
+    switch (event->type) {
+        case EV_KEY:
+            break;
+        case EV_ABS:
+            if (level < EVENT_LOG_INPUT) {
+                return;
+            }
+            break;
+        default:
+            if (level < EVENT_LOG_ALL) {
+                return;
+            }
+            break;
+    }
+    if (event_ring_push(&log_ring, event)) {
+        /* pairs with the fence in log_thread_main() */
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load_explicit(&log_thread_idle, memory_order_relaxed) &&
+                atomic_exchange(&log_thread_idle, false)) {
+            log_wake();
+        }
+    }
+}
+
+
+/** \brief  Write pending events now
+ */
+void event_log_flush(void)
+{
+    if (log_fd < 0) {
+        return;
+    }
+    pthread_mutex_lock(&log_flush_lock);
+    log_drain();
+    pthread_mutex_unlock(&log_flush_lock);
+}
@@ -0,0 +1,54 @@
+/** \file   event-log.h
+ * \brief   Batched logging of input events - header
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <linux/input.h>
+
+/** \brief  Interval in milliseconds at which the log thread flushes */
+#define EVENT_LOG_FLUSH_INTERVAL_MS 20
+
+/** \brief  Size of the buffer events are formatted into before writing */
+#define EVENT_LOG_BUFFER_SIZE       65536
+
+/** \brief  Magic bytes written before the binary log records */
+#define EVENT_LOG_BINARY_MAGIC      "EVLOG01"
+
+/** \brief  Log verbosity levels */
+typedef enum {
+    EVENT_LOG_OFF = 0,      /**< don't log events */
+    EVENT_LOG_BUTTONS,      /**< log \c EV_KEY events */
+    EVENT_LOG_INPUT,        /**< log \c EV_KEY and \c EV_ABS events */
+    EVENT_LOG_ALL           /**< log all events, including \c EV_SYN */
+} event_log_level_t;
+
+/** \brief  Log output formats */
+typedef enum {
+    EVENT_LOG_TEXT = 0,     /**< one line of text per event */
+    EVENT_LOG_BINARY        /**< \c event_log_record_t per event */
+} event_log_mode_t;
+
+/** \brief  Binary log record, in host byte order */
+typedef struct event_log_record_s {
+    uint32_t sec;           /**< event time, seconds */
+    uint32_t usec;          /**< event time, microseconds */
+    uint16_t type;          /**< event type */
+    uint16_t code;          /**< event code */
+    int32_t  value;         /**< event value */
+} event_log_record_t;
+
+bool              event_log_init(int fd);
+void              event_log_shutdown(void);
+void              event_log_set_level(event_log_level_t level);
+event_log_level_t event_log_get_level(void);
+bool              event_log_parse_level(const char *name, event_log_level_t *level);
+void              event_log_set_mode(event_log_mode_t mode);
+void              event_log_event(const struct input_event *event);
+void              event_log_flush(void);
+
+#endif
@@ -0,0 +1,118 @@
+/** \file   event-ring.c
+ * \brief   Lock-free single-producer/single-consumer input event ring
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ * Used to move events from the reader thread to the UI thread without
+ * locking: the reader thread calls event_ring_push(), the UI thread calls
+ * event_ring_pop(). Only a single producer and a single consumer may use a
+ * ring at any time.
+ */
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <linux/input.h>
+
+#include "event-ring.h"
+
+
+/** \brief  Mask to turn a free-running index into an array index */
+#define RING_MASK   (EVENT_RING_SIZE - 1u)
+
+_Static_assert((EVENT_RING_SIZE & RING_MASK) == 0,
+               "EVENT_RING_SIZE must be a power of two");
+
+
+/** \brief  Initialize event ring
+ *
+ * Must not be called while a producer or consumer is using \a ring.
+ *
+ * \param[in]   ring    event ring
+ */
+void event_ring_init(event_ring_t *ring)
+{
+    atomic_init(&(ring->head), 0);
+    atomic_init(&(ring->tail), 0);
+    atomic_init(&(ring->overruns), 0);
+}
+
+
+/** \brief  Push event into ring
+ *
+ * Producer side. When the ring is full the event is dropped and the overrun
+ * counter is incremented.
+ *
+ * \param[in]   ring    event ring
+ * \param[in]   event   event to push
+ *
+ * \return  \c true on success, \c false if the ring was full
+ */
+bool event_ring_push(event_ring_t *ring, const struct input_event *event)
+{
+    size_t head = atomic_load_explicit(&(ring->head), memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&(ring->tail), memory_order_acquire);
+
+    if (head - tail >= EVENT_RING_SIZE) {
+        atomic_fetch_add_explicit(&(ring->overruns), 1, memory_order_relaxed);
+        return false;
+    }
+    ring->events[head & RING_MASK] = *event;
+    atomic_store_explicit(&(ring->head), head + 1u, memory_order_release);
+    return true;
+}
+
+
+/** \brief  Pop events from ring
+ *
+ * Consumer side.
+ *
+ * \param[in]   ring    event ring
+ * \param[out]  events  buffer for events
+ * \param[in]   max     maximum number of events to store in \a events
+ *
+ * \return  number of events stored in \a events
+ */
+size_t event_ring_pop(event_ring_t *ring, struct input_event *events, size_t max)
+{
+    size_t tail = atomic_load_explicit(&(ring->tail), memory_order_relaxed);
+    size_t head = atomic_load_explicit(&(ring->head), memory_order_acquire);
+    size_t num  = head - tail;
+    size_t i;
+
+    if (num > max) {
+        num = max;
+    }
+    for (i = 0; i < num; i++) {
+        events[i] = ring->events[(tail + i) & RING_MASK];
+    }
+    atomic_store_explicit(&(ring->tail), tail + num, memory_order_release);
+    return num;
+}
+
+
+/** \brief  Get number of events waiting in the ring
+ *
+ * \param[in]   ring    event ring
+ *
+ * \return  number of events, only exact when called from the consumer
+ */
+size_t event_ring_fill(event_ring_t *ring)
+{
+    size_t tail = atomic_load_explicit(&(ring->tail), memory_order_acquire);
+    size_t head = atomic_load_explicit(&(ring->head), memory_order_acquire);
+
+    return head - tail;
+}
+
+
+/** \brief  Get number of events dropped because the ring was full
+ *
+ * \param[in]   ring    event ring
+ *
+ * \return  number of dropped events
+ */
+unsigned long event_ring_get_overruns(event_ring_t *ring)
+{
+    return atomic_load_explicit(&(ring->overruns), memory_order_relaxed);
+}
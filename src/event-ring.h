@@ -0,0 +1,41 @@
+/** \file   event-ring.h
+ * \brief   Lock-free single-producer/single-consumer input event ring - header
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+#ifndef EVENT_RING_H
+#define EVENT_RING_H
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <linux/input.h>
+
+/** \brief  Number of events in the ring, must be a power of two */
+#define EVENT_RING_SIZE     1024u
+
+/** \brief  Assumed cache line size, used to keep head and tail apart */
+#define EVENT_RING_CACHELINE    64
+
+/** \brief  Event ring
+ *
+ * The producer only writes \c head, the consumer only writes \c tail, both
+ * are free-running counters masked on access.
+ */
+typedef struct event_ring_s {
+    alignas(EVENT_RING_CACHELINE) atomic_size_t head;       /**< producer index */
+    alignas(EVENT_RING_CACHELINE) atomic_size_t tail;       /**< consumer index */
+    alignas(EVENT_RING_CACHELINE) atomic_ulong  overruns;   /**< events dropped
+                                                                 due to a full
+                                                                 ring */
+    struct input_event events[EVENT_RING_SIZE];             /**< event storage */
+} event_ring_t;
+
+void   event_ring_init(event_ring_t *ring);
+bool   event_ring_push(event_ring_t *ring, const struct input_event *event);
+size_t event_ring_pop (event_ring_t *ring, struct input_event *events, size_t max);
+size_t event_ring_fill(event_ring_t *ring);
+unsigned long event_ring_get_overruns(event_ring_t *ring);
+
+#endif
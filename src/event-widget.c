@@ -4,20 +4,22 @@
  */
 
 #include <gtk/gtk.h>
-#include <errno.h>
-#include <fcntl.h>
-#include <libevdev/libevdev.h>
 #include <linux/input.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
-#include <sys/stat.h>
-#include <sys/types.h>
 
 #include "app-window.h"
 #include "axis-widget.h"
 #include "button-widget.h"
+#include "event-capture.h"
+#include "event-log.h"
+#include "event-ring.h"
 #include "joystick.h"
+#include "joy-mapping.h"
+#include "state-view.h"
+#include "stats-widget.h"
 
 #include "event-widget.h"
 
@@ -31,39 +33,103 @@
 /** \brief  Number of columns in the hat state grid */
 #define HAT_GRID_COLUMNS    2
 
+/** \brief  Maximum number of events drained from the ring in one go */
+#define DRAIN_BATCH_SIZE            64
+
+/** \brief  Maximum number of events replayed per frame at maximum speed
+ *
+ * Keeps the UI responsive while replaying large captures.
+ */
+#define REPLAY_MAX_EVENTS_PER_FRAME (256 * 1024)
+
+/** \brief  Polling states
+ *
+ * State changes are made explicitly through the poll_enter_*() functions,
+ * events are only received during the \c POLL_STATE_POLL state.
+ */
 typedef enum {
-    POLL_STATE_IDLE = 0,
-    POLL_STATE_START,
-    POLL_STATE_POLL,
-    POLL_STATE_STOP,
-    POLL_STATE_TEARDOWN
+    POLL_STATE_IDLE = 0,    /**< not subscribed to a device */
+    POLL_STATE_START,       /**< subscribing to a device */
+    POLL_STATE_POLL,        /**< subscribed to a device */
+    POLL_STATE_STOP,        /**< unsubscribing from device */
+    POLL_STATE_REPLAY,      /**< replaying a capture file */
+    POLL_STATE_TEARDOWN     /**< widget destroyed, no more polling */
 } poll_state_t;
 
 
 /** \brief  Polling state object
+ *
+ * \c sub_id and \c device_gone are shared with the polling engine's
+ * callbacks, the other fields belong to the UI thread.
  */
 typedef struct poll_data_s {
-    guint            source_id;
-    struct libevdev *evdev;
-    int              fd;
-    joy_dev_info_t  *new_device;
+    int              sub_id;         /**< polling engine subscription ID,
+                                          shared */
+    guint            tick_id;        /**< frame clock tick callback ID */
     joy_dev_info_t  *cur_device;     /**< device to poll */
-    poll_state_t     state;
-    gboolean         polling;
+    poll_state_t     state;          /**< polling state */
+    gboolean         device_gone;    /**< polling engine closed the device,
+                                          shared */
     int              prev_type;      /**< previous value of event type */
     int              prev_code;      /**< previous value of event code */
     int              prev_value;     /**< previous value of event value */
 } poll_data_t;
 
 
+/** \brief  State of the device being displayed
+ *
+ * While polling, \c current is read from the polling engine's published
+ * snapshot once per frame; while replaying, events are applied to it
+ * directly. The widgets are updated from the difference between \c current
+ * and \c shown, so the redraw cost doesn't depend on the report rate of the
+ * device.
+ */
+typedef struct dev_state_s {
+    joy_device_state_t current;     /**< latest complete report */
+    joy_device_state_t shown;       /**< state the widgets display */
+    joy_state_ref_t    ref;         /**< polling engine state reference */
+    bool               live;        /**< \c current is read through \c ref */
+} dev_state_t;
+
+
+/** \brief  Rows of a name label and a state widget in a titled grid
+ *
+ * Rows are created when a device has more controls than any device shown
+ * before, and kept afterwards: switching devices relabels the rows in use
+ * and hides the others.
+ */
+typedef struct widget_pool_s {
+    GtkWidget    *grid;     /**< titled grid holding the rows */
+    GtkWidget   **labels;   /**< name labels */
+    GtkWidget   **widgets;  /**< state widgets */
+    unsigned int  size;     /**< number of rows created */
+    unsigned int  used;     /**< number of rows shown, from the top */
+} widget_pool_t;
+
+
 /** \brief  Polling data
  *
- * Object for the UI thread and the polling thread to communicate.
- * Only to be accessed through calling \c poll_lock_obtain() and
- * \c poll_lock_release().
+ * Object for the UI thread and the polling engine's reader thread to
+ * communicate. on_poll_closed() can run on any thread and writes \c sub_id
+ * and \c device_gone, so those two are only accessed with the lock taken by
+ * poll_lock_obtain() held. All other fields are only used by the UI thread
+ * and accessed directly.
  */
 static poll_data_t  poll_data;
 
+/** \brief  Mutex protecting \c sub_id and \c device_gone of \c poll_data */
+static GMutex       poll_mutex;
+
+/** \brief  Events read by the reader thread, drained by the UI thread
+ *
+ * Doesn't need to be locked, the polling engine's reader thread is the only
+ * producer and the UI thread the only consumer.
+ */
+static event_ring_t event_ring;
+
+/** \brief  Event widget, used for the frame clock tick callback */
+static GtkWidget    *event_widget;
+
 /** \brief  Grid containing button state widgets */
 static GtkWidget    *button_grid;
 
@@ -73,45 +139,71 @@ static GtkWidget    *axis_grid;
 /** \brief  Grid containing hat state widgets */
 static GtkWidget    *hat_grid;
 
+/** \brief  Button LED widgets, indexed like the device's \c button_map */
+static widget_pool_t button_pool;
 
-/** \brief  Initialize polling state
- *
- * FIXME: rename, no longer uses threading or mutex
- */
-static void poll_lock_init(void)
-{
-    poll_data.source_id  = 0;
-    poll_data.new_device = NULL;
-    poll_data.cur_device = NULL;
-    poll_data.polling    = FALSE;
-    poll_data.state      = POLL_STATE_IDLE;
-    poll_data.prev_type  = -1;
-    poll_data.prev_code  = -1;
-    poll_data.prev_value = -1;
-}
+/** \brief  Axis widgets, indexed like the device's \c axis_map */
+static widget_pool_t axis_pool;
 
-static gboolean poll_worker(gpointer data);
+/** \brief  Hat direction labels */
+static widget_pool_t hat_pool;
 
-static void poll_lock_start_timeout(void)
-{
-    poll_data.source_id = g_timeout_add(10, poll_worker, NULL);
-}
+/** \brief  State of the device being displayed */
+static dev_state_t   dev_state;
+
+/** \brief  Recording of the polled device, if any */
+static capture_rec_t  *capture_rec;
+
+/** \brief  Capture being replayed, if any */
+static capture_play_t *capture_play;
+
+/** \brief  Replay speed factor, 0 for as fast as possible */
+static unsigned int    replay_speed = 1;
+
+/** \brief  Monotonic time replay was started, in microseconds */
+static gint64          replay_start;
+
+/** \brief  Time spent processing replayed events, in microseconds */
+static gint64          replay_busy;
 
-static void poll_lock_remove_timeout(void)
+/** \brief  Record toggle button */
+static GtkWidget      *record_button;
+
+/** \brief  Compact view drawing the whole device state */
+static GtkWidget      *state_view;
+
+/** \brief  Show the compact view instead of the button and axis widgets */
+static bool            compact_view;
+
+
+/** \brief  Initialize polling state
+ */
+static void poll_init(void)
 {
-    if (poll_data.source_id > 0) {
-        g_source_remove(poll_data.source_id);
-        poll_data.source_id = 0;
-    }
+    g_mutex_init(&poll_mutex);
+    event_ring_init(&event_ring);
+
+    poll_data.sub_id      = 0;
+    poll_data.tick_id     = 0;
+    poll_data.cur_device  = NULL;
+    poll_data.state       = POLL_STATE_IDLE;
+    poll_data.device_gone = FALSE;
+    poll_data.prev_type   = -1;
+    poll_data.prev_code   = -1;
+    poll_data.prev_value  = -1;
 }
 
-/** \brief  Obtain lock on poll data
+static void poll_enter_teardown(void);
+
+/** \brief  Obtain lock on the fields of the poll data shared with the reader
+ *
+ * Only needed for \c sub_id and \c device_gone.
  *
  * \return  poll data object reference
  */
 static poll_data_t *poll_lock_obtain(void)
 {
-//    g_mutex_lock(&poll_mutex);
+    g_mutex_lock(&poll_mutex);
     return &poll_data;
 }
 
@@ -119,7 +211,7 @@ static poll_data_t *poll_lock_obtain(void)
  */
 static void poll_lock_release(void)
 {
-//    g_mutex_unlock(&poll_mutex);
+    g_mutex_unlock(&poll_mutex);
 }
 
 /** \brief  Create label using Pango markup and setting horizontal alignment
@@ -167,30 +259,108 @@ static GtkWidget *titled_grid_new(const char   *title_markup,
     return grid;
 }
 
-/** \brief  Remove all widgets from a grid except the first row widgets
+/** \brief  Make sure a widget pool has enough rows
  *
- * \param[in]   grid    grid to remove items from
- * \param[in]   columns maximum number of columns in \a grid
+ * \param[in]   pool        widget pool
+ * \param[in]   size        number of rows required
+ * \param[in]   widget_new  function creating a state widget
  */
-static void titled_grid_clear(GtkWidget *grid, int columns)
+static void widget_pool_reserve(widget_pool_t *pool,
+                                unsigned int   size,
+                                GtkWidget   *(*widget_new)(void))
 {
-    int      row = 1;    /* skip title */
-    int      col;
-    gboolean row_empty;
+    unsigned int i;
 
-    do {
-        GtkWidget *widget;
-
-        row_empty = TRUE;
-        for (col = 0; col < columns; col++) {
-            widget = gtk_grid_get_child_at(GTK_GRID(grid), col, row);
-            if (widget != NULL) {
-                row_empty = FALSE;
-                gtk_widget_destroy(widget);
-            }
-        }
-        row++;
-    } while (!row_empty);
+    if (size <= pool->size) {
+        return;
+    }
+    pool->labels  = g_renew(GtkWidget *, pool->labels,  size);
+    pool->widgets = g_renew(GtkWidget *, pool->widgets, size);
+    for (i = pool->size; i < size; i++) {
+        GtkWidget *label  = label_helper("", GTK_ALIGN_START);
+        GtkWidget *widget = widget_new();
+
+        gtk_widget_set_margin_start(label, 8);
+        /* rows are shown by widget_pool_set_used() only */
+        gtk_widget_hide(label);
+        gtk_widget_hide(widget);
+        gtk_widget_set_no_show_all(label,  TRUE);
+        gtk_widget_set_no_show_all(widget, TRUE);
+        gtk_grid_attach(GTK_GRID(pool->grid), label,  0, (int)i + 1, 1, 1);
+        gtk_grid_attach(GTK_GRID(pool->grid), widget, 1, (int)i + 1, 1, 1);
+        pool->labels[i]  = label;
+        pool->widgets[i] = widget;
+    }
+    pool->size = size;
+}
+
+/** \brief  Set number of rows of a widget pool shown
+ *
+ * Only touches the rows that change visibility.
+ *
+ * \param[in]   pool    widget pool
+ * \param[in]   used    number of rows to show, at most the pool size
+ */
+static void widget_pool_set_used(widget_pool_t *pool, unsigned int used)
+{
+    unsigned int i;
+
+    for (i = used; i < pool->used; i++) {
+        gtk_widget_hide(pool->labels[i]);
+        gtk_widget_hide(pool->widgets[i]);
+    }
+    for (i = pool->used; i < used; i++) {
+        gtk_widget_show(pool->labels[i]);
+        gtk_widget_show(pool->widgets[i]);
+    }
+    pool->used = used;
+}
+
+/** \brief  Free a widget pool's references to its widgets
+ *
+ * The widgets themselves are owned by the grid.
+ *
+ * \param[in]   pool    widget pool
+ */
+static void widget_pool_free(widget_pool_t *pool)
+{
+    g_free(pool->labels);
+    g_free(pool->widgets);
+    pool->labels  = NULL;
+    pool->widgets = NULL;
+    pool->size    = 0;
+    pool->used    = 0;
+}
+
+/** \brief  Create button widget for a widget pool
+ *
+ * \return  button LED widget
+ */
+static GtkWidget *button_pool_widget_new(void)
+{
+    return joy_button_widget_new();
+}
+
+/** \brief  Create axis widget for a widget pool
+ *
+ * \return  axis widget, range set when used
+ */
+static GtkWidget *axis_pool_widget_new(void)
+{
+    GtkWidget *axis = joy_axis_widget_new(-1, 1);
+
+    gtk_widget_set_halign(axis, GTK_ALIGN_FILL);
+    gtk_widget_set_hexpand(axis, TRUE);
+    return axis;
+}
+
+/** \brief  Create hat widget for a widget pool
+ *
+ * \return  label showing the hat direction
+ */
+static GtkWidget *hat_pool_widget_new(void)
+{
+    return label_helper(joy_get_hat_direction_name(0), GTK_ALIGN_START);
 }
 
 /** \brief  Handler for the 'clicked' event of the "Stop polling" button
@@ -204,6 +374,290 @@ static void on_stop_polling_clicked(G_GNUC_UNUSED GtkButton *self,
     event_widget_stop_poll();
 }
 
+/** \brief  Get the events the event widget needs from a device
+ *
+ * The widgets need the buttons, axes and hats, which the log also needs
+ * unless it logs all events.
+ *
+ * \param[in]   device  device
+ * \param[out]  filter  filter
+ *
+ * \return  \a filter, or \c NULL for all events
+ */
+static const joy_poll_filter_t *poll_filter_get(const joy_dev_info_t *device,
+                                                joy_poll_filter_t    *filter)
+{
+    if (event_log_get_level() == EVENT_LOG_ALL) {
+        return NULL;
+    }
+    joy_poll_filter_init(filter);
+    joy_poll_filter_add_device(filter, device);
+    return filter;
+}
+
+/** \brief  Handler for the 'changed' event of the log level combo box
+ *
+ * \param[in]   self    combo box
+ * \param[in]   data    extra event data (unused)
+ */
+static void on_log_level_changed(GtkComboBox *self,
+                                 G_GNUC_UNUSED gpointer data)
+{
+    event_log_level_t  level;
+    joy_poll_filter_t  filter;
+    poll_data_t       *pd;
+    joy_dev_info_t    *device;
+    int                sub_id;
+    const gchar       *id = gtk_combo_box_get_active_id(self);
+
+    if (id != NULL && event_log_parse_level(id, &level)) {
+        event_log_set_level(level);
+
+        pd     = poll_lock_obtain();
+        sub_id = pd->sub_id;
+        poll_lock_release();
+        device = poll_data.cur_device;
+        /* whether the kernel should still drop the events the widgets
+         * don't need, not with our lock held since the engine's callbacks
+         * take it */
+        if (sub_id > 0 && device != NULL) {
+            joy_poll_set_filter(sub_id, poll_filter_get(device, &filter));
+        }
+    }
+}
+
+/** \brief  Create combo box to set the event log verbosity level
+ *
+ * \return  GtkComboBoxText
+ */
+static GtkWidget *log_level_combo_new(void)
+{
+    GtkWidget *combo = gtk_combo_box_text_new();
+
+    gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(combo), "off",     "Log: off");
+    gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(combo), "buttons", "Log: buttons");
+    gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(combo), "input",   "Log: buttons and axes");
+    gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(combo), "all",     "Log: all events");
+    gtk_combo_box_set_active(GTK_COMBO_BOX(combo), (gint)event_log_get_level());
+    g_signal_connect(G_OBJECT(combo),
+                     "changed",
+                     G_CALLBACK(on_log_level_changed),
+                     NULL);
+    return combo;
+}
+
+static void poll_enter_replay(const char *path);
+
+/** \brief  Run file chooser dialog
+ *
+ * \param[in]   title   dialog title
+ * \param[in]   action  open or save
+ *
+ * \return  path of the selected file, free with g_free(), or \c NULL
+ */
+static gchar *capture_file_dialog(const char *title, GtkFileChooserAction action)
+{
+    GtkWidget     *dialog;
+    GtkFileFilter *filter;
+    gchar         *path = NULL;
+
+    dialog = gtk_file_chooser_dialog_new(title,
+                                         GTK_WINDOW(gtk_widget_get_toplevel(event_widget)),
+                                         action,
+                                         "_Cancel", GTK_RESPONSE_CANCEL,
+                                         action == GTK_FILE_CHOOSER_ACTION_SAVE
+                                            ? "_Save" : "_Open",
+                                         GTK_RESPONSE_ACCEPT,
+                                         NULL);
+    filter = gtk_file_filter_new();
+    gtk_file_filter_set_name(filter, "Event captures (*.evcap)");
+    gtk_file_filter_add_pattern(filter, "*.evcap");
+    gtk_file_chooser_add_filter(GTK_FILE_CHOOSER(dialog), filter);
+    if (action == GTK_FILE_CHOOSER_ACTION_SAVE) {
+        gtk_file_chooser_set_do_overwrite_confirmation(GTK_FILE_CHOOSER(dialog), TRUE);
+        gtk_file_chooser_set_current_name(GTK_FILE_CHOOSER(dialog), "session.evcap");
+    }
+    if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
+        path = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
+    }
+    gtk_widget_destroy(dialog);
+    return path;
+}
+
+/** \brief  Stop recording, if recording
+ */
+static void record_stop(void)
+{
+    unsigned long num;
+    gchar        *msg;
+
+    if (capture_rec == NULL) {
+        return;
+    }
+    num = capture_rec_stop(capture_rec);
+    capture_rec = NULL;
+    msg = g_strdup_printf("Recorded %lu events.", num);
+    g_print("%s\n", msg);
+    app_window_message(msg);
+    g_free(msg);
+
+    if (record_button != NULL &&
+            gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(record_button))) {
+        /* handler ignores this, nothing is recording anymore */
+        gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(record_button), FALSE);
+    }
+}
+
+/** \brief  Handler for the 'toggled' event of the "Record" button
+ *
+ * \param[in]   self    toggle button
+ * \param[in]   data    extra event data (unused)
+ */
+static void on_record_toggled(GtkToggleButton *self,
+                              G_GNUC_UNUSED gpointer data)
+{
+    gchar *path;
+
+    if (!gtk_toggle_button_get_active(self)) {
+        record_stop();
+        return;
+    }
+    if (capture_rec != NULL) {
+        return;
+    }
+    if (poll_data.state != POLL_STATE_POLL || poll_data.cur_device == NULL) {
+        app_window_message("Select a device to record first.");
+        gtk_toggle_button_set_active(self, FALSE);
+        return;
+    }
+
+    path = capture_file_dialog("Record events", GTK_FILE_CHOOSER_ACTION_SAVE);
+    /* polling might have stopped while the dialog was running */
+    if (path != NULL && poll_data.state == POLL_STATE_POLL) {
+        capture_rec = capture_rec_start(path, poll_data.cur_device);
+    }
+    if (capture_rec == NULL) {
+        if (path != NULL) {
+            app_window_message("Failed to start recording.");
+        }
+        gtk_toggle_button_set_active(self, FALSE);
+    } else {
+        app_window_message("Recording events.");
+    }
+    g_free(path);
+}
+
+/** \brief  Handler for the 'clicked' event of the "Replay" button
+ *
+ * \param[in]   self    button (unused)
+ * \param[in]   data    extra event data (unused)
+ */
+static void on_replay_clicked(G_GNUC_UNUSED GtkButton *self,
+                              G_GNUC_UNUSED gpointer   data)
+{
+    gchar *path = capture_file_dialog("Replay events", GTK_FILE_CHOOSER_ACTION_OPEN);
+
+    if (path != NULL) {
+        poll_enter_replay(path);
+        g_free(path);
+    }
+}
+
+/** \brief  Handler for the 'changed' event of the replay speed combo box
+ *
+ * \param[in]   self    combo box
+ * \param[in]   data    extra event data (unused)
+ */
+static void on_replay_speed_changed(GtkComboBox *self,
+                                    G_GNUC_UNUSED gpointer data)
+{
+    const gchar *id = gtk_combo_box_get_active_id(self);
+
+    if (id != NULL) {
+        /* takes effect on the next replay, keeps the replay clock simple */
+        replay_speed = (unsigned int)g_ascii_strtoull(id, NULL, 10);
+    }
+}
+
+/** \brief  Create combo box to set the replay speed
+ *
+ * \return  GtkComboBoxText
+ */
+static GtkWidget *replay_speed_combo_new(void)
+{
+    GtkWidget *combo = gtk_combo_box_text_new();
+
+    gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(combo), "1",  "Replay: real time");
+    gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(combo), "4",  "Replay: 4x");
+    gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(combo), "16", "Replay: 16x");
+    gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(combo), "0",  "Replay: maximum speed");
+    gtk_combo_box_set_active(GTK_COMBO_BOX(combo), 0);
+    g_signal_connect(G_OBJECT(combo),
+                     "changed",
+                     G_CALLBACK(on_replay_speed_changed),
+                     NULL);
+    return combo;
+}
+
+/** \brief  Set all button and axis widgets from the state shown
+ *
+ * Used when switching back from the compact view, which leaves the widgets
+ * alone.
+ */
+static void widgets_sync(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < button_pool.used; i++) {
+        joy_button_widget_set_pressed(button_pool.widgets[i],
+                                      joy_device_state_button(&dev_state.shown, i));
+    }
+    for (i = 0; i < axis_pool.used; i++) {
+        joy_axis_widget_set_value(axis_pool.widgets[i], dev_state.shown.axes[i]);
+    }
+    for (i = 0; i < hat_pool.used; i++) {
+        gtk_label_set_text(GTK_LABEL(hat_pool.widgets[i]),
+                           joy_get_hat_direction_name(
+                               joy_device_state_hat(&dev_state.shown, i)));
+    }
+}
+
+/** \brief  Handler for the 'toggled' event of the "Compact view" button
+ *
+ * \param[in]   self    check button
+ * \param[in]   data    extra event data (unused)
+ */
+static void on_compact_toggled(GtkToggleButton *self,
+                               G_GNUC_UNUSED gpointer data)
+{
+    compact_view = gtk_toggle_button_get_active(self);
+    gtk_widget_set_visible(button_grid, !compact_view);
+    gtk_widget_set_visible(axis_grid,   !compact_view);
+    gtk_widget_set_visible(hat_grid,    !compact_view);
+    gtk_widget_set_visible(state_view,  compact_view);
+    if (compact_view) {
+        /* the view only redraws changes after this */
+        state_view_update(state_view, &dev_state.shown);
+        gtk_widget_queue_draw(state_view);
+    } else {
+        widgets_sync();
+    }
+}
+
+/** \brief  Handler for the 'destroy' event of the event widget
+ *
+ * \param[in]   self    event widget (unused)
+ * \param[in]   data    extra event data (unused)
+ */
+static void on_event_widget_destroy(G_GNUC_UNUSED GtkWidget *self,
+                                    G_GNUC_UNUSED gpointer   data)
+{
+    poll_enter_teardown();
+    widget_pool_free(&button_pool);
+    widget_pool_free(&axis_pool);
+    widget_pool_free(&hat_pool);
+}
+
 
 /** \brief  Create widget to show indicators for events
  */
@@ -211,8 +665,12 @@ GtkWidget *event_widget_new(void)
 {
     GtkWidget *grid;
     GtkWidget *stop_btn;
+    GtkWidget *log_combo;
+    GtkWidget *replay_btn;
+    GtkWidget *speed_combo;
+    GtkWidget *compact_btn;
 
-    poll_lock_init();
+    poll_init();
 
     grid = titled_grid_new("<b>Joystick events</b>", 3, 32, 16);
     gtk_grid_set_column_homogeneous(GTK_GRID(grid), TRUE);
@@ -220,336 +678,572 @@ GtkWidget *event_widget_new(void)
     gtk_widget_set_margin_start (grid, 16);
     gtk_widget_set_margin_end   (grid, 16);
     gtk_widget_set_margin_bottom(grid,  8);
+    event_widget = grid;
 
     button_grid = titled_grid_new("<b>Buttons</b>", BUTTON_GRID_COLUMNS, 16, 8);
     axis_grid   = titled_grid_new("<b>Axes</b>",    AXIS_GRID_COLUMNS,   16, 8);
     hat_grid    = titled_grid_new("<b>Hats</b>",    HAT_GRID_COLUMNS,    16, 8);
+    button_pool.grid = button_grid;
+    axis_pool.grid   = axis_grid;
+    hat_pool.grid    = hat_grid;
     gtk_grid_attach(GTK_GRID(grid), button_grid, 0, 1, 1, 1);
     gtk_grid_attach(GTK_GRID(grid), axis_grid,   1, 1, 1, 1);
     gtk_grid_attach(GTK_GRID(grid), hat_grid,    2, 1, 1, 1);
 
     stop_btn = gtk_button_new_with_label("Stop polling");
-    gtk_grid_attach(GTK_GRID(grid), stop_btn, 0, 2, 3, 1);
+    gtk_grid_attach(GTK_GRID(grid), stop_btn, 0, 2, 2, 1);
+    log_combo = log_level_combo_new();
+    gtk_grid_attach(GTK_GRID(grid), log_combo, 2, 2, 1, 1);
     g_signal_connect(G_OBJECT(stop_btn),
                      "clicked",
                      G_CALLBACK(on_stop_polling_clicked),
                      NULL);
 
-    gtk_widget_show_all(grid);
+    record_button = gtk_toggle_button_new_with_label("Record");
+    replay_btn    = gtk_button_new_with_label("Replay...");
+    speed_combo   = replay_speed_combo_new();
+    gtk_grid_attach(GTK_GRID(grid), record_button, 0, 3, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), replay_btn,    1, 3, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), speed_combo,   2, 3, 1, 1);
+
+    compact_btn = gtk_check_button_new_with_label("Compact view");
+    gtk_grid_attach(GTK_GRID(grid), compact_btn, 0, 4, 1, 1);
+    g_signal_connect(G_OBJECT(compact_btn),
+                     "toggled",
+                     G_CALLBACK(on_compact_toggled),
+                     NULL);
+    state_view = state_view_new();
+    gtk_widget_set_no_show_all(state_view, TRUE);
+    gtk_grid_attach(GTK_GRID(grid), state_view, 0, 5, 3, 1);
+    g_signal_connect(G_OBJECT(record_button),
+                     "toggled",
+                     G_CALLBACK(on_record_toggled),
+                     NULL);
+    g_signal_connect(G_OBJECT(replay_btn),
+                     "clicked",
+                     G_CALLBACK(on_replay_clicked),
+                     NULL);
+
+    g_signal_connect(G_OBJECT(grid),
+                     "destroy",
+                     G_CALLBACK(on_event_widget_destroy),
+                     NULL);
 
-    poll_lock_start_timeout();
+    gtk_widget_show_all(grid);
     return grid;
 }
 
 
-/** \brief  Remove all button, axis and hat widgets from the event widget
+/** \brief  Reset device state for a device
+ *
+ * \param[in]   device  joystick device
+ */
+static void dev_state_init(const joy_dev_info_t *device)
+{
+    joy_device_state_init(&dev_state.current, device);
+    joy_device_state_init(&dev_state.shown,   device);
+    dev_state.live = false;
+}
+
+
+/** \brief  Hide all button, axis and hat widgets of the event widget
+ *
+ * The widgets are kept for the next device.
  */
 void event_widget_clear(void)
 {
-    titled_grid_clear(button_grid, BUTTON_GRID_COLUMNS);
-    titled_grid_clear(axis_grid,   AXIS_GRID_COLUMNS);
-    titled_grid_clear(hat_grid,    HAT_GRID_COLUMNS);
+    event_widget_stop_poll();
+    dev_state.live = false;
+    widget_pool_set_used(&button_pool, 0);
+    widget_pool_set_used(&axis_pool,   0);
+    widget_pool_set_used(&hat_pool,    0);
+    state_view_set_device(state_view, NULL);
 }
 
 
 /** \brief  Set device to display events for
+ *
+ * Reuses the widgets of the previous device, only creating widgets when the
+ * device has more buttons, axes or hats than any device shown before.
  *
  * \param[in]   device  joystick device
  */
 void event_widget_set_device(joy_dev_info_t *device)
 {
-    /* FIXME: move into poll worker! */
+    unsigned int i;
 
-    GtkWidget    *label;
-    const char   *name;
-    unsigned int  i;
+    dev_state_init(device);
 
     /* Buttons */
-    titled_grid_clear(button_grid, BUTTON_GRID_COLUMNS);
+    widget_pool_reserve(&button_pool, device->num_buttons, button_pool_widget_new);
     for (i = 0; i < device->num_buttons; i++) {
-        GtkWidget  *button;
-
-        name   = joy_get_button_name(device->button_map[i]);
-        label  = label_helper(name, GTK_ALIGN_START);
-        button = joy_button_widget_new();
-        gtk_widget_set_margin_start(label, 8);
-        gtk_grid_attach(GTK_GRID(button_grid), label,  0, (int)i + 1, 1, 1);
-        gtk_grid_attach(GTK_GRID(button_grid), button, 1, (int)i + 1, 1, 1);
+        gtk_label_set_markup(GTK_LABEL(button_pool.labels[i]),
+                             joy_get_button_name(device->button_map[i]));
+        joy_button_widget_set_pressed(button_pool.widgets[i], FALSE);
     }
+    widget_pool_set_used(&button_pool, device->num_buttons);
 
     /* Axes */
-    titled_grid_clear(axis_grid, AXIS_GRID_COLUMNS);
+    widget_pool_reserve(&axis_pool, device->num_axes, axis_pool_widget_new);
     for (i = 0; i < device->num_axes; i++) {
-        GtkWidget *axis;
-        int32_t    min_;
-        int32_t    max_;
-
-        name  = joy_get_axis_name(device->axis_map[i].code);
-        min_  = device->axis_map[i].minimum;
-        max_  = device->axis_map[i].maximum;
-        label = label_helper(name, GTK_ALIGN_START);
-        axis  = joy_axis_widget_new(min_, max_);
-        gtk_widget_set_margin_start(label, 8);
-        gtk_widget_set_hexpand(label, FALSE);
-        gtk_widget_set_halign(axis, GTK_ALIGN_FILL);
-        gtk_widget_set_hexpand(axis, TRUE);
-        gtk_grid_attach(GTK_GRID(axis_grid), label, 0, (int)i + 1, 1, 1);
-        gtk_grid_attach(GTK_GRID(axis_grid), axis,  1, (int)i + 1, 1, 1);
+        gtk_label_set_markup(GTK_LABEL(axis_pool.labels[i]),
+                             joy_get_axis_name(device->axis_map[i].code));
+        joy_axis_widget_set_range(axis_pool.widgets[i],
+                                  device->axis_map[i].minimum,
+                                  device->axis_map[i].maximum);
     }
+    widget_pool_set_used(&axis_pool, device->num_axes);
+
+    /* Hats */
+    widget_pool_reserve(&hat_pool, device->num_hats, hat_pool_widget_new);
+    for (i = 0; i < device->num_hats; i++) {
+        gtk_label_set_markup(GTK_LABEL(hat_pool.labels[i]),
+                             joy_get_hat_name(device->hat_map[i * 2u].code));
+        gtk_label_set_text(GTK_LABEL(hat_pool.widgets[i]),
+                           joy_get_hat_direction_name(0));
+    }
+    widget_pool_set_used(&hat_pool, device->num_hats);
+
+    state_view_set_device(state_view, device);
 }
 
 
-/** \brief  Update a button state with event data
+/** \brief  Push changes in the device state to the widgets
  *
- * \param[in]   ev  event data
+ * Compares the current state with the state shown and only touches the
+ * widgets of buttons, axes and hats that changed. Does nothing unless a
+ * report was completed since the last flush, so widgets only show complete
+ * reports.
+ *
+ * \return  \c true if the widgets were updated
  */
-static void update_button(joy_dev_info_t *dev, struct input_event *ev)
+static bool dev_state_flush(void)
 {
-    unsigned int i;
+    const joy_device_state_t *cur   = &dev_state.current;
+    joy_device_state_t       *shown = &dev_state.shown;
+    unsigned int              w;
+    unsigned int              i;
 
-    if (dev == NULL) {
-        return;
+    if (cur->sequence == shown->sequence) {
+        return false;
     }
+    if (compact_view) {
+        state_view_update(state_view, cur);
+        *shown = *cur;
+        return true;
+    }
+
+    for (w = 0; w < (button_pool.used + 31u) / 32u; w++) {
+        uint32_t changed = cur->buttons[w] ^ shown->buttons[w];
 
-    for (i = 0; dev->num_buttons; i++) {
-        if (ev->code == dev->button_map[i]) {
-            GtkWidget *led = gtk_grid_get_child_at(GTK_GRID(button_grid), 1, (int)i + 1);
+        while (changed != 0) {
+            unsigned int bit   = (unsigned int)__builtin_ctz(changed);
+            unsigned int index = w * 32u + bit;
 
-            if (led != NULL) {
-                joy_button_widget_set_pressed(led, ev->value);
-                break;
-            } else {
-                g_printerr("No LED for button %03x!\n", ev->code);
+            if (index < button_pool.used) {
+                joy_button_widget_set_pressed(button_pool.widgets[index],
+                                              (cur->buttons[w] >> bit) & 1u);
             }
+            changed &= changed - 1u;
         }
     }
-}
 
-static void update_axis(joy_dev_info_t *dev, struct input_event *ev)
-{
-    unsigned int i;
-
-    if (dev == NULL) {
-        return;
+    for (i = 0; i < axis_pool.used; i++) {
+        if (cur->axes[i] != shown->axes[i]) {
+            joy_axis_widget_set_value(axis_pool.widgets[i], cur->axes[i]);
+        }
     }
 
-    for (i = 0; dev->num_axes; i++) {
-        if (ev->code == dev->axis_map[i].code) {
-            GtkWidget *axis = gtk_grid_get_child_at(GTK_GRID(axis_grid), 1, (int)i + 1);
-
-            if (axis != NULL) {
-                joy_axis_widget_set_value(axis, ev->value);
-                break;
-            } else {
-                g_printerr("No widget for axis %03x!\n", ev->code);
-            }
+    for (i = 0; i < hat_pool.used; i++) {
+        if (cur->hat_dirs[i] != shown->hat_dirs[i]) {
+            gtk_label_set_text(GTK_LABEL(hat_pool.widgets[i]),
+                               joy_get_hat_direction_name(cur->hat_dirs[i]));
         }
     }
+
+    *shown = *cur;
+    return true;
 }
 
-/** \brief  Update the event widget with event data
+/** \brief  Apply event data to the event widget's device state
  *
- * \param[in]   ev  event data
+ * Used for replayed events, while polling the state is read from the
+ * polling engine instead.
+ *
+ * \param[in]   pd      poll data
+ * \param[in]   event   event data
  */
 static void event_widget_update(poll_data_t *pd, struct input_event *event)
 {
-    int           type  = event->type;
-    int           code  = event->code;
-    int           value = event->value;
+    if (pd->cur_device != NULL) {
+        joy_device_state_apply(&dev_state.current, pd->cur_device, event);
+    }
+    pd->prev_type  = event->type;
+    pd->prev_code  = event->code;
+    pd->prev_value = event->value;
+}
+
+/** \brief  Polling engine callback for events of the polled device
+ *
+ * Called on the polling engine's reader thread.
+ *
+ * \param[in]   device  device (unused)
+ * \param[in]   events  events
+ * \param[in]   num     number of \a events
+ * \param[in]   data    extra data (unused)
+ */
+static void on_poll_events(G_GNUC_UNUSED joy_dev_info_t           *device,
+                                         const struct input_event *events,
+                                         size_t                    num,
+                           G_GNUC_UNUSED void                     *data)
+{
+    size_t i;
 
-    if (type == EV_KEY) {
-        update_button(pd->cur_device, event);
-    } else if (type == EV_ABS) {
-        update_axis(pd->cur_device, event);
+    for (i = 0; i < num; i++) {
+        event_ring_push(&event_ring, &events[i]);
     }
+}
 
-    pd->prev_type  = type;
-    pd->prev_code  = code;
-    pd->prev_value = value;
+/** \brief  Polling engine callback for the polled device being closed
+ *
+ * Can be called on any thread, so only sets a flag for the frame clock tick
+ * handler to pick up.
+ *
+ * \param[in]   device  device (unused)
+ * \param[in]   data    extra data (unused)
+ */
+static void on_poll_closed(G_GNUC_UNUSED joy_dev_info_t *device,
+                           G_GNUC_UNUSED void           *data)
+{
+    poll_data_t *pd = poll_lock_obtain();
+
+    pd->sub_id      = 0;
+    pd->device_gone = TRUE;
+    poll_lock_release();
 }
 
-/** \brief  Debug hook: print event data to stdout
+/** \brief  Log events in the ring
  *
- * \param[in]   ev  event data
+ * Called from the frame clock tick, so at most once per frame. The widgets
+ * don't need the events, they are updated from the engine's state snapshot.
  */
-static void print_event(struct input_event *ev)
+static void poll_drain_ring(void)
 {
-    if (ev->type == EV_SYN) {
-        printf("Event: time %ld.%06ld, +++ %s +++\n",
-               ev->input_event_sec,
-               ev->input_event_usec,
-               libevdev_event_type_get_name(ev->type));
-    } else {
-        printf("Event: time %ld.%06ld, type %d (%s), code %d (%s), value %d\n",
-               ev->input_event_sec,
-               ev->input_event_usec,
-               ev->type,
-               libevdev_event_type_get_name(ev->type),
-               ev->code,
-               libevdev_event_code_get_name(ev->type, ev->code),
-               ev->value);
-    }
+    struct input_event events[DRAIN_BATCH_SIZE];
+    size_t             num;
+    size_t             i;
+
+    do {
+        num = event_ring_pop(&event_ring, events, G_N_ELEMENTS(events));
+        for (i = 0; i < num; i++) {
+            event_log_event(&events[i]);
+        }
+    } while (num == G_N_ELEMENTS(events));
 }
 
-/** \brief  Worker thread polling joystick events
+static void poll_enter_stop(void);
+
+/** \brief  Frame clock tick handler
+ *
+ * Drains the event ring into the log, reads the polling engine's state
+ * snapshot and updates the widgets from it, once per frame. Stops polling
+ * when the polling engine closed the device.
  *
- * \param[in]   data    joystick device info
+ * \param[in]   widget      event widget (unused)
+ * \param[in]   frame_clock frame clock (unused)
+ * \param[in]   data        extra data (unused)
  *
- * \return  \c NULL
+ * \return  \c G_SOURCE_CONTINUE
  */
-static gboolean poll_worker(G_GNUC_UNUSED gpointer data)
+static gboolean on_frame_tick(G_GNUC_UNUSED GtkWidget     *widget,
+                              G_GNUC_UNUSED GdkFrameClock *frame_clock,
+                              G_GNUC_UNUSED gpointer       data)
 {
-    joy_dev_info_t  *info  = NULL;
-    struct input_event event;
-    poll_data_t     *pd;
-    unsigned int     flags = LIBEVDEV_READ_FLAG_NORMAL;
-    int              rc;
+    poll_data_t *pd;
+    gboolean     gone;
+    uint64_t     reports;
 
-    pd = poll_lock_obtain();
+    poll_drain_ring();
+
+    pd   = poll_lock_obtain();
+    gone = pd->device_gone;
+    poll_lock_release();
+    if (!gone && dev_state.live) {
+        /* a stale generation means the engine closed the device */
+        gone = !joy_poll_read_state(&dev_state.ref, &dev_state.current);
+    }
+    if (!gone) {
+        reports = dev_state.current.sequence - dev_state.shown.sequence;
+        if (dev_state_flush()) {
+            /* all reports since the last frame end up in a single update */
+            joy_poll_count_ui_updates(poll_data.cur_device, 1,
+                                      (unsigned long)(reports - 1u));
+        }
+    }
+    if (gone) {
+        /* don't touch cur_device, it might have been freed by a rescan */
+        g_print("Polled device was closed.\n");
+        poll_enter_stop();
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+/** \brief  Frame clock tick handler while replaying a capture
+ *
+ * Feeds the events due since the start of the replay through the same path
+ * as live events. At maximum speed a large batch is processed each frame and
+ * the throughput is reported at the end.
+ *
+ * \param[in]   widget      event widget (unused)
+ * \param[in]   frame_clock frame clock (unused)
+ * \param[in]   data        extra data (unused)
+ *
+ * \return  \c G_SOURCE_CONTINUE
+ */
+static gboolean on_replay_tick(G_GNUC_UNUSED GtkWidget     *widget,
+                               G_GNUC_UNUSED GdkFrameClock *frame_clock,
+                               G_GNUC_UNUSED gpointer       data)
+{
+    struct input_event events[DRAIN_BATCH_SIZE];
+    uint64_t           until;
+    size_t             total = 0;
+    size_t             num;
+    size_t             i;
+    gint64             t0;
+
+    if (replay_speed == 0) {
+        until = UINT64_MAX;
+    } else {
+        until = (uint64_t)(g_get_monotonic_time() - replay_start) * replay_speed;
+    }
 
-    if (pd->new_device != NULL) {
-        if (pd->state != POLL_STATE_IDLE) {
-            pd->state = POLL_STATE_STOP;
+    t0 = g_get_monotonic_time();
+    do {
+        num = capture_play_next(capture_play, until, events, G_N_ELEMENTS(events));
+        for (i = 0; i < num; i++) {
+            event_widget_update(&poll_data, &events[i]);
+            event_log_event(&events[i]);
         }
+        total += num;
+    } while (num == G_N_ELEMENTS(events) && total < REPLAY_MAX_EVENTS_PER_FRAME);
+    dev_state_flush();
+    replay_busy += g_get_monotonic_time() - t0;
+
+    if (capture_play_done(capture_play)) {
+        size_t  count = capture_play_get_count(capture_play);
+        gint64  busy  = replay_busy > 0 ? replay_busy : 1;
+        gchar  *msg;
+
+        msg = g_strdup_printf("Replayed %zu events in %.3f s, %.0f events/s processed.",
+                              count,
+                              (double)(g_get_monotonic_time() - replay_start) / 1e6,
+                              (double)count * 1e6 / (double)busy);
+        g_print("%s\n", msg);
+        poll_enter_stop();
+        /* after stopping, otherwise the message is overwritten */
+        app_window_message(msg);
+        g_free(msg);
     }
+    return G_SOURCE_CONTINUE;
+}
 
-    switch (pd->state) {
+/** \brief  Unsubscribe from the polled device or end the replay, if any
+ *
+ * Must be called from the UI thread.
+ */
+static void poll_close_device(void)
+{
+    poll_data_t *pd;
+    int          sub_id;
 
-        case POLL_STATE_IDLE:
-            /* only from idle can we start polling a new device */
-            if (pd->new_device != NULL) {
-                g_print("Setting new device %s\n", pd->new_device->name);
-                pd->cur_device = pd->new_device;
-                pd->new_device = NULL;
-                pd->state      = POLL_STATE_START;
-            }
-            break;
+    /* recording subscribes to the device as well */
+    record_stop();
 
-        case POLL_STATE_STOP:
-            printf("Stopping polling.\n");
-            app_window_message("Stopped polling.");
+    pd          = poll_lock_obtain();
+    sub_id      = pd->sub_id;
+    pd->sub_id  = 0;
+    poll_lock_release();
 
-            if (pd->evdev != NULL) {
-                libevdev_free(pd->evdev);
-                pd->evdev = NULL;
-            }
-            if (pd->fd >= 0) {
-                close(pd->fd);
-                pd->fd = -1;
-            }
-            pd->cur_device = NULL;
-            pd->state      = POLL_STATE_IDLE;
-            break;
-
-        case POLL_STATE_TEARDOWN:
-            g_print("Tearing down worker thread.\n");
-            poll_lock_release();
-            return G_SOURCE_REMOVE;
-
-        case POLL_STATE_START:
-            g_print("Starting polling.\n");
-            info   = pd->cur_device;
-            pd->fd = open(info->path, O_RDONLY);
-            if (pd->fd < 0) {
-                g_print("Failed to open device at %s: %s\n",
-                           info->path, strerror(errno));
-                pd->state = POLL_STATE_IDLE;
-                break;
-            }
-            rc = libevdev_new_from_fd(pd->fd, &(pd->evdev));
-            if (rc < 0) {
-                g_print("Failed to initialize libevdev: %s\n",
-                           strerror(-rc));
-                pd->state = POLL_STATE_IDLE;
-                break;
-            }
-            g_print("OK: libevdev *dev = %p\n", (const void *)pd->evdev);
-
-            event_widget_set_device(pd->cur_device);
-            pd->state = POLL_STATE_POLL;
-            break;
-
-        case POLL_STATE_POLL:
-            while (libevdev_has_event_pending(pd->evdev)) {
-                rc = libevdev_next_event(pd->evdev, flags, &event);
-                if (rc == LIBEVDEV_READ_STATUS_SYNC) {
-                    printf("=== dropped ===\n");
-                    while (rc == LIBEVDEV_READ_STATUS_SYNC) {
-                        printf("SYNC:\n");
-                        print_event(&event);
-                        rc = libevdev_next_event(pd->evdev, LIBEVDEV_READ_FLAG_SYNC, &event);
-                    }
-                    printf("=== re-synced ===\n");
-                } else if (rc == LIBEVDEV_READ_STATUS_SUCCESS) {
-                    event_widget_update(pd, &event);
-                    print_event(&event);
-                }
-            }
-            break;
+    /* once this returns the reader thread won't push into the ring anymore */
+    joy_poll_unsubscribe(sub_id);
+
+    if (poll_data.tick_id > 0) {
+        gtk_widget_remove_tick_callback(event_widget, poll_data.tick_id);
+        poll_data.tick_id = 0;
     }
 
+    pd = poll_lock_obtain();
+    pd->device_gone = FALSE;
     poll_lock_release();
-    return G_SOURCE_CONTINUE;
+    poll_data.cur_device = NULL;
+    event_ring_init(&event_ring);
+    dev_state.live = false;
 
-#if 0
-            } while (rc == LIBEVDEV_READ_STATUS_SYNC ||
-                     rc == LIBEVDEV_READ_STATUS_SUCCESS ||
-                     rc == -EAGAIN);
+    /* the replayed device is owned by the capture */
+    capture_play_close(capture_play);
+    capture_play = NULL;
+}
 
-            if (rc != LIBEVDEV_READ_STATUS_SUCCESS && rc != -EAGAIN) {C
-                fprintf(stderr, "failed to handle events: %s\n", strerror(-rc));
-            }
+/** \brief  Transition to the STOP state and from there to IDLE
+ */
+static void poll_enter_stop(void)
+{
+    poll_data_t *pd = &poll_data;
 
-            close(fd);
-            libevdev_free(dev);
-#endif
+    if (pd->state == POLL_STATE_IDLE || pd->state == POLL_STATE_TEARDOWN) {
+        return;
+    }
+    pd->state = POLL_STATE_STOP;
+    printf("Stopping polling.\n");
+    app_window_message("Stopped polling.");
 
+    poll_close_device();
+    pd->state = POLL_STATE_IDLE;
+    stats_widget_stop();
 }
 
-
-/** \brief  Start worker thread polling joystick events
+/** \brief  Transition to the START state and from there to POLL
+ *
+ * Any device currently being polled is stopped first. On failure to
+ * subscribe to the device the state returns to IDLE.
  *
  * \param[in]   device  joystick device info
  */
-void event_widget_start_poll(joy_dev_info_t *device)
+static void poll_enter_start(joy_dev_info_t *device)
 {
-    poll_data_t *pd;
+    poll_data_t       *pd = &poll_data;
+    joy_poll_filter_t  filter;
+    int                sub_id;
 
-    pd = poll_lock_obtain();
-    pd->new_device = device;
-    poll_lock_release();
-#if 0
-    g_print("Waiting for cancel to be FALSE\n");
-    while (TRUE) {
-        pd = poll_lock_obtain();
-        if (!pd->polling) {
-            g_print("OK:\n");
-            break;
-        }
-        poll_lock_release();
-        g_usleep(1000);
+    if (pd->state == POLL_STATE_TEARDOWN) {
+        return;
     }
+    poll_enter_stop();
 
-    if (pd->thread == NULL) {
-        char text[256];
+    g_print("Setting new device %s\n", device->name);
+    if (device->mapping != NULL) {
+        g_print("Using controller mapping '%s'\n", joy_mapping_get_name(device->mapping));
+    }
+    g_print("Starting polling.\n");
+    pd->state      = POLL_STATE_START;
+    pd->cur_device = device;
+
+    event_widget_set_device(pd->cur_device);
+
+    sub_id = joy_poll_subscribe_filtered(device,
+                                         poll_filter_get(device, &filter),
+                                         on_poll_events,
+                                         on_poll_closed,
+                                         NULL);
+    if (sub_id < 0) {
+        g_print("Failed to subscribe to device %s\n", device->path);
+        pd->cur_device = NULL;
+        pd->state      = POLL_STATE_IDLE;
+        return;
+    }
+    /* start from the engine's state, not from the last replay or device */
+    if (joy_poll_get_state_ref(device, &dev_state.ref) &&
+            joy_poll_read_state(&dev_state.ref, &dev_state.current)) {
+        dev_state.live = true;
+        /* show the initial state even if no report was made yet */
+        dev_state.shown.sequence = dev_state.current.sequence - 1u;
+        dev_state_flush();
+    }
 
-        g_snprintf(text, sizeof text, "Polling device %s", device->name);
-        app_window_message(text);
+    pd->tick_id = gtk_widget_add_tick_callback(event_widget,
+                                               on_frame_tick,
+                                               NULL,
+                                               NULL);
+    pd->state   = POLL_STATE_POLL;
+    pd          = poll_lock_obtain();
+    pd->sub_id  = sub_id;
+    poll_lock_release();
+    stats_widget_start();
+}
 
-        pd->device  = device;
-        pd->polling = TRUE;
-        pd->thread  = g_thread_new("poll", poll_worker, device);
+/** \brief  Transition to the REPLAY state
+ *
+ * Stops polling and replays a capture file through the event widget, as if
+ * the events came from the recorded device. Returns to IDLE when done or on
+ * failure to open the file.
+ *
+ * \param[in]   path    capture file path
+ */
+static void poll_enter_replay(const char *path)
+{
+    poll_data_t *pd = &poll_data;
+    gchar       *msg;
+
+    if (pd->state == POLL_STATE_TEARDOWN) {
+        return;
     }
-    poll_lock_release();
-#endif
+    poll_enter_stop();
+
+    capture_play = capture_play_open(path);
+    if (capture_play == NULL) {
+        app_window_message("Failed to open capture file.");
+        return;
+    }
+    pd->cur_device = capture_play_get_device(capture_play);
+    event_widget_set_device(pd->cur_device);
+
+    msg = g_strdup_printf("Replaying %zu events (%.3f s) of %s.",
+                          capture_play_get_count(capture_play),
+                          (double)capture_play_get_duration(capture_play) / 1e6,
+                          pd->cur_device->name);
+    g_print("%s\n", msg);
+    app_window_message(msg);
+    g_free(msg);
+
+    replay_start = g_get_monotonic_time();
+    replay_busy  = 0;
+    pd->tick_id  = gtk_widget_add_tick_callback(event_widget,
+                                                on_replay_tick,
+                                                NULL,
+                                                NULL);
+    pd->state    = POLL_STATE_REPLAY;
+}
+
+/** \brief  Transition to the final TEARDOWN state
+ *
+ * Called when the event widget is destroyed, after this no device can be
+ * polled anymore. Doesn't report to the status bar since that might already
+ * have been destroyed.
+ */
+static void poll_enter_teardown(void)
+{
+    g_print("Tearing down polling.\n");
+    record_button = NULL;
+    poll_close_device();
+    poll_data.state = POLL_STATE_TEARDOWN;
+    stats_widget_stop();
 }
 
 
-/** \brief  Stop worker thread polling joystick events
+/** \brief  Start polling joystick events
+ *
+ * \param[in]   device  joystick device info
+ */
+void event_widget_start_poll(joy_dev_info_t *device)
+{
+    poll_enter_start(device);
+}
+
+
+/** \brief  Stop polling joystick events
  */
 void event_widget_stop_poll(void)
 {
-    poll_data_t *pd = poll_lock_obtain();
-    pd->state = POLL_STATE_STOP;
-    poll_lock_release();
+    poll_enter_stop();
+}
+
+
+/** \brief  Get device being polled
+ *
+ * \return  device or \c NULL when not polling a device (replaying a capture
+ *          doesn't count)
+ */
+joy_dev_info_t *event_widget_get_device(void)
+{
+    return poll_data.state == POLL_STATE_POLL ? poll_data.cur_device : NULL;
 }
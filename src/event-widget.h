@@ -9,10 +9,11 @@
 #include <gtk/gtk.h>
 #include "joystick.h"
 
-GtkWidget *event_widget_new(void);
-void       event_widget_set_device(joy_dev_info_t *device);
-void       event_widget_clear(void);
-void       event_widget_start_poll(joy_dev_info_t *device);
-void       event_widget_stop_poll(void);
+GtkWidget      *event_widget_new(void);
+void            event_widget_set_device(joy_dev_info_t *device);
+void            event_widget_clear(void);
+void            event_widget_start_poll(joy_dev_info_t *device);
+void            event_widget_stop_poll(void);
+joy_dev_info_t *event_widget_get_device(void);
 
 #endif
@@ -0,0 +1,19 @@
+/** \file   headless-main.c
+ * \brief   Entry point of the headless program, built without GTK
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+#include "headless.h"
+
+
+/** \brief  Program entry point
+ *
+ * \param[in]   argc    argument count
+ * \param[in]   argv    argument vector
+ *
+ * \return  0 on success
+ */
+int main(int argc, char *argv[])
+{
+    return headless_main(argc, argv);
+}
@@ -0,0 +1,1044 @@
+/** \file   headless.c
+ * \brief   Headless mode streaming joystick events without a UI
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ * Runs the device scan and the polling engine without GTK, for automated
+ * test rigs. Either streams the events of the devices through the event log,
+ * writes snapshots of their state at a fixed interval, or writes the changes
+ * of the game controller controls the events map to, as text or binary
+ * records, to stdout, a file or a UNIX socket.
+ *
+ * Devices are listed on stderr at startup, so stdout only carries the
+ * stream. Scanning only finds the joystick nodes in
+ * \c JOY_INPUT_NODES_PATH, virtual devices created through uinput usually
+ * don't get a link there and are passed with \c -d instead.
+ *
+ * Events of all devices are merged into one stream, in events mode select a
+ * single device with \c -d to tell them apart. State snapshots carry the
+ * index of the device.
+ *
+ * For end to end tests of pads with force feedback, \c -r plays a rumble
+ * effect on each button press, the delay from the press to writing the
+ * effect is reported on exit.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "event-log.h"
+#include "event-ring.h"
+#include "joystick.h"
+#include "joy-axis.h"
+#include "joy-cache.h"
+#include "joy-mapping.h"
+#include "vice.h"
+
+#include "headless.h"
+
+
+#define ARRAY_LEN(arr)  (sizeof arr / sizeof arr[0])
+
+/** \brief  Strength of the strong rumble motor used by \c -r */
+#define RUMBLE_STRONG       0xc000u
+
+/** \brief  Strength of the weak rumble motor used by \c -r */
+#define RUMBLE_WEAK         0x8000u
+
+/** \brief  Room kept in the output buffer for the longest line or record
+ *
+ * A text line takes at most about 12 characters per axis, 9 per button
+ * word and 11 per hat.
+ */
+#define STATE_RECORD_MAX    4096u
+
+
+/** \brief  Device streamed in headless mode */
+typedef struct headless_device_s {
+    joy_dev_info_t  *device;    /**< device info */
+    joy_state_ref_t  ref;       /**< reference to the published state */
+    uint64_t         sequence;  /**< sequence of the last snapshot written */
+    int              sub_id;    /**< polling engine subscription */
+    int              ff_effect; /**< rumble effect ID, -1 for none, set
+                                     before the reader thread starts */
+    int32_t          held[JOY_STATE_MAX_AXES];
+                                /**< axis values held by the normalization's
+                                     hysteresis */
+    int16_t          controls[JOY_CONTROL_COUNT];
+                                /**< last values of the mapped controls, only
+                                     used by the reader thread */
+    atomic_bool      open;      /**< still open in the polling engine */
+    bool             owned;     /**< opened with \c -d, free on exit */
+} headless_device_t;
+
+
+/** \brief  Devices streamed */
+static headless_device_t devices[JOY_POLL_MAX_DEVICES];
+
+/** \brief  Number of \c devices used */
+static unsigned int      num_devices;
+
+/** \brief  Number of devices still open */
+static atomic_uint       num_open;
+
+/** \brief  Set by the signal handler to end the main loop */
+static volatile sig_atomic_t quit_requested;
+
+/** \brief  Output file descriptor */
+static int               out_fd = -1;
+
+/** \brief  Buffer state snapshots are formatted into */
+static char              out_buffer[HEADLESS_BUFFER_SIZE];
+
+/** \brief  Number of bytes used in \c out_buffer */
+static size_t            out_used;
+
+/** \brief  Binary magic has been written */
+static bool              out_magic_written;
+
+/** \brief  Length of the rumble played on button presses, 0 for none */
+static unsigned int      rumble_ms;
+
+/** \brief  Events are streamed through the event log */
+static bool              stream_events;
+
+/** \brief  State snapshots carry normalized axis values */
+static bool              normalize_axes;
+
+/** \brief  Mapped control changes are streamed */
+static bool              stream_controls;
+
+/** \brief  Control changes from the reader thread to the main loop
+ *
+ * Abuses the input event: \c type is the device index, \c code the control.
+ */
+static event_ring_t      control_ring;
+
+
+/** \brief  Handler for SIGINT and SIGTERM
+ *
+ * \param[in]   sig signal number (unused)
+ */
+static void on_signal(int sig)
+{
+    (void)sig;
+    quit_requested = 1;
+}
+
+/** \brief  Install signal handlers
+ *
+ * SIGPIPE is ignored so a closed pipe or socket shows up as a write error.
+ */
+static void signals_install(void)
+{
+    struct sigaction action;
+
+    memset(&action, 0, sizeof action);
+    sigemptyset(&action.sa_mask);
+    action.sa_handler = on_signal;
+    sigaction(SIGINT,  &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    action.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &action, NULL);
+}
+
+
+/** \brief  Open the output
+ *
+ * \param[in]   file        path of file to write, \c NULL for none
+ * \param[in]   sock_path   path of UNIX socket to connect to, \c NULL for none
+ *
+ * \return  file descriptor, stdout if neither \a file nor \a sock_path is
+ *          given, -1 on error
+ */
+static int output_open(const char *file, const char *sock_path)
+{
+    struct sockaddr_un addr;
+    int                fd;
+
+    if (file != NULL) {
+        fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            fprintf(stderr, "error: failed to open %s: %s\n", file, strerror(errno));
+        }
+        return fd;
+    }
+    if (sock_path == NULL) {
+        return STDOUT_FILENO;
+    }
+
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if (strlen(sock_path) >= sizeof addr.sun_path) {
+        fprintf(stderr, "error: socket path too long: %s\n", sock_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, sock_path);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        fprintf(stderr, "error: failed to create socket: %s\n", strerror(errno));
+        return -1;
+    }
+    if (connect(fd, (const struct sockaddr *)&addr, sizeof addr) < 0) {
+        fprintf(stderr, "error: failed to connect to %s: %s\n",
+                sock_path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/** \brief  Write the output buffer
+ *
+ * \return  \c false on a write error
+ */
+static bool output_flush(void)
+{
+    const char *data = out_buffer;
+    size_t      size = out_used;
+
+    out_used = 0;
+    while (size > 0) {
+        ssize_t written = write(out_fd, data, size);
+
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "error: failed to write output: %s\n", strerror(errno));
+            return false;
+        }
+        data += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
+
+/** \brief  Append formatted text to a buffer
+ *
+ * \param[out]     buffer  output buffer
+ * \param[in]      size    size of \a buffer
+ * \param[in,out]  used    number of characters used in \a buffer
+ * \param[in]      fmt     format string
+ */
+static void text_append(char *buffer, size_t size, size_t *used, const char *fmt, ...)
+{
+    va_list args;
+    int     len;
+
+    if (*used + 1u >= size) {
+        return;
+    }
+    va_start(args, fmt);
+    len = vsnprintf(buffer + *used, size - *used, fmt, args);
+    va_end(args);
+    if (len > 0) {
+        *used += (size_t)len < size - *used ? (size_t)len : size - *used - 1u;
+    }
+}
+
+/** \brief  Format state snapshot as a line of text
+ *
+ * Device index, sequence number, the button bitmap in hex (button 0 is the
+ * lowest bit of the first word), the axis values (raw, or normalized with
+ * four decimals) and the hat directions.
+ *
+ * \param[out]  buffer  output buffer
+ * \param[in]   size    size of \a buffer
+ * \param[in]   index   device index
+ * \param[in]   state   device state
+ * \param[in]   norm    normalized axis values, \c NULL for raw values
+ *
+ * \return  number of characters written, excluding the NUL
+ */
+static size_t state_format_text(char                     *buffer,
+                                size_t                    size,
+                                unsigned int              index,
+                                const joy_device_state_t *state,
+                                const float              *norm)
+{
+    size_t       used = 0;
+    unsigned int i;
+
+    text_append(buffer, size, &used, "%u %llu buttons",
+                index, (unsigned long long)state->sequence);
+    for (i = 0; i < (state->num_buttons + 31u) / 32u; i++) {
+        text_append(buffer, size, &used, " %08x", (unsigned int)state->buttons[i]);
+    }
+    text_append(buffer, size, &used, " axes");
+    for (i = 0; i < state->num_axes; i++) {
+        if (norm != NULL) {
+            text_append(buffer, size, &used, " %.4f", (double)norm[i]);
+        } else {
+            text_append(buffer, size, &used, " %d", (int)state->axes[i]);
+        }
+    }
+    text_append(buffer, size, &used, " hats");
+    for (i = 0; i < state->num_hats; i++) {
+        text_append(buffer, size, &used, " %s",
+                    joy_get_hat_direction_name(joy_device_state_hat(state, i)));
+    }
+    text_append(buffer, size, &used, "\n");
+    return used;
+}
+
+/* binary records hold either raw or normalized axis values in 32 bits */
+_Static_assert(sizeof(float) == sizeof(int32_t), "axis values differ in size");
+
+/** \brief  Format state snapshot as a binary record
+ *
+ * \param[out]  buffer  output buffer, large enough for the largest record
+ * \param[in]   index   device index
+ * \param[in]   state   device state
+ * \param[in]   norm    normalized axis values, \c NULL for raw values
+ *
+ * \return  size of the record
+ */
+static size_t state_format_binary(char                     *buffer,
+                                  unsigned int              index,
+                                  const joy_device_state_t *state,
+                                  const float              *norm)
+{
+    headless_state_record_t rec;
+    size_t                  buttons = (state->num_buttons + 31u) / 32u * sizeof(uint32_t);
+    size_t                  axes    = state->num_axes * sizeof(int32_t);
+    size_t                  hats    = state->num_hats * sizeof(uint8_t);
+    size_t                  size;
+
+    size = (sizeof rec + buttons + axes + hats + 7u) & ~(size_t)7u;
+    memset(buffer, 0, size);
+
+    rec.size        = (uint32_t)size;
+    rec.device      = (uint16_t)index;
+    rec.num_buttons = state->num_buttons;
+    rec.num_axes    = state->num_axes;
+    rec.num_hats    = state->num_hats;
+    rec.flags       = norm != NULL ? HEADLESS_STATE_NORMALIZED : 0;
+    rec.sequence    = state->sequence;
+    memcpy(buffer, &rec, sizeof rec);
+    buffer += sizeof rec;
+    memcpy(buffer, state->buttons, buttons);
+    buffer += buttons;
+    if (norm != NULL) {
+        memcpy(buffer, norm, axes);
+    } else {
+        memcpy(buffer, state->axes, axes);
+    }
+    buffer += axes;
+    memcpy(buffer, state->hat_dirs, hats);
+    return size;
+}
+
+/** \brief  Handle the states that changed since the last call
+ *
+ * Snapshots go into the output buffer, which is written when full and at
+ * the end, so there's at most one write() per interval.
+ *
+ * \param[in]   binary  write binary records instead of text
+ *
+ * \return  \c false on a write error
+ */
+static bool states_update(bool binary)
+{
+    unsigned int i;
+
+    if (binary && !out_magic_written) {
+        memcpy(out_buffer, HEADLESS_STATE_MAGIC, sizeof HEADLESS_STATE_MAGIC - 1u);
+        out_used          = sizeof HEADLESS_STATE_MAGIC - 1u;
+        out_magic_written = true;
+    }
+
+    for (i = 0; i < num_devices; i++) {
+        headless_device_t  *dev = &devices[i];
+        joy_device_state_t  state;
+        float               norm[JOY_STATE_MAX_AXES];
+        const float        *axes = NULL;
+
+        if (!atomic_load(&(dev->open))) {
+            continue;
+        }
+        if (!joy_poll_read_state(&(dev->ref), &state)) {
+            /* closed, reported by on_poll_closed() */
+            continue;
+        }
+        if (state.sequence == dev->sequence) {
+            continue;
+        }
+        dev->sequence = state.sequence;
+        if (normalize_axes) {
+            joy_axis_normalize_state(dev->device, &state, dev->held, norm);
+            axes = norm;
+        }
+
+        if (sizeof out_buffer - out_used < STATE_RECORD_MAX && !output_flush()) {
+            return false;
+        }
+        if (binary) {
+            out_used += state_format_binary(out_buffer + out_used, i, &state, axes);
+        } else {
+            out_used += state_format_text(out_buffer + out_used,
+                                          sizeof out_buffer - out_used,
+                                          i,
+                                          &state,
+                                          axes);
+        }
+    }
+    return out_used == 0 || output_flush();
+}
+
+/** \brief  Write the control changes queued since the last call
+ *
+ * Text lines have the device index, the event time, the control name and
+ * the value.
+ *
+ * \param[in]   binary  write binary records instead of text
+ *
+ * \return  \c false on a write error
+ */
+static bool controls_update(bool binary)
+{
+    struct input_event changes[64];
+    size_t             num;
+
+    if (binary && !out_magic_written) {
+        memcpy(out_buffer, HEADLESS_CONTROL_MAGIC, sizeof HEADLESS_CONTROL_MAGIC - 1u);
+        out_used          = sizeof HEADLESS_CONTROL_MAGIC - 1u;
+        out_magic_written = true;
+    }
+
+    while ((num = event_ring_pop(&control_ring, changes, ARRAY_LEN(changes))) > 0) {
+        size_t i;
+
+        for (i = 0; i < num; i++) {
+            const struct input_event *change = &changes[i];
+
+            if (sizeof out_buffer - out_used < STATE_RECORD_MAX && !output_flush()) {
+                return false;
+            }
+            if (binary) {
+                headless_control_record_t rec;
+
+                memset(&rec, 0, sizeof rec);
+                rec.sec     = (uint32_t)change->input_event_sec;
+                rec.usec    = (uint32_t)change->input_event_usec;
+                rec.device  = change->type;
+                rec.value   = (int16_t)change->value;
+                rec.control = (uint8_t)change->code;
+                memcpy(out_buffer + out_used, &rec, sizeof rec);
+                out_used += sizeof rec;
+            } else {
+                text_append(out_buffer, sizeof out_buffer, &out_used,
+                            "%u %ld.%06ld %s %d\n",
+                            (unsigned int)change->type,
+                            (long)change->input_event_sec,
+                            (long)change->input_event_usec,
+                            joy_control_name((joy_control_t)change->code),
+                            (int)change->value);
+            }
+        }
+    }
+    return out_used == 0 || output_flush();
+}
+
+/** \brief  Queue the control changes an event maps to
+ *
+ * \param[in,out]  dev     headless device
+ * \param[in]      ev      event
+ */
+static void controls_translate(headless_device_t *dev, const struct input_event *ev)
+{
+    joy_control_event_t controls[JOY_MAPPING_MAX_OUTPUTS];
+    size_t              num = joy_mapping_translate(dev->device, ev, controls);
+    size_t              i;
+
+    for (i = 0; i < num; i++) {
+        struct input_event change;
+
+        if (dev->controls[controls[i].control] == controls[i].value) {
+            continue;
+        }
+        dev->controls[controls[i].control] = controls[i].value;
+        change.input_event_sec  = ev->input_event_sec;
+        change.input_event_usec = ev->input_event_usec;
+        change.type             = (uint16_t)(dev - devices);
+        change.code             = controls[i].control;
+        change.value            = controls[i].value;
+        /* a full ring drops and counts the change */
+        event_ring_push(&control_ring, &change);
+    }
+}
+
+
+/** \brief  Events callback of the polling engine
+ *
+ * Logs the events or queues the control changes they map to when streaming
+ * those, and plays the rumble on button presses, queued right from the
+ * reader so it goes out with the same dispatch.
+ *
+ * \param[in]   device  device
+ * \param[in]   events  events
+ * \param[in]   num     number of \a events
+ * \param[in]   data    headless device
+ */
+static void on_poll_events(joy_dev_info_t           *device,
+                           const struct input_event *events,
+                           size_t                    num,
+                           void                     *data)
+{
+    headless_device_t *dev = data;
+    size_t             i;
+
+    for (i = 0; i < num; i++) {
+        const struct input_event *ev = &events[i];
+
+        if (stream_events) {
+            event_log_event(ev);
+        }
+        if (stream_controls) {
+            controls_translate(dev, ev);
+        }
+        if (dev->ff_effect >= 0 && ev->type == EV_KEY && ev->value == 1 &&
+                joy_dev_info_button_index(device, ev->code) >= 0) {
+            /* delay measured from the press */
+            joy_poll_ff_play(device, dev->ff_effect, 1,
+                             (uint64_t)ev->input_event_sec * 1000000u +
+                             (uint64_t)ev->input_event_usec);
+        }
+    }
+}
+
+/** \brief  Closed callback of the polling engine
+ *
+ * \param[in]   device  device closed
+ * \param[in]   data    headless device
+ */
+static void on_poll_closed(joy_dev_info_t *device, void *data)
+{
+    headless_device_t *dev = data;
+
+    if (atomic_exchange(&(dev->open), false)) {
+        fprintf(stderr, "device %u: %s closed\n",
+                (unsigned int)(dev - devices), device->path);
+        atomic_fetch_sub(&num_open, 1u);
+    }
+}
+
+
+/** \brief  Add device to the devices streamed
+ *
+ * \param[in]   device  device info
+ * \param[in]   owned   free \a device on exit
+ *
+ * \return  \c false if the devices table is full
+ */
+static bool devices_add(joy_dev_info_t *device, bool owned)
+{
+    headless_device_t *dev;
+
+    if (num_devices >= JOY_POLL_MAX_DEVICES) {
+        fprintf(stderr, "error: more than %d devices\n", JOY_POLL_MAX_DEVICES);
+        return false;
+    }
+    dev = &devices[num_devices++];
+    dev->device   = device;
+    dev->sequence = UINT64_MAX;
+    dev->sub_id   = -1;
+    dev->ff_effect = -1;
+    dev->owned    = owned;
+    joy_axis_hold_init(&(device->axis_norm), dev->held);
+    memset(dev->controls, 0, sizeof dev->controls);
+    atomic_init(&(dev->open), false);
+    return true;
+}
+
+/** \brief  Get the events needed from a device
+ *
+ * The kernel drops everything else. State snapshots need the buttons, axes
+ * and hats, rumble the buttons and the event log whatever its level logs.
+ *
+ * \param[in]   device  device info
+ * \param[in]   events  streaming events
+ * \param[out]  filter  filter
+ *
+ * \return  \a filter, or \c NULL for all events
+ */
+static const joy_poll_filter_t *devices_filter(const joy_dev_info_t *device,
+                                               bool                  events,
+                                               joy_poll_filter_t    *filter)
+{
+    unsigned int i;
+
+    if (events && event_log_get_level() == EVENT_LOG_ALL) {
+        return NULL;
+    }
+    joy_poll_filter_init(filter);
+    if (!events || event_log_get_level() == EVENT_LOG_INPUT) {
+        joy_poll_filter_add_device(filter, device);
+    } else {
+        /* EVENT_LOG_BUTTONS, or EVENT_LOG_OFF with rumble */
+        for (i = 0; i < device->num_buttons; i++) {
+            joy_poll_filter_add(filter, EV_KEY, device->button_map[i]);
+        }
+    }
+    return filter;
+}
+
+/** \brief  Subscribe to all devices
+ *
+ * \param[in]   events  stream events, otherwise only the state or the
+ *                      controls are read
+ *
+ * \return  number of devices opened
+ */
+static unsigned int devices_open(bool events)
+{
+    joy_poll_filter_t filter;
+    unsigned int      i;
+
+    for (i = 0; i < num_devices; i++) {
+        headless_device_t *dev = &devices[i];
+
+        fprintf(stderr, "device %u: %s \"%s\" %s\n",
+                i, dev->device->path, dev->device->name, dev->device->guid_str);
+        if (stream_controls) {
+            if (dev->device->mapping != NULL) {
+                fprintf(stderr, "device %u: mapping \"%s\"\n",
+                        i, joy_mapping_get_name(dev->device->mapping));
+            } else {
+                fprintf(stderr, "device %u: no controller mapping\n", i);
+            }
+        }
+        atomic_store(&(dev->open), true);
+        atomic_fetch_add(&num_open, 1u);
+        dev->sub_id = joy_poll_subscribe_filtered(dev->device,
+                                                  devices_filter(dev->device, events, &filter),
+                                                  events || stream_controls || rumble_ms > 0
+                                                  ? on_poll_events : NULL,
+                                                  on_poll_closed,
+                                                  dev);
+        if (dev->sub_id < 0 || !joy_poll_get_state_ref(dev->device, &(dev->ref))) {
+            fprintf(stderr, "error: failed to open %s\n", dev->device->path);
+            atomic_store(&(dev->open), false);
+            atomic_fetch_sub(&num_open, 1u);
+        }
+    }
+    return atomic_load(&num_open);
+}
+
+/** \brief  Upload the rumble effect to the devices that have force feedback
+ */
+static void devices_rumble_init(void)
+{
+    struct ff_effect effect;
+    unsigned int     i;
+
+    memset(&effect, 0, sizeof effect);
+    effect.type                      = FF_RUMBLE;
+    effect.u.rumble.strong_magnitude = RUMBLE_STRONG;
+    effect.u.rumble.weak_magnitude   = RUMBLE_WEAK;
+    effect.replay.length             = (uint16_t)(rumble_ms < UINT16_MAX ? rumble_ms : UINT16_MAX);
+
+    for (i = 0; i < num_devices; i++) {
+        headless_device_t *dev = &devices[i];
+
+        if (!atomic_load(&(dev->open))) {
+            continue;
+        }
+        if (!joy_poll_ff_supported(dev->device)) {
+            fprintf(stderr, "device %u: no force feedback\n", i);
+            continue;
+        }
+        effect.id      = -1;
+        dev->ff_effect = joy_poll_ff_upload(dev->device, &effect);
+    }
+}
+
+/** \brief  Report the force feedback statistics of the devices with rumble
+ */
+static void devices_rumble_report(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < num_devices; i++) {
+        joy_poll_stats_t stats;
+        uint64_t         total = 0;
+        unsigned int     b;
+
+        if (devices[i].ff_effect < 0 ||
+                !joy_poll_get_device_stats(devices[i].device, &stats)) {
+            continue;
+        }
+        for (b = 0; b < JOY_POLL_DELAY_BUCKETS; b++) {
+            total += stats.ff_delay_hist[b];
+        }
+        fprintf(stderr,
+                "device %u: %llu rumbles in %llu writes, %llu dropped, "
+                "max delay %llu us\n",
+                i,
+                (unsigned long long)stats.ff_events,
+                (unsigned long long)stats.ff_writes,
+                (unsigned long long)stats.ff_dropped,
+                (unsigned long long)stats.ff_delay_us_max);
+        for (b = 0; b < JOY_POLL_DELAY_BUCKETS && total > 0; b++) {
+            if (stats.ff_delay_hist[b] == 0) {
+                continue;
+            }
+            if (b < JOY_POLL_DELAY_BUCKETS - 1u) {
+                fprintf(stderr, "  <%6llu us: %llu\n",
+                        1ull << b, (unsigned long long)stats.ff_delay_hist[b]);
+            } else {
+                fprintf(stderr, "  >=%5llu us: %llu\n",
+                        1ull << (b - 1u), (unsigned long long)stats.ff_delay_hist[b]);
+            }
+        }
+    }
+}
+
+/** \brief  Unsubscribe from all devices and free the ones opened with -d
+ */
+static void devices_close(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < num_devices; i++) {
+        if (devices[i].sub_id >= 0) {
+            joy_poll_unsubscribe(devices[i].sub_id);
+        }
+    }
+    joy_poll_shutdown();
+    for (i = 0; i < num_devices; i++) {
+        if (devices[i].owned) {
+            joy_dev_info_free(devices[i].device);
+        }
+    }
+    num_devices = 0;
+    joy_free_devices_list();
+}
+
+
+/** \brief  Get current time of the monotonic clock in milliseconds
+ *
+ * \return  time in milliseconds
+ */
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+/** \brief  Set axis change suppression thresholds for the devices of a GUID
+ *
+ * \param[in]   arg     "<guid>=<thresholds>"
+ * \param[in]   options options of the other devices
+ *
+ * \return  \c false if \a arg is invalid
+ */
+static bool guid_filter_set(char *arg, const joy_poll_options_t *options)
+{
+    joy_poll_options_t  guid_options = *options;
+    char               *eq           = strchr(arg, '=');
+    bool                ok;
+
+    *eq = '\0';
+    ok  = joy_poll_parse_abs_filter(eq + 1, &guid_options) &&
+          joy_poll_set_guid_options(arg, &guid_options);
+    *eq = '=';
+    if (!ok) {
+        fprintf(stderr, "error: invalid GUID filter '%s'\n", arg);
+    }
+    return ok;
+}
+
+/** \brief  Show usage message
+ *
+ * \param[in]   prog    program name
+ * \param[in]   option  option selecting headless mode, \c NULL for none
+ */
+static void usage(const char *prog, const char *option)
+{
+    printf("Usage: %s%s%s [options]\n"
+           "  -d <node>     stream an event device, can be repeated (default: all\n"
+           "                joysticks in " JOY_INPUT_NODES_PATH ")\n"
+           "  -p <dir>      directory to scan for joysticks instead\n"
+           "  -s            write state snapshots instead of events\n"
+           "  -i <msec>     interval between state snapshots (default %u)\n"
+           "  -n            normalized axis values in [-1, 1] in state snapshots\n"
+           "  -k            write changes of the mapped controller controls instead\n"
+           "                of events, mappings from $" JOY_MAPPING_ENV " or\n"
+           "                " JOY_MAPPING_DEFAULT "\n"
+           "  -l <level>    events logged: buttons, input or all (default input)\n"
+           "  -b            binary records instead of text\n"
+           "  -o <file>     write to file instead of stdout\n"
+           "  -u <path>     write to UNIX socket instead of stdout\n"
+           "  -c <clock>    event clock: monotonic, boottime or realtime\n"
+           "  -g            grab the devices, so the desktop doesn't see their events\n"
+           "  -a [<guid>=]<fuzz>,<flat>\n"
+           "                axis changes and deadzone suppressed before output:\n"
+           "                numbers or 'device' for the axes' own (default 0,device),\n"
+           "                'device' or 'off' for both, the axes' own deadzone only\n"
+           "                applies to axes centered on 0, can be repeated with a GUID\n"
+           "                for the devices with that GUID\n"
+           "  -m <method>   read method: raw or libevdev (default raw)\n"
+           "  -r <msec>     play a rumble of this length on each button press\n"
+           "  -t <sec>      stop after this many seconds (default: on SIGINT/SIGTERM\n"
+           "                or when all devices are gone)\n",
+           prog, option != NULL ? " " : "", option != NULL ? option : "",
+           HEADLESS_DEFAULT_INTERVAL);
+}
+
+/** \brief  Run headless mode
+ *
+ * Also accepts being called with \c HEADLESS_OPTION as the first argument,
+ * as done by the GUI program.
+ *
+ * \param[in]   argc    argument count
+ * \param[in]   argv    argument vector
+ *
+ * \return  exit status
+ */
+int headless_main(int argc, char *argv[])
+{
+    const char        *option    = NULL;
+    const char        *out_file  = NULL;
+    const char        *out_sock  = NULL;
+    const char        *scan_path = JOY_INPUT_NODES_PATH;
+    const char        *nodes[JOY_POLL_MAX_DEVICES];
+    unsigned int       num_nodes = 0;
+    char              *guid_filters[JOY_POLL_MAX_GUID_OPTIONS];
+    unsigned int       num_guid_filters = 0;
+    unsigned int       interval  = HEADLESS_DEFAULT_INTERVAL;
+    unsigned long      duration  = 0;
+    event_log_level_t  level     = EVENT_LOG_INPUT;
+    joy_poll_options_t options;
+    joy_read_method_t  method    = JOY_READ_RAW;
+    bool               states    = false;
+    bool               controls  = false;
+    bool               binary    = false;
+    bool               ok        = true;
+    uint64_t           deadline  = 0;
+    unsigned int       i;
+    int                opt;
+
+    if (argc > 1 && strcmp(argv[1], HEADLESS_OPTION) == 0) {
+        option = HEADLESS_OPTION;
+        optind = 2;
+    }
+    joy_poll_options_init(&options);
+
+    while ((opt = getopt(argc, argv, "d:p:si:nkl:bo:u:c:ga:m:r:t:h")) != -1) {
+        switch (opt) {
+            case 'd':
+                if (num_nodes >= JOY_POLL_MAX_DEVICES) {
+                    fprintf(stderr, "error: more than %d devices\n", JOY_POLL_MAX_DEVICES);
+                    return EXIT_FAILURE;
+                }
+                nodes[num_nodes++] = optarg;
+                break;
+            case 'p':
+                scan_path = optarg;
+                break;
+            case 's':
+                states = true;
+                break;
+            case 'i':
+                interval = (unsigned int)strtoul(optarg, NULL, 10);
+                break;
+            case 'n':
+                normalize_axes = true;
+                break;
+            case 'k':
+                controls = true;
+                break;
+            case 'l':
+                ok = event_log_parse_level(optarg, &level);
+                break;
+            case 'b':
+                binary = true;
+                break;
+            case 'o':
+                out_file = optarg;
+                break;
+            case 'u':
+                out_sock = optarg;
+                break;
+            case 'c':
+                ok = joy_poll_parse_clock(optarg, &options.clock_id);
+                break;
+            case 'g':
+                options.grab = true;
+                break;
+            case 'a':
+                if (strchr(optarg, '=') == NULL) {
+                    ok = joy_poll_parse_abs_filter(optarg, &options);
+                } else if (num_guid_filters < JOY_POLL_MAX_GUID_OPTIONS) {
+                    guid_filters[num_guid_filters++] = optarg;
+                } else {
+                    fprintf(stderr, "error: more than %d GUID filters\n",
+                            JOY_POLL_MAX_GUID_OPTIONS);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'm':
+                if (strcmp(optarg, "raw") == 0) {
+                    method = JOY_READ_RAW;
+                } else if (strcmp(optarg, "libevdev") == 0) {
+                    method = JOY_READ_LIBEVDEV;
+                } else {
+                    ok = false;
+                }
+                break;
+            case 'r':
+                rumble_ms = (unsigned int)strtoul(optarg, NULL, 10);
+                break;
+            case 't':
+                duration = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                usage(argv[0], option);
+                return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        if (!ok) {
+            usage(argv[0], option);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind < argc || interval == 0 || (out_file != NULL && out_sock != NULL) ||
+            (states && controls)) {
+        usage(argv[0], option);
+        return EXIT_FAILURE;
+    }
+    /* GUID overrides start from the options of the other devices */
+    for (i = 0; i < num_guid_filters; i++) {
+        if (!guid_filter_set(guid_filters[i], &options)) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    lib_alloc_set_counting(getenv("EVDEV_JS_ALLOC_STATS") != NULL);
+
+    /* before the devices are created, they look up their mappings */
+    if (controls) {
+        const char *db_path = getenv(JOY_MAPPING_ENV);
+
+        if (db_path == NULL || *db_path == '\0') {
+            db_path = JOY_MAPPING_DEFAULT;
+        }
+        if (!joy_mapping_open(db_path)) {
+            fprintf(stderr, "error: failed to open mapping database %s\n", db_path);
+            return EXIT_FAILURE;
+        }
+        event_ring_init(&control_ring);
+    }
+
+    /* collect devices before touching the output */
+    if (num_nodes > 0) {
+        for (i = 0; i < num_nodes; i++) {
+            joy_dev_info_t *device = joy_dev_info_new_from_path(nodes[i]);
+
+            if (device == NULL) {
+                fprintf(stderr, "error: %s is not a usable event device\n", nodes[i]);
+                devices_close();
+                return EXIT_FAILURE;
+            }
+            devices_add(device, true);
+        }
+    } else {
+        joy_dev_info_t **list  = NULL;
+        int              count = joy_scan_devices(scan_path, &list);
+        int              d;
+
+        for (d = 0; d < count; d++) {
+            if (!devices_add(list[d], false)) {
+                break;
+            }
+        }
+    }
+    if (num_devices == 0) {
+        fprintf(stderr, "error: no joystick devices found\n");
+        devices_close();
+        return EXIT_FAILURE;
+    }
+
+    out_fd = output_open(out_file, out_sock);
+    if (out_fd < 0) {
+        devices_close();
+        return EXIT_FAILURE;
+    }
+    signals_install();
+
+    stream_events   = !states && !controls;
+    stream_controls = controls;
+    if (stream_events) {
+        event_log_set_level(level);
+        event_log_set_mode(binary ? EVENT_LOG_BINARY : EVENT_LOG_TEXT);
+        ok = event_log_init(out_fd);
+    }
+    joy_poll_set_default_options(&options);
+    joy_poll_set_read_method(method);
+    ok = ok && joy_poll_init() && devices_open(stream_events) > 0;
+    if (ok && rumble_ms > 0) {
+        /* before the reader thread, which reads the effect IDs */
+        devices_rumble_init();
+    }
+    ok = ok && joy_poll_thread_start();
+
+    if (duration > 0) {
+        deadline = now_ms() + (uint64_t)duration * 1000u;
+    }
+    while (ok && !quit_requested && atomic_load(&num_open) > 0 &&
+            (deadline == 0 || now_ms() < deadline)) {
+        struct timespec ts = {
+            (time_t)(interval / 1000u), (long)(interval % 1000u) * 1000000L
+        };
+
+        nanosleep(&ts, NULL);
+        if (states) {
+            ok = states_update(binary);
+        } else if (controls) {
+            ok = controls_update(binary);
+        }
+    }
+
+    if (states && ok) {
+        /* last changes before exiting */
+        ok = states_update(binary);
+    }
+    devices_rumble_report();
+    devices_close();
+    if (controls && ok) {
+        /* last changes before exiting, the reader thread is gone */
+        ok = controls_update(binary);
+    }
+    if (controls && event_ring_get_overruns(&control_ring) > 0) {
+        fprintf(stderr, "%lu control changes dropped\n",
+                event_ring_get_overruns(&control_ring));
+    }
+    if (stream_events) {
+        event_log_shutdown();
+    }
+    if (out_fd != STDOUT_FILENO) {
+        close(out_fd);
+    }
+    out_fd = -1;
+    joy_cache_close();
+    joy_mapping_close();
+    if (getenv("EVDEV_JS_ALLOC_STATS") != NULL) {
+        lib_alloc_print_stats();
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
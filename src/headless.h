@@ -0,0 +1,62 @@
+/** \file   headless.h
+ * \brief   Headless mode streaming joystick events without a UI - header
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <stdint.h>
+
+/** \brief  Command line option selecting headless mode in the GUI program */
+#define HEADLESS_OPTION             "--headless"
+
+/** \brief  Default interval in milliseconds between state snapshots */
+#define HEADLESS_DEFAULT_INTERVAL   10u
+
+/** \brief  Size of the buffer state snapshots are formatted into */
+#define HEADLESS_BUFFER_SIZE        65536
+
+/** \brief  Magic bytes written before the binary state records */
+#define HEADLESS_STATE_MAGIC        "JSSTATE1"
+
+/** \brief  State record flag: axis values are normalized \c float in [-1, 1] */
+#define HEADLESS_STATE_NORMALIZED   0x0001u
+
+/** \brief  Binary state record header, in host byte order
+ *
+ * Followed by the button bitmap (\c uint32_t words), the axis values
+ * (\c int32_t, or \c float with \c HEADLESS_STATE_NORMALIZED) and the hat
+ * directions (\c uint8_t), padded to a multiple of 8 bytes which is
+ * included in \c size.
+ */
+typedef struct headless_state_record_s {
+    uint32_t size;          /**< size of the record including the header */
+    uint16_t device;        /**< index of the device as listed at startup */
+    uint16_t num_buttons;   /**< number of buttons */
+    uint16_t num_axes;      /**< number of axes */
+    uint16_t num_hats;      /**< number of hats */
+    uint32_t flags;         /**< \c HEADLESS_STATE_NORMALIZED */
+    uint64_t sequence;      /**< reports applied to the device's state */
+} headless_state_record_t;
+
+/** \brief  Magic bytes written before the binary control records */
+#define HEADLESS_CONTROL_MAGIC      "JSCTRL01"
+
+/** \brief  Binary control record, in host byte order
+ *
+ * A change of a mapped controller control, see joy-mapping.h for the
+ * controls and their value ranges.
+ */
+typedef struct headless_control_record_s {
+    uint32_t sec;           /**< event time, seconds */
+    uint32_t usec;          /**< event time, microseconds */
+    uint16_t device;        /**< index of the device as listed at startup */
+    int16_t  value;         /**< new value of the control */
+    uint8_t  control;       /**< control (\c joy_control_t) */
+    uint8_t  reserved[3];   /**< padding, set to 0 */
+} headless_control_record_t;
+
+int headless_main(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,332 @@
+/** \file   joy-axis.c
+ * \brief   Axis normalization
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ * Converts raw axis values from their [minimum, maximum] range to [-1, 1],
+ * with \c flat applied as a deadzone around the center and \c fuzz as
+ * hysteresis: a value only replaces the held value when it differs by more
+ * than \c fuzz, which filters out the jitter of noisy sticks.
+ *
+ * The parameters are precomputed per axis when the device info is created,
+ * so normalizing is a handful of multiply/compare/select operations that
+ * are done four axes at a time with SSE2 or NEON, all axes of a device in a
+ * few iterations. The scalar version does the same single precision
+ * operations in the same order, so all paths give identical results, which
+ * `make check` verifies against the scalar version.
+ */
+
+#include <math.h>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#elif defined(__ARM_NEON)
+# include <arm_neon.h>
+#endif
+
+#include "joystick.h"
+
+#include "joy-axis.h"
+
+
+/** \brief  Round number of axes up to a multiple of the vector width
+ *
+ * \param[in]   num_axes    number of axes
+ *
+ * \return  number of array elements processed
+ */
+static unsigned int axis_lanes(unsigned int num_axes)
+{
+    return (num_axes + JOY_AXIS_LANES - 1u) & ~(JOY_AXIS_LANES - 1u);
+}
+
+
+/** \brief  Precompute normalization parameters of axes
+ *
+ * \param[out]  norm        normalization parameters
+ * \param[in]   axes        axis info
+ * \param[in]   num_axes    number of \a axes, at most \c JOY_STATE_MAX_AXES
+ */
+void joy_axis_norm_init(joy_axis_norm_t      *norm,
+                        const joy_abs_info_t *axes,
+                        unsigned int          num_axes)
+{
+    unsigned int i;
+
+    if (num_axes > JOY_STATE_MAX_AXES) {
+        num_axes = JOY_STATE_MAX_AXES;
+    }
+    for (i = 0; i < JOY_STATE_MAX_AXES; i++) {
+        norm->center[i]   = 0.0f;
+        norm->deadzone[i] = 0.0f;
+        norm->scale[i]    = 0.0f;
+        norm->fuzz[i]     = 0.0f;
+    }
+    norm->num_axes = (uint16_t)num_axes;
+
+    for (i = 0; i < num_axes; i++) {
+        double half = ((double)axes[i].maximum - (double)axes[i].minimum) / 2.0;
+        double flat = axes[i].flat > 0 ? (double)axes[i].flat : 0.0;
+
+        norm->center[i] = (float)(((double)axes[i].minimum + (double)axes[i].maximum) / 2.0);
+        norm->fuzz[i]   = axes[i].fuzz > 0 ? (float)axes[i].fuzz : 0.0f;
+        if (half <= 0.0) {
+            /* empty or inverted range, always report the center */
+            continue;
+        }
+        if (flat >= half) {
+            /* deadzone covering the whole range, likewise */
+            continue;
+        }
+        norm->deadzone[i] = (float)flat;
+        norm->scale[i]    = (float)(1.0 / (half - flat));
+    }
+}
+
+
+/** \brief  Initialize the held values for joy_axis_normalize()
+ *
+ * \param[in]   norm    normalization parameters
+ * \param[out]  held    held values, \c JOY_STATE_MAX_AXES elements
+ */
+void joy_axis_hold_init(const joy_axis_norm_t *norm, int32_t *held)
+{
+    unsigned int i;
+
+    for (i = 0; i < JOY_STATE_MAX_AXES; i++) {
+        held[i] = (int32_t)lrintf(norm->center[i]);
+    }
+}
+
+
+/** \brief  Normalize a single axis value, without hysteresis
+ *
+ * The same single precision operations in the same order as the vector
+ * versions.
+ *
+ * \param[in]   norm    normalization parameters
+ * \param[in]   index   axis index
+ * \param[in]   value   raw (or held) value
+ *
+ * \return  normalized value
+ */
+static float normalize_one(const joy_axis_norm_t *norm, unsigned int index, int32_t value)
+{
+    float d = (float)value - norm->center[index];
+    float v = fabsf(d) - norm->deadzone[index];
+
+    v = v > 0.0f ? v : 0.0f;
+    v = v * norm->scale[index];
+    v = v < 1.0f ? v : 1.0f;
+    return copysignf(v, d);
+}
+
+/** \brief  Normalize axes, scalar version
+ *
+ * \param[in]       norm    normalization parameters
+ * \param[in]       axes    raw axis values
+ * \param[in,out]   held    held values
+ * \param[out]      out     normalized values
+ * \param[in]       num     number of elements
+ */
+static void normalize_scalar(const joy_axis_norm_t *norm,
+                             const int32_t         *axes,
+                             int32_t               *held,
+                             float                 *out,
+                             unsigned int           num)
+{
+    unsigned int i;
+
+    for (i = 0; i < num; i++) {
+        if (fabsf((float)axes[i] - (float)held[i]) > norm->fuzz[i]) {
+            held[i] = axes[i];
+        }
+        out[i] = normalize_one(norm, i, held[i]);
+    }
+}
+
+
+#if defined(__SSE2__)
+
+/** \brief  Normalize axes, SSE2 version
+ *
+ * \param[in]       norm    normalization parameters
+ * \param[in]       axes    raw axis values
+ * \param[in,out]   held    held values
+ * \param[out]      out     normalized values
+ * \param[in]       num     number of elements, multiple of 4
+ */
+static void normalize_vector(const joy_axis_norm_t *norm,
+                             const int32_t         *axes,
+                             int32_t               *held,
+                             float                 *out,
+                             unsigned int           num)
+{
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one  = _mm_set1_ps(1.0f);
+    unsigned int i;
+
+    for (i = 0; i < num; i += 4u) {
+        __m128i raw  = _mm_loadu_si128((const __m128i *)(const void *)(axes + i));
+        __m128i hold = _mm_loadu_si128((const __m128i *)(const void *)(held + i));
+        __m128  diff;
+        __m128i move;
+        __m128  d;
+        __m128  v;
+
+        /* hysteresis: take the new value if it moved more than fuzz */
+        diff = _mm_sub_ps(_mm_cvtepi32_ps(raw), _mm_cvtepi32_ps(hold));
+        diff = _mm_andnot_ps(sign, diff);
+        move = _mm_castps_si128(_mm_cmpgt_ps(diff, _mm_loadu_ps(norm->fuzz + i)));
+        hold = _mm_or_si128(_mm_and_si128(move, raw), _mm_andnot_si128(move, hold));
+        _mm_storeu_si128((__m128i *)(void *)(held + i), hold);
+
+        /* deadzone and scale the distance from the center, restore sign */
+        d = _mm_sub_ps(_mm_cvtepi32_ps(hold), _mm_loadu_ps(norm->center + i));
+        v = _mm_sub_ps(_mm_andnot_ps(sign, d), _mm_loadu_ps(norm->deadzone + i));
+        v = _mm_max_ps(v, zero);
+        v = _mm_min_ps(_mm_mul_ps(v, _mm_loadu_ps(norm->scale + i)), one);
+        _mm_storeu_ps(out + i, _mm_or_ps(v, _mm_and_ps(d, sign)));
+    }
+}
+
+#elif defined(__ARM_NEON)
+
+/** \brief  Normalize axes, NEON version
+ *
+ * \param[in]       norm    normalization parameters
+ * \param[in]       axes    raw axis values
+ * \param[in,out]   held    held values
+ * \param[out]      out     normalized values
+ * \param[in]       num     number of elements, multiple of 4
+ */
+static void normalize_vector(const joy_axis_norm_t *norm,
+                             const int32_t         *axes,
+                             int32_t               *held,
+                             float                 *out,
+                             unsigned int           num)
+{
+    const uint32x4_t  sign = vdupq_n_u32(0x80000000u);
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    const float32x4_t one  = vdupq_n_f32(1.0f);
+    unsigned int      i;
+
+    for (i = 0; i < num; i += 4u) {
+        int32x4_t   raw  = vld1q_s32(axes + i);
+        int32x4_t   hold = vld1q_s32(held + i);
+        float32x4_t diff;
+        uint32x4_t  move;
+        float32x4_t d;
+        float32x4_t v;
+
+        /* hysteresis: take the new value if it moved more than fuzz */
+        diff = vabsq_f32(vsubq_f32(vcvtq_f32_s32(raw), vcvtq_f32_s32(hold)));
+        move = vcgtq_f32(diff, vld1q_f32(norm->fuzz + i));
+        hold = vbslq_s32(move, raw, hold);
+        vst1q_s32(held + i, hold);
+
+        /* deadzone and scale the distance from the center, restore sign */
+        d = vsubq_f32(vcvtq_f32_s32(hold), vld1q_f32(norm->center + i));
+        v = vsubq_f32(vabsq_f32(d), vld1q_f32(norm->deadzone + i));
+        v = vmaxq_f32(v, zero);
+        v = vminq_f32(vmulq_f32(v, vld1q_f32(norm->scale + i)), one);
+        vst1q_f32(out + i, vbslq_f32(sign, d, v));
+    }
+}
+
+#endif
+
+
+/** \brief  Normalize raw axis values
+ *
+ * Processes the axes in groups of \c JOY_AXIS_LANES, so \a axes, \a held
+ * and \a out must hold \c num_axes rounded up to that many elements.
+ *
+ * \param[in]       norm    normalization parameters
+ * \param[in]       axes    raw axis values, indexed like the axis map
+ * \param[in,out]   held    values held by the hysteresis, initialize with
+ *                          joy_axis_hold_init()
+ * \param[out]      out     normalized values in [-1, 1]
+ */
+void joy_axis_normalize(const joy_axis_norm_t *norm,
+                        const int32_t         *axes,
+                        int32_t               *held,
+                        float                 *out)
+{
+#if defined(__SSE2__) || defined(__ARM_NEON)
+    normalize_vector(norm, axes, held, out, axis_lanes(norm->num_axes));
+#else
+    normalize_scalar(norm, axes, held, out, axis_lanes(norm->num_axes));
+#endif
+}
+
+
+/** \brief  Normalize raw axis values with the scalar implementation
+ *
+ * The reference joy_axis_normalize() gives identical results to, whatever
+ * implementation it uses. Same arguments as joy_axis_normalize().
+ *
+ * \param[in]       norm    normalization parameters
+ * \param[in]       axes    raw axis values, indexed like the axis map
+ * \param[in,out]   held    values held by the hysteresis
+ * \param[out]      out     normalized values in [-1, 1]
+ */
+void joy_axis_normalize_scalar(const joy_axis_norm_t *norm,
+                               const int32_t         *axes,
+                               int32_t               *held,
+                               float                 *out)
+{
+    normalize_scalar(norm, axes, held, out, axis_lanes(norm->num_axes));
+}
+
+
+/** \brief  Normalize a single raw axis value, without hysteresis
+ *
+ * For translating events one at a time.
+ *
+ * \param[in]   norm    normalization parameters
+ * \param[in]   index   axis index, below \c num_axes
+ * \param[in]   value   raw value
+ *
+ * \return  normalized value in [-1, 1]
+ */
+float joy_axis_normalize_value(const joy_axis_norm_t *norm,
+                               unsigned int           index,
+                               int32_t                value)
+{
+    return normalize_one(norm, index, value);
+}
+
+
+/** \brief  Normalize the axes of a device state snapshot
+ *
+ * \param[in]       device  joystick device
+ * \param[in]       state   state snapshot of \a device
+ * \param[in,out]   held    values held by the hysteresis,
+ *                          \c JOY_STATE_MAX_AXES elements
+ * \param[out]      out     normalized values, \c JOY_STATE_MAX_AXES elements
+ */
+void joy_axis_normalize_state(const joy_dev_info_t     *device,
+                              const joy_device_state_t *state,
+                              int32_t                  *held,
+                              float                    *out)
+{
+    joy_axis_normalize(&(device->axis_norm), state->axes, held, out);
+}
+
+
+/** \brief  Get name of the normalization implementation in use
+ *
+ * \return  "sse2", "neon" or "scalar"
+ */
+const char *joy_axis_normalize_impl(void)
+{
+#if defined(__SSE2__)
+    return "sse2";
+#elif defined(__ARM_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,42 @@
+/** \file   joy-axis.h
+ * \brief   Axis normalization - header
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+#ifndef JOY_AXIS_H
+#define JOY_AXIS_H
+
+#include <stdint.h>
+
+#include "joystick.h"
+
+/** \brief  Number of axes processed at once by joy_axis_normalize()
+ *
+ * Arrays passed to joy_axis_normalize() must hold the number of axes rounded
+ * up to a multiple of this, arrays of \c JOY_STATE_MAX_AXES elements always
+ * do.
+ */
+#define JOY_AXIS_LANES  4
+
+void        joy_axis_norm_init(joy_axis_norm_t      *norm,
+                               const joy_abs_info_t *axes,
+                               unsigned int          num_axes);
+void        joy_axis_hold_init(const joy_axis_norm_t *norm, int32_t *held);
+void        joy_axis_normalize(const joy_axis_norm_t *norm,
+                               const int32_t         *axes,
+                               int32_t               *held,
+                               float                 *out);
+void        joy_axis_normalize_scalar(const joy_axis_norm_t *norm,
+                                      const int32_t         *axes,
+                                      int32_t               *held,
+                                      float                 *out);
+float       joy_axis_normalize_value(const joy_axis_norm_t *norm,
+                                     unsigned int           index,
+                                     int32_t                value);
+void        joy_axis_normalize_state(const joy_dev_info_t     *device,
+                                     const joy_device_state_t *state,
+                                     int32_t                  *held,
+                                     float                    *out);
+const char *joy_axis_normalize_impl(void);
+
+#endif
@@ -0,0 +1,669 @@
+/** \file   joy-cache.c
+ * \brief   Persistent device capability cache
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ * Identical controllers always report the same buttons, axes and hats, so
+ * the capabilities of probed devices are stored in a binary file in the XDG
+ * cache directory, keyed by GUID and name. On the next start the file is
+ * mapped into memory and devices already known skip the capability bitmaps,
+ * only the name and IDs still have to be read to build the GUID, and the
+ * ranges of the axes, which can change with calibration or firmware.
+ *
+ * The file is specific to the host (native byte order and word size): it
+ * starts with a header, followed by an array of fixed-size entries sorted by
+ * GUID and name for binary search, followed by the variable-length data of
+ * the entries: axis and hat info, button codes and the device name. Devices
+ * sharing a GUID under different names each get their own entry.
+ *
+ * joy_cache_lookup() and joy_cache_add() may be called from multiple probe
+ * threads at once, the other functions must not be called while probing.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "vice.h"
+#include "joystick.h"
+
+#include "joy-cache.h"
+
+
+/** \brief  Magic bytes at the start of the cache file */
+#define CACHE_MAGIC     "EJSCAPS"
+
+/** \brief  Cache file format version, bump when changing the layout */
+#define CACHE_VERSION   1u
+
+/** \brief  Cache file header */
+typedef struct cache_header_s {
+    char     magic[8];          /**< CACHE_MAGIC, NUL-terminated */
+    uint32_t version;           /**< CACHE_VERSION */
+    uint32_t num_entries;       /**< number of entries following the header */
+} cache_header_t;
+
+/** \brief  Cache file entry */
+typedef struct cache_entry_s {
+    uint8_t  guid[JOY_GUID_SIZE];   /**< device GUID */
+    uint32_t offset;                /**< offset in file of the entry data */
+    uint16_t name_size;             /**< size of name including the NUL */
+    uint16_t num_buttons;           /**< number of buttons */
+    uint16_t num_axes;              /**< number of axes */
+    uint16_t num_hats;              /**< number of hats */
+    uint32_t reserved;              /**< padding, set to 0 */
+} cache_entry_t;
+
+/** \brief  Axis info as stored in the cache file */
+typedef struct cache_abs_s {
+    uint16_t code;
+    uint16_t reserved;
+    int32_t  minimum;
+    int32_t  maximum;
+    int32_t  fuzz;
+    int32_t  flat;
+    int32_t  resolution;
+} cache_abs_t;
+
+/** \brief  Entry to write to the cache file, from a probed device or from the
+ *          mapped file
+ */
+typedef struct cache_source_s {
+    const uint8_t        *guid;         /**< device GUID */
+    const char           *name;         /**< device name */
+    const joy_dev_info_t *info;         /**< probed device or \c NULL */
+    const cache_entry_t  *entry;        /**< entry in mapped file or \c NULL */
+    uint16_t              num_buttons;  /**< number of buttons */
+    uint16_t              num_axes;     /**< number of axes */
+    uint16_t              num_hats;     /**< number of hats */
+    size_t                name_size;    /**< size of name including the NUL */
+} cache_source_t;
+
+/** \brief  Key of a cache entry */
+typedef struct cache_key_s {
+    const uint8_t *guid;    /**< device GUID */
+    const char    *name;    /**< device name */
+} cache_key_t;
+
+
+/** \brief  Mapped cache file (read-only), \c NULL if not mapped */
+static unsigned char        *cache_map;
+
+/** \brief  Size of the mapped cache file */
+static size_t                cache_map_size;
+
+/** \brief  Number of valid entries in the mapped cache file */
+static uint32_t              cache_num_entries;
+
+/** \brief  Devices probed since the last flush, to be added to the file */
+static joy_dev_info_t      **cache_pending;
+
+/** \brief  Number of devices in \c cache_pending */
+static size_t                cache_num_pending;
+
+/** \brief  Lock for \c cache_pending, probe threads add to it */
+static pthread_mutex_t       cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/** \brief  Get path of the cache file
+ *
+ * Uses \c $XDG_CACHE_HOME, falling back to \c $HOME/.cache.
+ *
+ * \param[in]   create_dirs create missing directories
+ *
+ * \return  path, free with lib_free(), or \c NULL when no home is set
+ */
+static char *cache_get_path(bool create_dirs)
+{
+    const char *base;
+    const char *sub;
+    char       *path;
+    size_t      size;
+
+    base = getenv("XDG_CACHE_HOME");
+    sub  = "";
+    if (base == NULL || *base == '\0') {
+        base = getenv("HOME");
+        sub  = "/.cache";
+        if (base == NULL || *base == '\0') {
+            return NULL;
+        }
+    }
+
+    size = strlen(base) + strlen(sub) + sizeof "/" JOY_CACHE_DIR "/" JOY_CACHE_FILE;
+    path = lib_malloc_cat(size, LIB_ALLOC_JOY_CACHE);
+    if (create_dirs) {
+        snprintf(path, size, "%s%s", base, sub);
+        mkdir(path, 0700);
+        snprintf(path, size, "%s%s/" JOY_CACHE_DIR, base, sub);
+        mkdir(path, 0700);
+    }
+    snprintf(path, size, "%s%s/" JOY_CACHE_DIR "/" JOY_CACHE_FILE, base, sub);
+    return path;
+}
+
+/** \brief  Get size of the data of a cache entry
+ *
+ * \param[in]   num_buttons number of buttons
+ * \param[in]   num_axes    number of axes
+ * \param[in]   num_hats    number of hats
+ * \param[in]   name_size   size of name including the NUL
+ *
+ * \return  size in bytes, not rounded up for alignment
+ */
+static size_t entry_data_size(size_t num_buttons,
+                              size_t num_axes,
+                              size_t num_hats,
+                              size_t name_size)
+{
+    return (num_axes + num_hats * 2u) * sizeof(cache_abs_t) +
+           num_buttons * sizeof(uint16_t) +
+           name_size;
+}
+
+/** \brief  Round size up to the alignment of the entry data
+ *
+ * \param[in]   size    size in bytes
+ *
+ * \return  aligned size
+ */
+static size_t entry_data_align(size_t size)
+{
+    return (size + (alignof(cache_abs_t) - 1u)) & ~(alignof(cache_abs_t) - 1u);
+}
+
+/** \brief  Get entries of the mapped cache file
+ *
+ * \return  entries
+ */
+static const cache_entry_t *cache_entries(void)
+{
+    return (const cache_entry_t *)(cache_map + sizeof(cache_header_t));
+}
+
+/** \brief  Compare function for bsearch() of a GUID in the cache entries */
+static int compar_entry_guid(const void *key, const void *entry)
+{
+    return memcmp(key, ((const cache_entry_t *)entry)->guid, JOY_GUID_SIZE);
+}
+
+/** \brief  Compare GUIDs and names
+ *
+ * \param[in]   guid1   first GUID
+ * \param[in]   name1   first name
+ * \param[in]   guid2   second GUID
+ * \param[in]   name2   second name
+ *
+ * \return  <0, 0 or >0, ordering on GUID first
+ */
+static int compare_key(const uint8_t *guid1, const char *name1,
+                       const uint8_t *guid2, const char *name2)
+{
+    int result = memcmp(guid1, guid2, JOY_GUID_SIZE);
+
+    return result != 0 ? result : strcmp(name1, name2);
+}
+
+/** \brief  Compare function for bsearch() of a key in a sorted device list */
+static int compar_key_info(const void *key, const void *elem)
+{
+    const cache_key_t    *k = key;
+    const joy_dev_info_t *d = *(joy_dev_info_t * const *)elem;
+
+    return compare_key(k->guid, k->name, d->guid, d->name);
+}
+
+/** \brief  Compare function for qsort() of devices on GUID and name */
+static int compar_info_key(const void *p1, const void *p2)
+{
+    const joy_dev_info_t *d1 = *(joy_dev_info_t * const *)p1;
+    const joy_dev_info_t *d2 = *(joy_dev_info_t * const *)p2;
+
+    return compare_key(d1->guid, d1->name, d2->guid, d2->name);
+}
+
+/** \brief  Compare function for qsort() of entries to write on GUID and name */
+static int compar_source_key(const void *p1, const void *p2)
+{
+    const cache_source_t *s1 = p1;
+    const cache_source_t *s2 = p2;
+
+    return compare_key(s1->guid, s1->name, s2->guid, s2->name);
+}
+
+/** \brief  Check if an entry of the mapped cache file is valid
+ *
+ * The file might be truncated or from an older build, so don't trust it.
+ *
+ * \param[in]   entry   cache entry
+ *
+ * \return  \c true if the entry's data is inside the file, the name is
+ *          NUL-terminated and the maps fit those of a probed device
+ */
+static bool entry_is_valid(const cache_entry_t *entry)
+{
+    size_t size;
+
+    if (entry->name_size == 0 ||
+            entry->num_buttons > JOY_BUTTON_INDEX_SIZE ||
+            entry->num_axes > JOY_AXIS_INDEX_SIZE ||
+            entry->num_hats > JOY_HAT_MAX ||
+            entry->offset % alignof(cache_abs_t) != 0 ||
+            entry->offset > cache_map_size) {
+        return false;
+    }
+    size = entry_data_size(entry->num_buttons,
+                           entry->num_axes,
+                           entry->num_hats,
+                           entry->name_size);
+    if (size > cache_map_size - entry->offset) {
+        return false;
+    }
+    return cache_map[entry->offset + size - 1u] == '\0';
+}
+
+/** \brief  Get name stored in a cache entry
+ *
+ * \param[in]   entry   valid cache entry
+ *
+ * \return  name
+ */
+static const char *entry_get_name(const cache_entry_t *entry)
+{
+    size_t size = entry_data_size(entry->num_buttons,
+                                  entry->num_axes,
+                                  entry->num_hats,
+                                  0);
+
+    return (const char *)(cache_map + entry->offset + size);
+}
+
+/** \brief  Copy axis info from the cache file
+ *
+ * \param[out]  dest    axis info
+ * \param[in]   src     axis info in the cache file
+ */
+static void abs_info_from_cache(joy_abs_info_t *dest, const cache_abs_t *src)
+{
+    dest->code       = src->code;
+    dest->minimum    = src->minimum;
+    dest->maximum    = src->maximum;
+    dest->fuzz       = src->fuzz;
+    dest->flat       = src->flat;
+    dest->resolution = src->resolution;
+}
+
+/** \brief  Copy axis info to the cache file
+ *
+ * \param[out]  dest    axis info in the cache file
+ * \param[in]   src     axis info
+ */
+static void abs_info_to_cache(cache_abs_t *dest, const joy_abs_info_t *src)
+{
+    dest->code       = src->code;
+    dest->reserved   = 0;
+    dest->minimum    = src->minimum;
+    dest->maximum    = src->maximum;
+    dest->fuzz       = src->fuzz;
+    dest->flat       = src->flat;
+    dest->resolution = src->resolution;
+}
+
+/** \brief  Set capabilities of a device from a cache entry
+ *
+ * Copies the maps into the maps of \a info and sets its index tables, which
+ * must be cleared.
+ *
+ * \param[in]   entry   valid cache entry
+ * \param[out]  info    joystick info with maps large enough for the entry
+ */
+static void entry_decode(const cache_entry_t *entry, joy_dev_info_t *info)
+{
+    const cache_abs_t *abs;
+    const uint16_t    *buttons;
+    unsigned int       i;
+
+    abs     = (const cache_abs_t *)(cache_map + entry->offset);
+    buttons = (const uint16_t *)(abs + entry->num_axes + entry->num_hats * 2u);
+
+    info->num_buttons = entry->num_buttons;
+    info->num_axes    = entry->num_axes;
+    info->num_hats    = entry->num_hats;
+
+    for (i = 0; i < entry->num_axes; i++) {
+        abs_info_from_cache(&(info->axis_map[i]), abs++);
+        if (info->axis_map[i].code < JOY_AXIS_INDEX_SIZE) {
+            info->axis_index[info->axis_map[i].code] = (int16_t)i;
+        }
+    }
+    for (i = 0; i < entry->num_hats * 2u; i++) {
+        abs_info_from_cache(&(info->hat_map[i]), abs++);
+    }
+    for (i = 0; i < entry->num_buttons; i++) {
+        unsigned int code = buttons[i];
+
+        info->button_map[i] = (uint16_t)code;
+        if (code >= JOY_BUTTON_CODE_MIN && code < KEY_CNT) {
+            info->button_index[code - JOY_BUTTON_CODE_MIN] = (int16_t)i;
+        }
+    }
+}
+
+/** \brief  Free devices pending to be added to the cache file */
+static void cache_free_pending(void)
+{
+    size_t i;
+
+    for (i = 0; i < cache_num_pending; i++) {
+        joy_dev_info_free(cache_pending[i]);
+    }
+    lib_free(cache_pending);
+    cache_pending     = NULL;
+    cache_num_pending = 0;
+}
+
+
+/** \brief  Map cache file into memory
+ *
+ * A missing or invalid cache file isn't an error, all devices will simply
+ * be probed. Does nothing if the file is already mapped.
+ *
+ * \return  \c true if the cache file was mapped
+ */
+bool joy_cache_open(void)
+{
+    const cache_header_t *header;
+    struct stat           st;
+    char                 *path;
+    void                 *map;
+    int                   fd;
+
+    if (cache_map != NULL) {
+        return true;
+    }
+    path = cache_get_path(false);
+    if (path == NULL) {
+        return false;
+    }
+    fd = open(path, O_RDONLY|O_CLOEXEC);
+    lib_free(path);
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof *header) {
+        close(fd);
+        return false;
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    header = map;
+    if (memcmp(header->magic, CACHE_MAGIC, sizeof header->magic) != 0 ||
+            header->version != CACHE_VERSION ||
+            header->num_entries > ((size_t)st.st_size - sizeof *header) /
+                                  sizeof(cache_entry_t)) {
+        munmap(map, (size_t)st.st_size);
+        return false;
+    }
+    cache_map         = map;
+    cache_map_size    = (size_t)st.st_size;
+    cache_num_entries = header->num_entries;
+    return true;
+}
+
+
+/** \brief  Set capabilities of a device from the cache
+ *
+ * The maps of \a info must have room for \c JOY_BUTTON_INDEX_SIZE buttons,
+ * \c JOY_AXIS_INDEX_SIZE axes and \c JOY_HAT_MAX hats, as they have while
+ * probing.
+ *
+ * \param[in,out]   info    joystick info with name and GUID set and the
+ *                          capabilities not yet probed
+ *
+ * \return  \c true if \a info was found in the cache
+ */
+bool joy_cache_lookup(joy_dev_info_t *info)
+{
+    const cache_entry_t *entries;
+    const cache_entry_t *entry;
+
+    if (cache_map == NULL || info->name == NULL) {
+        return false;
+    }
+    entries = cache_entries();
+    entry   = bsearch(info->guid,
+                      entries,
+                      cache_num_entries,
+                      sizeof *entry,
+                      compar_entry_guid);
+    if (entry == NULL) {
+        return false;
+    }
+    /* entries with the same GUID are adjacent, check their names */
+    while (entry > entries && memcmp((entry - 1)->guid, info->guid, JOY_GUID_SIZE) == 0) {
+        entry--;
+    }
+    for (; entry < entries + cache_num_entries &&
+            memcmp(entry->guid, info->guid, JOY_GUID_SIZE) == 0; entry++) {
+        if (entry_is_valid(entry) && strcmp(entry_get_name(entry), info->name) == 0) {
+            entry_decode(entry, info);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/** \brief  Add probed device to the cache
+ *
+ * The device is written to the cache file on the next joy_cache_flush().
+ *
+ * \param[in]   info    joystick info
+ */
+void joy_cache_add(const joy_dev_info_t *info)
+{
+    joy_dev_info_t *copy = joy_dev_info_dup(info);
+
+    pthread_mutex_lock(&cache_mutex);
+    cache_pending = lib_realloc_cat(cache_pending,
+                                    (cache_num_pending + 1u) * sizeof *cache_pending,
+                                    LIB_ALLOC_JOY_CACHE);
+    cache_pending[cache_num_pending++] = copy;
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+
+/** \brief  Write cache file if devices were added
+ *
+ * Merges the devices added with joy_cache_add() with the entries of the
+ * mapped file, writes the result to a temporary file and renames it over
+ * the cache file, so other instances never see a partially written file.
+ * The new file is mapped afterwards.
+ *
+ * \return  \c true on success or if there was nothing to write
+ */
+bool joy_cache_flush(void)
+{
+    cache_source_t *sources;
+    cache_header_t *header;
+    cache_entry_t  *entries;
+    unsigned char  *buffer;
+    size_t          num_sources;
+    size_t          offset;
+    size_t          size;
+    size_t          i;
+    char           *path;
+    char           *tmp_path;
+    bool            result = false;
+    int             fd;
+
+    if (cache_num_pending == 0) {
+        return true;
+    }
+
+    /* newly probed devices replace entries with the same GUID and name */
+    sources     = lib_malloc_cat((cache_num_pending + cache_num_entries) * sizeof *sources,
+                                 LIB_ALLOC_JOY_CACHE);
+    num_sources = 0;
+    qsort(cache_pending, cache_num_pending, sizeof *cache_pending, compar_info_key);
+    for (i = 0; i < cache_num_pending; i++) {
+        const joy_dev_info_t *info = cache_pending[i];
+
+        if (num_sources == 0 ||
+                compare_key(sources[num_sources - 1u].guid, sources[num_sources - 1u].name,
+                            info->guid, info->name) != 0) {
+            sources[num_sources].guid        = info->guid;
+            sources[num_sources].name        = info->name;
+            sources[num_sources].info        = info;
+            sources[num_sources].entry       = NULL;
+            sources[num_sources].num_buttons = info->num_buttons;
+            sources[num_sources].num_axes    = info->num_axes;
+            sources[num_sources].num_hats    = info->num_hats;
+            sources[num_sources].name_size   = strlen(info->name) + 1u;
+            num_sources++;
+        }
+    }
+    for (i = 0; i < cache_num_entries; i++) {
+        const cache_entry_t *entry = &(cache_entries()[i]);
+        cache_key_t          key;
+
+        if (!entry_is_valid(entry)) {
+            continue;
+        }
+        key.guid = entry->guid;
+        key.name = entry_get_name(entry);
+        if (bsearch(&key, cache_pending, cache_num_pending,
+                    sizeof *cache_pending, compar_key_info) != NULL) {
+            continue;
+        }
+        sources[num_sources].guid        = entry->guid;
+        sources[num_sources].name        = key.name;
+        sources[num_sources].info        = NULL;
+        sources[num_sources].entry       = entry;
+        sources[num_sources].num_buttons = entry->num_buttons;
+        sources[num_sources].num_axes    = entry->num_axes;
+        sources[num_sources].num_hats    = entry->num_hats;
+        sources[num_sources].name_size   = entry->name_size;
+        num_sources++;
+    }
+    qsort(sources, num_sources, sizeof *sources, compar_source_key);
+
+    /* lay out file in memory */
+    size = sizeof *header + num_sources * sizeof *entries;
+    for (i = 0; i < num_sources; i++) {
+        size = entry_data_align(size);
+        size += entry_data_size(sources[i].num_buttons,
+                                sources[i].num_axes,
+                                sources[i].num_hats,
+                                sources[i].name_size);
+    }
+    buffer  = lib_calloc_cat(1, size, LIB_ALLOC_JOY_CACHE);
+    header  = (cache_header_t *)buffer;
+    entries = (cache_entry_t *)(buffer + sizeof *header);
+    memcpy(header->magic, CACHE_MAGIC, sizeof header->magic);
+    header->version     = CACHE_VERSION;
+    header->num_entries = (uint32_t)num_sources;
+
+    offset = sizeof *header + num_sources * sizeof *entries;
+    for (i = 0; i < num_sources; i++) {
+        const cache_source_t *src   = &sources[i];
+        cache_entry_t        *entry = &entries[i];
+        size_t                data_size;
+
+        offset    = entry_data_align(offset);
+        data_size = entry_data_size(src->num_buttons,
+                                    src->num_axes,
+                                    src->num_hats,
+                                    src->name_size);
+        memcpy(entry->guid, src->guid, sizeof entry->guid);
+        entry->offset      = (uint32_t)offset;
+        entry->name_size   = (uint16_t)src->name_size;
+        entry->num_buttons = src->num_buttons;
+        entry->num_axes    = src->num_axes;
+        entry->num_hats    = src->num_hats;
+
+        if (src->entry != NULL) {
+            /* same host, same layout: copy data as is */
+            memcpy(buffer + offset, cache_map + src->entry->offset, data_size);
+        } else {
+            const joy_dev_info_t *info = src->info;
+            cache_abs_t          *abs  = (cache_abs_t *)(buffer + offset);
+            uint16_t             *buttons;
+            unsigned int          n;
+
+            for (n = 0; n < info->num_axes; n++) {
+                abs_info_to_cache(abs++, &(info->axis_map[n]));
+            }
+            for (n = 0; n < info->num_hats * 2u; n++) {
+                abs_info_to_cache(abs++, &(info->hat_map[n]));
+            }
+            buttons = (uint16_t *)abs;
+            memcpy(buttons, info->button_map, info->num_buttons * sizeof *buttons);
+            memcpy(buttons + info->num_buttons, info->name, src->name_size);
+        }
+        offset += data_size;
+    }
+    lib_free(sources);
+
+    /* write to temporary file and move it into place */
+    path = cache_get_path(true);
+    if (path != NULL) {
+        size_t tmp_size = strlen(path) + 32u;
+
+        tmp_path = lib_malloc_cat(tmp_size, LIB_ALLOC_JOY_CACHE);
+        snprintf(tmp_path, tmp_size, "%s.%ld.tmp", path, (long)getpid());
+        fd = open(tmp_path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0600);
+        if (fd < 0) {
+            fprintf(stderr, "error: failed to create %s: %s\n",
+                    tmp_path, strerror(errno));
+        } else {
+            bool written = write(fd, buffer, size) == (ssize_t)size;
+
+            if (close(fd) == 0 && written && rename(tmp_path, path) == 0) {
+                result = true;
+            } else {
+                fprintf(stderr, "error: failed to write %s: %s\n",
+                        path, strerror(errno));
+                unlink(tmp_path);
+            }
+        }
+        lib_free(tmp_path);
+        lib_free(path);
+    }
+    lib_free(buffer);
+    cache_free_pending();
+
+    if (result) {
+        joy_cache_close();
+        joy_cache_open();
+    }
+    return result;
+}
+
+
+/** \brief  Unmap cache file and discard devices not yet written
+ */
+void joy_cache_close(void)
+{
+    if (cache_map != NULL) {
+        munmap(cache_map, cache_map_size);
+    }
+    cache_map         = NULL;
+    cache_map_size    = 0;
+    cache_num_entries = 0;
+    cache_free_pending();
+}
@@ -0,0 +1,25 @@
+/** \file   joy-cache.h
+ * \brief   Persistent device capability cache - header
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+#ifndef JOY_CACHE_H
+#define JOY_CACHE_H
+
+#include <stdbool.h>
+
+#include "joystick.h"
+
+/** \brief  Directory inside the XDG cache directory */
+#define JOY_CACHE_DIR       "evdev-js-test"
+
+/** \brief  Name of the cache file */
+#define JOY_CACHE_FILE      "devices.cache"
+
+bool joy_cache_open  (void);
+bool joy_cache_lookup(joy_dev_info_t *info);
+void joy_cache_add   (const joy_dev_info_t *info);
+bool joy_cache_flush (void);
+void joy_cache_close (void);
+
+#endif
@@ -0,0 +1,853 @@
+/** \file   joy-mapping.c
+ * \brief   SDL game controller mappings
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ * Translates device events into the logical controls of a game controller
+ * (A, B, left stick X, ...) using the mappings of SDL's gamecontrollerdb.txt,
+ * keyed by the SDL-compatible GUID generated for each device.
+ *
+ * The database has thousands of lines of which only a few are ever used, so
+ * joy_mapping_open() only maps the file into memory. On the first lookup a
+ * single pass over the file indexes the Linux entries by GUID in an open
+ * addressing hash table, without parsing the mappings themselves. Only the
+ * entries matched to a device are parsed, and compiled into flat tables
+ * indexed by event code, so joy_mapping_translate() is a table lookup.
+ *
+ * Compiled mappings are shared by devices with the same GUID and live until
+ * joy_mapping_close(), devices point to them through their \c mapping member.
+ */
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <linux/input.h>
+
+#include "vice.h"
+#include "joystick.h"
+#include "joy-axis.h"
+
+#include "joy-mapping.h"
+
+
+/** \brief  Length of a GUID in the mapping database */
+#define DB_GUID_LEN     (JOY_GUID_SIZE * 2)
+
+/** \brief  Offset in a GUID string of the CRC16 SDL stores in bytes 2-3 */
+#define DB_GUID_CRC     4
+
+/** \brief  Offset in a GUID string of the version in bytes 12-13 */
+#define DB_GUID_VERSION 24
+
+/** \brief  Length in a GUID string of the CRC16 and version */
+#define DB_GUID_WORD    4
+
+/** \brief  Binding of an input to a control
+ *
+ * The input is converted to [-1, 1] (buttons to 0 or 1) and mapped from the
+ * range [\c in_min, \c in_max] to [\c out_min, \c out_max], values outside
+ * the input range are clamped. Button controls are pressed when the input
+ * is past the middle of its range.
+ */
+typedef struct mapping_bind_s {
+    uint8_t  control;   /**< control (\c joy_control_t) */
+    int8_t   in_min;    /**< input value mapping to \c out_min */
+    int8_t   in_max;    /**< input value mapping to \c out_max */
+    int8_t   out_min;   /**< output at \c in_min */
+    int8_t   out_max;   /**< output at \c in_max */
+} mapping_bind_t;
+
+/** \brief  Mapping compiled for a device */
+struct joy_mapping_s {
+    joy_mapping_t  *next;       /**< next compiled mapping */
+    const char     *line;       /**< database line compiled */
+    char            guid_str[DB_GUID_LEN + 1];
+                                /**< GUID of the device compiled for */
+    char           *name;       /**< controller name in the database */
+    mapping_bind_t  buttons[JOY_BUTTON_INDEX_SIZE];
+                                /**< bindings by button code minus
+                                     \c JOY_BUTTON_CODE_MIN */
+    mapping_bind_t  axes[JOY_AXIS_INDEX_SIZE][JOY_MAPPING_MAX_OUTPUTS];
+                                /**< bindings by axis code, including hats */
+};
+
+
+/** \brief  Control names as used in the mapping database */
+static const char *control_names[JOY_CONTROL_COUNT] = {
+    [JOY_CONTROL_A]             = "a",
+    [JOY_CONTROL_B]             = "b",
+    [JOY_CONTROL_X]             = "x",
+    [JOY_CONTROL_Y]             = "y",
+    [JOY_CONTROL_BACK]          = "back",
+    [JOY_CONTROL_GUIDE]         = "guide",
+    [JOY_CONTROL_START]         = "start",
+    [JOY_CONTROL_LEFTSTICK]     = "leftstick",
+    [JOY_CONTROL_RIGHTSTICK]    = "rightstick",
+    [JOY_CONTROL_LEFTSHOULDER]  = "leftshoulder",
+    [JOY_CONTROL_RIGHTSHOULDER] = "rightshoulder",
+    [JOY_CONTROL_DPUP]          = "dpup",
+    [JOY_CONTROL_DPDOWN]        = "dpdown",
+    [JOY_CONTROL_DPLEFT]        = "dpleft",
+    [JOY_CONTROL_DPRIGHT]       = "dpright",
+    [JOY_CONTROL_MISC1]         = "misc1",
+    [JOY_CONTROL_PADDLE1]       = "paddle1",
+    [JOY_CONTROL_PADDLE2]       = "paddle2",
+    [JOY_CONTROL_PADDLE3]       = "paddle3",
+    [JOY_CONTROL_PADDLE4]       = "paddle4",
+    [JOY_CONTROL_TOUCHPAD]      = "touchpad",
+    [JOY_CONTROL_LEFTX]         = "leftx",
+    [JOY_CONTROL_LEFTY]         = "lefty",
+    [JOY_CONTROL_RIGHTX]        = "rightx",
+    [JOY_CONTROL_RIGHTY]        = "righty",
+    [JOY_CONTROL_LEFTTRIGGER]   = "lefttrigger",
+    [JOY_CONTROL_RIGHTTRIGGER]  = "righttrigger"
+};
+
+/** \brief  Mapped database file, \c NULL if not opened */
+static const char     *db_map;
+
+/** \brief  Size of \c db_map */
+static size_t          db_size;
+
+/** \brief  Hash table of database lines, offset plus one, 0 if empty */
+static uint32_t       *db_index;
+
+/** \brief  Number of slots in \c db_index, a power of two */
+static size_t          db_index_size;
+
+/** \brief  Database indexed */
+static bool            db_indexed;
+
+/** \brief  Mappings compiled so far */
+static joy_mapping_t  *db_compiled;
+
+/** \brief  Lock for the index and compiled mappings */
+static pthread_mutex_t db_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/** \brief  Find string in a line
+ *
+ * \param[in]   line    line
+ * \param[in]   len     length of \a line
+ * \param[in]   str     string to find
+ *
+ * \return  position in \a line or \c NULL if not found
+ */
+static const char *line_find(const char *line, size_t len, const char *str)
+{
+    size_t      slen = strlen(str);
+    const char *end  = line + len;
+    const char *p    = line;
+
+    while ((size_t)(end - p) >= slen &&
+            (p = memchr(p, str[0], (size_t)(end - p) - slen + 1u)) != NULL) {
+        if (memcmp(p, str, slen) == 0) {
+            return p;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+/** \brief  Determine if a database line is a mapping for Linux
+ *
+ * Lines without a platform field apply to all platforms.
+ *
+ * \param[in]   line    start of line
+ * \param[in]   len     length of \a line
+ *
+ * \return  \c true if usable
+ */
+static bool line_is_linux(const char *line, size_t len)
+{
+    const char *p = line_find(line, len, "platform:");
+
+    if (p == NULL) {
+        return true;
+    }
+    p  += sizeof "platform:" - 1u;
+    len = (size_t)(line + len - p);
+    return len >= 5u && memcmp(p, "Linux", 5u) == 0 && (len == 5u || p[5] == ',');
+}
+
+/** \brief  Determine if a database line starts with a GUID
+ *
+ * \param[in]   line    start of line
+ * \param[in]   len     length of \a line
+ *
+ * \return  \c true if the line is an entry
+ */
+static bool line_has_guid(const char *line, size_t len)
+{
+    size_t i;
+
+    if (len <= DB_GUID_LEN || line[DB_GUID_LEN] != ',') {
+        return false;
+    }
+    for (i = 0; i < DB_GUID_LEN; i++) {
+        if (!isxdigit((unsigned char)line[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** \brief  Determine if a GUID position holds the CRC16 or version
+ *
+ * Those are ignored for hashing, so entries that only differ from the
+ * device in them are found as fallbacks.
+ *
+ * \param[in]   pos position in GUID string
+ *
+ * \return  \c true if ignored
+ */
+static bool guid_pos_is_loose(size_t pos)
+{
+    return (pos >= DB_GUID_CRC     && pos < DB_GUID_CRC + DB_GUID_WORD) ||
+           (pos >= DB_GUID_VERSION && pos < DB_GUID_VERSION + DB_GUID_WORD);
+}
+
+/** \brief  Hash GUID string (FNV-1a), ignoring case, CRC16 and version
+ *
+ * \param[in]   guid    GUID string of \c DB_GUID_LEN characters
+ *
+ * \return  hash
+ */
+static uint32_t guid_hash(const char *guid)
+{
+    uint32_t hash = 2166136261u;
+    size_t   i;
+
+    for (i = 0; i < DB_GUID_LEN; i++) {
+        if (!guid_pos_is_loose(i)) {
+            hash ^= (uint32_t)tolower((unsigned char)guid[i]);
+            hash *= 16777619u;
+        }
+    }
+    return hash;
+}
+
+/** \brief  Rate how well a database GUID matches a device GUID
+ *
+ * \param[in]   db      GUID string in the database
+ * \param[in]   dev     GUID string of the device
+ *
+ * \return  3 for an exact match, 2 if only the CRC16 differs, 1 if the
+ *          version differs as well, 0 for no match
+ */
+static int guid_match(const char *db, const char *dev)
+{
+    bool   crc     = true;
+    bool   version = true;
+    size_t i;
+
+    for (i = 0; i < DB_GUID_LEN; i++) {
+        if (tolower((unsigned char)db[i]) == tolower((unsigned char)dev[i])) {
+            continue;
+        }
+        if (i >= DB_GUID_CRC && i < DB_GUID_CRC + DB_GUID_WORD) {
+            crc = false;
+        } else if (i >= DB_GUID_VERSION && i < DB_GUID_VERSION + DB_GUID_WORD) {
+            version = false;
+        } else {
+            return 0;
+        }
+    }
+    return 1 + (int)crc + (int)(crc && version);
+}
+
+
+/** \brief  Get next line of the mapped database
+ *
+ * \param[in]   pos     start of line
+ * \param[out]  len     length of line excluding the line end
+ *
+ * \return  start of the next line
+ */
+static const char *db_next_line(const char *pos, size_t *len)
+{
+    const char *end = db_map + db_size;
+    const char *eol = memchr(pos, '\n', (size_t)(end - pos));
+
+    if (eol == NULL) {
+        eol = end;
+    }
+    *len = (size_t)(eol - pos);
+    if (*len > 0 && pos[*len - 1u] == '\r') {
+        (*len)--;
+    }
+    return eol < end ? eol + 1 : end;
+}
+
+/** \brief  Index the entries of the database by GUID
+ *
+ * Counts the lines to size the hash table, then adds the Linux entries.
+ * Must be called with \c db_mutex held.
+ */
+static void db_build_index(void)
+{
+    const char *end = db_map + db_size;
+    const char *pos;
+    size_t      lines = 0;
+    size_t      mask;
+
+    db_indexed = true;
+    for (pos = db_map; pos < end; lines++) {
+        pos = memchr(pos, '\n', (size_t)(end - pos));
+        pos = pos != NULL ? pos + 1 : end;
+    }
+    /* keep the table at most half full */
+    db_index_size = 16;
+    while (db_index_size < lines * 2u) {
+        db_index_size *= 2u;
+    }
+    db_index = lib_calloc_cat(db_index_size, sizeof *db_index, LIB_ALLOC_JOY_MAPPING);
+    mask     = db_index_size - 1u;
+
+    for (pos = db_map; pos < end; ) {
+        const char *line = pos;
+        size_t      len;
+        size_t      slot;
+
+        pos = db_next_line(line, &len);
+        if (!line_has_guid(line, len) || !line_is_linux(line, len)) {
+            continue;
+        }
+        slot = guid_hash(line) & mask;
+        while (db_index[slot] != 0) {
+            slot = (slot + 1u) & mask;
+        }
+        db_index[slot] = (uint32_t)(line - db_map) + 1u;
+    }
+}
+
+/** \brief  Find best database entry for a GUID
+ *
+ * Later entries override earlier ones with the same match quality, like
+ * SDL does when loading mappings.
+ *
+ * \param[in]   guid_str    device GUID string
+ *
+ * \return  start of line or \c NULL if not found
+ */
+static const char *db_lookup(const char *guid_str)
+{
+    const char *best       = NULL;
+    int         best_match = 0;
+    size_t      mask       = db_index_size - 1u;
+    size_t      slot;
+
+    for (slot = guid_hash(guid_str) & mask; db_index[slot] != 0; slot = (slot + 1u) & mask) {
+        const char *line  = db_map + db_index[slot] - 1u;
+        int         match = guid_match(line, guid_str);
+
+        if (match > best_match || (match == best_match && match > 0 && line > best)) {
+            best       = line;
+            best_match = match;
+        }
+    }
+    return best;
+}
+
+
+/** \brief  Get event code of a button by SDL's button index
+ *
+ * SDL numbers the joystick buttons from \c BTN_JOYSTICK up, followed by the
+ * buttons below \c BTN_JOYSTICK.
+ *
+ * \param[in]   device  joystick device
+ * \param[in]   index   SDL button index
+ *
+ * \return  button code or -1 if the device doesn't have the button
+ */
+static int sdl_button_code(const joy_dev_info_t *device, unsigned long index)
+{
+    unsigned int pass;
+    unsigned int i;
+
+    for (pass = 0; pass < 2u; pass++) {
+        for (i = 0; i < device->num_buttons; i++) {
+            unsigned int code = device->button_map[i];
+
+            if ((code >= BTN_JOYSTICK) == (pass == 0) && index-- == 0) {
+                return (int)code;
+            }
+        }
+    }
+    return -1;
+}
+
+/** \brief  Look up control by name
+ *
+ * \param[in]   name    control name
+ * \param[in]   len     length of \a name
+ *
+ * \return  control or \c JOY_CONTROL_NONE if unknown
+ */
+static joy_control_t control_from_name(const char *name, size_t len)
+{
+    int c;
+
+    for (c = 0; c < JOY_CONTROL_COUNT; c++) {
+        if (strlen(control_names[c]) == len && memcmp(control_names[c], name, len) == 0) {
+            return (joy_control_t)c;
+        }
+    }
+    return JOY_CONTROL_NONE;
+}
+
+/** \brief  Compile a single binding ("leftx:a0", "-lefty:-a1~", "dpup:h0.1")
+ *
+ * Bindings of controls this module doesn't know, references to inputs the
+ * device doesn't have and other fields like the platform are ignored.
+ *
+ * \param[in,out]   mapping mapping
+ * \param[in]       device  joystick device
+ * \param[in]       field   binding
+ * \param[in]       len     length of \a field
+ */
+static void mapping_compile_field(joy_mapping_t        *mapping,
+                                  const joy_dev_info_t *device,
+                                  const char           *field,
+                                  size_t                len)
+{
+    const char     *end = field + len;
+    const char     *colon;
+    const char     *p;
+    char           *num_end;
+    char            number[16];
+    mapping_bind_t  bind;
+    mapping_bind_t *slot;
+    joy_control_t   control;
+    int8_t          out_half = 0;
+    int8_t          in_half  = 0;
+    unsigned long   index;
+    unsigned long   mask = 0;
+    int             code;
+    char            type;
+    size_t          n;
+
+    colon = memchr(field, ':', len);
+    if (colon == NULL) {
+        return;
+    }
+    p = field;
+    if (*p == '+' || *p == '-') {
+        out_half = *p == '+' ? 1 : -1;
+        p++;
+    }
+    control = control_from_name(p, (size_t)(colon - p));
+    if (control == JOY_CONTROL_NONE) {
+        return;
+    }
+
+    p = colon + 1;
+    if (p < end && (*p == '+' || *p == '-')) {
+        in_half = *p == '+' ? 1 : -1;
+        p++;
+    }
+    if (p >= end) {
+        return;
+    }
+    type = *p++;
+    /* strtoul() needs a terminated copy, the line isn't */
+    n = (size_t)(end - p);
+    if (n == 0 || n >= sizeof number) {
+        return;
+    }
+    memcpy(number, p, n);
+    number[n] = '\0';
+    index = strtoul(number, &num_end, 10);
+    if (num_end == number) {
+        return;
+    }
+    if (type == 'h') {
+        if (*num_end != '.') {
+            return;
+        }
+        mask = strtoul(num_end + 1, &num_end, 10);
+    }
+
+    bind.control = (uint8_t)control;
+    bind.in_min  = 0;
+    bind.in_max  = 1;
+    if (!joy_control_is_axis(control)) {
+        bind.out_min = 0;
+        bind.out_max = 1;
+    } else if (out_half != 0) {
+        bind.out_min = 0;
+        bind.out_max = out_half;
+    } else if (control == JOY_CONTROL_LEFTTRIGGER || control == JOY_CONTROL_RIGHTTRIGGER) {
+        bind.out_min = 0;
+        bind.out_max = 1;
+    } else {
+        bind.out_min = -1;
+        bind.out_max = 1;
+    }
+
+    switch (type) {
+        case 'b':
+            code = sdl_button_code(device, index);
+            if (code < 0) {
+                return;
+            }
+            mapping->buttons[code - JOY_BUTTON_CODE_MIN] = bind;
+            return;
+
+        case 'a':
+            if (index >= device->num_axes) {
+                return;
+            }
+            code = device->axis_map[index].code;
+            if (in_half != 0) {
+                bind.in_max = in_half;
+            } else {
+                bind.in_min = -1;
+            }
+            if (*num_end == '~') {
+                int8_t tmp = bind.in_min;
+
+                bind.in_min = bind.in_max;
+                bind.in_max = tmp;
+            }
+            break;
+
+        case 'h':
+            if (index >= device->num_hats) {
+                return;
+            }
+            /* SDL hat bits: 1 up, 2 right, 4 down, 8 left */
+            if (mask == 1u || mask == 4u) {
+                code = device->hat_map[index * 2u + 1u].code;
+            } else if (mask == 2u || mask == 8u) {
+                code = device->hat_map[index * 2u].code;
+            } else {
+                return;
+            }
+            bind.in_max = (mask == 1u || mask == 8u) ? -1 : 1;
+            break;
+
+        default:
+            return;
+    }
+
+    if (code >= JOY_AXIS_INDEX_SIZE) {
+        return;
+    }
+    for (n = 0; n < JOY_MAPPING_MAX_OUTPUTS; n++) {
+        slot = &(mapping->axes[code][n]);
+        if (slot->control == JOY_CONTROL_NONE) {
+            *slot = bind;
+            return;
+        }
+    }
+}
+
+/** \brief  Compile database entry for a device
+ *
+ * \param[in]   device  joystick device
+ * \param[in]   line    database line
+ *
+ * \return  compiled mapping
+ */
+static joy_mapping_t *mapping_compile(const joy_dev_info_t *device, const char *line)
+{
+    joy_mapping_t *mapping;
+    const char    *field;
+    const char    *comma;
+    const char    *end;
+    size_t         len;
+    size_t         i;
+
+    db_next_line(line, &len);
+    end = line + len;
+
+    mapping = lib_malloc_cat(sizeof *mapping, LIB_ALLOC_JOY_MAPPING);
+    mapping->next = NULL;
+    mapping->line = line;
+    memcpy(mapping->guid_str, device->guid_str, sizeof mapping->guid_str);
+    for (i = 0; i < JOY_BUTTON_INDEX_SIZE; i++) {
+        mapping->buttons[i].control = JOY_CONTROL_NONE;
+    }
+    for (i = 0; i < JOY_AXIS_INDEX_SIZE; i++) {
+        mapping->axes[i][0].control = JOY_CONTROL_NONE;
+        mapping->axes[i][1].control = JOY_CONTROL_NONE;
+    }
+
+    /* GUID, name, then the bindings */
+    field = line + DB_GUID_LEN + 1;
+    comma = memchr(field, ',', (size_t)(end - field));
+    if (comma == NULL) {
+        comma = end;
+    }
+    mapping->name = lib_malloc_cat((size_t)(comma - field) + 1u, LIB_ALLOC_JOY_MAPPING);
+    memcpy(mapping->name, field, (size_t)(comma - field));
+    mapping->name[comma - field] = '\0';
+
+    for (field = comma; field < end; field = comma) {
+        field++;
+        comma = memchr(field, ',', (size_t)(end - field));
+        if (comma == NULL) {
+            comma = end;
+        }
+        if (comma > field) {
+            mapping_compile_field(mapping, device, field, (size_t)(comma - field));
+        }
+    }
+    return mapping;
+}
+
+
+/** \brief  Open mapping database
+ *
+ * Only maps the file, the entries are indexed on the first lookup. Closes a
+ * previously opened database, which must not be used by any device anymore.
+ *
+ * \param[in]   path    path to gamecontrollerdb.txt
+ *
+ * \return  \c true on success
+ */
+bool joy_mapping_open(const char *path)
+{
+    struct stat  st;
+    void        *map;
+    int          fd;
+
+    joy_mapping_close();
+    fd = open(path, O_RDONLY|O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    posix_madvise(map, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+
+    pthread_mutex_lock(&db_mutex);
+    db_map     = map;
+    db_size    = (size_t)st.st_size;
+    db_indexed = false;
+    pthread_mutex_unlock(&db_mutex);
+    return true;
+}
+
+
+/** \brief  Close mapping database and free the compiled mappings
+ *
+ * Devices keep pointers to their mappings, so only call this on shutdown or
+ * before a rescan.
+ */
+void joy_mapping_close(void)
+{
+    pthread_mutex_lock(&db_mutex);
+    while (db_compiled != NULL) {
+        joy_mapping_t *next = db_compiled->next;
+
+        lib_free(db_compiled->name);
+        lib_free(db_compiled);
+        db_compiled = next;
+    }
+    lib_free(db_index);
+    db_index      = NULL;
+    db_index_size = 0;
+    db_indexed    = false;
+    if (db_map != NULL) {
+        munmap((void *)(uintptr_t)db_map, db_size);
+    }
+    db_map  = NULL;
+    db_size = 0;
+    pthread_mutex_unlock(&db_mutex);
+}
+
+
+/** \brief  Find mapping for a device
+ *
+ * Compiles the database entry matching the device's GUID the first time it
+ * is requested.
+ *
+ * \param[in]   device  joystick device
+ *
+ * \return  mapping or \c NULL if the device isn't in the database
+ */
+const joy_mapping_t *joy_mapping_find(const joy_dev_info_t *device)
+{
+    joy_mapping_t *mapping = NULL;
+    const char    *line;
+
+    pthread_mutex_lock(&db_mutex);
+    if (db_map == NULL) {
+        pthread_mutex_unlock(&db_mutex);
+        return NULL;
+    }
+    if (!db_indexed) {
+        db_build_index();
+    }
+    line = db_lookup(device->guid_str);
+    if (line != NULL) {
+        for (mapping = db_compiled; mapping != NULL; mapping = mapping->next) {
+            if (mapping->line == line && strcmp(mapping->guid_str, device->guid_str) == 0) {
+                break;
+            }
+        }
+        if (mapping == NULL) {
+            mapping       = mapping_compile(device, line);
+            mapping->next = db_compiled;
+            db_compiled   = mapping;
+        }
+    }
+    pthread_mutex_unlock(&db_mutex);
+    return mapping;
+}
+
+
+/** \brief  Get controller name of a mapping
+ *
+ * \param[in]   mapping mapping
+ *
+ * \return  name as in the database
+ */
+const char *joy_mapping_get_name(const joy_mapping_t *mapping)
+{
+    return mapping->name;
+}
+
+
+/** \brief  Apply binding to an input value
+ *
+ * \param[in]   bind        binding
+ * \param[in]   value       input value in [-1, 1]
+ * \param[out]  control     control event
+ */
+static void bind_apply(const mapping_bind_t *bind,
+                       float                 value,
+                       joy_control_event_t  *control)
+{
+    float t = (value - (float)bind->in_min) / (float)(bind->in_max - bind->in_min);
+
+    t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+    control->control = bind->control;
+    if (joy_control_is_axis((joy_control_t)bind->control)) {
+        float out = (float)bind->out_min + t * (float)(bind->out_max - bind->out_min);
+        /* full int16_t range as in SDL: -1 is -32768, 1 is 32767 */
+        long  v   = lrintf(out * (out < 0.0f ? 32768.0f : 32767.0f));
+
+        control->value = (int16_t)(v < INT16_MIN ? INT16_MIN : (v > INT16_MAX ? INT16_MAX : v));
+    } else {
+        control->value = t > 0.5f ? 1 : 0;
+    }
+}
+
+/** \brief  Get axis value in [-1, 1]
+ *
+ * Uses the device's axis normalization, without hysteresis since events
+ * are translated independently. Hats are -1, 0 or 1 already.
+ *
+ * \param[in]   device  joystick device
+ * \param[in]   code    axis code
+ * \param[in]   value   raw value
+ *
+ * \return  normalized value
+ */
+static float axis_value(const joy_dev_info_t *device, unsigned int code, int32_t value)
+{
+    int i = joy_dev_info_axis_index(device, code);
+
+    if (i < 0) {
+        return value < 0 ? -1.0f : (value > 0 ? 1.0f : 0.0f);
+    }
+    return joy_axis_normalize_value(&(device->axis_norm), (unsigned int)i, value);
+}
+
+
+/** \brief  Translate device event into control events
+ *
+ * Produces an event for every control bound to the input, whether the
+ * control's value changed or not, and a single one for a control bound to
+ * both halves of the input.
+ *
+ * \param[in]   device      joystick device
+ * \param[in]   event       event of \a device
+ * \param[out]  controls    control events, room for
+ *                          \c JOY_MAPPING_MAX_OUTPUTS
+ *
+ * \return  number of control events, 0 if the input isn't mapped
+ */
+size_t joy_mapping_translate(const joy_dev_info_t     *device,
+                             const struct input_event *event,
+                             joy_control_event_t      *controls)
+{
+    const joy_mapping_t *mapping = device->mapping;
+    size_t               num     = 0;
+
+    if (mapping == NULL) {
+        return 0;
+    }
+    if (event->type == EV_KEY) {
+        const mapping_bind_t *bind;
+
+        if (event->code < JOY_BUTTON_CODE_MIN || event->code >= KEY_CNT) {
+            return 0;
+        }
+        bind = &(mapping->buttons[event->code - JOY_BUTTON_CODE_MIN]);
+        if (bind->control != JOY_CONTROL_NONE) {
+            bind_apply(bind, event->value != 0 ? 1.0f : 0.0f, &controls[num++]);
+        }
+    } else if (event->type == EV_ABS && event->code < JOY_AXIS_INDEX_SIZE) {
+        const mapping_bind_t *binds = mapping->axes[event->code];
+        float                 value = axis_value(device, event->code, event->value);
+
+        while (num < JOY_MAPPING_MAX_OUTPUTS && binds[num].control != JOY_CONTROL_NONE) {
+            bind_apply(&binds[num], value, &controls[num]);
+            num++;
+        }
+        /* halves of one control ("-leftx:h0.8,+leftx:h0.2"): the half the
+         * input is in decides, the other one would reset the control */
+        if (num == 2u && controls[0].control == controls[1].control) {
+            if (controls[0].value == 0) {
+                controls[0] = controls[1];
+            }
+            num = 1;
+        }
+    }
+    return num;
+}
+
+
+/** \brief  Get name of a control
+ *
+ * \param[in]   control control
+ *
+ * \return  name as used in the mapping database
+ */
+const char *joy_control_name(joy_control_t control)
+{
+    if (control >= JOY_CONTROL_COUNT) {
+        return "none";
+    }
+    return control_names[control];
+}
+
+
+/** \brief  Determine if a control is an axis
+ *
+ * \param[in]   control control
+ *
+ * \return  \c true for sticks and triggers
+ */
+bool joy_control_is_axis(joy_control_t control)
+{
+    return control >= JOY_CONTROL_LEFTX && control < JOY_CONTROL_COUNT;
+}
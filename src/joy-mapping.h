@@ -0,0 +1,83 @@
+/** \file   joy-mapping.h
+ * \brief   SDL game controller mappings - header
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+#ifndef JOY_MAPPING_H
+#define JOY_MAPPING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/input.h>
+
+#include "joystick.h"
+
+/** \brief  Environment variable with the path of the mapping database */
+#define JOY_MAPPING_ENV         "EVDEV_JS_MAPPINGS"
+
+/** \brief  Mapping database used when \c JOY_MAPPING_ENV isn't set */
+#define JOY_MAPPING_DEFAULT     "gamecontrollerdb.txt"
+
+/** \brief  Maximum number of controls a single event translates to
+ *
+ * An axis can be split into two halves bound to different controls.
+ */
+#define JOY_MAPPING_MAX_OUTPUTS 2
+
+/** \brief  Logical game controller controls, in SDL's order */
+typedef enum {
+    JOY_CONTROL_A = 0,
+    JOY_CONTROL_B,
+    JOY_CONTROL_X,
+    JOY_CONTROL_Y,
+    JOY_CONTROL_BACK,
+    JOY_CONTROL_GUIDE,
+    JOY_CONTROL_START,
+    JOY_CONTROL_LEFTSTICK,
+    JOY_CONTROL_RIGHTSTICK,
+    JOY_CONTROL_LEFTSHOULDER,
+    JOY_CONTROL_RIGHTSHOULDER,
+    JOY_CONTROL_DPUP,
+    JOY_CONTROL_DPDOWN,
+    JOY_CONTROL_DPLEFT,
+    JOY_CONTROL_DPRIGHT,
+    JOY_CONTROL_MISC1,
+    JOY_CONTROL_PADDLE1,
+    JOY_CONTROL_PADDLE2,
+    JOY_CONTROL_PADDLE3,
+    JOY_CONTROL_PADDLE4,
+    JOY_CONTROL_TOUCHPAD,
+    JOY_CONTROL_LEFTX,          /**< first axis control */
+    JOY_CONTROL_LEFTY,
+    JOY_CONTROL_RIGHTX,
+    JOY_CONTROL_RIGHTY,
+    JOY_CONTROL_LEFTTRIGGER,
+    JOY_CONTROL_RIGHTTRIGGER,
+
+    JOY_CONTROL_COUNT,          /**< number of controls */
+    JOY_CONTROL_NONE = 0xff     /**< not bound */
+} joy_control_t;
+
+/** \brief  Control state change produced by joy_mapping_translate()
+ *
+ * Buttons have value 0 or 1, stick axes range from -32768 to 32767 and
+ * triggers from 0 to 32767, as in SDL.
+ */
+typedef struct joy_control_event_s {
+    uint8_t  control;   /**< control (\c joy_control_t) */
+    int16_t  value;     /**< new value */
+} joy_control_event_t;
+
+bool                 joy_mapping_open(const char *path);
+void                 joy_mapping_close(void);
+const joy_mapping_t *joy_mapping_find(const joy_dev_info_t *device);
+const char          *joy_mapping_get_name(const joy_mapping_t *mapping);
+size_t               joy_mapping_translate(const joy_dev_info_t     *device,
+                                           const struct input_event *event,
+                                           joy_control_event_t      *controls);
+
+const char          *joy_control_name(joy_control_t control);
+bool                 joy_control_is_axis(joy_control_t control);
+
+#endif
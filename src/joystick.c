@@ -11,6 +11,8 @@
 #include <string.h>
 #include <stdbool.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
 #include <errno.h>
 #include <limits.h>
 
@@ -18,23 +20,41 @@
 #include <fcntl.h>
 #include <libevdev/libevdev.h>
 #include <linux/input.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "vice.h"
+#include "joy-cache.h"
+#include "joy-axis.h"
+#include "joy-mapping.h"
 
 #include "joystick.h"
 
 
 #define ARRAY_LEN(arr)  (sizeof arr / sizeof arr[0])
 
+/** \brief  Number of bits in an unsigned long */
+#define BITS_PER_LONG   ((unsigned int)(sizeof(unsigned long) * CHAR_BIT))
+
+/** \brief  Number of unsigned longs required for a bitmap of \a n bits */
+#define NLONGS(n)       (((n) + BITS_PER_LONG - 1u) / BITS_PER_LONG)
+
 #define JOY_UDEV_SUFFIX "-event-joystick"
 
-typedef struct ev_code_name_s {
-    unsigned int  code;
-    const char   *name;
-} ev_code_name_t;
+/** \brief  Maximum number of threads used to probe devices */
+#define JOY_SCAN_MAX_THREADS    8
 
 
 /* The XBox "profile" axis is a recent addition, from kernel ~6.1 onward, so we
@@ -45,100 +65,186 @@ typedef struct ev_code_name_s {
 #define ABS_PROFILE 0x21
 #endif
 
-/** \brief  Button names */
-static const ev_code_name_t button_names[] = {
+/** \brief  Lowest button code in the button names table */
+#define BUTTON_NAMES_FIRST  BTN_MISC
+
+/** \brief  Highest button code in the button names table */
+#define BUTTON_NAMES_LAST   BTN_DPAD_RIGHT
+
+/** \brief  Lowest axis code in the axis names table */
+#define AXIS_NAMES_FIRST    ABS_X
+
+/** \brief  Highest axis code in the axis names table */
+#define AXIS_NAMES_LAST     ABS_MISC
+
+/** \brief  Button names
+ *
+ * Indexed by event code minus \c BUTTON_NAMES_FIRST, codes without a name are
+ * \c NULL.
+ */
+static const char *const button_names[BUTTON_NAMES_LAST - BUTTON_NAMES_FIRST + 1] = {
+#define B(code) [(code) - BUTTON_NAMES_FIRST]
     /* 0x100-0x109 - BTN_MISC */
-    { BTN_0,        "Btn0" },           { BTN_1,        "Btn1" },
-    { BTN_0,        "Btn2" },           { BTN_1,        "Btn3" },
-    { BTN_0,        "Btn4" },           { BTN_1,        "Btn5" },
-    { BTN_0,        "Btn6" },           { BTN_1,        "Btn7" },
-    { BTN_0,        "Btn8" },           { BTN_1,        "Btn9" },
+    B(BTN_0)        = "Btn0",           B(BTN_1)        = "Btn1",
+    B(BTN_2)        = "Btn2",           B(BTN_3)        = "Btn3",
+    B(BTN_4)        = "Btn4",           B(BTN_5)        = "Btn5",
+    B(BTN_6)        = "Btn6",           B(BTN_7)        = "Btn7",
+    B(BTN_8)        = "Btn8",           B(BTN_9)        = "Btn9",
 
     /* 0x110-0x117 - BTN_MOUSE */
-    { BTN_LEFT,     "LeftBtn" },        { BTN_RIGHT,    "RightBtn" },
-    { BTN_MIDDLE,   "MiddleBtn" },      { BTN_SIDE,     "SideBtn" },
-    { BTN_EXTRA,    "ExtraBtn" },       { BTN_FORWARD,  "FowardBtn" },
-    { BTN_BACK,     "BackBtn" },        { BTN_TASK,     "TaskBtn" },
+    B(BTN_LEFT)     = "LeftBtn",        B(BTN_RIGHT)    = "RightBtn",
+    B(BTN_MIDDLE)   = "MiddleBtn",      B(BTN_SIDE)     = "SideBtn",
+    B(BTN_EXTRA)    = "ExtraBtn",       B(BTN_FORWARD)  = "FowardBtn",
+    B(BTN_BACK)     = "BackBtn",        B(BTN_TASK)     = "TaskBtn",
 
     /* 0x120-0x12f - BTN_JOYSTICK */
-    { BTN_TRIGGER,  "Trigger" },        { BTN_THUMB,    "ThumbBtn" },
-    { BTN_THUMB2,   "ThumbBtn2" },      { BTN_TOP,      "TopBtn" },
-    { BTN_TOP2,     "TopBtn2" },        { BTN_PINKIE,   "PinkieButton" },
-    { BTN_BASE,     "BaseBtn" },        { BTN_BASE2,    "BaseBtn2" },
-    { BTN_BASE3,    "BaseBtn3" },       { BTN_BASE4,    "BaseBtn4" },
-    { BTN_BASE5,    "BaseBtn5" },       { BTN_BASE6,    "BaseBtn6" },
-    { BTN_DEAD,     "BtnDead" },
+    B(BTN_TRIGGER)  = "Trigger",        B(BTN_THUMB)    = "ThumbBtn",
+    B(BTN_THUMB2)   = "ThumbBtn2",      B(BTN_TOP)      = "TopBtn",
+    B(BTN_TOP2)     = "TopBtn2",        B(BTN_PINKIE)   = "PinkieButton",
+    B(BTN_BASE)     = "BaseBtn",        B(BTN_BASE2)    = "BaseBtn2",
+    B(BTN_BASE3)    = "BaseBtn3",       B(BTN_BASE4)    = "BaseBtn4",
+    B(BTN_BASE5)    = "BaseBtn5",       B(BTN_BASE6)    = "BaseBtn6",
+    B(BTN_DEAD)     = "BtnDead",
 
     /* 0x130-0x13e - BTN_GAMEPAD */
-    { BTN_A,        "BtnA" },           { BTN_B,        "BtnB" },
-    { BTN_C,        "BtnC" },           { BTN_X,        "BtnX" },
-    { BTN_Y,        "BtnY" },           { BTN_Z,        "BtnZ" },
-    { BTN_TL,       "BtnTL" },          { BTN_TR,       "BtnTR" },
-    { BTN_TL2,      "BtnTL2" },         { BTN_TR2,      "BtnTR2" },
-    { BTN_SELECT,   "BtnSelect" },      { BTN_START,    "BtnStart" },
-    { BTN_MODE,     "BtnMode" },        { BTN_THUMBL,   "BtnThumbL" },
-    { BTN_THUMBR,   "BtnThumbR" },
+    B(BTN_A)        = "BtnA",           B(BTN_B)        = "BtnB",
+    B(BTN_C)        = "BtnC",           B(BTN_X)        = "BtnX",
+    B(BTN_Y)        = "BtnY",           B(BTN_Z)        = "BtnZ",
+    B(BTN_TL)       = "BtnTL",          B(BTN_TR)       = "BtnTR",
+    B(BTN_TL2)      = "BtnTL2",         B(BTN_TR2)      = "BtnTR2",
+    B(BTN_SELECT)   = "BtnSelect",      B(BTN_START)    = "BtnStart",
+    B(BTN_MODE)     = "BtnMode",        B(BTN_THUMBL)   = "BtnThumbL",
+    B(BTN_THUMBR)   = "BtnThumbR",
 
     /* Skipping 0x140-0x14f: BTN_TOOL_PEN - BTN_TOOL_QUADTAP */
 
     /* 0x150-0x151: BTN_WHEEL */
-    { BTN_GEAR_DOWN, "GearDown" },      { BTN_GEAR_UP,  "GearUp" },
+    B(BTN_GEAR_DOWN) = "GearDown",      B(BTN_GEAR_UP)  = "GearUp",
 
     /* 0x220-0223 */
-    { BTN_DPAD_UP,   "BtnDPadUp" },     { BTN_DPAD_DOWN,  "BtnDPadDown" },
-    { BTN_DPAD_LEFT, "BtnDPadLeft" },   { BTN_DPAD_RIGHT, "BtnDPadRight" }
+    B(BTN_DPAD_UP)   = "BtnDPadUp",     B(BTN_DPAD_DOWN)  = "BtnDPadDown",
+    B(BTN_DPAD_LEFT) = "BtnDPadLeft",   B(BTN_DPAD_RIGHT) = "BtnDPadRight"
+#undef B
 };
 
-/** \brief  Axis names */
-static const ev_code_name_t axis_names[] = {
-    { ABS_X,            "X" },
-    { ABS_Y,            "Y" },
-    { ABS_Z,            "Z" },
-    { ABS_RX,           "Rx" },
-    { ABS_RY,           "Ry" },
-    { ABS_RZ,           "Rz" },
-    { ABS_THROTTLE,     "Throttle" },
-    { ABS_RUDDER,       "Rudder" },
-    { ABS_WHEEL,        "Wheel" },
-    { ABS_GAS,          "Gas" },
-    { ABS_BRAKE,        "Brake" },
-    { ABS_HAT0X,        "Hat0X" },
-    { ABS_HAT0Y,        "Hat0Y" },
-    { ABS_HAT1X,        "Hat1X" },
-    { ABS_HAT1Y,        "Hat1Y" },
-    { ABS_HAT2X,        "Hat2X" },
-    { ABS_HAT2Y,        "Hat2Y" },
-    { ABS_HAT3X,        "Hat3X" },
-    { ABS_HAT3Y,        "Hat3Y" },
-    { ABS_PRESSURE,     "Pressure" },
-    { ABS_DISTANCE,     "Distance" },
-    { ABS_TILT_X,       "XTilt" },
-    { ABS_TILT_Y,       "YTilt" },
-    { ABS_TOOL_WIDTH,   "ToolWidth" },
-    { ABS_VOLUME,       "Volume" },
-    { ABS_PROFILE,      "Profile" },
-    { ABS_MISC,         "Misc" }
+/** \brief  Axis names
+ *
+ * Indexed by event code minus \c AXIS_NAMES_FIRST, codes without a name are
+ * \c NULL.
+ */
+static const char *const axis_names[AXIS_NAMES_LAST - AXIS_NAMES_FIRST + 1] = {
+#define A(code) [(code) - AXIS_NAMES_FIRST]
+    A(ABS_X)            = "X",
+    A(ABS_Y)            = "Y",
+    A(ABS_Z)            = "Z",
+    A(ABS_RX)           = "Rx",
+    A(ABS_RY)           = "Ry",
+    A(ABS_RZ)           = "Rz",
+    A(ABS_THROTTLE)     = "Throttle",
+    A(ABS_RUDDER)       = "Rudder",
+    A(ABS_WHEEL)        = "Wheel",
+    A(ABS_GAS)          = "Gas",
+    A(ABS_BRAKE)        = "Brake",
+    A(ABS_HAT0X)        = "Hat0X",
+    A(ABS_HAT0Y)        = "Hat0Y",
+    A(ABS_HAT1X)        = "Hat1X",
+    A(ABS_HAT1Y)        = "Hat1Y",
+    A(ABS_HAT2X)        = "Hat2X",
+    A(ABS_HAT2Y)        = "Hat2Y",
+    A(ABS_HAT3X)        = "Hat3X",
+    A(ABS_HAT3Y)        = "Hat3Y",
+    A(ABS_PRESSURE)     = "Pressure",
+    A(ABS_DISTANCE)     = "Distance",
+    A(ABS_TILT_X)       = "XTilt",
+    A(ABS_TILT_Y)       = "YTilt",
+    A(ABS_TOOL_WIDTH)   = "ToolWidth",
+    A(ABS_VOLUME)       = "Volume",
+    A(ABS_PROFILE)      = "Profile",
+    A(ABS_MISC)         = "Misc"
+#undef A
 };
 
 /** \brief  Hat names
  *
- * Each of two hat axes maps to the same name.
- */
-static const ev_code_name_t hat_names[] = {
-    { ABS_HAT0X,    "Hat0" },
-    { ABS_HAT0Y,    "Hat0" },
-    { ABS_HAT1X,    "Hat1" },
-    { ABS_HAT1Y,    "Hat1" },
-    { ABS_HAT2X,    "Hat2" },
-    { ABS_HAT2Y,    "Hat2" },
-    { ABS_HAT3X,    "Hat3" },
-    { ABS_HAT3Y,    "Hat3" },
+ * Indexed by event code minus \c ABS_HAT0X, each of two hat axes maps to the
+ * same name.
+ */
+static const char *const hat_names[JOY_HAT_MAX * 2] = {
+    "Hat0", "Hat0",
+    "Hat1", "Hat1",
+    "Hat2", "Hat2",
+    "Hat3", "Hat3"
+};
+
+_Static_assert(ABS_HAT3Y - ABS_HAT0X + 1 == JOY_HAT_MAX * 2,
+               "hat names table doesn't match the hat codes");
+
+/** \brief  Hat direction names
+ *
+ * Indexed by direction, combinations of opposite directions can't be
+ * produced by joy_dev_info_hat_direction().
+ */
+static const char *const hat_direction_names[16] = {
+    [0]                            = "Centered",
+    [JOY_HAT_UP]                   = "Up",
+    [JOY_HAT_DOWN]                 = "Down",
+    [JOY_HAT_LEFT]                 = "Left",
+    [JOY_HAT_RIGHT]                = "Right",
+    [JOY_HAT_UP | JOY_HAT_LEFT]    = "Up-Left",
+    [JOY_HAT_UP | JOY_HAT_RIGHT]   = "Up-Right",
+    [JOY_HAT_DOWN | JOY_HAT_LEFT]  = "Down-Left",
+    [JOY_HAT_DOWN | JOY_HAT_RIGHT] = "Down-Right"
 };
 
+/* Y negative is up, as with the evdev hat axes */
+const uint8_t joy_hat_directions[9] = {
+    JOY_HAT_UP   | JOY_HAT_LEFT, JOY_HAT_UP,   JOY_HAT_UP   | JOY_HAT_RIGHT,
+                   JOY_HAT_LEFT, 0,                           JOY_HAT_RIGHT,
+    JOY_HAT_DOWN | JOY_HAT_LEFT, JOY_HAT_DOWN, JOY_HAT_DOWN | JOY_HAT_RIGHT
+};
+
+
+/** \brief  Scratch space for probing a device
+ *
+ * The maps and name of \c info point into the arrays, which are large enough
+ * for any device. After probing the device is copied into a single block
+ * with dev_info_pack().
+ */
+typedef struct dev_probe_s {
+    joy_dev_info_t  info;                               /**< device info */
+    uint16_t        buttons[JOY_BUTTON_INDEX_SIZE];     /**< button map */
+    joy_abs_info_t  axes[JOY_AXIS_INDEX_SIZE];          /**< axis map */
+    joy_abs_info_t  hats[JOY_HAT_MAX * 2];              /**< hat map */
+    char            name[256];                          /**< device name */
+    bool            valid;                              /**< probe succeeded */
+    bool            cached;                             /**< capabilities
+                                                             taken from the
+                                                             cache */
+} dev_probe_t;
+
+/** \brief  Devices to probe during a scan, shared by the scan threads */
+typedef struct scan_job_s {
+    dev_probe_t *probes;    /**< probe per node */
+    int          count;     /**< number of elements in \c probes */
+    atomic_int   next;      /**< index of next device to probe */
+} scan_job_t;
+
 
 static joy_dev_info_t **devices_list;
 static int              devices_count;
 
+/** \brief  Field the devices list is kept sorted on */
+static joy_sort_field_t devices_sort_field = JOY_SORT_NONE;
+
+/** \brief  Single block holding the devices of the last scan
+ *
+ * Devices added by hotplug are allocated separately.
+ */
+static unsigned char   *devices_arena;
+
+/** \brief  Size of \c devices_arena */
+static size_t           devices_arena_size;
+
 
 /** \brief  Get axis name for event code
  *
@@ -148,14 +254,11 @@ static int              devices_count;
  */
 const char *joy_get_axis_name(unsigned int code)
 {
-    size_t i;
+    /* unsigned wrap-around makes codes below the first fail as well */
+    unsigned int index = code - AXIS_NAMES_FIRST;
 
-    for (i = 0; i < ARRAY_LEN(axis_names); i++) {
-        if (axis_names[i].code == code) {
-            return axis_names[i].name;
-        } else if (axis_names[i].code > code) {
-            break;
-        }
+    if (index < ARRAY_LEN(axis_names) && axis_names[index] != NULL) {
+        return axis_names[index];
     }
     return "<?>";
 }
@@ -169,14 +272,10 @@ const char *joy_get_axis_name(unsigned int code)
  */
 const char *joy_get_button_name(unsigned int code)
 {
-    size_t i;
+    unsigned int index = code - BUTTON_NAMES_FIRST;
 
-    for (i = 0; i < ARRAY_LEN(button_names); i++) {
-        if (button_names[i].code == code) {
-            return button_names[i].name;
-        } else if (button_names[i].code > code) {
-            break;
-        }
+    if (index < ARRAY_LEN(button_names) && button_names[index] != NULL) {
+        return button_names[index];
     }
     return "<?>";
 }
@@ -190,14 +289,25 @@ const char *joy_get_button_name(unsigned int code)
  */
 const char *joy_get_hat_name(unsigned int code)
 {
-    size_t i ;
+    unsigned int index = code - ABS_HAT0X;
 
-    for (i = 0; i < ARRAY_LEN(hat_names); i++) {
-        if (hat_names[i].code == code) {
-            return hat_names[i].name;
-        } else if (hat_names[i].code > code) {
-            break;
-        }
+    if (index < ARRAY_LEN(hat_names)) {
+        return hat_names[index];
+    }
+    return "<?>";
+}
+
+/** \brief  Get name of a hat direction
+ *
+ * \param[in]   direction   direction, combination of \c JOY_HAT_UP etc.
+ *
+ * \return  name of direction
+ */
+const char *joy_get_hat_direction_name(unsigned int direction)
+{
+    if (direction < ARRAY_LEN(hat_direction_names) &&
+            hat_direction_names[direction] != NULL) {
+        return hat_direction_names[direction];
     }
     return "<?>";
 }
@@ -240,21 +350,218 @@ static void dev_info_clear(joy_dev_info_t *info)
     info->button_map  = NULL;
     info->axis_map    = NULL;
     info->hat_map     = NULL;
+
+    /* all bits set is -1 for int16_t */
+    memset(info->button_index, 0xff, sizeof info->button_index);
+    memset(info->axis_index,   0xff, sizeof info->axis_index);
+
+    info->size        = 0;
+}
+
+/** \brief  Initialize probe scratch space
+ *
+ * \param[out]  probe   probe scratch space
+ * \param[in]   path    device node path, owned by the caller
+ */
+static void dev_probe_init(dev_probe_t *probe, char *path)
+{
+    dev_info_clear(&(probe->info));
+    probe->info.path       = path;
+    probe->info.name       = probe->name;
+    probe->info.button_map = probe->buttons;
+    probe->info.axis_map   = probe->axes;
+    probe->info.hat_map    = probe->hats;
+    probe->name[0]         = '\0';
+    probe->valid           = false;
+    probe->cached          = false;
+}
+
+/** \brief  Round up size so the next block is suitably aligned
+ *
+ * \param[in]   size    size in bytes
+ *
+ * \return  aligned size
+ */
+static size_t dev_info_align(size_t size)
+{
+    return (size + alignof(max_align_t) - 1u) & ~(alignof(max_align_t) - 1u);
+}
+
+/** \brief  Get size of the single block required for a joystick info
+ *
+ * The block holds the struct, followed by the axis, hat and button maps and
+ * the path and name strings.
+ *
+ * \param[in]   info    joystick info
+ *
+ * \return  size in bytes, aligned for placing blocks after each other
+ */
+static size_t dev_info_packed_size(const joy_dev_info_t *info)
+{
+    size_t size = sizeof *info;
+
+    size += (info->num_axes + info->num_hats * 2u) * sizeof *(info->axis_map);
+    size += info->num_buttons * sizeof *(info->button_map);
+    size += strlen(info->path) + 1u;
+    size += strlen(info->name) + 1u;
+    return dev_info_align(size);
+}
+
+/** \brief  Set hat decoding parameters of a joystick info from its hat map
+ *
+ * A hat axis points in a direction when its value is more than a quarter of
+ * its range away from the center, so analog hats work as well as the usual
+ * -1 to 1 ones. Axes with an empty range are decoded by sign.
+ *
+ * \param[in,out]  info    joystick info
+ */
+static void dev_info_set_hat_decode(joy_dev_info_t *info)
+{
+    joy_hat_decode_t *decode = &(info->hat_decode);
+    unsigned int      i;
+
+    for (i = 0; i < JOY_HAT_MAX * 2u; i++) {
+        decode->low[i]   = -1;
+        decode->high[i]  = 1;
+        decode->index[i] = -1;
+    }
+    for (i = 0; i < info->num_hats * 2u && i < JOY_HAT_MAX * 2u; i++) {
+        const joy_abs_info_t *abs_info = &(info->hat_map[i]);
+        int64_t               quarter;
+
+        if (abs_info->code >= ABS_HAT0X && abs_info->code <= ABS_HAT3Y) {
+            decode->index[abs_info->code - ABS_HAT0X] = (int8_t)i;
+        }
+        quarter = ((int64_t)abs_info->maximum - (int64_t)abs_info->minimum) / 4;
+        if (abs_info->maximum > abs_info->minimum) {
+            decode->low[i]  = (int32_t)(abs_info->minimum + quarter);
+            decode->high[i] = (int32_t)(abs_info->maximum - quarter);
+        }
+    }
+}
+
+/** \brief  Get first bytes of a string as a big-endian integer
+ *
+ * Comparing these compares the strings' first eight bytes like strcmp().
+ *
+ * \param[in]   s   string
+ *
+ * \return  sort key
+ */
+static uint64_t sort_key_prefix(const char *s)
+{
+    uint64_t key = 0;
+    size_t   i;
+
+    for (i = 0; i < sizeof key; i++) {
+        key <<= 8;
+        if (*s != '\0') {
+            key |= (unsigned char)*s++;
+        }
+    }
+    return key;
+}
+
+/** \brief  Set sort keys of a joystick info from its GUID, name and path
+ *
+ * \param[in,out]  info    joystick info
+ */
+static void dev_info_set_sort_keys(joy_dev_info_t *info)
+{
+    const char *node = strrchr(info->path, '/');
+    size_t      w;
+    size_t      i;
+
+    for (w = 0; w < 2u; w++) {
+        info->sort_guid[w] = 0;
+        for (i = 0; i < 8u; i++) {
+            info->sort_guid[w] = (info->sort_guid[w] << 8) | info->guid[w * 8u + i];
+        }
+    }
+    info->sort_name        = sort_key_prefix(info->name);
+    info->sort_node_offset = node != NULL ? (size_t)(node - info->path) + 1u : 0;
+    info->sort_node        = sort_key_prefix(info->path + info->sort_node_offset);
 }
 
-/** \brief  Free memory used by members of a joystick info struct
+/** \brief  Copy joystick info into a single block
  *
- * Does not free \a info itself.
+ * \param[in]   src     joystick info
+ * \param[out]  block   memory of at least dev_info_packed_size(\a src) bytes
+ *
+ * \return  joystick info in \a block
+ */
+static joy_dev_info_t *dev_info_pack(const joy_dev_info_t *src, void *block)
+{
+    joy_dev_info_t *info = block;
+    unsigned char  *data = (unsigned char *)(info + 1);
+    size_t          size;
+
+    *info = *src;
+    info->size = dev_info_packed_size(src);
+
+    /* maps first, they have the strictest alignment */
+    info->axis_map = NULL;
+    if (src->num_axes > 0) {
+        size = src->num_axes * sizeof *(info->axis_map);
+        info->axis_map = memcpy(data, src->axis_map, size);
+        data += size;
+    }
+    info->hat_map = NULL;
+    if (src->num_hats > 0) {
+        size = src->num_hats * 2u * sizeof *(info->hat_map);
+        info->hat_map = memcpy(data, src->hat_map, size);
+        data += size;
+    }
+    info->button_map = NULL;
+    if (src->num_buttons > 0) {
+        size = src->num_buttons * sizeof *(info->button_map);
+        info->button_map = memcpy(data, src->button_map, size);
+        data += size;
+    }
+    size = strlen(src->path) + 1u;
+    info->path = memcpy(data, src->path, size);
+    data += size;
+    size = strlen(src->name) + 1u;
+    info->name = memcpy(data, src->name, size);
+
+    /* devices are created here after a scan or cache lookup */
+    joy_axis_norm_init(&(info->axis_norm), info->axis_map, info->num_axes);
+    dev_info_set_hat_decode(info);
+    info->mapping = joy_mapping_find(info);
+    dev_info_set_sort_keys(info);
+    return info;
+}
+
+/** \brief  Get pointer into a copy of a joystick info block
+ *
+ * \param[in]   ptr     pointer into the block at \a from, or \c NULL
+ * \param[in]   from    original block
+ * \param[in]   to      copy of the block
+ *
+ * \return  pointer at the same offset in \a to, or \c NULL
+ */
+static void *dev_info_rebase(const void *ptr, const void *from, void *to)
+{
+    if (ptr == NULL) {
+        return NULL;
+    }
+    return (unsigned char *)to + ((const unsigned char *)ptr - (const unsigned char *)from);
+}
+
+/** \brief  Determine if joystick info lives in the devices arena
  *
  * \param[in]   info    joystick info
+ *
+ * \return  \c true if \a info is part of \c devices_arena
  */
-static void dev_info_free_data(joy_dev_info_t *info)
+static bool dev_info_in_arena(const joy_dev_info_t *info)
 {
-    lib_free(info->path);
-    lib_free(info->name);
-    lib_free(info->button_map);
-    lib_free(info->axis_map);
-    lib_free(info->hat_map);
+    const unsigned char *p = (const unsigned char *)info;
+
+    /* compare as integers, relational operators on unrelated pointers are UB */
+    return devices_arena != NULL &&
+           (uintptr_t)p >= (uintptr_t)devices_arena &&
+           (uintptr_t)p <  (uintptr_t)devices_arena + devices_arena_size;
 }
 
 /** \brief  Generate GUID in the format used by SDL's mapping files
@@ -304,48 +611,93 @@ static void dev_info_generate_guid_str(joy_dev_info_t *info)
     size_t i;
 
     for (i = 0; i < sizeof info->guid / sizeof info->guid[0]; i++) {
-        info->guid_str[i * 2 + 0] = digits[info->guid[i] >> 8];
+        info->guid_str[i * 2 + 0] = digits[info->guid[i] >> 4];
         info->guid_str[i * 2 + 1] = digits[info->guid[i] & 0x0f];
     }
     info->guid_str[i * 2] = '\0';
 }
 
-/** \brief  Scan joystick device for buttons present
+/** \brief  Count set bits of a bitmap in the range [first, last)
  *
- * \param[in]   info    joystick info
- * \param[in]   dev     evdev instance
+ * \param[in]   bits    bitmap as returned by \c EVIOCGBIT
+ * \param[in]   first   first bit to count
+ * \param[in]   last    bit after last bit to count
+ *
+ * \return  number of bits set
  */
-static void dev_info_scan_buttons(joy_dev_info_t *info, struct libevdev *dev)
+static unsigned int bitmap_count(const unsigned long *bits,
+                                 unsigned int         first,
+                                 unsigned int         last)
 {
-    if (libevdev_has_event_type(dev, EV_KEY)) {
-        unsigned int num_buttons = 0;
-        unsigned int code;
+    unsigned int count = 0;
+    unsigned int w;
 
-#if 0
-        printf("<debug> device has event type EV_KEY\n");
-#endif
-        /* count number of buttons */
-        for (code = BTN_MISC; code < KEY_MAX; code++) {
-            if (libevdev_has_event_code(dev, EV_KEY, code)) {
-                num_buttons++;
-            }
+    for (w = first / BITS_PER_LONG; w * BITS_PER_LONG < last; w++) {
+        unsigned long word = bits[w];
+
+        if (w == first / BITS_PER_LONG) {
+            word &= ~0ul << (first % BITS_PER_LONG);
         }
-#if 0
-        printf("<debug> %u buttons\n", num_buttons);
-#endif
-        info->num_buttons = (uint16_t)num_buttons;
+        if ((w + 1u) * BITS_PER_LONG > last) {
+            word &= ~(~0ul << (last % BITS_PER_LONG));
+        }
+        count += (unsigned int)__builtin_popcountl(word);
+    }
+    return count;
+}
+
+/** \brief  Find next set bit of a bitmap in the range [from, last)
+ *
+ * \param[in]   bits    bitmap as returned by \c EVIOCGBIT
+ * \param[in]   from    first bit to check
+ * \param[in]   last    bit after last bit to check
+ *
+ * \return  index of set bit or \a last if none found
+ */
+static unsigned int bitmap_next(const unsigned long *bits,
+                                unsigned int         from,
+                                unsigned int         last)
+{
+    unsigned int  w;
+    unsigned long word;
+
+    if (from >= last) {
+        return last;
+    }
+    w    = from / BITS_PER_LONG;
+    word = bits[w] & (~0ul << (from % BITS_PER_LONG));
+    while (word == 0) {
+        if (++w * BITS_PER_LONG >= last) {
+            return last;
+        }
+        word = bits[w];
+    }
+    from = w * BITS_PER_LONG + (unsigned int)__builtin_ctzl(word);
+    return from < last ? from : last;
+}
+
+/** \brief  Scan joystick device for buttons present
+ *
+ * \param[in]   info        joystick info with probe scratch maps
+ * \param[in]   key_bits    \c EV_KEY bitmap of the device
+ */
+static void dev_info_scan_buttons(joy_dev_info_t      *info,
+                                  const unsigned long *key_bits)
+{
+    unsigned int num_buttons;
+    unsigned int code;
 
-        num_buttons = 0;
-        info->button_map = lib_malloc(num_buttons * sizeof *(info->button_map));
-        for (code = BTN_JOYSTICK; code < KEY_MAX; code++) {
-            if (libevdev_has_event_code(dev, EV_KEY, code)) {
-                info->button_map[num_buttons++] = (uint16_t)code;
+    num_buttons = bitmap_count(key_bits, BTN_MISC, KEY_MAX);
 #if 0
-                printf("<debug> button %02x '%s'\n",
-                       code, libevdev_event_code_get_name(EV_KEY, code));
+    fprintf(stderr, "<debug> %u buttons\n", num_buttons);
 #endif
-            }
-        }
+    info->num_buttons = (uint16_t)num_buttons;
+    num_buttons = 0;
+    for (code = bitmap_next(key_bits, BTN_MISC, KEY_MAX);
+            code < KEY_MAX;
+            code = bitmap_next(key_bits, code + 1u, KEY_MAX)) {
+        info->button_index[code - JOY_BUTTON_CODE_MIN] = (int16_t)num_buttons;
+        info->button_map[num_buttons++] = (uint16_t)code;
     }
 }
 
@@ -354,133 +706,335 @@ static bool is_hat_code(unsigned int code)
     return (bool)(code >= ABS_HAT0X && code <= ABS_HAT3Y);
 }
 
-static void dev_info_scan_axes_and_hats(joy_dev_info_t *info, struct libevdev *dev)
+/** \brief  Read range of an axis from the device
+ *
+ * \param[in,out]  abs_vice    axis info with the code set
+ * \param[in]      fd          file descriptor of device node
+ *
+ * \return  \c false if the kernel didn't report the range, a 16-bit range
+ *          is used then
+ */
+static bool abs_info_read(joy_abs_info_t *abs_vice, int fd)
 {
-    if (libevdev_has_event_type(dev, EV_ABS)) {
-        unsigned int num_axes = 0;
-        unsigned int num_hats = 0;  /* number of hat *axes* */
-        unsigned int code;
-#if 0
-        printf("<debug> device has event type EV_ABS\n");
-#endif
-        for (code = ABS_X; code < ABS_RESERVED; code++) {
-            if (libevdev_has_event_code(dev, EV_ABS, code)) {
-                if (is_hat_code(code)) {
-                    num_hats++;
-                } else {
-                    num_axes++;
-                }
-            }
-        }
+    struct input_absinfo abs_evdev;
+
+    if (ioctl(fd, EVIOCGABS((unsigned int)abs_vice->code), &abs_evdev) == 0) {
+        abs_vice->minimum    = abs_evdev.minimum;
+        abs_vice->maximum    = abs_evdev.maximum;
+        abs_vice->fuzz       = abs_evdev.fuzz;
+        abs_vice->flat       = abs_evdev.flat;
+        abs_vice->resolution = abs_evdev.resolution;
+        return true;
+    }
+    abs_vice->minimum    = INT16_MIN;
+    abs_vice->maximum    = INT16_MAX;
+    abs_vice->fuzz       = 0;
+    abs_vice->flat       = 0;
+    abs_vice->resolution = 0;
+    return false;
+}
+
+/** \brief  Scan joystick device for axes and hats present
+ *
+ * \param[in]   info        joystick info with probe scratch maps
+ * \param[in]   fd          file descriptor of device node
+ * \param[in]   abs_bits    \c EV_ABS bitmap of the device
+ */
+static void dev_info_scan_axes_and_hats(joy_dev_info_t      *info,
+                                        int                  fd,
+                                        const unsigned long *abs_bits)
+{
+    unsigned int num_axes;
+    unsigned int num_hats;  /* number of hat *axes* */
+    unsigned int code;
+
+    num_hats = bitmap_count(abs_bits, ABS_HAT0X, ABS_HAT3Y + 1u);
+    num_axes = bitmap_count(abs_bits, ABS_X, ABS_RESERVED) - num_hats;
 #if 0
-        printf("<debug> %u axes, %u hats\n", num_axes, num_hats / 2u);
+    fprintf(stderr, "<debug> %u axes, %u hats\n", num_axes, num_hats / 2u);
 #endif
-        info->num_axes = (uint16_t)num_axes;
-        info->num_hats = (uint16_t)num_hats / 2u;
+    info->num_axes = (uint16_t)num_axes;
+    info->num_hats = (uint16_t)(num_hats / 2u);
 
-        info->axis_map = lib_malloc(num_axes * sizeof *(info->axis_map));
-        info->hat_map  = lib_malloc(num_hats * sizeof *(info->hat_map));
+    num_axes = 0;
+    num_hats = 0;
+    for (code = bitmap_next(abs_bits, ABS_X, ABS_RESERVED);
+            code < ABS_RESERVED;
+            code = bitmap_next(abs_bits, code + 1u, ABS_RESERVED)) {
+        joy_abs_info_t *abs_vice;
 
-        num_axes = 0;
-        num_hats = 0;
-        for (code = ABS_X; code < ABS_RESERVED; code++) {
-            if (libevdev_has_event_code(dev, EV_ABS, code)) {
-                const struct input_absinfo *abs_evdev;
-                joy_abs_info_t             *abs_vice;
+        if (is_hat_code(code)) {
+            abs_vice = &(info->hat_map[num_hats]);
+            num_hats++;
+        } else {
+            info->axis_index[code] = (int16_t)num_axes;
+            abs_vice = &(info->axis_map[num_axes]);
+            num_axes++;
+        }
 
-                abs_evdev = libevdev_get_abs_info(dev, code);
+        abs_info_clear(abs_vice);
+        abs_vice->code = (uint16_t)code;
+        abs_info_read(abs_vice, fd);
+    }
+}
 
-                if (is_hat_code(code)) {
-                    abs_vice = &(info->hat_map[num_hats]);
-                    num_hats++;
-                } else {
-                    abs_vice = &(info->axis_map[num_axes]);
-                    num_axes++;
-                }
+/** \brief  Read ranges of the axes and hats of a device found in the cache
+ *
+ * Recalibration or a firmware update changes the ranges without changing
+ * the GUID, so only the set of axes, hats and buttons comes from the cache.
+ *
+ * \param[in,out]  info    joystick info with the maps set from the cache
+ * \param[in]      fd      file descriptor of device node
+ *
+ * \return  \c true if a range differs from the cached one
+ */
+static bool dev_info_refresh_axes_and_hats(joy_dev_info_t *info, int fd)
+{
+    bool         changed = false;
+    unsigned int i;
 
-                abs_info_clear(abs_vice);
-                abs_vice->code = (uint16_t)code;
-                if (abs_evdev != NULL) {
-                    abs_vice->minimum    = abs_evdev->minimum;
-                    abs_vice->maximum    = abs_evdev->maximum;
-                    abs_vice->fuzz       = abs_evdev->fuzz;
-                    abs_vice->flat       = abs_evdev->flat;
-                    abs_vice->resolution = abs_evdev->resolution;
-                } else {
-                    abs_vice->minimum = INT16_MIN;
-                    abs_vice->maximum = INT16_MAX;
-                }
-            }
+    for (i = 0; i < info->num_axes + info->num_hats * 2u; i++) {
+        joy_abs_info_t *abs_vice = i < info->num_axes
+                                 ? &(info->axis_map[i])
+                                 : &(info->hat_map[i - info->num_axes]);
+        joy_abs_info_t  cached   = *abs_vice;
+
+        abs_info_read(abs_vice, fd);
+        if (cached.minimum    != abs_vice->minimum ||
+                cached.maximum    != abs_vice->maximum ||
+                cached.fuzz       != abs_vice->fuzz ||
+                cached.flat       != abs_vice->flat ||
+                cached.resolution != abs_vice->resolution) {
+            changed = true;
         }
     }
+    return changed;
 }
 
 
+/** \brief  Create copy of joystick info
+ *
+ * \param[in]   device  joystick info
+ *
+ * \return  copy, free with joy_dev_info_free()
+ */
 joy_dev_info_t *joy_dev_info_dup(const joy_dev_info_t *device)
 {
-    unsigned int    i;
     joy_dev_info_t *newdev;
 
-    newdev = lib_malloc(sizeof *newdev);
-    dev_info_clear(newdev);
+    /* the data follows the struct in the same block, so copy the block and
+     * move the pointers along */
+    newdev = lib_malloc_cat(device->size, LIB_ALLOC_JOY_DEVICE);
+    memcpy(newdev, device, device->size);
+    newdev->path = dev_info_rebase(device->path, device, newdev);
+    newdev->name = dev_info_rebase(device->name, device, newdev);
+    newdev->button_map = dev_info_rebase(device->button_map, device, newdev);
+    newdev->axis_map   = dev_info_rebase(device->axis_map,   device, newdev);
+    newdev->hat_map    = dev_info_rebase(device->hat_map,    device, newdev);
+    return newdev;
+}
+
+
+/** \brief  Recreate joystick info from a copy of its block
+ *
+ * The block is the first \c size bytes of a joystick info, for example as
+ * stored in a file, so its pointers are invalid. They are set again from
+ * the layout used by dev_info_pack(), after checking that everything lies
+ * inside the block.
+ *
+ * \param[in]   block   copy of a joystick info block
+ * \param[in]   size    size of \a block
+ *
+ * \return  joystick info, or \c NULL if \a block isn't valid, free with
+ *          joy_dev_info_free()
+ */
+joy_dev_info_t *joy_dev_info_new_from_block(const void *block, size_t size)
+{
+    joy_dev_info_t  header;
+    joy_dev_info_t *info;
+    unsigned char  *data;
+    unsigned char  *end;
+    size_t          maps_size;
+    unsigned int    i;
 
-    newdev->path = lib_strdup(device->path);
-    newdev->name = lib_strdup(device->name);
-    memcpy(newdev->guid, device->guid, sizeof device->guid);
-    memcpy(newdev->guid_str, device->guid_str, sizeof device->guid_str);
+    if (size < sizeof header) {
+        return NULL;
+    }
+    memcpy(&header, block, sizeof header);
+    if (header.size != size ||
+            header.num_buttons > JOY_BUTTON_INDEX_SIZE ||
+            header.num_axes > JOY_AXIS_INDEX_SIZE ||
+            header.num_hats > JOY_HAT_MAX) {
+        return NULL;
+    }
+    maps_size = (header.num_axes + header.num_hats * 2u) * sizeof(joy_abs_info_t) +
+                header.num_buttons * sizeof(uint16_t);
+    if (maps_size + 2u > size - sizeof header) {
+        return NULL;
+    }
 
-    newdev->bustype     = device->bustype;
-    newdev->vendor      = device->vendor;
-    newdev->product     = device->product;
-    newdev->version     = device->version;
+    info = lib_malloc_cat(size, LIB_ALLOC_JOY_DEVICE);
+    memcpy(info, block, size);
+    data = (unsigned char *)(info + 1);
+    end  = (unsigned char *)info + size;
 
-    newdev->num_axes    = device->num_axes;
-    newdev->num_buttons = device->num_buttons;
-    newdev->num_hats    = device->num_hats;
-    newdev->num_balls   = device->num_balls;
+    info->axis_map = NULL;
+    if (info->num_axes > 0) {
+        info->axis_map = (void *)data;
+        data += info->num_axes * sizeof *(info->axis_map);
+    }
+    info->hat_map = NULL;
+    if (info->num_hats > 0) {
+        info->hat_map = (void *)data;
+        data += info->num_hats * 2u * sizeof *(info->hat_map);
+    }
+    info->button_map = NULL;
+    if (info->num_buttons > 0) {
+        info->button_map = (void *)data;
+        data += info->num_buttons * sizeof *(info->button_map);
+    }
 
-    if (device->num_buttons > 0) {
-        newdev->button_map = lib_malloc(device->num_buttons * sizeof *(newdev->button_map));
-        for (i = 0; i < device->num_buttons; i++) {
-            newdev->button_map[i] = device->button_map[i];
-        }
+    /* path and name, both must be terminated inside the block */
+    info->path = (char *)data;
+    data = memchr(data, '\0', (size_t)(end - data));
+    if (data == NULL || ++data >= end) {
+        lib_free(info);
+        return NULL;
     }
-    if (device->num_axes > 0) {
-        newdev->axis_map = lib_malloc(device->num_axes * sizeof *(newdev->axis_map));
-        for (i = 0; i < device->num_axes; i++) {
-            newdev->axis_map[i] = device->axis_map[i];
+    info->name = (char *)data;
+    if (memchr(data, '\0', (size_t)(end - data)) == NULL) {
+        lib_free(info);
+        return NULL;
+    }
+    info->guid_str[sizeof info->guid_str - 1u] = '\0';
+
+    /* don't trust the index tables, rebuild them from the maps */
+    memset(info->button_index, 0xff, sizeof info->button_index);
+    memset(info->axis_index,   0xff, sizeof info->axis_index);
+    for (i = 0; i < info->num_buttons; i++) {
+        unsigned int code = info->button_map[i];
+
+        if (code >= JOY_BUTTON_CODE_MIN && code < KEY_CNT) {
+            info->button_index[code - JOY_BUTTON_CODE_MIN] = (int16_t)i;
         }
     }
-    if (device->num_hats > 0) {
-        /* num_hat * 2 since each hat consists of two axes */
-        newdev->hat_map = lib_malloc(device->num_hats * 2u * sizeof *(newdev->hat_map));
-        for (i = 0; i < device->num_hats * 2u; i++) {
-            newdev->hat_map[i] = device->hat_map[i];
+    for (i = 0; i < info->num_axes; i++) {
+        if (info->axis_map[i].code < JOY_AXIS_INDEX_SIZE) {
+            info->axis_index[info->axis_map[i].code] = (int16_t)i;
         }
     }
-    return newdev;
+    joy_axis_norm_init(&(info->axis_norm), info->axis_map, info->num_axes);
+    dev_info_set_hat_decode(info);
+    /* the pointer in the block is stale */
+    info->mapping = joy_mapping_find(info);
+    dev_info_set_sort_keys(info);
+    return info;
 }
 
 
 /** \brief  Free memory used by a joystick info struct
  *
- * \param[in]   info    joystick info
+ * Devices of the last scan live in a single arena freed by
+ * joy_free_devices_list(), for those this is a no-op.
+ *
+ * \param[in]   device  joystick info
  */
 void joy_dev_info_free(joy_dev_info_t *device)
 {
-    if (device != NULL) {dev_info_free_data(device);
+    if (device != NULL && !dev_info_in_arena(device)) {
         lib_free(device);
     }
 }
 
 
+/** \brief  Initialize device state snapshot for a device
+ *
+ * All buttons released, all axes and hats 0.
+ *
+ * \param[out]  state   device state
+ * \param[in]   device  device info
+ */
+void joy_device_state_init(joy_device_state_t   *state,
+                           const joy_dev_info_t *device)
+{
+    memset(state, 0, sizeof *state);
+    state->num_buttons = (uint16_t)(device->num_buttons < JOY_STATE_MAX_BUTTONS
+                                    ? device->num_buttons : JOY_STATE_MAX_BUTTONS);
+    state->num_axes    = (uint16_t)(device->num_axes < JOY_STATE_MAX_AXES
+                                    ? device->num_axes : JOY_STATE_MAX_AXES);
+    state->num_hats    = (uint16_t)(device->num_hats < JOY_HAT_MAX
+                                    ? device->num_hats : JOY_HAT_MAX);
+}
+
+
+/** \brief  Apply event to a device state snapshot
+ *
+ * \param[in,out]   state   device state
+ * \param[in]       device  device info
+ * \param[in]       event   event
+ *
+ * \return  \c true if \a event completed a report (\c SYN_REPORT)
+ */
+bool joy_device_state_apply(joy_device_state_t       *state,
+                            const joy_dev_info_t     *device,
+                            const struct input_event *event)
+{
+    int index;
+
+    switch (event->type) {
+        case EV_KEY:
+            index = joy_dev_info_button_index(device, event->code);
+            if (index >= 0 && index < state->num_buttons) {
+                uint32_t mask = 1u << ((unsigned int)index % 32u);
+
+                if (event->value != 0) {
+                    state->buttons[index / 32] |= mask;
+                } else {
+                    state->buttons[index / 32] &= ~mask;
+                }
+            }
+            break;
+
+        case EV_ABS:
+            index = joy_dev_info_axis_index(device, event->code);
+            if (index >= 0 && index < state->num_axes) {
+                state->axes[index] = event->value;
+            } else if (is_hat_code(event->code)) {
+                index = device->hat_decode.index[event->code - ABS_HAT0X];
+                if (index >= 0 && index < state->num_hats * 2) {
+                    unsigned int hat = (unsigned int)index / 2u;
+
+                    state->hats[index] = event->value;
+                    state->hat_dirs[hat] = (uint8_t)joy_dev_info_hat_direction(
+                            device, hat,
+                            state->hats[hat * 2u], state->hats[hat * 2u + 1u]);
+                }
+            }
+            break;
+
+        case EV_SYN:
+            if (event->code == SYN_REPORT) {
+                state->sequence++;
+                state->time_us = (uint64_t)event->input_event_sec * 1000000u +
+                                 (uint64_t)event->input_event_usec;
+                return true;
+            }
+            break;
+
+        default:
+            break;
+    }
+    return false;
+}
+
+
 static char *sd_get_full_path(const char *root, size_t root_len, const char *name)
 {
     char   *fullpath;
     size_t  nlen = strlen(name);
 
     if (root == NULL || *root == '\0') {
-        fullpath = lib_malloc(nlen + 2u);
+        fullpath = lib_malloc_cat(nlen + 2u, LIB_ALLOC_JOY_STRING);
         fullpath[0] = '/';
         memcpy(fullpath + 1, name, nlen + 1u);
     } else {
@@ -491,7 +1045,7 @@ static char *sd_get_full_path(const char *root, size_t root_len, const char *nam
         } else {
             rlen = root_len;
         }
-        fullpath = lib_malloc(rlen + nlen + 2u);
+        fullpath = lib_malloc_cat(rlen + nlen + 2u, LIB_ALLOC_JOY_STRING);
         memcpy(fullpath, root, rlen);
         fullpath[rlen] = '/';
         memcpy(fullpath + rlen + 1, name, nlen + 1u);
@@ -500,73 +1054,337 @@ static char *sd_get_full_path(const char *root, size_t root_len, const char *nam
     return fullpath;
 }
 
-static int sd_filter(const struct dirent *entry)
+/** \brief  Determine if a node name is a joystick node created by udev
+ *
+ * \param[in]   name    node name
+ *
+ * \return  \c true if \a name ends with \c JOY_UDEV_SUFFIX
+ */
+static bool sd_is_joystick_name(const char *name)
 {
-    const char *name;
-    size_t      nlen;
-    size_t      slen;
+    size_t nlen = strlen(name);
+    size_t slen = strlen(JOY_UDEV_SUFFIX);
 
-    name = entry->d_name;
-    nlen = strlen(entry->d_name);
-    slen = strlen(JOY_UDEV_SUFFIX);
+    return (nlen > slen) && memcmp(name + nlen - slen, JOY_UDEV_SUFFIX, slen) == 0;
+}
 
-    if ((nlen > slen) && memcmp(name + nlen - slen, JOY_UDEV_SUFFIX, slen) == 0) {
-        return 1;
-    }
-    return 0;
+static int sd_filter(const struct dirent *entry)
+{
+    return sd_is_joystick_name(entry->d_name) ? 1 : 0;
 }
 
-static bool sd_get_dev_info(joy_dev_info_t *info)
+/** \brief  Probe device node for name, IDs and capabilities
+ *
+ * Uses the evdev ioctls directly: the capability bitmaps are fetched once and
+ * scanned a word at a time instead of querying each event code.
+ *
+ * \param[in,out]   probe   probe scratch space with \c info.path set
+ *
+ * \return  \c true on success
+ */
+static bool sd_get_dev_info(dev_probe_t *probe)
 {
-    struct libevdev *dev;
-    int              fd;
-    int              rc;
+    joy_dev_info_t *info = &(probe->info);
+    unsigned long   ev_bits[NLONGS(EV_CNT)];
+    unsigned long   key_bits[NLONGS(KEY_CNT)];
+    unsigned long   abs_bits[NLONGS(ABS_CNT)];
+    struct input_id id;
+    int             fd;
 
-    fd = open(info->path, O_RDONLY|O_NONBLOCK);
+    fd = open(info->path, O_RDONLY|O_NONBLOCK|O_CLOEXEC);
     if (fd < 0) {
         fprintf(stderr,
                 "error: failed to open %s: %s\n",
                 info->path, strerror(errno));
         return false;
     }
-    rc = libevdev_new_from_fd(fd, &dev);
-    if (rc < 0) {
-        fprintf(stderr, "failed to initialize evdev: %s\n", strerror(-rc));
+
+    memset(ev_bits,  0, sizeof ev_bits);
+    memset(key_bits, 0, sizeof key_bits);
+    memset(abs_bits, 0, sizeof abs_bits);
+    if (ioctl(fd, EVIOCGBIT(0, sizeof ev_bits), ev_bits) < 0 ||
+            ioctl(fd, EVIOCGID, &id) < 0) {
+        fprintf(stderr, "failed to query %s: %s\n", info->path, strerror(errno));
         close(fd);
         return false;
     }
 
     /* get device name */
-    info->name = lib_strdup(libevdev_get_name(dev));
+    memset(probe->name, 0, sizeof probe->name);
+    if (ioctl(fd, EVIOCGNAME(sizeof probe->name - 1u), probe->name) < 0) {
+        probe->name[0] = '\0';
+    }
 
     /* get bus, vendor, product and version */
-    info->bustype = (uint16_t)libevdev_get_id_bustype(dev);
-    info->vendor  = (uint16_t)libevdev_get_id_vendor(dev);
-    info->product = (uint16_t)libevdev_get_id_product(dev);
-    info->version = (uint16_t)libevdev_get_id_version(dev);
+    info->bustype = id.bustype;
+    info->vendor  = id.vendor;
+    info->product = id.product;
+    info->version = id.version;
 
     /* generate 128 bit GUID and string version thereof */
     dev_info_generate_guid(info);
     dev_info_generate_guid_str(info);
 
-    dev_info_scan_buttons(info, dev);
-    dev_info_scan_axes_and_hats(info, dev);
+    /* identical devices have identical capabilities, the ranges are read
+     * anyway and a changed one updates the cache */
+    if (joy_cache_lookup(info)) {
+        probe->cached = !dev_info_refresh_axes_and_hats(info, fd);
+        close(fd);
+        return true;
+    }
+
+    if (bitmap_next(ev_bits, EV_KEY, EV_KEY + 1u) == EV_KEY &&
+            ioctl(fd, EVIOCGBIT(EV_KEY, sizeof key_bits), key_bits) >= 0) {
+        dev_info_scan_buttons(info, key_bits);
+    }
+    if (bitmap_next(ev_bits, EV_ABS, EV_ABS + 1u) == EV_ABS &&
+            ioctl(fd, EVIOCGBIT(EV_ABS, sizeof abs_bits), abs_bits) >= 0) {
+        dev_info_scan_axes_and_hats(info, fd, abs_bits);
+    }
 
-    libevdev_free(dev);
     close(fd);
     return true;
 }
 
 
+/** \brief  Create joystick info for a single device node
+ *
+ * \param[in]   path    path to evdev device node
+ *
+ * \return  joystick info, or \c NULL on failure, free with joy_dev_info_free()
+ */
+joy_dev_info_t *joy_dev_info_new_from_path(const char *path)
+{
+    dev_probe_t    *probe;
+    joy_dev_info_t *info = NULL;
+    char           *copy;
+
+    /* too large for the stack of a GTK callback */
+    probe = lib_malloc_cat(sizeof *probe, LIB_ALLOC_JOY_SCAN);
+    copy  = lib_strdup_cat(path, LIB_ALLOC_JOY_STRING);
+    dev_probe_init(probe, copy);
+    joy_cache_open();
+    if (sd_get_dev_info(probe)) {
+        info = dev_info_pack(&(probe->info),
+                             lib_malloc_cat(dev_info_packed_size(&(probe->info)),
+                                            LIB_ALLOC_JOY_DEVICE));
+        if (!probe->cached) {
+            joy_cache_add(info);
+            joy_cache_flush();
+        }
+    }
+    lib_free(copy);
+    lib_free(probe);
+    return info;
+}
+
+
+/** \brief  Probe devices of a scan job until none are left
+ *
+ * \param[in]   job scan job
+ */
+static void scan_job_run(scan_job_t *job)
+{
+    int n;
+
+    while ((n = atomic_fetch_add(&(job->next), 1)) < job->count) {
+        job->probes[n].valid = sd_get_dev_info(&(job->probes[n]));
+    }
+}
+
+/** \brief  Scan worker thread
+ *
+ * \param[in]   arg scan job
+ *
+ * \return  \c NULL
+ */
+static void *scan_worker(void *arg)
+{
+    scan_job_run(arg);
+    return NULL;
+}
+
+/** \brief  Probe devices of a scan job in parallel
+ *
+ * Probing a device can block for a while on slow devices, so the devices
+ * are probed by a small pool of threads (including the calling thread),
+ * making the scan take about as long as the slowest device.
+ *
+ * \param[in]   job scan job
+ */
+static void scan_job_probe(scan_job_t *job)
+{
+    pthread_t workers[JOY_SCAN_MAX_THREADS - 1];
+    int       num_workers;
+    int       w;
+
+    num_workers = job->count - 1;
+    if (num_workers > JOY_SCAN_MAX_THREADS - 1) {
+        num_workers = JOY_SCAN_MAX_THREADS - 1;
+    }
+    for (w = 0; w < num_workers; w++) {
+        int rc = pthread_create(&workers[w], NULL, scan_worker, job);
+
+        if (rc != 0) {
+            /* carry on with fewer threads */
+            fprintf(stderr, "warning: failed to create scan thread: %s\n",
+                    strerror(rc));
+            num_workers = w;
+            break;
+        }
+    }
+    scan_job_run(job);
+    for (w = 0; w < num_workers; w++) {
+        pthread_join(workers[w], NULL);
+    }
+}
+
+
+/** \brief  Compare sort keys
+ *
+ * \param[in]   k1  first key
+ * \param[in]   k2  second key
+ *
+ * \return  <0, 0 or >0 like strcmp()
+ */
+static int compar_key(uint64_t k1, uint64_t k2)
+{
+    return (k1 > k2) - (k1 < k2);
+}
+
+/** \brief  Compare devices on a field using the precomputed sort keys
+ *
+ * The GUID keys compare like the GUID strings, the string keys only hold
+ * the first bytes so equal keys fall back to comparing the strings. Nodes
+ * in the same directory only compare the node names.
+ *
+ * \param[in]   d1      first device
+ * \param[in]   d2      second device
+ * \param[in]   field   field to compare
+ *
+ * \return  <0, 0 or >0 like strcmp()
+ */
+static int devices_compare(const joy_dev_info_t *d1,
+                           const joy_dev_info_t *d2,
+                           joy_sort_field_t      field)
+{
+    size_t offset;
+    int    result;
+
+    switch (field) {
+        case JOY_SORT_GUID:
+            result = compar_key(d1->sort_guid[0], d2->sort_guid[0]);
+            if (result == 0) {
+                result = compar_key(d1->sort_guid[1], d2->sort_guid[1]);
+            }
+            return result;
+        case JOY_SORT_NAME:
+            result = compar_key(d1->sort_name, d2->sort_name);
+            return result != 0 ? result : strcmp(d1->name, d2->name);
+        case JOY_SORT_NODE:
+            offset = d1->sort_node_offset;
+            if (offset != d2->sort_node_offset || memcmp(d1->path, d2->path, offset) != 0) {
+                return strcmp(d1->path, d2->path);
+            }
+            result = compar_key(d1->sort_node, d2->sort_node);
+            return result != 0 ? result : strcmp(d1->path + offset, d2->path + offset);
+        default:
+            return 0;
+    }
+}
+
+/** \brief  Find position to insert a device in the sorted devices list
+ *
+ * Returns the position after devices comparing equal, so inserting keeps
+ * the sort stable.
+ *
+ * \param[in]   info    joystick info
+ *
+ * \return  index in devices list
+ */
+static int devices_list_upper_bound(const joy_dev_info_t *info)
+{
+    int lo = 0;
+    int hi = devices_count;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+
+        if (devices_compare(info, devices_list[mid], devices_sort_field) < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+/** \brief  Sort the devices list on \c devices_sort_field
+ *
+ * Stable merge sort, so devices comparing equal stay in directory order.
+ */
+static void devices_list_sort(void)
+{
+    joy_dev_info_t **src;
+    joy_dev_info_t **dst;
+    joy_dev_info_t **tmp;
+    size_t           count = (size_t)devices_count;
+    size_t           width;
+
+    if (devices_sort_field == JOY_SORT_NONE || count < 2u) {
+        return;
+    }
+    src = devices_list;
+    dst = lib_malloc_cat(count * sizeof *dst, LIB_ALLOC_JOY_DEVICE);
+    tmp = dst;
+    for (width = 1; width < count; width *= 2u) {
+        size_t lo;
+
+        for (lo = 0; lo < count; lo += width * 2u) {
+            size_t mid = lo + width     < count ? lo + width     : count;
+            size_t hi  = lo + width * 2 < count ? lo + width * 2 : count;
+            size_t a   = lo;
+            size_t b   = mid;
+            size_t d   = lo;
+
+            while (a < mid && b < hi) {
+                if (devices_compare(src[b], src[a], devices_sort_field) < 0) {
+                    dst[d++] = src[b++];
+                } else {
+                    dst[d++] = src[a++];
+                }
+            }
+            while (a < mid) {
+                dst[d++] = src[a++];
+            }
+            while (b < hi) {
+                dst[d++] = src[b++];
+            }
+        }
+        /* swap roles of the buffers */
+        dst = src;
+        src = dst == devices_list ? tmp : devices_list;
+    }
+    if (src != devices_list) {
+        memcpy(devices_list, src, count * sizeof *devices_list);
+    }
+    lib_free(tmp);
+}
+
+
 /** \brief  Scan connected joystick devices
  *
  * \param[in]   path    kernel virtual filesystem path with device nodes
+ * \param[out]  devices list of devices found (optional)
  *
  * \return  number of devices found, or -1 on error
  */
 int joy_scan_devices(const char *path, joy_dev_info_t ***devices)
 {
     struct dirent **namelist;
+    scan_job_t      job;
+    unsigned char  *block;
+    int             num_nodes;
     int             d;  /* device index */
     int             i;  /* info index */
     size_t          root_len;
@@ -579,42 +1397,70 @@ int joy_scan_devices(const char *path, joy_dev_info_t ***devices)
         devices_list = NULL;
     }
 
-    devices_count = scandir(path == NULL ? "" : path, &namelist, sd_filter, NULL);
-    if (devices_count < 0) {
+    num_nodes = scandir(path == NULL ? "" : path, &namelist, sd_filter, alphasort);
+    if (num_nodes < 0) {
         /* error */
         fprintf(stderr, "failed to scan devices: %s\n", strerror(errno));
         return -1;
-    } else if (devices_count == 0) {
+    } else if (num_nodes == 0) {
+        free(namelist);
         if (devices != NULL) {
             *devices = NULL;
         }
         return 0;
     }
 
-    devices_list = lib_malloc(((size_t)devices_count + 1u) * sizeof *devices_list);
-    for (d = 0; d < devices_count + 1; d++) {
-        devices_list[d] = NULL;
+    job.probes = lib_malloc_cat((size_t)num_nodes * sizeof *(job.probes),
+                                LIB_ALLOC_JOY_SCAN);
+    job.count  = num_nodes;
+    atomic_init(&(job.next), 0);
+    for (d = 0; d < num_nodes; d++) {
+        dev_probe_init(&(job.probes[d]),
+                       sd_get_full_path(path, root_len, namelist[d]->d_name));
+        free(namelist[d]);
     }
+    free(namelist);
 
-    i = 0;
-    for (d = 0; d < devices_count; d++) {
-        joy_dev_info_t *info;
+    joy_cache_open();
+    scan_job_probe(&job);
 
-        info = lib_malloc(sizeof *info);
-        dev_info_clear(info);
-        info->path = sd_get_full_path(path, root_len, namelist[i]->d_name);
+    /* pack results into a single arena */
+    devices_arena_size = 0;
+    for (d = 0; d < num_nodes; d++) {
+        if (job.probes[d].valid) {
+            devices_arena_size += dev_info_packed_size(&(job.probes[d].info));
+        }
+    }
+    devices_arena = NULL;
+    if (devices_arena_size > 0) {
+        devices_arena = lib_malloc_cat(devices_arena_size, LIB_ALLOC_JOY_DEVICE);
+    }
+
+    /* merge results in directory order, skipping failed devices */
+    devices_list = lib_malloc_cat(((size_t)num_nodes + 1u) * sizeof *devices_list,
+                                  LIB_ALLOC_JOY_DEVICE);
+    block = devices_arena;
+    i     = 0;
+    for (d = 0; d < num_nodes; d++) {
+        if (job.probes[d].valid) {
+            joy_dev_info_t *info = dev_info_pack(&(job.probes[d].info), block);
 
-        if (sd_get_dev_info(info)) {
+            block += info->size;
             devices_list[i++] = info;
-        } else {
-            lib_free(info->path);
-            lib_free(info);
+            if (!job.probes[d].cached) {
+                joy_cache_add(info);
+            }
+            /* no-op if the polling engine isn't initialized */
+            joy_poll_add_device(info);
         }
-        free(namelist[d]);
+        lib_free(job.probes[d].info.path);
     }
-    free(namelist);
-
     devices_list[i] = NULL;
+    devices_count   = i;
+    lib_free(job.probes);
+    joy_cache_flush();
+    devices_list_sort();
+
     if (devices != NULL) {
         *devices = devices_list;
     }
@@ -654,59 +1500,2726 @@ void joy_free_devices_list(void)
         int i;
 
         for (i = 0; i < devices_count; i++) {
+            joy_poll_remove_device(devices_list[i]);
+            /* only frees devices added by hotplug */
             joy_dev_info_free(devices_list[i]);
         }
+        lib_free(devices_list);
     }
-    devices_list  = NULL;
-    devices_count = 0;
+    /* all scanned devices at once */
+    lib_free(devices_arena);
+    devices_arena      = NULL;
+    devices_arena_size = 0;
+    devices_list       = NULL;
+    devices_count      = 0;
 }
 
 
-static int compar_guid(const void *p1, const void *p2)
+/*
+ * Hotplug support
+ *
+ * Watches the directory with device nodes using inotify and adds or removes
+ * single devices to/from the devices list, leaving the other devices alone.
+ */
+
+/** \brief  Find device in devices list by node path
+ *
+ * \param[in]   path    device node path
+ *
+ * \return  index in devices list or -1 when not found
+ */
+static int devices_list_find_path(const char *path)
 {
-    const joy_dev_info_t *d1 = p1;
-    const joy_dev_info_t *d2 = p2;
+    int i;
 
-    return strcmp(d1->guid_str, d2->guid_str);
+    for (i = 0; i < devices_count; i++) {
+        if (strcmp(devices_list[i]->path, path) == 0) {
+            return i;
+        }
+    }
+    return -1;
 }
 
-static int compar_name(const void *p1, const void *p2)
+/** \brief  Add device to devices list
+ *
+ * Inserts the device at its position when the list is sorted, otherwise
+ * appends it.
+ *
+ * \param[in]   info    joystick info
+ *
+ * \return  index of \a info in the devices list
+ */
+static int devices_list_insert(joy_dev_info_t *info)
 {
-    const joy_dev_info_t *d1 = p1;
-    const joy_dev_info_t *d2 = p2;
+    int index = devices_count;
 
-    return strcmp(d1->name, d2->name);
+    if (devices_sort_field != JOY_SORT_NONE) {
+        index = devices_list_upper_bound(info);
+    }
+    devices_list = lib_realloc_cat(devices_list,
+                                   ((size_t)devices_count + 2u) * sizeof *devices_list,
+                                   LIB_ALLOC_JOY_DEVICE);
+    memmove(devices_list + index + 1,
+            devices_list + index,
+            (size_t)(devices_count - index) * sizeof *devices_list);
+    devices_list[index] = info;
+    devices_count++;
+    devices_list[devices_count] = NULL;
+    return index;
 }
 
-static int compar_node(const void *p1, const void *p2)
+/** \brief  Remove device from devices list, closing and freeing it
+ *
+ * \param[in]   index   index in devices list
+ */
+static void devices_list_remove(int index)
 {
-    const joy_dev_info_t *d1 = p1;
-    const joy_dev_info_t *d2 = p2;
+    joy_dev_info_t *info = devices_list[index];
 
-    return strcmp(d1->path, d2->path);
+    memmove(devices_list + index,
+            devices_list + index + 1,
+            (size_t)(devices_count - index) * sizeof *devices_list);
+    devices_count--;
+    joy_poll_remove_device(info);
+    joy_dev_info_free(info);
 }
 
+/** \brief  Size of the buffer used to read inotify events */
+#define HOTPLUG_BUFFER_SIZE 4096
 
-void joy_sort_devices_list(joy_sort_field_t field)
+/** \brief  Inotify instance, -1 if not initialized */
+static int                       hotplug_fd = -1;
+
+/** \brief  Watch on the device nodes directory, -1 if not watched */
+static int                       hotplug_wd = -1;
+
+/** \brief  Watch on the parent of the device nodes directory
+ *
+ * Used to catch (re)creation of the nodes directory, udev removes it when
+ * the last device is unplugged.
+ */
+static int                       hotplug_parent_wd = -1;
+
+/** \brief  Device nodes directory */
+static char                     *hotplug_path;
+
+/** \brief  Name of the device nodes directory inside its parent */
+static const char               *hotplug_dirname;
+
+/** \brief  Callback for added devices */
+static joy_hotplug_added_cb_t    hotplug_added_cb;
+
+/** \brief  Callback for removed devices */
+static joy_hotplug_removed_cb_t  hotplug_removed_cb;
+
+/** \brief  Data for the hotplug callbacks */
+static void                     *hotplug_cb_data;
+
+
+/** \brief  Add device node to devices list, if not present yet
+ *
+ * \param[in]   name    node name in the nodes directory
+ *
+ * \return  \c true if a device was added
+ */
+static bool hotplug_add_node(const char *name)
 {
-    int (*compar)(const void *, const void *);
+    joy_dev_info_t *info;
+    char           *path;
+    int             index;
 
-    if (devices_list == NULL) {
-        return;
+    path = sd_get_full_path(hotplug_path, strlen(hotplug_path), name);
+    if (devices_list_find_path(path) >= 0) {
+        lib_free(path);
+        return false;
     }
-    switch (field) {
-        case JOY_SORT_GUID:
-            compar = compar_guid;
-            break;
-        case JOY_SORT_NAME:
-            compar = compar_name;
-            break;
-        case JOY_SORT_NODE:
-            compar = compar_node;
+    info = joy_dev_info_new_from_path(path);
+    lib_free(path);
+    if (info == NULL) {
+        return false;
+    }
+
+    index = devices_list_insert(info);
+    joy_poll_add_device(info);
+    if (hotplug_added_cb != NULL) {
+        hotplug_added_cb(info, index, hotplug_cb_data);
+    }
+    return true;
+}
+
+/** \brief  Remove device node from devices list, if present
+ *
+ * \param[in]   name    node name in the nodes directory
+ *
+ * \return  \c true if a device was removed
+ */
+static bool hotplug_remove_node(const char *name)
+{
+    char *path;
+    int   index;
+
+    path  = sd_get_full_path(hotplug_path, strlen(hotplug_path), name);
+    index = devices_list_find_path(path);
+    lib_free(path);
+    if (index < 0) {
+        return false;
+    }
+
+    if (hotplug_removed_cb != NULL) {
+        hotplug_removed_cb(devices_list[index], index, hotplug_cb_data);
+    }
+    devices_list_remove(index);
+    return true;
+}
+
+/** \brief  Start watching the device nodes directory
+ *
+ * Adds any nodes already present that aren't in the devices list yet.
+ *
+ * \return  number of devices added
+ */
+static int hotplug_watch_nodes_dir(void)
+{
+    struct dirent **namelist;
+    int             num;
+    int             added = 0;
+    int             i;
+
+    hotplug_wd = inotify_add_watch(hotplug_fd, hotplug_path,
+                                   IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO);
+    if (hotplug_wd < 0) {
+        return 0;
+    }
+
+    /* catch nodes created before the watch was added */
+    num = scandir(hotplug_path, &namelist, sd_filter, alphasort);
+    if (num < 0) {
+        return 0;
+    }
+    for (i = 0; i < num; i++) {
+        if (hotplug_add_node(namelist[i]->d_name)) {
+            added++;
+        }
+        free(namelist[i]);
+    }
+    free(namelist);
+    return added;
+}
+
+
+/** \brief  Initialize hotplug support
+ *
+ * Devices added to or removed from \a path are added to or removed from the
+ * devices list, calling the callbacks. Call joy_hotplug_dispatch() when the
+ * fd returned by joy_hotplug_get_fd() becomes readable.
+ *
+ * \param[in]   path        device nodes directory
+ * \param[in]   on_added    callback for added devices (optional)
+ * \param[in]   on_removed  callback for removed devices (optional)
+ * \param[in]   data        data for the callbacks
+ *
+ * \return  \c true on success
+ */
+bool joy_hotplug_init(const char               *path,
+                      joy_hotplug_added_cb_t    on_added,
+                      joy_hotplug_removed_cb_t  on_removed,
+                      void                     *data)
+{
+    char  *parent;
+    char  *slash;
+
+    if (hotplug_fd >= 0) {
+        joy_hotplug_shutdown();
+    }
+
+    hotplug_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+    if (hotplug_fd < 0) {
+        fprintf(stderr, "error: failed to initialize inotify: %s\n",
+                strerror(errno));
+        return false;
+    }
+    hotplug_path       = lib_strdup_cat(path, LIB_ALLOC_JOY_STRING);
+    hotplug_added_cb   = on_added;
+    hotplug_removed_cb = on_removed;
+    hotplug_cb_data    = data;
+
+    slash = strrchr(hotplug_path, '/');
+    if (slash != NULL && slash != hotplug_path) {
+        parent          = lib_strdup_cat(hotplug_path, LIB_ALLOC_JOY_STRING);
+        hotplug_dirname = slash + 1;
+        parent[slash - hotplug_path] = '\0';
+        hotplug_parent_wd = inotify_add_watch(hotplug_fd, parent,
+                                              IN_CREATE|IN_MOVED_TO|IN_ONLYDIR);
+        lib_free(parent);
+    }
+
+    hotplug_watch_nodes_dir();
+    return true;
+}
+
+
+/** \brief  Get hotplug inotify fd
+ *
+ * \return  fd or -1 when hotplug isn't initialized
+ */
+int joy_hotplug_get_fd(void)
+{
+    return hotplug_fd;
+}
+
+
+/** \brief  Process pending hotplug events
+ *
+ * \return  number of devices added or removed
+ */
+int joy_hotplug_dispatch(void)
+{
+    alignas(struct inotify_event) char buffer[HOTPLUG_BUFFER_SIZE];
+    int                                changes = 0;
+
+    if (hotplug_fd < 0) {
+        return 0;
+    }
+
+    while (true) {
+        ssize_t len = read(hotplug_fd, buffer, sizeof buffer);
+        ssize_t pos = 0;
+
+        if (len <= 0) {
+            /* EAGAIN: nothing (more) to read */
             break;
-        default:
-            return;
+        }
+        while (pos < len) {
+            const struct inotify_event *ev = (const void *)(buffer + pos);
+
+            pos += (ssize_t)(sizeof *ev + ev->len);
+
+            if (ev->wd == hotplug_parent_wd) {
+                if (ev->len > 0 && hotplug_wd < 0 &&
+                        strcmp(ev->name, hotplug_dirname) == 0) {
+                    changes += hotplug_watch_nodes_dir();
+                }
+            } else if (ev->wd == hotplug_wd) {
+                if (ev->mask & IN_IGNORED) {
+                    /* directory was removed, parent watch picks up recreation */
+                    hotplug_wd = -1;
+                } else if (ev->len == 0 || !sd_is_joystick_name(ev->name)) {
+                    continue;
+                } else if (ev->mask & (IN_CREATE|IN_MOVED_TO)) {
+                    changes += hotplug_add_node(ev->name) ? 1 : 0;
+                } else if (ev->mask & (IN_DELETE|IN_MOVED_FROM)) {
+                    changes += hotplug_remove_node(ev->name) ? 1 : 0;
+                }
+            }
+        }
+    }
+    return changes;
+}
+
+
+/** \brief  Stop hotplug support
+ */
+void joy_hotplug_shutdown(void)
+{
+    if (hotplug_fd >= 0) {
+        close(hotplug_fd);
+    }
+    lib_free(hotplug_path);
+    hotplug_fd         = -1;
+    hotplug_wd         = -1;
+    hotplug_parent_wd  = -1;
+    hotplug_path       = NULL;
+    hotplug_dirname    = NULL;
+    hotplug_added_cb   = NULL;
+    hotplug_removed_cb = NULL;
+    hotplug_cb_data    = NULL;
+}
+
+
+/** \brief  Sort devices list
+ *
+ * The list is kept sorted on \a field afterwards: devices added by hotplug
+ * are inserted at their position and a rescan sorts the new list.
+ *
+ * \param[in]   field   field to sort on, \c JOY_SORT_NONE to stop sorting
+ */
+void joy_sort_devices_list(joy_sort_field_t field)
+{
+    if (field < JOY_SORT_GUID || field > JOY_SORT_NONE) {
+        return;
     }
+    devices_sort_field = field;
+    devices_list_sort();
+}
+
+
+/*
+ * Polling engine
+ *
+ * Watches all opened devices with a single epoll set, reading events from
+ * every device that has some pending with a single epoll_wait() per wakeup
+ * and handing them to the subscribers of each device.
+ *
+ * The engine can be driven either by calling joy_poll_dispatch() when the
+ * fd returned by joy_poll_get_fd() becomes readable (eg from a main loop),
+ * or by the reader thread started with joy_poll_thread_start().
+ */
+
+/** \brief  Realtime priority for the polling engine's reader thread
+ *
+ * When non-zero the reader thread tries to switch itself to \c SCHED_FIFO
+ * with this priority, falling back to a raised nice value. Set to 0 to keep
+ * the reader thread at normal priority.
+ */
+#define POLL_THREAD_RT_PRIORITY 10
+
+/** \brief  Nice value used when \c SCHED_FIFO isn't allowed */
+#define POLL_THREAD_NICE        -5
+
+/** \brief  Number of events handed to subscribers in one call */
+#define POLL_BATCH_SIZE         64
+
+/** \brief  Epoll key of the wake-up eventfd */
+#define POLL_WAKE_KEY           UINT64_MAX
+
+/** \brief  Number of 64-bit words in a bitmap of all key codes */
+#define POLL_KEY_WORDS          ((KEY_CNT + 63u) / 64u)
+
+/** \brief  Subscription of a consumer to a device's events */
+typedef struct poll_sub_s {
+    int                   id;           /**< subscription ID, 0 if unused */
+    joy_poll_events_cb_t  on_events;    /**< events callback */
+    joy_poll_closed_cb_t  on_closed;    /**< device closed callback */
+    void                 *data;         /**< data for the callbacks */
+    bool                  filtered;     /**< only wants \c filter */
+    joy_poll_filter_t     filter;       /**< events wanted */
+    bool                  raw;          /**< wants the events before change
+                                             suppression */
+} poll_sub_t;
+
+/** \brief  Force feedback event waiting to be written */
+typedef struct poll_ff_cmd_s {
+    uint16_t effect;        /**< effect ID */
+    int32_t  value;         /**< play count, 0 to stop */
+    uint64_t cause_us;      /**< time the delay is measured from */
+} poll_ff_cmd_t;
+
+/** \brief  Change suppression thresholds of an axis */
+typedef struct poll_abs_filter_s {
+    int32_t fuzz;           /**< changes up to this size are dropped */
+    int32_t flat;           /**< values this close to \c center become it */
+    int32_t center;         /**< center of the range */
+    int32_t minimum;        /**< minimum of the range, always passed */
+    int32_t maximum;        /**< maximum of the range, always passed */
+} poll_abs_filter_t;
+
+/** \brief  Options of the devices with a specific GUID */
+typedef struct poll_guid_options_s {
+    char               guid[JOY_GUID_SIZE * 2 + 1]; /**< GUID as hex string,
+                                                         empty if unused */
+    joy_poll_options_t options;                     /**< options */
+} poll_guid_options_t;
+
+/** \brief  Device watched by the polling engine */
+typedef struct poll_entry_s {
+    joy_dev_info_t   *device;       /**< device info, \c NULL if slot unused */
+    struct libevdev  *evdev;        /**< libevdev instance */
+    int               fd;           /**< file descriptor of the device node */
+    uint32_t          generation;   /**< incremented each time the slot is
+                                         reused, to detect stale epoll keys */
+    bool              dropped;      /**< \c SYN_DROPPED seen, discarding
+                                         events until the next
+                                         \c SYN_REPORT */
+    clockid_t         clock_id;     /**< clock of the event timestamps */
+    double            latency_avg;  /**< rolling average of the delay of
+                                         \c SYN_REPORT events (us) */
+    double            latency_jitter;
+                                    /**< rolling mean deviation of the delay
+                                         from \c latency_avg (us) */
+    uint64_t          latency_last; /**< delay of the last \c SYN_REPORT */
+    uint64_t          latency_samples;
+                                    /**< number of delays measured */
+    uint64_t          stats_start;  /**< time stats were reset (ns) */
+    joy_poll_stats_t  stats;        /**< statistics */
+    uint64_t          key_bits[POLL_KEY_WORDS];
+                                    /**< key state as seen by subscribers */
+    int32_t           abs_values[ABS_CNT];
+                                    /**< axis state as seen by subscribers */
+    joy_device_state_t state;       /**< state being updated by events */
+    atomic_uint       state_seq;    /**< seqlock sequence of
+                                         \c state_published, odd while
+                                         being written */
+    joy_device_state_t state_published;
+                                    /**< state after the last complete
+                                         report, read without locking */
+    poll_sub_t        subs[JOY_POLL_MAX_SUBSCRIBERS];   /**< subscribers */
+    bool              ff_writable;  /**< opened for writing and the device
+                                         has force feedback */
+    /* force feedback queue, under poll_ff_mutex instead of poll_mutex */
+    const joy_dev_info_t *ff_device;
+                                    /**< \c device while it is open and
+                                         \c ff_writable, else \c NULL */
+    clockid_t         ff_clock_id;  /**< copy of \c clock_id */
+    poll_ff_cmd_t     ff_queue[JOY_POLL_FF_QUEUE_SIZE];
+                                    /**< force feedback events to write */
+    unsigned int      ff_count;     /**< number of events in \c ff_queue */
+    uint64_t          ff_rejected;  /**< events dropped as the queue was
+                                         full, added to the stats on the
+                                         next write */
+    bool              masked;       /**< kernel only passes \c mask */
+    joy_poll_filter_t mask;         /**< events passed by the kernel, union
+                                         of the subscribers' filters */
+    uint64_t          abs_filtered; /**< bitmap of axis codes with change
+                                         suppression */
+    poll_abs_filter_t abs_filter[ABS_CNT];
+                                    /**< change suppression thresholds */
+    bool              report_passed;
+                                    /**< an event of the current report
+                                         reached subscribers */
+    bool              report_suppressed;
+                                    /**< an event of the current report was
+                                         dropped */
+} poll_entry_t;
+
 
-    qsort((void *)devices_list, sizeof devices_list[0], sizeof devices_list, compar);
+/** \brief  Devices watched by the polling engine */
+static poll_entry_t     poll_entries[JOY_POLL_MAX_DEVICES];
+
+/** \brief  Lock for \c poll_entries */
+static pthread_mutex_t  poll_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** \brief  Options for devices opened without explicit options */
+static joy_poll_options_t poll_default_options = {
+    .clock_id = CLOCK_MONOTONIC,
+    .grab     = false,
+    .abs_fuzz = 0,
+    .abs_flat = JOY_POLL_ABS_DEVICE
+};
+
+/** \brief  Options for devices with a specific GUID opened without explicit
+ *          options, taking precedence over \c poll_default_options */
+static poll_guid_options_t poll_guid_options[JOY_POLL_MAX_GUID_OPTIONS];
+
+/** \brief  Epoll instance, -1 when the engine isn't initialized */
+static int              poll_epoll_fd = -1;
+
+/** \brief  Eventfd used to wake up joy_poll_dispatch() */
+static int              poll_wake_fd = -1;
+
+/** \brief  Next subscription ID to hand out */
+static int              poll_next_sub_id = 1;
+
+/** \brief  Method used to read events from the devices */
+static joy_read_method_t poll_read_method = JOY_READ_RAW;
+
+/** \brief  Reader thread */
+static pthread_t        poll_thread;
+
+/** \brief  Reader thread is running */
+static bool             poll_thread_running = false;
+
+/** \brief  Reader thread should exit */
+static atomic_bool      poll_thread_quit;
+
+/** \brief  Some entry has force feedback events queued */
+static atomic_bool      poll_ff_pending;
+
+/** \brief  Lock for the force feedback queues of \c poll_entries
+ *
+ * Only held to queue or take events, never across I/O, so force feedback
+ * can be requested without waiting for joy_poll_dispatch() and from its
+ * subscriber callbacks. Taken after \c poll_mutex when both are needed.
+ */
+static pthread_mutex_t  poll_ff_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** \brief  Kernel doesn't support \c EVIOCSMASK, don't try again */
+static bool             poll_mask_unsupported;
+
+
+_Static_assert(ABS_CNT <= 64, "EV_ABS codes don't fit the filter bitmap");
+_Static_assert(EV_CNT <= 32, "event types don't fit the filter bitmap");
+
+/** \brief  Set filter to pass all events
+ *
+ * \param[out]  filter  filter
+ */
+static void poll_filter_set_all(joy_poll_filter_t *filter)
+{
+    memset(filter, 0xff, sizeof *filter);
+}
+
+/** \brief  Determine if a filter passes an event
+ *
+ * \param[in]   filter  filter
+ * \param[in]   type    event type
+ * \param[in]   code    event code
+ *
+ * \return  \c true if passed
+ */
+static bool poll_filter_has(const joy_poll_filter_t *filter,
+                            unsigned int             type,
+                            unsigned int             code)
+{
+    if (type >= EV_CNT || !((filter->types >> type) & 1u)) {
+        return false;
+    }
+    if (type == EV_KEY) {
+        return code < KEY_CNT && ((filter->keys[code / 64u] >> (code % 64u)) & 1u);
+    }
+    if (type == EV_ABS) {
+        return code < ABS_CNT && ((filter->abs >> code) & 1u);
+    }
+    return true;
+}
+
+/** \brief  Generate epoll key for entry
+ *
+ * \param[in]   slot    index in \c poll_entries
+ *
+ * \return  key containing generation and slot index
+ */
+static uint64_t poll_entry_key(unsigned int slot)
+{
+    return ((uint64_t)poll_entries[slot].generation << 32u) | slot;
+}
+
+/** \brief  Look up entry from epoll key
+ *
+ * \param[in]   key epoll key
+ *
+ * \return  entry or \c NULL when the entry was closed after epoll_wait()
+ *          returned
+ */
+static poll_entry_t *poll_entry_from_key(uint64_t key)
+{
+    unsigned int slot = (unsigned int)(key & 0xffffffffu);
+
+    if (slot >= JOY_POLL_MAX_DEVICES ||
+            poll_entries[slot].device == NULL ||
+            poll_entries[slot].generation != (uint32_t)(key >> 32u)) {
+        return NULL;
+    }
+    return &poll_entries[slot];
+}
+
+/** \brief  Find entry for device
+ *
+ * \param[in]   device  device info
+ *
+ * \return  entry or \c NULL when \a device isn't watched
+ */
+static poll_entry_t *poll_entry_find(const joy_dev_info_t *device)
+{
+    unsigned int slot;
+
+    for (slot = 0; slot < JOY_POLL_MAX_DEVICES; slot++) {
+        if (poll_entries[slot].device == device) {
+            return &poll_entries[slot];
+        }
+    }
+    return NULL;
+}
+
+/** \brief  Get key state as last seen by the subscribers of an entry
+ *
+ * \param[in]   entry   polling engine entry
+ * \param[in]   code    key code
+ *
+ * \return  key state
+ */
+static int poll_entry_get_key(const poll_entry_t *entry, unsigned int code)
+{
+    return (int)((entry->key_bits[code / 64u] >> (code % 64u)) & 1u);
+}
+
+/** \brief  Set key state as seen by the subscribers of an entry
+ *
+ * \param[in]   entry   polling engine entry
+ * \param[in]   code    key code
+ * \param[in]   value   key value (non-zero is pressed)
+ */
+static void poll_entry_set_key(poll_entry_t *entry, unsigned int code, int value)
+{
+    uint64_t mask = UINT64_C(1) << (code % 64u);
+
+    if (value != 0) {
+        entry->key_bits[code / 64u] |= mask;
+    } else {
+        entry->key_bits[code / 64u] &= ~mask;
+    }
+}
+
+/** \brief  Get monotonic time in nanoseconds
+ *
+ * \return  time in nanoseconds
+ */
+static uint64_t poll_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/** \brief  Get time of a clock in microseconds
+ *
+ * \param[in]   clock_id    clock
+ *
+ * \return  time in microseconds
+ */
+static uint64_t poll_clock_now_us(clockid_t clock_id)
+{
+    struct timespec ts;
+
+    clock_gettime(clock_id, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+/** \brief  Get time of the clock used for the event timestamps of an entry
+ *
+ * \param[in]   entry   polling engine entry
+ *
+ * \return  time in microseconds
+ */
+static uint64_t poll_entry_now_us(const poll_entry_t *entry)
+{
+    return poll_clock_now_us(entry->clock_id);
+}
+
+/** \brief  Update the rolling latency estimate of an entry
+ *
+ * Exponentially weighted average and mean deviation of the delay, in the
+ * manner of the RTP interarrival jitter estimate.
+ *
+ * \param[in]   entry   polling engine entry
+ * \param[in]   delay   delay of a \c SYN_REPORT in microseconds
+ */
+static void poll_entry_update_latency(poll_entry_t *entry, uint64_t delay)
+{
+    double d = (double)delay;
+
+    if (entry->latency_samples == 0) {
+        entry->latency_avg    = d;
+        entry->latency_jitter = 0.0;
+    } else {
+        double dev = d > entry->latency_avg ? d - entry->latency_avg
+                                            : entry->latency_avg - d;
+
+        entry->latency_avg    += (d - entry->latency_avg) / JOY_POLL_LATENCY_WEIGHT;
+        entry->latency_jitter += (dev - entry->latency_jitter) / JOY_POLL_LATENCY_WEIGHT;
+    }
+    entry->latency_last = delay;
+    entry->latency_samples++;
+}
+
+/** \brief  Reset statistics and latency estimate of an entry
+ *
+ * \param[in]   entry   polling engine entry
+ */
+static void poll_entry_reset_stats(poll_entry_t *entry)
+{
+    memset(&(entry->stats), 0, sizeof entry->stats);
+    entry->stats_start     = poll_now_ns();
+    entry->latency_samples = 0;
+}
+
+/** \brief  Get delay histogram bucket of a delay
+ *
+ * \param[in]   delay   delay in microseconds
+ *
+ * \return  bucket index, see \c JOY_POLL_DELAY_BUCKETS
+ */
+static unsigned int poll_delay_bucket(uint64_t delay)
+{
+    /* 0 -> bucket 0, [2^(n-1), 2^n) -> bucket n */
+    unsigned int bucket = delay == 0 ? 0 : 64u - (unsigned int)__builtin_clzll(delay);
+
+    return bucket < JOY_POLL_DELAY_BUCKETS ? bucket : JOY_POLL_DELAY_BUCKETS - 1u;
+}
+
+/** \brief  Count events read from an entry
+ *
+ * Counts the events per type, adds the delay between their kernel timestamp
+ * and now to the delay histogram and updates the latency estimate with the
+ * delay of the \c SYN_REPORT events.
+ *
+ * \param[in]   entry   polling engine entry
+ * \param[in]   events  events
+ * \param[in]   num     number of \a events
+ */
+static void poll_entry_count(poll_entry_t             *entry,
+                             const struct input_event *events,
+                             size_t                    num)
+{
+    joy_poll_stats_t *stats  = &(entry->stats);
+    uint64_t          now_us = poll_entry_now_us(entry);
+    size_t            i;
+
+    stats->events += num;
+    for (i = 0; i < num; i++) {
+        const struct input_event *ev = &events[i];
+        uint64_t                  stamp;
+        uint64_t                  delay;
+
+        if (ev->type < EV_CNT) {
+            stats->events_by_type[ev->type]++;
+        }
+        stamp = (uint64_t)ev->input_event_sec * 1000000u +
+                (uint64_t)ev->input_event_usec;
+        delay = now_us > stamp ? now_us - stamp : 0;
+        stats->delay_hist[poll_delay_bucket(delay)]++;
+        if (delay > stats->delay_us_max) {
+            stats->delay_us_max = delay;
+        }
+        if (ev->type == EV_SYN && ev->code == SYN_REPORT) {
+            poll_entry_update_latency(entry, delay);
+        }
+    }
+}
+
+/** \brief  Count a resync of an entry
+ *
+ * \param[in]   entry   polling engine entry
+ * \param[in]   start   time the resync started (ns)
+ */
+static void poll_entry_count_resync(poll_entry_t *entry, uint64_t start)
+{
+    uint64_t duration = poll_now_ns() - start;
+
+    entry->stats.resyncs++;
+    entry->stats.resync_ns += duration;
+    if (duration > entry->stats.resync_ns_max) {
+        entry->stats.resync_ns_max = duration;
+    }
+}
+
+/** \brief  Publish the state of an entry for lock-free readers
+ *
+ * Writes \c state_published under the seqlock. Only called with
+ * \c poll_mutex held, so there is a single writer.
+ *
+ * \param[in]   entry   polling engine entry
+ */
+static void poll_entry_publish_state(poll_entry_t *entry)
+{
+    unsigned int seq = atomic_load_explicit(&(entry->state_seq), memory_order_relaxed);
+
+    atomic_store_explicit(&(entry->state_seq), seq + 1u, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    entry->state_published = entry->state;
+    atomic_store_explicit(&(entry->state_seq), seq + 2u, memory_order_release);
+}
+
+/** \brief  Initialize state of an entry from its libevdev instance
+ *
+ * libevdev reads the device's state when it is created, so this is the
+ * state subscribers start with.
+ *
+ * \param[in]   entry   polling engine entry
+ */
+static void poll_entry_load_state(poll_entry_t *entry)
+{
+    const joy_dev_info_t *device = entry->device;
+    joy_device_state_t   *state  = &(entry->state);
+    unsigned int          i;
+
+    memset(entry->key_bits,   0, sizeof entry->key_bits);
+    memset(entry->abs_values, 0, sizeof entry->abs_values);
+    joy_device_state_init(state, device);
+    state->generation = entry->generation;
+
+    for (i = 0; i < device->num_buttons; i++) {
+        unsigned int code  = device->button_map[i];
+        int          value = libevdev_get_event_value(entry->evdev, EV_KEY, code);
+
+        poll_entry_set_key(entry, code, value);
+        if (value != 0 && i < state->num_buttons) {
+            state->buttons[i / 32u] |= 1u << (i % 32u);
+        }
+    }
+    for (i = 0; i < device->num_axes; i++) {
+        unsigned int code = device->axis_map[i].code;
+
+        entry->abs_values[code] = libevdev_get_event_value(entry->evdev,
+                                                           EV_ABS, code);
+        if (i < state->num_axes) {
+            state->axes[i] = entry->abs_values[code];
+        }
+    }
+    for (i = 0; i < device->num_hats * 2u; i++) {
+        unsigned int code = device->hat_map[i].code;
+
+        entry->abs_values[code] = libevdev_get_event_value(entry->evdev,
+                                                           EV_ABS, code);
+        if (i < state->num_hats * 2u) {
+            state->hats[i] = entry->abs_values[code];
+        }
+    }
+    for (i = 0; i < state->num_hats; i++) {
+        state->hat_dirs[i] = (uint8_t)joy_dev_info_hat_direction(
+                device, i, state->hats[i * 2u], state->hats[i * 2u + 1u]);
+    }
+    poll_entry_publish_state(entry);
+}
+
+/** \brief  Update the state of an entry with a block of events
+ *
+ * \param[in]   entry   polling engine entry
+ * \param[in]   events  events
+ * \param[in]   num     number of \a events
+ */
+static void poll_entry_decode(poll_entry_t             *entry,
+                              const struct input_event *events,
+                              size_t                    num)
+{
+    size_t i;
+
+    for (i = 0; i < num; i++) {
+        const struct input_event *ev = &events[i];
+
+        if (ev->type == EV_KEY && ev->code < KEY_CNT) {
+            poll_entry_set_key(entry, ev->code, ev->value);
+        } else if (ev->type == EV_ABS && ev->code < ABS_CNT) {
+            entry->abs_values[ev->code] = ev->value;
+        }
+        if (joy_device_state_apply(&(entry->state), entry->device, ev)) {
+            poll_entry_publish_state(entry);
+        }
+    }
+}
+
+/** \brief  Close device of entry and free the slot
+ *
+ * Subscribers get their \c on_closed callback called. Must be called with
+ * \c poll_mutex held.
+ *
+ * \param[in]   entry   polling engine entry
+ */
+static void poll_entry_close(poll_entry_t *entry)
+{
+    size_t s;
+
+    for (s = 0; s < JOY_POLL_MAX_SUBSCRIBERS; s++) {
+        poll_sub_t *sub = &(entry->subs[s]);
+
+        if (sub->id != 0) {
+            if (sub->on_closed != NULL) {
+                sub->on_closed(entry->device, sub->data);
+            }
+            sub->id = 0;
+        }
+    }
+
+    /* before closing, poll_ff_dup_fd() dups the fd under poll_ff_mutex */
+    pthread_mutex_lock(&poll_ff_mutex);
+    entry->ff_device = NULL;
+    entry->ff_count  = 0;
+    pthread_mutex_unlock(&poll_ff_mutex);
+
+    epoll_ctl(poll_epoll_fd, EPOLL_CTL_DEL, entry->fd, NULL);
+    libevdev_free(entry->evdev);
+    close(entry->fd);
+
+    entry->device      = NULL;
+    entry->evdev       = NULL;
+    entry->fd          = -1;
+    entry->ff_writable = false;
+    entry->generation++;
+    /* readers holding a state ref see the device is gone */
+    entry->state.generation = entry->generation;
+    poll_entry_publish_state(entry);
+}
+
+/** \brief  Get options of a device opened without explicit options
+ *
+ * Must be called with \c poll_mutex held.
+ *
+ * \param[in]   device  device info
+ *
+ * \return  options set for the device's GUID, or the defaults
+ */
+static const joy_poll_options_t *poll_options_for_device(const joy_dev_info_t *device)
+{
+    size_t i;
+
+    for (i = 0; i < JOY_POLL_MAX_GUID_OPTIONS; i++) {
+        if (poll_guid_options[i].guid[0] != '\0' &&
+                strcmp(poll_guid_options[i].guid, device->guid_str) == 0) {
+            return &(poll_guid_options[i].options);
+        }
+    }
+    return &poll_default_options;
+}
+
+/** \brief  Set the change suppression thresholds of an entry
+ *
+ * Only the axes get thresholds, hats are digital and pass all changes.
+ * The axes' own \c flat is only used for axes centered on 0: the kernel
+ * sets it for one-sided axes like triggers and pedals too, where the
+ * midpoint is just somewhere along the travel.
+ *
+ * \param[in]   entry   polling engine entry
+ * \param[in]   options options
+ */
+static void poll_entry_set_abs_filter(poll_entry_t             *entry,
+                                      const joy_poll_options_t *options)
+{
+    const joy_dev_info_t *device = entry->device;
+    unsigned int          i;
+
+    entry->abs_filtered      = 0;
+    entry->report_passed     = false;
+    entry->report_suppressed = false;
+    for (i = 0; i < device->num_axes; i++) {
+        const joy_abs_info_t *axis   = &(device->axis_map[i]);
+        poll_abs_filter_t    *filter;
+
+        if (axis->code >= ABS_CNT) {
+            continue;
+        }
+        filter          = &(entry->abs_filter[axis->code]);
+        filter->fuzz    = options->abs_fuzz == JOY_POLL_ABS_DEVICE ? axis->fuzz : options->abs_fuzz;
+        if (options->abs_flat != JOY_POLL_ABS_DEVICE) {
+            filter->flat = options->abs_flat;
+        } else if (axis->minimum < 0 && axis->maximum > 0) {
+            filter->flat = axis->flat;
+        } else {
+            filter->flat = 0;
+        }
+        filter->minimum = axis->minimum;
+        filter->maximum = axis->maximum;
+        filter->center  = (int32_t)(((int64_t)axis->minimum + axis->maximum) / 2);
+        if (filter->fuzz > 0 || filter->flat > 0) {
+            entry->abs_filtered |= UINT64_C(1) << axis->code;
+        }
+    }
+}
+
+/** \brief  Apply options to an open entry
+ *
+ * Must be called with \c poll_mutex held.
+ *
+ * \param[in]   entry   polling engine entry
+ * \param[in]   options options, \c NULL for the defaults
+ */
+static void poll_entry_apply_options(poll_entry_t             *entry,
+                                     const joy_poll_options_t *options)
+{
+    if (options == NULL) {
+        options = poll_options_for_device(entry->device);
+    }
+    if (libevdev_set_clock_id(entry->evdev, (int)options->clock_id) == 0) {
+        entry->clock_id = options->clock_id;
+    } else {
+        fprintf(stderr, "error: failed to set clock of %s, using CLOCK_REALTIME\n",
+                entry->device->path);
+        /* the kernel's default */
+        entry->clock_id = CLOCK_REALTIME;
+    }
+    pthread_mutex_lock(&poll_ff_mutex);
+    entry->ff_clock_id = entry->clock_id;
+    pthread_mutex_unlock(&poll_ff_mutex);
+    if (libevdev_grab(entry->evdev, options->grab ? LIBEVDEV_GRAB : LIBEVDEV_UNGRAB) < 0 &&
+            options->grab) {
+        fprintf(stderr, "error: failed to grab %s\n", entry->device->path);
+    }
+    poll_entry_set_abs_filter(entry, options);
+    /* delays measured against the old clock are meaningless now */
+    poll_entry_reset_stats(entry);
+}
+
+/** \brief  Open device and add to epoll set
+ *
+ * Must be called with \c poll_mutex held.
+ *
+ * \param[in]   device  device info
+ *
+ * \return  entry or \c NULL on failure
+ */
+static poll_entry_t *poll_entry_open(joy_dev_info_t           *device,
+                                     const joy_poll_options_t *options)
+{
+    struct epoll_event  ev;
+    poll_entry_t       *entry = NULL;
+    unsigned int        slot;
+    bool                writable;
+    int                 rc;
+
+    for (slot = 0; slot < JOY_POLL_MAX_DEVICES; slot++) {
+        if (poll_entries[slot].device == NULL) {
+            entry = &poll_entries[slot];
+            break;
+        }
+    }
+    if (entry == NULL) {
+        fprintf(stderr, "error: cannot poll more than %d devices\n",
+                JOY_POLL_MAX_DEVICES);
+        return NULL;
+    }
+
+    /* writable for force feedback, if permissions allow */
+    writable  = true;
+    entry->fd = open(device->path, O_RDWR|O_NONBLOCK|O_CLOEXEC);
+    if (entry->fd < 0 && (errno == EACCES || errno == EPERM || errno == EROFS)) {
+        writable  = false;
+        entry->fd = open(device->path, O_RDONLY|O_NONBLOCK|O_CLOEXEC);
+    }
+    if (entry->fd < 0) {
+        fprintf(stderr,
+                "error: failed to open %s: %s\n",
+                device->path, strerror(errno));
+        return NULL;
+    }
+    rc = libevdev_new_from_fd(entry->fd, &(entry->evdev));
+    if (rc < 0) {
+        fprintf(stderr, "failed to initialize evdev: %s\n", strerror(-rc));
+        close(entry->fd);
+        entry->fd = -1;
+        return NULL;
+    }
+
+    memset(&ev, 0, sizeof ev);
+    ev.events   = EPOLLIN;
+    ev.data.u64 = poll_entry_key(slot);
+    if (epoll_ctl(poll_epoll_fd, EPOLL_CTL_ADD, entry->fd, &ev) < 0) {
+        fprintf(stderr, "error: failed to add %s to epoll set: %s\n",
+                device->path, strerror(errno));
+        libevdev_free(entry->evdev);
+        close(entry->fd);
+        entry->evdev = NULL;
+        entry->fd    = -1;
+        return NULL;
+    }
+    entry->device      = device;
+    entry->dropped     = false;
+    entry->ff_writable = writable && libevdev_has_event_type(entry->evdev, EV_FF);
+    entry->masked      = false;
+    poll_entry_apply_options(entry, options);
+    poll_entry_load_state(entry);
+
+    pthread_mutex_lock(&poll_ff_mutex);
+    entry->ff_device   = entry->ff_writable ? device : NULL;
+    entry->ff_count    = 0;
+    entry->ff_rejected = 0;
+    pthread_mutex_unlock(&poll_ff_mutex);
+    return entry;
+}
+
+/** \brief  Set the kernel's event mask of an entry
+ *
+ * \param[in]   entry   polling engine entry
+ * \param[in]   mask    events to pass
+ *
+ * \return  \c false if the kernel doesn't support \c EVIOCSMASK
+ */
+static bool poll_entry_set_mask(poll_entry_t *entry, const joy_poll_filter_t *mask)
+{
+    struct input_mask im;
+
+    /* type 0 masks the event types */
+    im.type       = 0;
+    im.codes_size = sizeof mask->types;
+    im.codes_ptr  = (uint64_t)(uintptr_t)&(mask->types);
+    if (ioctl(entry->fd, EVIOCSMASK, &im) < 0) {
+        return false;
+    }
+    im.type       = EV_KEY;
+    im.codes_size = sizeof mask->keys;
+    im.codes_ptr  = (uint64_t)(uintptr_t)mask->keys;
+    ioctl(entry->fd, EVIOCSMASK, &im);
+    im.type       = EV_ABS;
+    im.codes_size = sizeof mask->abs;
+    im.codes_ptr  = (uint64_t)(uintptr_t)&(mask->abs);
+    ioctl(entry->fd, EVIOCSMASK, &im);
+    return true;
+}
+
+/** \brief  Update the kernel's event mask of an entry from its subscribers
+ *
+ * Passes the union of the subscribers' filters. Everything passes while any
+ * subscriber has no filter, or there are no subscribers, so the published
+ * state stays complete for readers that don't subscribe. Must be called with
+ * \c poll_mutex held.
+ *
+ * \param[in]   entry   polling engine entry
+ */
+static void poll_entry_update_mask(poll_entry_t *entry)
+{
+    joy_poll_filter_t mask;
+    bool              all  = true;
+    size_t            s;
+    size_t            w;
+
+    memset(&mask, 0, sizeof mask);
+    for (s = 0; s < JOY_POLL_MAX_SUBSCRIBERS; s++) {
+        const poll_sub_t *sub = &(entry->subs[s]);
+
+        if (sub->id == 0) {
+            continue;
+        }
+        if (!sub->filtered) {
+            all = true;
+            break;
+        }
+        all         = false;
+        mask.types |= sub->filter.types;
+        mask.abs   |= sub->filter.abs;
+        for (w = 0; w < JOY_POLL_FILTER_KEY_WORDS; w++) {
+            mask.keys[w] |= sub->filter.keys[w];
+        }
+    }
+    if (all) {
+        if (!entry->masked) {
+            return;
+        }
+        poll_filter_set_all(&mask);
+    } else {
+        /* reports and SYN_DROPPED are needed to apply and resync the state */
+        mask.types |= 1u << EV_SYN;
+        if (entry->masked && memcmp(&mask, &(entry->mask), sizeof mask) == 0) {
+            return;
+        }
+    }
+    if (poll_mask_unsupported) {
+        return;
+    }
+    if (!poll_entry_set_mask(entry, &mask)) {
+        fprintf(stderr, "error: EVIOCSMASK failed on %s, not filtering events: %s\n",
+                entry->device->path, strerror(errno));
+        poll_mask_unsupported = true;
+        return;
+    }
+    entry->mask   = mask;
+    entry->masked = !all;
+}
+
+/** \brief  Hand events to the subscribers of an entry
+ *
+ * \param[in]   entry   polling engine entry
+ * \param[in]   events  events
+ * \param[in]   num     number of \a events
+ * \param[in]   raw     hand \a events to the raw subscribers, else to the
+ *                      others
+ */
+static void poll_entry_publish(poll_entry_t             *entry,
+                               const struct input_event *events,
+                               size_t                    num,
+                               bool                      raw)
+{
+    size_t s;
+
+    for (s = 0; s < JOY_POLL_MAX_SUBSCRIBERS; s++) {
+        poll_sub_t *sub = &(entry->subs[s]);
+
+        if (sub->id != 0 && sub->on_events != NULL && sub->raw == raw) {
+            sub->on_events(entry->device, events, num, sub->data);
+        }
+    }
+}
+
+/** \brief  Drop axis changes below the thresholds of an entry from a block
+ *
+ * Values within \c flat of the center are set to the center, changes up to
+ * \c fuzz from the value subscribers last saw are dropped unless they reach
+ * the center or an end of the range, so a stick coming to rest always
+ * reports it. A \c SYN_REPORT is dropped as well when every event of its
+ * report was, to not wake up consumers for nothing. The block is compacted
+ * in place.
+ *
+ * \param[in]       entry   polling engine entry
+ * \param[in,out]   events  events
+ * \param[in]       num     number of \a events
+ *
+ * \return  number of events left in \a events
+ */
+static size_t poll_entry_suppress(poll_entry_t       *entry,
+                                  struct input_event *events,
+                                  size_t              num)
+{
+    joy_poll_stats_t *stats = &(entry->stats);
+    size_t            kept  = 0;
+    size_t            i;
+
+    for (i = 0; i < num; i++) {
+        struct input_event *ev = &events[i];
+
+        if (ev->type == EV_ABS && ev->code < ABS_CNT &&
+                ((entry->abs_filtered >> ev->code) & 1u)) {
+            const poll_abs_filter_t *filter = &(entry->abs_filter[ev->code]);
+            int32_t                  value  = ev->value;
+            int64_t                  delta;
+
+            if (value != filter->center &&
+                    llabs((int64_t)value - filter->center) <= filter->flat) {
+                value     = filter->center;
+                ev->value = value;
+                stats->abs_flattened++;
+            }
+            delta = llabs((int64_t)value - entry->abs_values[ev->code]);
+            if (delta == 0 ||
+                    (delta <= filter->fuzz &&
+                     value != filter->center &&
+                     value != filter->minimum &&
+                     value != filter->maximum)) {
+                stats->abs_suppressed++;
+                entry->report_suppressed = true;
+                continue;
+            }
+            /* the next event of this axis in the block compares against it */
+            entry->abs_values[ev->code] = value;
+            entry->report_passed        = true;
+        } else if (ev->type == EV_SYN && ev->code == SYN_REPORT) {
+            bool empty = entry->report_suppressed && !entry->report_passed;
+
+            entry->report_passed     = false;
+            entry->report_suppressed = false;
+            if (empty) {
+                stats->syn_suppressed++;
+                continue;
+            }
+        } else {
+            entry->report_passed = true;
+        }
+        if (kept != i) {
+            events[kept] = *ev;
+        }
+        kept++;
+    }
+    return kept;
+}
+
+/** \brief  Publish a block of events and decode it into the entry's state
+ *
+ * \param[in]   entry   polling engine entry
+ * \param[in]   events  events, changes below the entry's thresholds are
+ *                      removed
+ * \param[in]   num     number of \a events
+ */
+static void poll_entry_emit(poll_entry_t       *entry,
+                            struct input_event *events,
+                            size_t              num)
+{
+    if (num > 0) {
+        /* the block is suppressed in place, raw subscribers see it first */
+        poll_entry_publish(entry, events, num, true);
+    }
+    if (entry->abs_filtered != 0) {
+        num = poll_entry_suppress(entry, events, num);
+    }
+    if (num > 0) {
+        poll_entry_decode(entry, events, num);
+        poll_entry_publish(entry, events, num, false);
+    }
+}
+
+/** \brief  Append event to a buffer, emitting the buffer when full
+ *
+ * \param[in]       entry   polling engine entry
+ * \param[in,out]   events  buffer of \c POLL_BATCH_SIZE events
+ * \param[in,out]   num     number of events in \a events
+ * \param[in]       time    event timestamp
+ * \param[in]       type    event type
+ * \param[in]       code    event code
+ * \param[in]       value   event value
+ */
+static void poll_entry_append(poll_entry_t             *entry,
+                              struct input_event       *events,
+                              size_t                   *num,
+                              const struct input_event *time,
+                              unsigned int              type,
+                              unsigned int              code,
+                              int                       value)
+{
+    struct input_event *ev = &events[*num];
+
+    ev->input_event_sec  = time->input_event_sec;
+    ev->input_event_usec = time->input_event_usec;
+    ev->type             = (uint16_t)type;
+    ev->code             = (uint16_t)code;
+    ev->value            = value;
+    if (++(*num) == POLL_BATCH_SIZE) {
+        poll_entry_emit(entry, events, *num);
+        *num = 0;
+    }
+}
+
+/** \brief  Resynchronize entry after the kernel dropped events
+ *
+ * Has libevdev query the device's current state and emits the differences
+ * between that state and the state the subscribers have seen, followed by a
+ * \c SYN_REPORT. The events libevdev generates while syncing are ignored
+ * since libevdev's own state is stale when reading raw.
+ *
+ * \param[in]   entry   polling engine entry
+ * \param[in]   dropped the \c SYN_DROPPED event, used for timestamps
+ *
+ * \return  number of events emitted
+ */
+static int poll_entry_resync(poll_entry_t *entry, const struct input_event *dropped)
+{
+    const joy_dev_info_t *device = entry->device;
+    struct input_event    events[POLL_BATCH_SIZE];
+    struct input_event    ev;
+    size_t                num   = 0;
+    int                   total = 0;
+    uint64_t              start = poll_now_ns();
+    unsigned int          i;
+    int                   rc;
+
+    rc = libevdev_next_event(entry->evdev, LIBEVDEV_READ_FLAG_FORCE_SYNC, &ev);
+    while (rc == LIBEVDEV_READ_STATUS_SYNC) {
+        rc = libevdev_next_event(entry->evdev, LIBEVDEV_READ_FLAG_SYNC, &ev);
+    }
+
+    for (i = 0; i < device->num_buttons; i++) {
+        unsigned int code  = device->button_map[i];
+        int          value = libevdev_get_event_value(entry->evdev, EV_KEY, code);
+
+        if (entry->masked && !poll_filter_has(&(entry->mask), EV_KEY, code)) {
+            continue;
+        }
+        if ((value != 0) != (poll_entry_get_key(entry, code) != 0)) {
+            poll_entry_append(entry, events, &num, dropped, EV_KEY, code, value);
+            total++;
+        }
+    }
+    for (i = 0; i < device->num_axes + device->num_hats * 2u; i++) {
+        unsigned int code;
+        int          value;
+
+        if (i < device->num_axes) {
+            code = device->axis_map[i].code;
+        } else {
+            code = device->hat_map[i - device->num_axes].code;
+        }
+        if (entry->masked && !poll_filter_has(&(entry->mask), EV_ABS, code)) {
+            continue;
+        }
+        value = libevdev_get_event_value(entry->evdev, EV_ABS, code);
+        if (value != entry->abs_values[code]) {
+            poll_entry_append(entry, events, &num, dropped, EV_ABS, code, value);
+            total++;
+        }
+    }
+    poll_entry_append(entry, events, &num, dropped, EV_SYN, SYN_REPORT, 0);
+    poll_entry_emit(entry, events, num);
+    poll_entry_count_resync(entry, start);
+    return total + 1;
+}
+
+/** \brief  Read all pending events of an entry using raw reads
+ *
+ * Reads blocks of events directly from the fd and publishes them without
+ * copying. libevdev is only used to resync after a \c SYN_DROPPED, which
+ * replaces the events still in the block with the device's live state.
+ *
+ * \param[in]   entry   polling engine entry
+ *
+ * \return  number of events read
+ */
+static int poll_entry_read_raw(poll_entry_t *entry)
+{
+    struct input_event events[POLL_BATCH_SIZE];
+    int                total = 0;
+
+    while (true) {
+        ssize_t bytes;
+        size_t  num;
+        size_t  start = 0;
+        size_t  i;
+
+        bytes = read(entry->fd, events, sizeof events);
+        if (bytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            /* EAGAIN: done, anything else: handled by EPOLLHUP/EPOLLERR */
+            break;
+        }
+        num = (size_t)bytes / sizeof events[0];
+        if (num == 0) {
+            break;
+        }
+        poll_entry_count(entry, events, num);
+
+        for (i = 0; i < num; i++) {
+            const struct input_event *ev = &events[i];
+
+            if (ev->type != EV_SYN) {
+                continue;
+            }
+            if (ev->code == SYN_DROPPED) {
+                entry->stats.syn_dropped++;
+                if (!entry->dropped) {
+                    poll_entry_emit(entry, events + start, i - start);
+                    total += (int)(i - start);
+                }
+                entry->dropped = true;
+                start = i + 1u;
+            } else if (ev->code == SYN_REPORT && entry->dropped) {
+                /* events up to and including this SYN_REPORT are incomplete */
+                entry->dropped = false;
+                total += poll_entry_resync(entry, ev);
+                /* the resync drained the kernel's queue and loaded the live
+                 * state, the rest of the block is older than that */
+                start = num;
+                break;
+            }
+        }
+        if (!entry->dropped && start < num) {
+            poll_entry_emit(entry, events + start, num - start);
+            total += (int)(num - start);
+        }
+        if (num < POLL_BATCH_SIZE) {
+            /* short read: no more events pending */
+            break;
+        }
+    }
+    return total;
+}
+
+/** \brief  Read all pending events of an entry using libevdev
+ *
+ * \param[in]   entry   polling engine entry
+ *
+ * \return  number of events read
+ */
+static int poll_entry_read_libevdev(poll_entry_t *entry)
+{
+    struct input_event events[POLL_BATCH_SIZE];
+    size_t             num   = 0;
+    int                total = 0;
+    int                rc;
+
+    while (true) {
+        rc = libevdev_next_event(entry->evdev,
+                                 LIBEVDEV_READ_FLAG_NORMAL,
+                                 &events[num]);
+        if (rc == LIBEVDEV_READ_STATUS_SYNC) {
+            uint64_t start = poll_now_ns();
+
+            entry->stats.syn_dropped++;
+            /* the sync events bring subscribers back to the device's state */
+            do {
+                if (++num == POLL_BATCH_SIZE) {
+                    poll_entry_emit(entry, events, num);
+                    total += (int)num;
+                    num    = 0;
+                }
+                rc = libevdev_next_event(entry->evdev,
+                                         LIBEVDEV_READ_FLAG_SYNC,
+                                         &events[num]);
+            } while (rc == LIBEVDEV_READ_STATUS_SYNC);
+            poll_entry_count_resync(entry, start);
+        } else if (rc == LIBEVDEV_READ_STATUS_SUCCESS) {
+            poll_entry_count(entry, &events[num], 1);
+            if (++num == POLL_BATCH_SIZE) {
+                poll_entry_emit(entry, events, num);
+                total += (int)num;
+                num    = 0;
+            }
+        } else {
+            /* -EAGAIN or a real error */
+            break;
+        }
+    }
+    if (num > 0) {
+        poll_entry_emit(entry, events, num);
+        total += (int)num;
+    }
+    return total;
+}
+
+/** \brief  Read all pending events of an entry and publish them
+ *
+ * \param[in]   entry   polling engine entry
+ *
+ * \return  number of events read
+ */
+static int poll_entry_read(poll_entry_t *entry)
+{
+    int num;
+
+    if (poll_read_method == JOY_READ_LIBEVDEV) {
+        num = poll_entry_read_libevdev(entry);
+    } else {
+        num = poll_entry_read_raw(entry);
+    }
+    entry->stats.wakeups++;
+    if ((uint64_t)num > entry->stats.wakeup_events_max) {
+        entry->stats.wakeup_events_max = (uint64_t)num;
+    }
+    return num;
+}
+
+
+/** \brief  Write the queued force feedback events of an entry
+ *
+ * All queued events go out in a single write(), the kernel starts or stops
+ * an effect for each. Must be called with \c poll_mutex held.
+ *
+ * \param[in]   entry   polling engine entry
+ */
+static void poll_entry_ff_flush(poll_entry_t *entry)
+{
+    struct input_event events[JOY_POLL_FF_QUEUE_SIZE];
+    poll_ff_cmd_t      queue[JOY_POLL_FF_QUEUE_SIZE];
+    joy_poll_stats_t  *stats = &(entry->stats);
+    ssize_t            written;
+    size_t             count;
+    size_t             num;
+    uint64_t           now_us;
+    unsigned int       i;
+
+    /* take the queue, the write happens without poll_ff_mutex */
+    pthread_mutex_lock(&poll_ff_mutex);
+    count = entry->ff_count;
+    memcpy(queue, entry->ff_queue, count * sizeof queue[0]);
+    entry->ff_count     = 0;
+    stats->ff_dropped  += entry->ff_rejected;
+    entry->ff_rejected  = 0;
+    pthread_mutex_unlock(&poll_ff_mutex);
+    if (count == 0) {
+        return;
+    }
+
+    memset(events, 0, sizeof events);
+    for (i = 0; i < count; i++) {
+        events[i].type  = EV_FF;
+        events[i].code  = queue[i].effect;
+        events[i].value = queue[i].value;
+    }
+    do {
+        written = write(entry->fd, events, count * sizeof events[0]);
+    } while (written < 0 && errno == EINTR);
+
+    now_us = poll_entry_now_us(entry);
+    num    = written > 0 ? (size_t)written / sizeof events[0] : 0;
+    stats->ff_writes++;
+    stats->ff_events  += num;
+    stats->ff_dropped += count - num;
+    for (i = 0; i < num; i++) {
+        uint64_t cause = queue[i].cause_us;
+        uint64_t delay = now_us > cause ? now_us - cause : 0;
+
+        stats->ff_delay_hist[poll_delay_bucket(delay)]++;
+        if (delay > stats->ff_delay_us_max) {
+            stats->ff_delay_us_max = delay;
+        }
+    }
+}
+
+/** \brief  Write the queued force feedback events of all entries
+ *
+ * Must be called with \c poll_mutex held.
+ */
+static void poll_ff_flush(void)
+{
+    unsigned int slot;
+
+    if (!atomic_exchange(&poll_ff_pending, false)) {
+        return;
+    }
+    for (slot = 0; slot < JOY_POLL_MAX_DEVICES; slot++) {
+        if (poll_entries[slot].ff_writable) {
+            poll_entry_ff_flush(&poll_entries[slot]);
+        }
+    }
+}
+
+
+/** \brief  Initialize polling engine
+ *
+ * \return  \c true on success
+ */
+bool joy_poll_init(void)
+{
+    struct epoll_event ev;
+    unsigned int       slot;
+
+    if (poll_epoll_fd >= 0) {
+        return true;
+    }
+
+    for (slot = 0; slot < JOY_POLL_MAX_DEVICES; slot++) {
+        /* keep generations, state refs from before a shutdown stay stale */
+        uint32_t generation = poll_entries[slot].generation;
+
+        memset(&poll_entries[slot], 0, sizeof poll_entries[slot]);
+        poll_entries[slot].fd                         = -1;
+        poll_entries[slot].generation                 = generation;
+        poll_entries[slot].state_published.generation = generation;
+    }
+
+    poll_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (poll_epoll_fd < 0) {
+        fprintf(stderr, "error: failed to create epoll instance: %s\n",
+                strerror(errno));
+        return false;
+    }
+    poll_wake_fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+    if (poll_wake_fd < 0) {
+        fprintf(stderr, "error: failed to create eventfd: %s\n",
+                strerror(errno));
+        close(poll_epoll_fd);
+        poll_epoll_fd = -1;
+        return false;
+    }
+    memset(&ev, 0, sizeof ev);
+    ev.events   = EPOLLIN;
+    ev.data.u64 = POLL_WAKE_KEY;
+    epoll_ctl(poll_epoll_fd, EPOLL_CTL_ADD, poll_wake_fd, &ev);
+
+    atomic_init(&poll_thread_quit, false);
+    return true;
+}
+
+
+/** \brief  Shut down polling engine
+ *
+ * Stops the reader thread, if running, and closes all devices.
+ */
+void joy_poll_shutdown(void)
+{
+    unsigned int slot;
+
+    if (poll_epoll_fd < 0) {
+        return;
+    }
+    joy_poll_thread_stop();
+
+    pthread_mutex_lock(&poll_mutex);
+    for (slot = 0; slot < JOY_POLL_MAX_DEVICES; slot++) {
+        if (poll_entries[slot].device != NULL) {
+            poll_entry_close(&poll_entries[slot]);
+        }
+    }
+    pthread_mutex_unlock(&poll_mutex);
+
+    close(poll_wake_fd);
+    close(poll_epoll_fd);
+    poll_wake_fd  = -1;
+    poll_epoll_fd = -1;
+}
+
+
+/** \brief  Open device and add it to the polling engine
+ *
+ * \param[in]   device  device info
+ *
+ * \return  \c true on success or if \a device was already added
+ */
+bool joy_poll_add_device(joy_dev_info_t *device)
+{
+    bool result;
+
+    if (poll_epoll_fd < 0 || device == NULL) {
+        return false;
+    }
+    pthread_mutex_lock(&poll_mutex);
+    result = poll_entry_find(device) != NULL || poll_entry_open(device, NULL) != NULL;
+    pthread_mutex_unlock(&poll_mutex);
+    return result;
+}
+
+
+/** \brief  Initialize device options with the defaults
+ *
+ * \param[out]  options options
+ */
+void joy_poll_options_init(joy_poll_options_t *options)
+{
+    options->clock_id = CLOCK_MONOTONIC;
+    options->grab     = false;
+    options->abs_fuzz = 0;
+    options->abs_flat = JOY_POLL_ABS_DEVICE;
+}
+
+
+/** \brief  Get name of a clock usable for event timestamps
+ *
+ * \param[in]   clock_id    clock ID
+ *
+ * \return  name ("monotonic", "boottime" or "realtime"), "?" if unknown
+ */
+const char *joy_poll_clock_name(clockid_t clock_id)
+{
+    switch (clock_id) {
+        case CLOCK_MONOTONIC:
+            return "monotonic";
+        case CLOCK_BOOTTIME:
+            return "boottime";
+        case CLOCK_REALTIME:
+            return "realtime";
+        default:
+            return "?";
+    }
+}
+
+
+/** \brief  Parse name of a clock usable for event timestamps
+ *
+ * \param[in]   name        clock name, see joy_poll_clock_name()
+ * \param[out]  clock_id    clock ID
+ *
+ * \return  \c true if \a name is valid
+ */
+bool joy_poll_parse_clock(const char *name, clockid_t *clock_id)
+{
+    static const clockid_t clocks[] = {
+        CLOCK_MONOTONIC, CLOCK_BOOTTIME, CLOCK_REALTIME
+    };
+    size_t i;
+
+    for (i = 0; i < ARRAY_LEN(clocks); i++) {
+        if (strcmp(name, joy_poll_clock_name(clocks[i])) == 0) {
+            *clock_id = clocks[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/** \brief  Parse axis change suppression thresholds
+ *
+ * \a text is "device" for the thresholds of each axis, "off" to pass all
+ * changes, or "<fuzz>,<flat>" with each part a number or "device".
+ *
+ * \param[in]       text    thresholds
+ * \param[in,out]   options options to set \c abs_fuzz and \c abs_flat of
+ *
+ * \return  \c true if \a text is valid
+ */
+bool joy_poll_parse_abs_filter(const char *text, joy_poll_options_t *options)
+{
+    int32_t     values[2];
+    const char *p = text;
+    size_t      i;
+
+    if (strcmp(text, "off") == 0) {
+        options->abs_fuzz = 0;
+        options->abs_flat = 0;
+        return true;
+    }
+    if (strcmp(text, "device") == 0) {
+        options->abs_fuzz = JOY_POLL_ABS_DEVICE;
+        options->abs_flat = JOY_POLL_ABS_DEVICE;
+        return true;
+    }
+    for (i = 0; i < ARRAY_LEN(values); i++) {
+        const char *end;
+        char       *num_end;
+        long        value;
+
+        if (strncmp(p, "device", 6) == 0) {
+            values[i] = JOY_POLL_ABS_DEVICE;
+            end       = p + 6;
+        } else {
+            errno = 0;
+            value = strtol(p, &num_end, 10);
+            end   = num_end;
+            if (end == p || errno != 0 || value < 0 || value > INT32_MAX) {
+                return false;
+            }
+            values[i] = (int32_t)value;
+        }
+        if (*end != (i == 0 ? ',' : '\0')) {
+            return false;
+        }
+        p = end + 1;
+    }
+    options->abs_fuzz = values[0];
+    options->abs_flat = values[1];
+    return true;
+}
+
+
+/** \brief  Set options for devices with a GUID opened without explicit options
+ *
+ * Take precedence over the defaults, doesn't affect devices already opened.
+ *
+ * \param[in]   guid    GUID as hex string, see \c guid_str of the device info
+ * \param[in]   options options, \c NULL to use the defaults again
+ *
+ * \return  \c false if \a guid is invalid or too many GUIDs have options
+ */
+bool joy_poll_set_guid_options(const char *guid, const joy_poll_options_t *options)
+{
+    poll_guid_options_t *slot = NULL;
+    size_t               i;
+
+    if (strlen(guid) != JOY_GUID_SIZE * 2 ||
+            strspn(guid, "0123456789abcdefABCDEF") != JOY_GUID_SIZE * 2) {
+        return false;
+    }
+    pthread_mutex_lock(&poll_mutex);
+    for (i = 0; i < JOY_POLL_MAX_GUID_OPTIONS; i++) {
+        poll_guid_options_t *entry = &poll_guid_options[i];
+
+        if (strcasecmp(entry->guid, guid) == 0) {
+            slot = entry;
+            break;
+        }
+        if (slot == NULL && entry->guid[0] == '\0') {
+            slot = entry;
+        }
+    }
+    if (slot != NULL) {
+        if (options == NULL) {
+            slot->guid[0] = '\0';
+        } else {
+            /* stored as guid_str has it, for a plain strcmp() on open */
+            for (i = 0; i < JOY_GUID_SIZE * 2; i++) {
+                slot->guid[i] = (char)tolower((unsigned char)guid[i]);
+            }
+            slot->guid[i] = '\0';
+            slot->options = *options;
+        }
+    }
+    pthread_mutex_unlock(&poll_mutex);
+    return slot != NULL || options == NULL;
+}
+
+
+/** \brief  Set options for devices opened without explicit options
+ *
+ * Used by joy_poll_add_device() and joy_poll_subscribe(), doesn't affect
+ * devices already opened.
+ *
+ * \param[in]   options options
+ */
+void joy_poll_set_default_options(const joy_poll_options_t *options)
+{
+    pthread_mutex_lock(&poll_mutex);
+    poll_default_options = *options;
+    pthread_mutex_unlock(&poll_mutex);
+}
+
+
+/** \brief  Add device to the polling engine with options
+ *
+ * If the device was already added, the options are applied to it.
+ *
+ * \param[in]   device  device info
+ * \param[in]   options options, \c NULL for the defaults
+ *
+ * \return  \c true on success
+ */
+bool joy_poll_add_device_with_options(joy_dev_info_t           *device,
+                                      const joy_poll_options_t *options)
+{
+    poll_entry_t *entry;
+
+    if (poll_epoll_fd < 0 || device == NULL) {
+        return false;
+    }
+    pthread_mutex_lock(&poll_mutex);
+    entry = poll_entry_find(device);
+    if (entry != NULL) {
+        poll_entry_apply_options(entry, options);
+    } else {
+        entry = poll_entry_open(device, options);
+    }
+    pthread_mutex_unlock(&poll_mutex);
+    return entry != NULL;
+}
+
+
+/** \brief  Remove device from the polling engine and close it
+ *
+ * The subscribers of \a device get their \c on_closed callback called.
+ *
+ * \param[in]   device  device info
+ */
+void joy_poll_remove_device(joy_dev_info_t *device)
+{
+    poll_entry_t *entry;
+
+    if (poll_epoll_fd < 0 || device == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&poll_mutex);
+    entry = poll_entry_find(device);
+    if (entry != NULL) {
+        poll_entry_close(entry);
+    }
+    pthread_mutex_unlock(&poll_mutex);
+}
+
+
+/** \brief  Get polling engine state of device
+ *
+ * \param[in]   device  device info
+ *
+ * \return  state
+ */
+joy_poll_state_t joy_poll_get_device_state(const joy_dev_info_t *device)
+{
+    joy_poll_state_t state;
+
+    pthread_mutex_lock(&poll_mutex);
+    state = poll_entry_find(device) != NULL ? JOY_POLL_OPEN : JOY_POLL_CLOSED;
+    pthread_mutex_unlock(&poll_mutex);
+    return state;
+}
+
+
+/** \brief  Initialize filter to pass only \c EV_SYN events
+ *
+ * \param[out]  filter  filter
+ */
+void joy_poll_filter_init(joy_poll_filter_t *filter)
+{
+    memset(filter, 0, sizeof *filter);
+    filter->types = 1u << EV_SYN;
+}
+
+/** \brief  Add event to a filter
+ *
+ * \param[in,out]  filter  filter
+ * \param[in]      type    event type
+ * \param[in]      code    event code, ignored for types other than
+ *                          \c EV_KEY and \c EV_ABS
+ */
+void joy_poll_filter_add(joy_poll_filter_t *filter,
+                         unsigned int       type,
+                         unsigned int       code)
+{
+    if (type >= EV_CNT) {
+        return;
+    }
+    filter->types |= 1u << type;
+    if (type == EV_KEY && code < KEY_CNT) {
+        filter->keys[code / 64u] |= (uint64_t)1 << (code % 64u);
+    } else if (type == EV_ABS && code < ABS_CNT) {
+        filter->abs |= (uint64_t)1 << code;
+    }
+}
+
+/** \brief  Add the buttons, axes and hats of a device to a filter
+ *
+ * Leaves out everything else the device reports, such as \c EV_MSC scan
+ * codes.
+ *
+ * \param[in,out]  filter  filter
+ * \param[in]      device  device info
+ */
+void joy_poll_filter_add_device(joy_poll_filter_t    *filter,
+                                const joy_dev_info_t *device)
+{
+    unsigned int i;
+
+    for (i = 0; i < device->num_buttons; i++) {
+        joy_poll_filter_add(filter, EV_KEY, device->button_map[i]);
+    }
+    for (i = 0; i < device->num_axes; i++) {
+        joy_poll_filter_add(filter, EV_ABS, device->axis_map[i].code);
+    }
+    for (i = 0; i < device->num_hats * 2u; i++) {
+        joy_poll_filter_add(filter, EV_ABS, device->hat_map[i].code);
+    }
+}
+
+/** \brief  Add subscription to a device
+ *
+ * \param[in]   device      device info
+ * \param[in]   filter      events wanted, \c NULL for all
+ * \param[in]   raw         wants events before change suppression
+ * \param[in]   on_events   callback for events (can be \c NULL)
+ * \param[in]   on_closed   callback for device closed (can be \c NULL)
+ * \param[in]   data        data for the callbacks
+ *
+ * \return  subscription ID (> 0) or -1 on error
+ */
+static int poll_subscribe(joy_dev_info_t          *device,
+                          const joy_poll_filter_t *filter,
+                          bool                     raw,
+                          joy_poll_events_cb_t     on_events,
+                          joy_poll_closed_cb_t     on_closed,
+                          void                    *data)
+{
+    poll_entry_t *entry;
+    size_t        s;
+    int           id = -1;
+
+    if (poll_epoll_fd < 0 || device == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&poll_mutex);
+    entry = poll_entry_find(device);
+    if (entry == NULL) {
+        entry = poll_entry_open(device, NULL);
+    }
+    if (entry != NULL) {
+        for (s = 0; s < JOY_POLL_MAX_SUBSCRIBERS; s++) {
+            poll_sub_t *sub = &(entry->subs[s]);
+
+            if (sub->id == 0) {
+                id             = poll_next_sub_id++;
+                sub->id        = id;
+                sub->on_events = on_events;
+                sub->on_closed = on_closed;
+                sub->data      = data;
+                sub->filtered  = filter != NULL;
+                sub->raw       = raw;
+                if (filter != NULL) {
+                    sub->filter = *filter;
+                }
+                poll_entry_update_mask(entry);
+                break;
+            }
+        }
+        if (id < 0) {
+            fprintf(stderr, "error: too many subscribers for %s\n",
+                    device->path);
+        }
+    }
+    pthread_mutex_unlock(&poll_mutex);
+    return id;
+}
+
+
+/** \brief  Subscribe to events of a device
+ *
+ * Adds \a device to the polling engine if not added yet.
+ *
+ * \param[in]   device      device info
+ * \param[in]   on_events   callback for events (can be \c NULL)
+ * \param[in]   on_closed   callback for device closed (can be \c NULL)
+ * \param[in]   data        data for the callbacks
+ *
+ * \return  subscription ID (> 0) or -1 on error
+ */
+int joy_poll_subscribe(joy_dev_info_t       *device,
+                       joy_poll_events_cb_t  on_events,
+                       joy_poll_closed_cb_t  on_closed,
+                       void                 *data)
+{
+    return joy_poll_subscribe_filtered(device, NULL, on_events, on_closed, data);
+}
+
+/** \brief  Subscribe to some of the events of a device
+ *
+ * Adds \a device to the polling engine if not added yet. The kernel is told
+ * to drop the events no subscriber of \a device wants, so subscribers can
+ * still get events outside \a filter that other subscribers want.
+ *
+ * \param[in]   device      device info
+ * \param[in]   filter      events wanted, \c NULL for all
+ * \param[in]   on_events   callback for events (can be \c NULL)
+ * \param[in]   on_closed   callback for device closed (can be \c NULL)
+ * \param[in]   data        data for the callbacks
+ *
+ * \return  subscription ID (> 0) or -1 on error
+ */
+int joy_poll_subscribe_filtered(joy_dev_info_t          *device,
+                                const joy_poll_filter_t *filter,
+                                joy_poll_events_cb_t     on_events,
+                                joy_poll_closed_cb_t     on_closed,
+                                void                    *data)
+{
+    return poll_subscribe(device, filter, false, on_events, on_closed, data);
+}
+
+/** \brief  Subscribe to the events of a device as read from the kernel
+ *
+ * Like joy_poll_subscribe(), but the events aren't subject to the device's
+ * axis change suppression (\c abs_fuzz and \c abs_flat), for consumers such
+ * as recorders that must see the raw stream. Raw subscribers are called
+ * before the state of the events is published.
+ *
+ * \param[in]   device      device info
+ * \param[in]   on_events   callback for events (can be \c NULL)
+ * \param[in]   on_closed   callback for device closed (can be \c NULL)
+ * \param[in]   data        data for the callbacks
+ *
+ * \return  subscription ID (> 0) or -1 on error
+ */
+int joy_poll_subscribe_raw(joy_dev_info_t       *device,
+                           joy_poll_events_cb_t  on_events,
+                           joy_poll_closed_cb_t  on_closed,
+                           void                 *data)
+{
+    return poll_subscribe(device, NULL, true, on_events, on_closed, data);
+}
+
+
+/** \brief  Remove subscription
+ *
+ * The \c on_closed callback isn't called. The device stays open.
+ *
+ * \param[in]   id  subscription ID returned by joy_poll_subscribe()
+ */
+void joy_poll_unsubscribe(int id)
+{
+    unsigned int slot;
+    size_t       s;
+
+    if (id <= 0) {
+        return;
+    }
+    pthread_mutex_lock(&poll_mutex);
+    for (slot = 0; slot < JOY_POLL_MAX_DEVICES; slot++) {
+        for (s = 0; s < JOY_POLL_MAX_SUBSCRIBERS; s++) {
+            if (poll_entries[slot].subs[s].id == id) {
+                poll_entries[slot].subs[s].id = 0;
+                poll_entry_update_mask(&poll_entries[slot]);
+            }
+        }
+    }
+    pthread_mutex_unlock(&poll_mutex);
+}
+
+
+/** \brief  Change the events a subscription wants
+ *
+ * \param[in]   id      subscription ID returned by joy_poll_subscribe()
+ * \param[in]   filter  events wanted, \c NULL for all
+ */
+void joy_poll_set_filter(int id, const joy_poll_filter_t *filter)
+{
+    unsigned int slot;
+    size_t       s;
+
+    if (id <= 0) {
+        return;
+    }
+    pthread_mutex_lock(&poll_mutex);
+    for (slot = 0; slot < JOY_POLL_MAX_DEVICES; slot++) {
+        for (s = 0; s < JOY_POLL_MAX_SUBSCRIBERS; s++) {
+            poll_sub_t *sub = &(poll_entries[slot].subs[s]);
+
+            if (sub->id == id) {
+                sub->filtered = filter != NULL;
+                if (filter != NULL) {
+                    sub->filter = *filter;
+                }
+                poll_entry_update_mask(&poll_entries[slot]);
+            }
+        }
+    }
+    pthread_mutex_unlock(&poll_mutex);
+}
+
+
+/** \brief  Set method used to read events
+ *
+ * \c JOY_READ_RAW is the default and fastest, \c JOY_READ_LIBEVDEV reads
+ * each event through libevdev and is mostly useful for comparison.
+ *
+ * \param[in]   method  read method
+ */
+void joy_poll_set_read_method(joy_read_method_t method)
+{
+    pthread_mutex_lock(&poll_mutex);
+    poll_read_method = method;
+    pthread_mutex_unlock(&poll_mutex);
+}
+
+
+/** \brief  Get file descriptor of the polling engine
+ *
+ * The fd becomes readable when joy_poll_dispatch() has work to do, for use
+ * with a main loop (eg \c g_unix_fd_add()) when not using the reader thread.
+ *
+ * \return  epoll fd, or -1 when the engine isn't initialized
+ */
+int joy_poll_get_fd(void)
+{
+    return poll_epoll_fd;
+}
+
+
+/** \brief  Wait for events and dispatch them to subscribers
+ *
+ * Performs a single epoll_wait() and reads all pending events of all devices
+ * that are ready. Devices that went away are closed.
+ *
+ * \param[in]   timeout timeout in milliseconds, -1 to block, 0 to not block
+ *
+ * \return  number of events dispatched, or -1 on error
+ */
+int joy_poll_dispatch(int timeout)
+{
+    struct epoll_event ready[JOY_POLL_MAX_DEVICES + 1];
+    int                nready;
+    int                total = 0;
+    int                i;
+
+    if (poll_epoll_fd < 0) {
+        return -1;
+    }
+    nready = epoll_wait(poll_epoll_fd, ready, (int)ARRAY_LEN(ready), timeout);
+    if (nready < 0) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        fprintf(stderr, "error: epoll_wait() failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    pthread_mutex_lock(&poll_mutex);
+    for (i = 0; i < nready; i++) {
+        poll_entry_t *entry;
+
+        if (ready[i].data.u64 == POLL_WAKE_KEY) {
+            uint64_t count;
+
+            if (read(poll_wake_fd, &count, sizeof count) < 0) {
+                /* EAGAIN: someone else already consumed the wake-up */
+            }
+            continue;
+        }
+        entry = poll_entry_from_key(ready[i].data.u64);
+        if (entry == NULL) {
+            continue;
+        }
+        if (ready[i].events & EPOLLIN) {
+            total += poll_entry_read(entry);
+        }
+        if (ready[i].events & (EPOLLHUP|EPOLLERR)) {
+            fprintf(stderr, "Device %s went away.\n", entry->device->path);
+            poll_entry_close(entry);
+        }
+    }
+    /* after reading, so effects triggered by these events go out now */
+    poll_ff_flush();
+    pthread_mutex_unlock(&poll_mutex);
+    return total;
+}
+
+
+/** \brief  Get reference to the published state of a device
+ *
+ * \param[in]   device  device info
+ * \param[out]  ref     state reference
+ *
+ * \return  \c false if \a device isn't watched by the polling engine
+ */
+bool joy_poll_get_state_ref(const joy_dev_info_t *device, joy_state_ref_t *ref)
+{
+    poll_entry_t *entry;
+
+    pthread_mutex_lock(&poll_mutex);
+    entry = poll_entry_find(device);
+    if (entry != NULL) {
+        ref->slot       = (unsigned int)(entry - poll_entries);
+        ref->generation = entry->generation;
+    }
+    pthread_mutex_unlock(&poll_mutex);
+    return entry != NULL;
+}
+
+
+/** \brief  Read state of a device after its last complete report
+ *
+ * Doesn't take the engine's lock, so it can be called at any rate from any
+ * thread without stalling the reader thread. The state is read under a
+ * seqlock and retried if the reader thread published a new state meanwhile.
+ *
+ * \param[in]   ref     state reference from joy_poll_get_state_ref()
+ * \param[out]  state   device state
+ *
+ * \return  \c false if the device was closed, \a state is undefined then
+ */
+bool joy_poll_read_state(const joy_state_ref_t *ref, joy_device_state_t *state)
+{
+    poll_entry_t *entry;
+    unsigned int  seq1;
+    unsigned int  seq2;
+    unsigned int  tries = 0;
+
+    if (ref->slot >= JOY_POLL_MAX_DEVICES) {
+        return false;
+    }
+    entry = &poll_entries[ref->slot];
+    do {
+        seq1 = atomic_load_explicit(&(entry->state_seq), memory_order_acquire);
+        if (seq1 & 1u) {
+            /* writer is copying a few hundred bytes, don't burn a core */
+            if (++tries % 64u == 0) {
+                sched_yield();
+            }
+            seq2 = seq1 + 1u;
+            continue;
+        }
+        *state = entry->state_published;
+        atomic_thread_fence(memory_order_acquire);
+        seq2 = atomic_load_explicit(&(entry->state_seq), memory_order_relaxed);
+    } while (seq1 != seq2);
+
+    return state->generation == ref->generation;
+}
+
+
+/** \brief  Get polling engine statistics of a device
+ *
+ * \param[in]   device  device info
+ * \param[out]  stats   statistics
+ *
+ * \return  \c false if \a device isn't watched by the polling engine
+ */
+bool joy_poll_get_device_stats(const joy_dev_info_t *device,
+                               joy_poll_stats_t     *stats)
+{
+    poll_entry_t *entry;
+
+    pthread_mutex_lock(&poll_mutex);
+    entry = poll_entry_find(device);
+    if (entry != NULL) {
+        *stats            = entry->stats;
+        stats->elapsed_ns = poll_now_ns() - entry->stats_start;
+        stats->clock_id   = entry->clock_id;
+    }
+    pthread_mutex_unlock(&poll_mutex);
+    return entry != NULL;
+}
+
+
+/** \brief  Get rolling latency estimate of a device
+ *
+ * The latency is the delay between the kernel timestamp of a \c SYN_REPORT
+ * and the polling engine reading it, measured with the device's clock.
+ *
+ * \param[in]   device  device info
+ * \param[out]  latency latency estimate
+ *
+ * \return  \c false if \a device isn't watched by the polling engine
+ */
+bool joy_poll_get_device_latency(const joy_dev_info_t *device,
+                                 joy_poll_latency_t   *latency)
+{
+    poll_entry_t *entry;
+
+    pthread_mutex_lock(&poll_mutex);
+    entry = poll_entry_find(device);
+    if (entry != NULL) {
+        latency->average_us = entry->latency_avg;
+        latency->jitter_us  = entry->latency_jitter;
+        latency->last_us    = entry->latency_last;
+        latency->samples    = entry->latency_samples;
+        latency->clock_id   = entry->clock_id;
+    }
+    pthread_mutex_unlock(&poll_mutex);
+    return entry != NULL;
+}
+
+
+/** \brief  Reset polling engine statistics and latency estimate of a device
+ *
+ * \param[in]   device  device info
+ */
+void joy_poll_reset_device_stats(const joy_dev_info_t *device)
+{
+    poll_entry_t *entry;
+
+    pthread_mutex_lock(&poll_mutex);
+    entry = poll_entry_find(device);
+    if (entry != NULL) {
+        poll_entry_reset_stats(entry);
+    }
+    pthread_mutex_unlock(&poll_mutex);
+}
+
+
+/** \brief  Add UI update counts of a subscriber to the statistics of a device
+ *
+ * For subscribers that merge device reports into fewer UI updates, so the
+ * statistics show how much of the event stream actually reaches the screen.
+ *
+ * \param[in]   device      device info
+ * \param[in]   applied     number of UI updates applied
+ * \param[in]   coalesced   number of device reports merged into those
+ */
+void joy_poll_count_ui_updates(const joy_dev_info_t *device,
+                               unsigned long         applied,
+                               unsigned long         coalesced)
+{
+    poll_entry_t *entry;
+
+    pthread_mutex_lock(&poll_mutex);
+    entry = poll_entry_find(device);
+    if (entry != NULL) {
+        entry->stats.ui_applied   += applied;
+        entry->stats.ui_coalesced += coalesced;
+    }
+    pthread_mutex_unlock(&poll_mutex);
+}
+
+
+/*
+ * Force feedback output
+ *
+ * Effects are uploaded once through the device's fd in the polling engine,
+ * which is opened for writing when permissions allow. Playing and stopping
+ * them only queues an event, the queue is written by joy_poll_dispatch() with
+ * a single write() per device, so callers never wait for the device and the
+ * reader is never held up by a slow caller. Effects are erased by the kernel
+ * when the device is closed.
+ */
+
+/** \brief  Find entry of a device that force feedback can be written to
+ *
+ * Must be called with \c poll_ff_mutex held.
+ *
+ * \param[in]   device  device info
+ *
+ * \return  entry or \c NULL
+ */
+static poll_entry_t *poll_ff_entry_find(const joy_dev_info_t *device)
+{
+    unsigned int slot;
+
+    if (device == NULL) {
+        return NULL;
+    }
+    for (slot = 0; slot < JOY_POLL_MAX_DEVICES; slot++) {
+        if (poll_entries[slot].ff_device == device) {
+            return &poll_entries[slot];
+        }
+    }
+    return NULL;
+}
+
+/** \brief  Get a duplicate of the fd of a device with force feedback
+ *
+ * Lets ioctls that can take a while run without holding a lock, the
+ * duplicate shares the open file and so the effects of the engine's fd.
+ *
+ * \param[in]   device  device info
+ *
+ * \return  file descriptor to close after use, or -1
+ */
+static int poll_ff_dup_fd(const joy_dev_info_t *device)
+{
+    poll_entry_t *entry;
+    int           fd = -1;
+
+    pthread_mutex_lock(&poll_ff_mutex);
+    entry = poll_ff_entry_find(device);
+    if (entry != NULL) {
+        fd = fcntl(entry->fd, F_DUPFD_CLOEXEC, 0);
+    }
+    pthread_mutex_unlock(&poll_ff_mutex);
+    return fd;
+}
+
+/** \brief  Determine if force feedback can be used on a device
+ *
+ * \param[in]   device  device info
+ *
+ * \return  \c true if \a device is watched by the polling engine, has force
+ *          feedback and could be opened for writing
+ */
+bool joy_poll_ff_supported(const joy_dev_info_t *device)
+{
+    bool result;
+
+    pthread_mutex_lock(&poll_ff_mutex);
+    result = poll_ff_entry_find(device) != NULL;
+    pthread_mutex_unlock(&poll_ff_mutex);
+    return result;
+}
+
+/** \brief  Upload force feedback effect to a device with \c EVIOCSFF
+ *
+ * \param[in]       device  device info
+ * \param[in,out]   effect  effect, \c id -1 for a new effect, which is set
+ *                          to the ID assigned by the kernel
+ *
+ * \return  effect ID or -1 on error
+ */
+int joy_poll_ff_upload(const joy_dev_info_t *device, struct ff_effect *effect)
+{
+    int fd = poll_ff_dup_fd(device);
+    int rc;
+
+    if (fd < 0) {
+        return -1;
+    }
+    rc = ioctl(fd, EVIOCSFF, effect);
+    if (rc < 0) {
+        fprintf(stderr, "error: failed to upload effect to %s: %s\n",
+                device->path, strerror(errno));
+    }
+    close(fd);
+    return rc < 0 ? -1 : effect->id;
+}
+
+/** \brief  Erase force feedback effect from a device with \c EVIOCRMFF
+ *
+ * \param[in]   device      device info
+ * \param[in]   effect_id   effect ID
+ *
+ * \return  \c true on success
+ */
+bool joy_poll_ff_erase(const joy_dev_info_t *device, int effect_id)
+{
+    int fd = poll_ff_dup_fd(device);
+    int rc;
+
+    if (fd < 0) {
+        return false;
+    }
+    rc = ioctl(fd, EVIOCRMFF, effect_id);
+    close(fd);
+    return rc == 0;
+}
+
+/** \brief  Queue playing or stopping a force feedback effect
+ *
+ * The event is written by the next joy_poll_dispatch(), which is woken up
+ * for it. The delay from \a cause_us to the write is added to the force
+ * feedback delay histogram of the device's statistics, when responding to
+ * input pass the timestamp of that input (eg \c time_us of a state
+ * snapshot or of the event) to measure the round trip.
+ *
+ * Never waits for the reader, only for other callers queueing, so it can be
+ * called from subscriber callbacks, where the event goes out at the end of
+ * the same joy_poll_dispatch().
+ *
+ * \param[in]   device      device info
+ * \param[in]   effect_id   effect ID returned by joy_poll_ff_upload()
+ * \param[in]   count       number of times to play the effect, 0 to stop
+ * \param[in]   cause_us    time on the device's clock to measure the delay
+ *                          from, 0 for now
+ *
+ * \return  \c false if the device has no force feedback or the queue is full
+ */
+bool joy_poll_ff_play(const joy_dev_info_t *device,
+                      int                   effect_id,
+                      int                   count,
+                      uint64_t              cause_us)
+{
+    poll_entry_t *entry;
+    bool          wake   = false;
+    bool          result = false;
+
+    if (effect_id < 0 || effect_id > UINT16_MAX || count < 0) {
+        return false;
+    }
+    pthread_mutex_lock(&poll_ff_mutex);
+    entry = poll_ff_entry_find(device);
+    if (entry != NULL) {
+        if (entry->ff_count < JOY_POLL_FF_QUEUE_SIZE) {
+            poll_ff_cmd_t *cmd = &(entry->ff_queue[entry->ff_count++]);
+
+            cmd->effect   = (uint16_t)effect_id;
+            cmd->value    = count;
+            cmd->cause_us = cause_us != 0 ? cause_us : poll_clock_now_us(entry->ff_clock_id);
+            /* one wake-up per batch */
+            wake   = !atomic_exchange(&poll_ff_pending, true);
+            result = true;
+        } else {
+            entry->ff_rejected++;
+        }
+    }
+    pthread_mutex_unlock(&poll_ff_mutex);
+
+    if (wake) {
+        uint64_t one = 1;
+
+        if (write(poll_wake_fd, &one, sizeof one) < 0) {
+            /* EAGAIN: counter saturated, dispatch is pending anyway */
+        }
+    }
+    return result;
+}
+
+
+/** \brief  Try to raise the scheduling priority of the calling thread
+ *
+ * Tries \c SCHED_FIFO first, which usually requires \c CAP_SYS_NICE or a
+ * suitable \c RLIMIT_RTPRIO, then falls back to lowering the nice value
+ * (which on Linux is a per-thread attribute).
+ */
+static void poll_thread_raise_priority(void)
+{
+#if POLL_THREAD_RT_PRIORITY > 0
+    struct sched_param param;
+    int                rc;
+
+    memset(&param, 0, sizeof param);
+    param.sched_priority = POLL_THREAD_RT_PRIORITY;
+    rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (rc == 0) {
+        return;
+    }
+    if (setpriority(PRIO_PROCESS, 0, POLL_THREAD_NICE) != 0) {
+        int err = errno;
+
+        /* both fail without privileges, report why each did */
+        fprintf(stderr,
+                "Reader thread running at normal priority: SCHED_FIFO: %s, nice: %s\n",
+                strerror(rc), strerror(err));
+    }
+#endif
+}
+
+/** \brief  Reader thread
+ *
+ * \param[in]   arg unused
+ *
+ * \return  \c NULL
+ */
+static void *poll_thread_main(void *arg)
+{
+    (void)arg;
+
+    poll_thread_raise_priority();
+    while (!atomic_load(&poll_thread_quit)) {
+        if (joy_poll_dispatch(-1) < 0) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+
+/** \brief  Start reader thread calling joy_poll_dispatch()
+ *
+ * Subscriber callbacks are called on the reader thread.
+ *
+ * \return  \c true on success or if already running
+ */
+bool joy_poll_thread_start(void)
+{
+    int rc;
+
+    if (poll_epoll_fd < 0) {
+        return false;
+    }
+    if (poll_thread_running) {
+        return true;
+    }
+    atomic_store(&poll_thread_quit, false);
+    rc = pthread_create(&poll_thread, NULL, poll_thread_main, NULL);
+    if (rc != 0) {
+        fprintf(stderr, "error: failed to create reader thread: %s\n",
+                strerror(rc));
+        return false;
+    }
+    poll_thread_running = true;
+    return true;
+}
+
+
+/** \brief  Stop reader thread
+ */
+void joy_poll_thread_stop(void)
+{
+    uint64_t one = 1;
+
+    if (!poll_thread_running) {
+        return;
+    }
+    atomic_store(&poll_thread_quit, true);
+    if (write(poll_wake_fd, &one, sizeof one) < 0) {
+        fprintf(stderr, "error: failed to wake reader thread: %s\n",
+                strerror(errno));
+    }
+    pthread_join(poll_thread, NULL);
+    poll_thread_running = false;
 }
@@ -10,16 +10,83 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <dirent.h>
+#include <time.h>
+#include <linux/input.h>
 
 #define JOY_INPUT_NODES_PATH    "/dev/input/by-id"
 
 #define JOY_GUID_SIZE           16
 
+/** \brief  Lowest button event code in the button index table */
+#define JOY_BUTTON_CODE_MIN     BTN_MISC
 
+/** \brief  Number of entries in the button index table */
+#define JOY_BUTTON_INDEX_SIZE   (KEY_CNT - JOY_BUTTON_CODE_MIN)
+
+/** \brief  Number of entries in the axis index table */
+#define JOY_AXIS_INDEX_SIZE     ABS_CNT
+
+/** \brief  Maximum number of hats: ABS_HAT0X/Y to ABS_HAT3X/Y */
+#define JOY_HAT_MAX             4
+
+/** \brief  Hat direction bits, as used by VICE's joystick ports
+ *
+ * A hat direction is a combination of these, 0 when centered.
+ */
+#define JOY_HAT_UP              0x01u
+#define JOY_HAT_DOWN            0x02u
+#define JOY_HAT_LEFT            0x04u
+#define JOY_HAT_RIGHT           0x08u
+
+
+/** \brief  Maximum number of buttons in a device state snapshot */
+#define JOY_STATE_MAX_BUTTONS   JOY_BUTTON_INDEX_SIZE
+
+/** \brief  Number of words in the button bitmap of a device state snapshot */
+#define JOY_STATE_BUTTON_WORDS  ((JOY_STATE_MAX_BUTTONS + 31) / 32)
+
+/** \brief  Maximum number of axes in a device state snapshot */
+#define JOY_STATE_MAX_AXES      ABS_CNT
+
+
+/** \brief  Maximum number of devices the polling engine can watch */
+#define JOY_POLL_MAX_DEVICES    32
+
+/** \brief  Maximum number of subscribers per device */
+#define JOY_POLL_MAX_SUBSCRIBERS    4
+
+/** \brief  Number of buckets in the event delay histogram
+ *
+ * Bucket 0 counts delays below 1 microsecond, bucket \c n delays of
+ * 2^(n-1) up to 2^n microseconds and the last bucket everything above.
+ */
+#define JOY_POLL_DELAY_BUCKETS      16
+
+/** \brief  Number of 64-bit words in the key code bitmap of a filter */
+#define JOY_POLL_FILTER_KEY_WORDS   ((KEY_CNT + 63) / 64)
+
+/** \brief  Number of force feedback play requests queued per device */
+#define JOY_POLL_FF_QUEUE_SIZE      32
+
+/** \brief  Axis threshold taken from the axis' own \c fuzz or \c flat */
+#define JOY_POLL_ABS_DEVICE         (-1)
+
+/** \brief  Maximum number of GUIDs with their own polling engine options */
+#define JOY_POLL_MAX_GUID_OPTIONS   16
+
+/** \brief  Weight of the history in the rolling latency estimate
+ *
+ * Each new sample moves the estimate by 1/N of its difference.
+ */
+#define JOY_POLL_LATENCY_WEIGHT     16.0
+
+
+/** \brief  Fields to sort the devices list on */
 typedef enum {
     JOY_SORT_GUID,
     JOY_SORT_NAME,
-    JOY_SORT_NODE
+    JOY_SORT_NODE,
+    JOY_SORT_NONE       /**< directory order, devices added are appended */
 } joy_sort_field_t;
 
 typedef struct joy_abs_info_s {
@@ -31,6 +98,42 @@ typedef struct joy_abs_info_s {
     int32_t  resolution;
 } joy_abs_info_t;
 
+/** \brief  Axis normalization parameters of a device
+ *
+ * Precomputed from the axis map when the device info is created, stored as
+ * a structure of arrays so joy_axis_normalize() can process several axes at
+ * once. Entries past \c num_axes are zero and normalize to 0.
+ */
+typedef struct joy_axis_norm_s {
+    float    center[JOY_STATE_MAX_AXES];    /**< middle of the axis range */
+    float    deadzone[JOY_STATE_MAX_AXES];  /**< distance from \c center
+                                                 reported as 0 (\c flat) */
+    float    scale[JOY_STATE_MAX_AXES];     /**< factor mapping the range
+                                                 outside the deadzone to
+                                                 [0, 1] */
+    float    fuzz[JOY_STATE_MAX_AXES];      /**< changes up to this size are
+                                                 ignored (\c fuzz) */
+    uint16_t num_axes;                      /**< number of axes */
+} joy_axis_norm_t;
+
+/** \brief  Hat decoding parameters of a device
+ *
+ * Precomputed from the hat map when the device info is created. Each hat
+ * axis value is classified as negative (up to \c low), positive (from
+ * \c high) or centered with two compares, after which the direction of the
+ * X/Y pair is looked up in a 3x3 table.
+ */
+typedef struct joy_hat_decode_s {
+    int32_t low[JOY_HAT_MAX * 2];   /**< highest value pointing left/up */
+    int32_t high[JOY_HAT_MAX * 2];  /**< lowest value pointing right/down */
+    int8_t  index[JOY_HAT_MAX * 2]; /**< hat event code (minus
+                                         \c ABS_HAT0X) to index in
+                                         \c hat_map, -1 if not present */
+} joy_hat_decode_t;
+
+/** \brief  Controller mapping compiled for a device, see joy-mapping.h */
+typedef struct joy_mapping_s joy_mapping_t;
+
 
 typedef struct joy_dev_info_s {
     char           *path;           /**< evdev device node path */
@@ -54,20 +157,399 @@ typedef struct joy_dev_info_s {
     joy_abs_info_t *hat_map;        /**< axis data of the hats in X/Y order,
                                          so the size of this array is
                                          \c num_hats*2 */
+
+    int16_t         button_index[JOY_BUTTON_INDEX_SIZE];
+                                    /**< button event code (minus
+                                         \c JOY_BUTTON_CODE_MIN) to index in
+                                         \c button_map, -1 if not present */
+    int16_t         axis_index[JOY_AXIS_INDEX_SIZE];
+                                    /**< axis event code to index in
+                                         \c axis_map, -1 if not present */
+    joy_axis_norm_t axis_norm;      /**< normalization of the axes in
+                                         \c axis_map */
+    joy_hat_decode_t hat_decode;    /**< decoding of the hats in
+                                         \c hat_map */
+    const joy_mapping_t *mapping;   /**< controller mapping, \c NULL if the
+                                         device isn't in the mapping
+                                         database */
+
+    uint64_t        sort_guid[2];   /**< GUID as big-endian words */
+    uint64_t        sort_name;      /**< first bytes of \c name, big-endian */
+    uint64_t        sort_node;      /**< first bytes of the node name in
+                                         \c path, big-endian */
+    size_t          sort_node_offset;
+                                    /**< offset in \c path of the node name */
+
+    size_t          size;           /**< size of the block holding the struct
+                                         followed by its maps and strings */
 } joy_dev_info_t;
 
 
+/** \brief  State of a device after a complete report
+ *
+ * Buttons, axes and hats are indexed like the device's \c button_map,
+ * \c axis_map and \c hat_map.
+ */
+typedef struct joy_device_state_s {
+    uint64_t sequence;      /**< number of reports (\c SYN_REPORT) applied */
+    uint64_t time_us;       /**< kernel timestamp of the last report in
+                                 microseconds, on the device's clock */
+    uint32_t generation;    /**< polling engine slot generation, used to
+                                 detect a closed device */
+    uint16_t num_buttons;   /**< number of buttons */
+    uint16_t num_axes;      /**< number of axes */
+    uint16_t num_hats;      /**< number of hats */
+    uint32_t buttons[JOY_STATE_BUTTON_WORDS];
+                            /**< bitmap of pressed buttons */
+    int32_t  axes[JOY_STATE_MAX_AXES];
+                            /**< axis values */
+    int32_t  hats[JOY_HAT_MAX * 2];
+                            /**< hat axis values in X/Y order */
+    uint8_t  hat_dirs[JOY_HAT_MAX];
+                            /**< hat directions (\c JOY_HAT_UP etc.) */
+} joy_device_state_t;
+
+/** \brief  Reference to the published state of a device in the polling engine
+ *
+ * Obtained once with joy_poll_get_state_ref(), after which the state can be
+ * read without taking the engine's lock.
+ */
+typedef struct joy_state_ref_s {
+    unsigned int slot;          /**< polling engine slot */
+    uint32_t     generation;    /**< slot generation when the ref was made */
+} joy_state_ref_t;
+
+
+/** \brief  Get index in the button map of a button event code
+ *
+ * \param[in]   device  joystick device
+ * \param[in]   code    button event code
+ *
+ * \return  index in \c button_map or -1 when the device doesn't have the button
+ */
+static inline int joy_dev_info_button_index(const joy_dev_info_t *device,
+                                            unsigned int          code)
+{
+    if (code < JOY_BUTTON_CODE_MIN || code >= KEY_CNT) {
+        return -1;
+    }
+    return device->button_index[code - JOY_BUTTON_CODE_MIN];
+}
+
+/** \brief  Get index in the axis map of an axis event code
+ *
+ * \param[in]   device  joystick device
+ * \param[in]   code    axis event code
+ *
+ * \return  index in \c axis_map or -1 when the device doesn't have the axis
+ */
+static inline int joy_dev_info_axis_index(const joy_dev_info_t *device,
+                                          unsigned int          code)
+{
+    if (code >= ABS_CNT) {
+        return -1;
+    }
+    return device->axis_index[code];
+}
+
+
+/** \brief  Hat direction of each negative/centered/positive X/Y combination
+ *
+ * Indexed by Y class * 3 + X class, see joy_dev_info_hat_direction().
+ */
+extern const uint8_t joy_hat_directions[9];
+
+/** \brief  Decode hat axis values into a direction
+ *
+ * Constant time and doesn't allocate, so it can be called for every frame.
+ *
+ * \param[in]   device  joystick device
+ * \param[in]   hat     hat index, below \c num_hats
+ * \param[in]   x       value of the hat's X axis
+ * \param[in]   y       value of the hat's Y axis
+ *
+ * \return  direction, combination of \c JOY_HAT_UP etc.
+ */
+static inline unsigned int joy_dev_info_hat_direction(const joy_dev_info_t *device,
+                                                      unsigned int          hat,
+                                                      int32_t               x,
+                                                      int32_t               y)
+{
+    const joy_hat_decode_t *decode = &(device->hat_decode);
+    unsigned int            col;
+    unsigned int            row;
+
+    col = (unsigned int)(x > decode->low[hat * 2u]) +
+          (unsigned int)(x >= decode->high[hat * 2u]);
+    row = (unsigned int)(y > decode->low[hat * 2u + 1u]) +
+          (unsigned int)(y >= decode->high[hat * 2u + 1u]);
+    return joy_hat_directions[row * 3u + col];
+}
+
+/** \brief  Get direction of a hat in a device state snapshot
+ *
+ * \param[in]   state   device state
+ * \param[in]   index   index of the hat
+ *
+ * \return  direction, combination of \c JOY_HAT_UP etc.
+ */
+static inline unsigned int joy_device_state_hat(const joy_device_state_t *state,
+                                                unsigned int              index)
+{
+    return state->hat_dirs[index];
+}
+
+/** \brief  Determine if a button is pressed in a device state snapshot
+ *
+ * \param[in]   state   device state
+ * \param[in]   index   index in the device's \c button_map
+ *
+ * \return  \c true if pressed
+ */
+static inline bool joy_device_state_button(const joy_device_state_t *state,
+                                           unsigned int              index)
+{
+    return (state->buttons[index / 32u] >> (index % 32u)) & 1u;
+}
+
+
+/** \brief  Polling engine state of a device */
+typedef enum {
+    JOY_POLL_CLOSED = 0,    /**< not watched by the polling engine */
+    JOY_POLL_OPEN           /**< opened and watched by the polling engine */
+} joy_poll_state_t;
+
+/** \brief  Polling engine statistics of a device
+ *
+ * Counted since the device was opened by the polling engine or the last
+ * call of joy_poll_reset_device_stats().
+ */
+typedef struct joy_poll_stats_s {
+    uint64_t events;                    /**< events read */
+    uint64_t events_by_type[EV_CNT];    /**< events read per event type */
+    uint64_t syn_dropped;               /**< \c SYN_DROPPED events */
+    uint64_t resyncs;                   /**< resyncs after \c SYN_DROPPED */
+    uint64_t resync_ns;                 /**< total time spent resyncing */
+    uint64_t resync_ns_max;             /**< longest resync */
+    uint64_t wakeups;                   /**< times the device was read */
+    uint64_t wakeup_events_max;         /**< most events in one wakeup */
+    uint64_t delay_hist[JOY_POLL_DELAY_BUCKETS];
+                                        /**< delay between the kernel
+                                             timestamp and reading the
+                                             event, see
+                                             \c JOY_POLL_DELAY_BUCKETS */
+    uint64_t delay_us_max;              /**< longest delay in microseconds */
+    uint64_t ui_applied;                /**< UI updates applied */
+    uint64_t ui_coalesced;              /**< device reports merged into
+                                             another UI update */
+    uint64_t ff_events;                 /**< force feedback events written */
+    uint64_t ff_writes;                 /**< write() calls for those */
+    uint64_t ff_dropped;                /**< force feedback events dropped,
+                                             queue full or write failed */
+    uint64_t ff_delay_hist[JOY_POLL_DELAY_BUCKETS];
+                                        /**< delay between the input event a
+                                             force feedback event responds
+                                             to (or the request) and writing
+                                             it, buckets as \c delay_hist */
+    uint64_t ff_delay_us_max;           /**< longest force feedback delay */
+    uint64_t abs_suppressed;            /**< axis events dropped as changes
+                                             within \c fuzz */
+    uint64_t abs_flattened;             /**< axis values within \c flat
+                                             clamped to the center */
+    uint64_t syn_suppressed;            /**< \c SYN_REPORT events dropped
+                                             since all events of their
+                                             report were */
+    uint64_t elapsed_ns;                /**< time the stats cover */
+    clockid_t clock_id;                 /**< clock of the device's event
+                                             timestamps, delays are measured
+                                             against it */
+} joy_poll_stats_t;
+
+/** \brief  Options for opening a device in the polling engine */
+typedef struct joy_poll_options_s {
+    clockid_t clock_id;     /**< clock for the event timestamps, set with
+                                 \c EVIOCSCLOCKID: \c CLOCK_MONOTONIC
+                                 (default), \c CLOCK_BOOTTIME or
+                                 \c CLOCK_REALTIME (the kernel's default) */
+    bool      grab;         /**< grab the device with \c EVIOCGRAB, so other
+                                 readers such as the desktop don't get its
+                                 events (default \c false) */
+    int32_t   abs_fuzz;     /**< axis changes up to this size are dropped
+                                 before reaching subscribers, except those
+                                 reaching the center or an end of the range:
+                                 \c JOY_POLL_ABS_DEVICE for each axis'
+                                 \c fuzz, 0 (default) to pass all changes,
+                                 the kernel already smooths changes within
+                                 \c fuzz itself */
+    int32_t   abs_flat;     /**< axis values this close to the center are
+                                 reported as the center:
+                                 \c JOY_POLL_ABS_DEVICE (default) for each
+                                 axis' \c flat if it's centered on 0,
+                                 0 to report them as read */
+} joy_poll_options_t;
+
+/** \brief  Events a subscriber wants from a device
+ *
+ * The polling engine has the kernel drop the events none of a device's
+ * subscribers want with \c EVIOCSMASK, so they are never copied to
+ * userspace. Codes are only filtered for \c EV_KEY and \c EV_ABS, other
+ * types pass with all their codes when the type is in \c types.
+ */
+typedef struct joy_poll_filter_s {
+    uint32_t types;                             /**< bitmap of event types */
+    uint64_t keys[JOY_POLL_FILTER_KEY_WORDS];   /**< bitmap of \c EV_KEY codes */
+    uint64_t abs;                               /**< bitmap of \c EV_ABS codes */
+} joy_poll_filter_t;
+
+/** \brief  Rolling latency estimate of a device */
+typedef struct joy_poll_latency_s {
+    double    average_us;   /**< average delay in microseconds */
+    double    jitter_us;    /**< mean deviation from the average */
+    uint64_t  last_us;      /**< last delay measured */
+    uint64_t  samples;      /**< number of delays measured */
+    clockid_t clock_id;     /**< clock of the device's event timestamps */
+} joy_poll_latency_t;
+
+/** \brief  Callback for a device added by hotplug
+ *
+ * \param[in]   device  device added to the devices list
+ * \param[in]   index   index of \a device in the devices list
+ * \param[in]   data    data passed to joy_hotplug_init()
+ */
+typedef void (*joy_hotplug_added_cb_t)(joy_dev_info_t *device, int index, void *data);
+
+/** \brief  Callback for a device removed by hotplug
+ *
+ * Called before \a device is removed from the devices list and freed.
+ *
+ * \param[in]   device  device being removed
+ * \param[in]   index   index of \a device in the devices list
+ * \param[in]   data    data passed to joy_hotplug_init()
+ */
+typedef void (*joy_hotplug_removed_cb_t)(joy_dev_info_t *device, int index, void *data);
+
+/** \brief  Method used by the polling engine to read events */
+typedef enum {
+    JOY_READ_RAW = 0,       /**< read blocks of events directly from the fd,
+                                 libevdev only used for resync */
+    JOY_READ_LIBEVDEV       /**< read events one by one through libevdev */
+} joy_read_method_t;
+
+/** \brief  Callback for events read by the polling engine
+ *
+ * Called from the thread running joy_poll_dispatch(), with the engine's lock
+ * held, so subscribers must not call back into the polling engine.
+ *
+ * \param[in]   device  device the events were read from
+ * \param[in]   events  events
+ * \param[in]   num     number of events
+ * \param[in]   data    data passed to joy_poll_subscribe()
+ */
+typedef void (*joy_poll_events_cb_t)(joy_dev_info_t           *device,
+                                     const struct input_event *events,
+                                     size_t                    num,
+                                     void                     *data);
+
+/** \brief  Callback for a device closed by the polling engine
+ *
+ * Called when the device went away or was removed from the polling engine,
+ * after this the subscription is gone. Same restrictions apply as for
+ * \c joy_poll_events_cb_t.
+ *
+ * \param[in]   device  device closed
+ * \param[in]   data    data passed to joy_poll_subscribe()
+ */
+typedef void (*joy_poll_closed_cb_t)(joy_dev_info_t *device, void *data);
+
+
 const char      *joy_get_axis_name(unsigned int code);
 const char      *joy_get_button_name(unsigned int code);
 const char      *joy_get_hat_name(unsigned int code);
+const char      *joy_get_hat_direction_name(unsigned int direction);
 
+joy_dev_info_t  *joy_dev_info_new_from_path(const char *path);
 joy_dev_info_t  *joy_dev_info_dup(const joy_dev_info_t *device);
+joy_dev_info_t  *joy_dev_info_new_from_block(const void *block, size_t size);
 void             joy_dev_info_free(joy_dev_info_t *device);
 
+void             joy_device_state_init(joy_device_state_t   *state,
+                                       const joy_dev_info_t *device);
+bool             joy_device_state_apply(joy_device_state_t       *state,
+                                        const joy_dev_info_t     *device,
+                                        const struct input_event *event);
+
 int              joy_scan_devices(const char *path, joy_dev_info_t ***devices);
 joy_dev_info_t **joy_get_devices_list(void);
 int              joy_get_devices_count(void);
 void             joy_free_devices_list(void);
 void             joy_sort_devices_list(joy_sort_field_t field);
 
+bool             joy_hotplug_init(const char               *path,
+                                  joy_hotplug_added_cb_t    on_added,
+                                  joy_hotplug_removed_cb_t  on_removed,
+                                  void                     *data);
+int              joy_hotplug_get_fd(void);
+int              joy_hotplug_dispatch(void);
+void             joy_hotplug_shutdown(void);
+
+bool             joy_poll_init(void);
+void             joy_poll_shutdown(void);
+bool             joy_poll_add_device(joy_dev_info_t *device);
+void             joy_poll_options_init(joy_poll_options_t *options);
+void             joy_poll_set_default_options(const joy_poll_options_t *options);
+const char      *joy_poll_clock_name(clockid_t clock_id);
+bool             joy_poll_parse_clock(const char *name, clockid_t *clock_id);
+bool             joy_poll_parse_abs_filter(const char *text, joy_poll_options_t *options);
+bool             joy_poll_set_guid_options(const char *guid, const joy_poll_options_t *options);
+bool             joy_poll_add_device_with_options(joy_dev_info_t           *device,
+                                                  const joy_poll_options_t *options);
+void             joy_poll_remove_device(joy_dev_info_t *device);
+joy_poll_state_t joy_poll_get_device_state(const joy_dev_info_t *device);
+void             joy_poll_filter_init(joy_poll_filter_t *filter);
+void             joy_poll_filter_add(joy_poll_filter_t *filter,
+                                     unsigned int       type,
+                                     unsigned int       code);
+void             joy_poll_filter_add_device(joy_poll_filter_t    *filter,
+                                            const joy_dev_info_t *device);
+int              joy_poll_subscribe(joy_dev_info_t       *device,
+                                    joy_poll_events_cb_t  on_events,
+                                    joy_poll_closed_cb_t  on_closed,
+                                    void                 *data);
+int              joy_poll_subscribe_raw(joy_dev_info_t       *device,
+                                       joy_poll_events_cb_t  on_events,
+                                       joy_poll_closed_cb_t  on_closed,
+                                       void                 *data);
+int              joy_poll_subscribe_filtered(joy_dev_info_t          *device,
+                                             const joy_poll_filter_t *filter,
+                                             joy_poll_events_cb_t     on_events,
+                                             joy_poll_closed_cb_t     on_closed,
+                                             void                    *data);
+void             joy_poll_unsubscribe(int id);
+void             joy_poll_set_filter(int id, const joy_poll_filter_t *filter);
+void             joy_poll_set_read_method(joy_read_method_t method);
+int              joy_poll_get_fd(void);
+int              joy_poll_dispatch(int timeout);
+bool             joy_poll_get_state_ref(const joy_dev_info_t *device,
+                                        joy_state_ref_t      *ref);
+bool             joy_poll_read_state(const joy_state_ref_t *ref,
+                                     joy_device_state_t    *state);
+bool             joy_poll_get_device_stats(const joy_dev_info_t *device,
+                                           joy_poll_stats_t     *stats);
+void             joy_poll_reset_device_stats(const joy_dev_info_t *device);
+bool             joy_poll_get_device_latency(const joy_dev_info_t *device,
+                                             joy_poll_latency_t   *latency);
+void             joy_poll_count_ui_updates(const joy_dev_info_t *device,
+                                           unsigned long         applied,
+                                           unsigned long         coalesced);
+bool             joy_poll_ff_supported(const joy_dev_info_t *device);
+int              joy_poll_ff_upload(const joy_dev_info_t *device,
+                                    struct ff_effect     *effect);
+bool             joy_poll_ff_erase(const joy_dev_info_t *device, int effect_id);
+bool             joy_poll_ff_play(const joy_dev_info_t *device,
+                                  int                   effect_id,
+                                  int                   count,
+                                  uint64_t              cause_us);
+bool             joy_poll_thread_start(void);
+void             joy_poll_thread_stop(void);
+
 #endif
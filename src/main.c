@@ -4,9 +4,29 @@
  */
 
 #include <gtk/gtk.h>
+#include <string.h>
+#include <unistd.h>
 #include "app-window.h"
 #include "axis-widget.h"
+#include "event-log.h"
+#include "headless.h"
 #include "joystick.h"
+#include "joy-cache.h"
+#include "joy-mapping.h"
+#include "vice.h"
+
+
+/** \brief  Size classes of the pool allocator for joystick allocations
+ *
+ * The small class covers device node paths and names, the large one
+ * the packed device info blocks: the info itself is about 2.5 KiB, plus the
+ * maps and strings. Scan arenas and the mapping index are bigger still and
+ * come from malloc().
+ */
+static const lib_pool_class_t pool_classes[] = {
+    {  256u, 64u },
+    { 4096u, 16u }
+};
 
 
 static void on_app_activate(GtkApplication *app, G_GNUC_UNUSED gpointer data)
@@ -14,6 +34,12 @@ static void on_app_activate(GtkApplication *app, G_GNUC_UNUSED gpointer data)
     GtkWidget *window;
 
     g_print("Initializing.\n");
+    event_log_init(STDOUT_FILENO);
+    if (joy_poll_init()) {
+        joy_poll_thread_start();
+    } else {
+        g_printerr("Failed to initialize polling engine.\n");
+    }
     window = app_window_new(app);
     gtk_widget_show_all(window);
 }
@@ -21,12 +47,120 @@ static void on_app_activate(GtkApplication *app, G_GNUC_UNUSED gpointer data)
 static void on_app_shutdown(G_GNUC_UNUSED GtkApplication *app, G_GNUC_UNUSED gpointer data)
 {
     g_print("Shutting down.\n");
+    joy_poll_shutdown();
+    event_log_shutdown();
+    joy_cache_close();
+    joy_mapping_close();
+    if (g_getenv("EVDEV_JS_ALLOC_STATS") != NULL) {
+        lib_alloc_print_stats();
+    }
     /* unref reusable CSS provider */
     joy_axis_widget_shutdown();
 }
 
 
+/** \brief  Set event log level and format from the environment
+ *
+ * \c EVDEV_JS_LOG sets the level ("off", "buttons", "input" or "all"),
+ * \c EVDEV_JS_LOG_BINARY selects the binary format.
+ */
+static void event_log_setup_from_env(void)
+{
+    const gchar       *name = g_getenv("EVDEV_JS_LOG");
+    event_log_level_t  level;
+
+    if (name != NULL) {
+        if (event_log_parse_level(name, &level)) {
+            event_log_set_level(level);
+        } else {
+            g_printerr("Invalid EVDEV_JS_LOG value '%s'.\n", name);
+        }
+    }
+    if (g_getenv("EVDEV_JS_LOG_BINARY") != NULL) {
+        event_log_set_mode(EVENT_LOG_BINARY);
+    }
+}
+
+
+/** \brief  Set up polling engine device options from the environment
+ *
+ * \c EVDEV_JS_CLOCK sets the clock of the event timestamps ("monotonic",
+ * "boottime" or "realtime"), \c EVDEV_JS_GRAB grabs the devices polled so
+ * the desktop doesn't see their events. \c EVDEV_JS_ABS_FILTER sets the axis
+ * change suppression thresholds, a ';' separated list of thresholds as
+ * accepted by joy_poll_parse_abs_filter(), each optionally preceded by
+ * "<guid>=" to only apply to the devices with that GUID.
+ */
+static void poll_options_setup_from_env(void)
+{
+    const gchar        *name    = g_getenv("EVDEV_JS_CLOCK");
+    const gchar        *filters = g_getenv("EVDEV_JS_ABS_FILTER");
+    joy_poll_options_t  options;
+
+    joy_poll_options_init(&options);
+    if (name != NULL && !joy_poll_parse_clock(name, &options.clock_id)) {
+        g_printerr("Invalid EVDEV_JS_CLOCK value '%s'.\n", name);
+    }
+    options.grab = g_getenv("EVDEV_JS_GRAB") != NULL;
+
+    if (filters != NULL) {
+        gchar **items = g_strsplit(filters, ";", -1);
+        int     pass;
+        int     i;
+
+        /* GUID overrides start from the defaults, whatever their order */
+        for (pass = 0; pass < 2; pass++) {
+            for (i = 0; items[i] != NULL; i++) {
+                gchar              *eq = strchr(items[i], '=');
+                joy_poll_options_t  guid_options = options;
+                bool                ok;
+
+                if ((pass == 0) != (eq == NULL) || items[i][0] == '\0') {
+                    continue;
+                }
+                if (eq == NULL) {
+                    ok = joy_poll_parse_abs_filter(items[i], &options);
+                } else {
+                    *eq = '\0';
+                    ok  = joy_poll_parse_abs_filter(eq + 1, &guid_options) &&
+                          joy_poll_set_guid_options(items[i], &guid_options);
+                    *eq = '=';
+                }
+                if (!ok) {
+                    g_printerr("Invalid EVDEV_JS_ABS_FILTER item '%s'.\n", items[i]);
+                }
+            }
+        }
+        g_strfreev(items);
+    }
+    joy_poll_set_default_options(&options);
+}
+
+
+/** \brief  Open the controller mapping database
+ *
+ * \c EVDEV_JS_MAPPINGS sets the path of the SDL gamecontrollerdb.txt file,
+ * by default it is looked for in the current directory.
+ */
+static void mapping_setup_from_env(void)
+{
+    const gchar *path = g_getenv(JOY_MAPPING_ENV);
+
+    if (path != NULL) {
+        if (!joy_mapping_open(path)) {
+            g_printerr("Failed to open mapping database '%s'.\n", path);
+        }
+    } else {
+        /* optional, the devices just won't have mappings */
+        joy_mapping_open(JOY_MAPPING_DEFAULT);
+    }
+}
+
+
 /** \brief  Program entry point
+ *
+ * Runs headless_main() instead of the UI when the first argument is
+ * \c HEADLESS_OPTION, without initializing GTK.
  *
  * \param[in]   argc    argument count
  * \param[in]   argv    argument vector
@@ -38,6 +172,17 @@ int main(int argc, char *argv[])
     GtkApplication *app;
     int             status;
 
+    if (argc > 1 && strcmp(argv[1], HEADLESS_OPTION) == 0) {
+        return headless_main(argc, argv);
+    }
+
+    /* before anything is allocated through lib_malloc() */
+    lib_pool_allocator_install(pool_classes, sizeof pool_classes / sizeof pool_classes[0]);
+    lib_alloc_set_counting(g_getenv("EVDEV_JS_ALLOC_STATS") != NULL);
+    event_log_setup_from_env();
+    poll_options_setup_from_env();
+    mapping_setup_from_env();
+
     app = gtk_application_new("io.github.compyx.evdev-js-test",
                               G_APPLICATION_DEFAULT_FLAGS);
     g_signal_connect(G_OBJECT(app), "activate", G_CALLBACK(on_app_activate), NULL);
@@ -0,0 +1,419 @@
+/** \file   state-view.c
+ * \brief   Compact view of a device's state
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ * Draws all buttons, axes and hats of a device on a single GtkDrawingArea
+ * from a device state snapshot, instead of using a widget per control:
+ *
+ * - buttons as a grid of LEDs with their names
+ * - axes as bars with their names and values
+ * - hats as a direction dot in a small square
+ *
+ * Updates compare the new state with the state drawn and only invalidate
+ * the cells that changed, and drawing skips the cells outside the clip
+ * region, so a frame costs about as much as the number of changed
+ * controls. Values are formatted into stack buffers, nothing is allocated
+ * while drawing.
+ */
+
+#include <gtk/gtk.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "joystick.h"
+
+#include "state-view.h"
+
+
+/** \brief  Number of button columns */
+#define BUTTON_COLUMNS  4
+
+/** \brief  Size of a button cell */
+#define BUTTON_W        96
+#define BUTTON_H        20
+
+/** \brief  Size of an axis row, and the widths of its name and bar */
+#define AXIS_W          (BUTTON_COLUMNS * BUTTON_W)
+#define AXIS_H          20
+#define AXIS_NAME_W     96
+#define AXIS_BAR_W      (AXIS_W - AXIS_NAME_W - 72)
+
+/** \brief  Size of a hat cell */
+#define HAT_W           96
+#define HAT_H           48
+
+/** \brief  Space between the sections */
+#define SECTION_GAP     8
+
+/** \brief  Font size of names and values */
+#define FONT_SIZE       11.0
+
+
+/** \brief  State object of the view */
+typedef struct view_state_s {
+    joy_dev_info_t       *device;   /**< copy of the device shown, \c NULL
+                                         for none */
+    joy_device_state_t    shown;    /**< state drawn */
+    int                   axes_y;   /**< top of the axes section */
+    int                   hats_y;   /**< top of the hats section */
+} view_state_t;
+
+
+/** \brief  Get state object of the view
+ *
+ * \param[in]   self    state view
+ *
+ * \return  state object
+ */
+static view_state_t *get_state(GtkWidget *self)
+{
+    return g_object_get_data(G_OBJECT(self), "StateView");
+}
+
+/** \brief  Handler for the 'destroy' event of the view
+ *
+ * \param[in]   self    state view (unused)
+ * \param[in]   data    state object
+ */
+static void on_destroy(G_GNUC_UNUSED GtkWidget *self, gpointer data)
+{
+    view_state_t *state = data;
+
+    joy_dev_info_free(state->device);
+    g_free(state);
+}
+
+
+/** \brief  Get area of a button cell
+ *
+ * \param[in]   index   button index
+ * \param[out]  rect    cell area
+ */
+static void button_rect(unsigned int index, GdkRectangle *rect)
+{
+    rect->x      = (int)(index % BUTTON_COLUMNS) * BUTTON_W;
+    rect->y      = (int)(index / BUTTON_COLUMNS) * BUTTON_H;
+    rect->width  = BUTTON_W;
+    rect->height = BUTTON_H;
+}
+
+/** \brief  Get area of an axis row
+ *
+ * \param[in]   state   view state
+ * \param[in]   index   axis index
+ * \param[out]  rect    row area
+ */
+static void axis_rect(const view_state_t *state, unsigned int index, GdkRectangle *rect)
+{
+    rect->x      = 0;
+    rect->y      = state->axes_y + (int)index * AXIS_H;
+    rect->width  = AXIS_W;
+    rect->height = AXIS_H;
+}
+
+/** \brief  Get area of a hat cell
+ *
+ * \param[in]   state   view state
+ * \param[in]   index   hat index
+ * \param[out]  rect    cell area
+ */
+static void hat_rect(const view_state_t *state, unsigned int index, GdkRectangle *rect)
+{
+    rect->x      = (int)(index % BUTTON_COLUMNS) * HAT_W;
+    rect->y      = state->hats_y + (int)(index / BUTTON_COLUMNS) * HAT_H;
+    rect->width  = HAT_W;
+    rect->height = HAT_H;
+}
+
+
+/** \brief  Draw text with its baseline centered vertically in an area
+ *
+ * \param[in]   cr      cairo context
+ * \param[in]   x       left of text
+ * \param[in]   rect    area
+ * \param[in]   text    text
+ */
+static void draw_text(cairo_t *cr, double x, const GdkRectangle *rect, const char *text)
+{
+    cairo_move_to(cr, x, rect->y + rect->height / 2.0 + FONT_SIZE / 3.0);
+    cairo_show_text(cr, text);
+}
+
+/** \brief  Draw a button cell
+ *
+ * \param[in]   cr      cairo context
+ * \param[in]   state   view state
+ * \param[in]   index   button index
+ * \param[in]   rect    cell area
+ */
+static void draw_button(cairo_t            *cr,
+                        const view_state_t *state,
+                        unsigned int        index,
+                        const GdkRectangle *rect)
+{
+    if (joy_device_state_button(&(state->shown), index)) {
+        cairo_set_source_rgb(cr, 0.0, 1.0, 0.0);
+    } else {
+        cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
+    }
+    cairo_rectangle(cr, rect->x + 4, rect->y + 4, 16, rect->height - 8);
+    cairo_fill(cr);
+
+    cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
+    draw_text(cr, rect->x + 26, rect, joy_get_button_name(state->device->button_map[index]));
+}
+
+/** \brief  Draw an axis row
+ *
+ * \param[in]   cr      cairo context
+ * \param[in]   state   view state
+ * \param[in]   index   axis index
+ * \param[in]   rect    row area
+ */
+static void draw_axis(cairo_t            *cr,
+                      const view_state_t *state,
+                      unsigned int        index,
+                      const GdkRectangle *rect)
+{
+    const joy_abs_info_t *info  = &(state->device->axis_map[index]);
+    int32_t               value = state->shown.axes[index];
+    double                range = (double)info->maximum - (double)info->minimum;
+    double                pos   = 0.0;
+    double                zero  = 0.0;
+    double                bar_x = rect->x + AXIS_NAME_W;
+    char                  text[16];
+
+    if (range > 0.0) {
+        pos  = ((double)value - info->minimum) / range;
+        zero = info->minimum < 0 && info->maximum > 0 ? -(double)info->minimum / range : 0.0;
+        pos  = pos  < 0.0 ? 0.0 : (pos > 1.0 ? 1.0 : pos);
+    }
+
+    cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
+    draw_text(cr, rect->x + 4, rect, joy_get_axis_name(info->code));
+
+    /* bar from zero (or the minimum) to the value */
+    cairo_set_source_rgb(cr, 0.8, 0.8, 0.8);
+    cairo_rectangle(cr, bar_x, rect->y + 4, AXIS_BAR_W, rect->height - 8);
+    cairo_fill(cr);
+    cairo_set_source_rgb(cr, 0.2, 0.4, 0.8);
+    cairo_rectangle(cr,
+                    bar_x + AXIS_BAR_W * fmin(zero, pos),
+                    rect->y + 4,
+                    AXIS_BAR_W * fabs(pos - zero),
+                    rect->height - 8);
+    cairo_fill(cr);
+
+    snprintf(text, sizeof text, "%+6d", (int)value);
+    cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
+    draw_text(cr, bar_x + AXIS_BAR_W + 8, rect, text);
+}
+
+/** \brief  Draw a hat cell
+ *
+ * \param[in]   cr      cairo context
+ * \param[in]   state   view state
+ * \param[in]   index   hat index
+ * \param[in]   rect    cell area
+ */
+static void draw_hat(cairo_t            *cr,
+                     const view_state_t *state,
+                     unsigned int        index,
+                     const GdkRectangle *rect)
+{
+    unsigned int dir  = joy_device_state_hat(&(state->shown), index);
+    int          x    = (dir & JOY_HAT_RIGHT) ? 1 : ((dir & JOY_HAT_LEFT) ? -1 : 0);
+    int          y    = (dir & JOY_HAT_DOWN)  ? 1 : ((dir & JOY_HAT_UP)   ? -1 : 0);
+    double       size = rect->height - 8;
+    double       cx   = rect->x + 4 + size / 2.0;
+    double       cy   = rect->y + 4 + size / 2.0;
+
+    cairo_set_source_rgb(cr, 0.8, 0.8, 0.8);
+    cairo_rectangle(cr, rect->x + 4, rect->y + 4, size, size);
+    cairo_fill(cr);
+
+    if (dir != 0) {
+        cairo_set_source_rgb(cr, 0.0, 1.0, 0.0);
+    } else {
+        cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
+    }
+    cairo_arc(cr,
+              cx + x * size / 3.0,
+              cy + y * size / 3.0,
+              size / 8.0,
+              0.0,
+              2.0 * G_PI);
+    cairo_fill(cr);
+
+    cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
+    draw_text(cr, rect->x + size + 12, rect,
+              joy_get_hat_name(state->device->hat_map[index * 2u].code));
+}
+
+/** \brief  Determine if an area needs drawing
+ *
+ * \param[in]   clip    clip rectangle
+ * \param[in]   rect    area
+ *
+ * \return  \c true if \a rect intersects \a clip
+ */
+static bool rect_visible(const GdkRectangle *clip, const GdkRectangle *rect)
+{
+    return gdk_rectangle_intersect(clip, rect, NULL);
+}
+
+/** \brief  Handler for the 'draw' event of the view
+ *
+ * Only draws the cells intersecting the clip region.
+ *
+ * \param[in]   self    state view
+ * \param[in]   cr      cairo context
+ * \param[in]   data    state object
+ *
+ * \return  \c FALSE
+ */
+static gboolean on_draw(G_GNUC_UNUSED GtkWidget *self, cairo_t *cr, gpointer data)
+{
+    view_state_t *state = data;
+    GdkRectangle  clip;
+    GdkRectangle  rect;
+    unsigned int  i;
+
+    if (state->device == NULL) {
+        return FALSE;
+    }
+    if (!gdk_cairo_get_clip_rectangle(cr, &clip)) {
+        return FALSE;
+    }
+
+    cairo_set_font_size(cr, FONT_SIZE);
+    for (i = 0; i < state->device->num_buttons; i++) {
+        button_rect(i, &rect);
+        if (rect_visible(&clip, &rect)) {
+            draw_button(cr, state, i, &rect);
+        }
+    }
+    for (i = 0; i < state->device->num_axes; i++) {
+        axis_rect(state, i, &rect);
+        if (rect_visible(&clip, &rect)) {
+            draw_axis(cr, state, i, &rect);
+        }
+    }
+    for (i = 0; i < state->device->num_hats; i++) {
+        hat_rect(state, i, &rect);
+        if (rect_visible(&clip, &rect)) {
+            draw_hat(cr, state, i, &rect);
+        }
+    }
+    return FALSE;
+}
+
+
+/** \brief  Create state view
+ *
+ * \return  GtkDrawingArea
+ */
+GtkWidget *state_view_new(void)
+{
+    GtkWidget    *view;
+    view_state_t *state;
+
+    view  = gtk_drawing_area_new();
+    state = g_malloc0(sizeof *state);
+    g_object_set_data(G_OBJECT(view), "StateView", (gpointer)state);
+    gtk_widget_set_halign(view, GTK_ALIGN_START);
+    gtk_widget_set_valign(view, GTK_ALIGN_START);
+
+    g_signal_connect(G_OBJECT(view),
+                     "draw",
+                     G_CALLBACK(on_draw),
+                     (gpointer)state);
+    g_signal_connect(G_OBJECT(view),
+                     "destroy",
+                     G_CALLBACK(on_destroy),
+                     (gpointer)state);
+    return view;
+}
+
+
+/** \brief  Set device shown by the view
+ *
+ * Lays out the controls of \a device and redraws the whole view with all
+ * controls released and centered.
+ *
+ * \param[in]   widget  state view
+ * \param[in]   device  joystick device, copied, or \c NULL to show nothing
+ */
+void state_view_set_device(GtkWidget *widget, const joy_dev_info_t *device)
+{
+    view_state_t *state = get_state(widget);
+    int           height;
+
+    /* the device can be freed by hotplug or a replay ending, keep a copy */
+    joy_dev_info_free(state->device);
+    state->device = device != NULL ? joy_dev_info_dup(device) : NULL;
+    if (device == NULL) {
+        gtk_widget_set_size_request(widget, -1, -1);
+        gtk_widget_queue_draw(widget);
+        return;
+    }
+    joy_device_state_init(&(state->shown), device);
+    state->axes_y = (device->num_buttons + BUTTON_COLUMNS - 1) / BUTTON_COLUMNS * BUTTON_H +
+                    SECTION_GAP;
+    state->hats_y = state->axes_y + device->num_axes * AXIS_H + SECTION_GAP;
+    height        = state->hats_y +
+                    (device->num_hats + BUTTON_COLUMNS - 1) / BUTTON_COLUMNS * HAT_H;
+    gtk_widget_set_size_request(widget, AXIS_W, height);
+    gtk_widget_queue_draw(widget);
+}
+
+
+/** \brief  Update view with a new state of the device
+ *
+ * Invalidates the cells of the controls that changed, they are redrawn on
+ * the next frame.
+ *
+ * \param[in]   widget  state view
+ * \param[in]   state   state snapshot of the device shown
+ */
+void state_view_update(GtkWidget *widget, const joy_device_state_t *state)
+{
+    view_state_t *vs = get_state(widget);
+    GdkRectangle  rect;
+    unsigned int  w;
+    unsigned int  i;
+
+    if (vs->device == NULL) {
+        return;
+    }
+
+    for (w = 0; w < (vs->device->num_buttons + 31u) / 32u; w++) {
+        uint32_t changed = state->buttons[w] ^ vs->shown.buttons[w];
+
+        while (changed != 0) {
+            unsigned int index = w * 32u + (unsigned int)__builtin_ctz(changed);
+
+            if (index < vs->device->num_buttons) {
+                button_rect(index, &rect);
+                gtk_widget_queue_draw_area(widget, rect.x, rect.y, rect.width, rect.height);
+            }
+            changed &= changed - 1u;
+        }
+    }
+    for (i = 0; i < vs->device->num_axes; i++) {
+        if (state->axes[i] != vs->shown.axes[i]) {
+            axis_rect(vs, i, &rect);
+            gtk_widget_queue_draw_area(widget, rect.x, rect.y, rect.width, rect.height);
+        }
+    }
+    for (i = 0; i < vs->device->num_hats; i++) {
+        if (state->hat_dirs[i] != vs->shown.hat_dirs[i]) {
+            hat_rect(vs, i, &rect);
+            gtk_widget_queue_draw_area(widget, rect.x, rect.y, rect.width, rect.height);
+        }
+    }
+    vs->shown = *state;
+}
@@ -0,0 +1,16 @@
+/** \file   state-view.h
+ * \brief   Compact view of a device's state - header
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+#ifndef STATE_VIEW_H
+#define STATE_VIEW_H
+
+#include <gtk/gtk.h>
+#include "joystick.h"
+
+GtkWidget *state_view_new       (void);
+void       state_view_set_device(GtkWidget *widget, const joy_dev_info_t *device);
+void       state_view_update    (GtkWidget *widget, const joy_device_state_t *state);
+
+#endif
@@ -0,0 +1,407 @@
+/** \file   stats-widget.c
+ * \brief   Widget showing polling engine statistics of the polled device
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ * Shows the counters of joy_poll_get_device_stats() for the device the event
+ * widget is polling, refreshed a few times per second while it polls, see
+ * stats_widget_start(). Rates are computed from the difference with the
+ * previous refresh.
+ */
+
+#include <gtk/gtk.h>
+#include <linux/input.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "event-widget.h"
+#include "joystick.h"
+
+#include "stats-widget.h"
+
+
+/** \brief  Refresh interval in milliseconds */
+#define STATS_UPDATE_INTERVAL_MS    500
+
+/** \brief  Width of the histogram bars in characters */
+#define STATS_HIST_BAR_WIDTH        24
+
+/** \brief  Statistics value rows */
+enum {
+    ROW_EVENTS,         /**< events read and rate */
+    ROW_TYPES,          /**< events per type */
+    ROW_DROPPED,        /**< SYN_DROPPED count */
+    ROW_RESYNCS,        /**< resync count and duration */
+    ROW_WAKEUPS,        /**< wakeups per second and events per wakeup */
+    ROW_SUPPRESSED,     /**< axis changes suppressed/flattened */
+    ROW_UI,             /**< UI updates applied/coalesced */
+    ROW_DELAY,          /**< delay percentiles */
+    ROW_LATENCY,        /**< rolling latency estimate */
+    ROW_FF,             /**< force feedback output */
+    ROW_COUNT           /**< number of rows */
+};
+
+/** \brief  Titles of the statistics rows */
+static const char *const row_titles[ROW_COUNT] = {
+    [ROW_EVENTS]     = "Events",
+    [ROW_TYPES]      = "Key/Abs/Syn/Other",
+    [ROW_DROPPED]    = "SYN_DROPPED",
+    [ROW_RESYNCS]    = "Resyncs",
+    [ROW_WAKEUPS]    = "Wakeups",
+    [ROW_SUPPRESSED] = "Suppressed",
+    [ROW_UI]         = "UI updates",
+    [ROW_DELAY]      = "Delay",
+    [ROW_LATENCY]    = "Latency",
+    [ROW_FF]         = "Force feedback"
+};
+
+
+/** \brief  Value labels, indexed by row */
+static GtkWidget        *value_labels[ROW_COUNT];
+
+/** \brief  Delay histogram label, \c NULL if the widget isn't there */
+static GtkWidget        *hist_label;
+
+/** \brief  Refresh timeout source ID, 0 when not polling */
+static guint             timeout_id;
+
+/** \brief  Device of the previous refresh */
+static joy_dev_info_t   *prev_device;
+
+/** \brief  Statistics of the previous refresh */
+static joy_poll_stats_t  prev_stats;
+
+
+/** \brief  Get upper bound of a delay histogram bucket
+ *
+ * \param[in]   bucket  bucket index
+ *
+ * \return  delay in microseconds
+ */
+static uint64_t bucket_limit_us(unsigned int bucket)
+{
+    return (uint64_t)1 << bucket;
+}
+
+/** \brief  Get delay percentile from a delay histogram
+ *
+ * \param[in]   hist        histogram, \c JOY_POLL_DELAY_BUCKETS buckets
+ * \param[in]   max         longest delay
+ * \param[in]   percentile  percentile (0-100)
+ *
+ * \return  upper bound in microseconds of the bucket holding the percentile
+ */
+static uint64_t delay_percentile(const uint64_t *hist, uint64_t max, unsigned int percentile)
+{
+    uint64_t     total = 0;
+    uint64_t     sum   = 0;
+    unsigned int b;
+
+    for (b = 0; b < JOY_POLL_DELAY_BUCKETS; b++) {
+        total += hist[b];
+    }
+    for (b = 0; b < JOY_POLL_DELAY_BUCKETS; b++) {
+        sum += hist[b];
+        if (total > 0 && sum * 100u >= total * percentile) {
+            break;
+        }
+    }
+    if (b >= JOY_POLL_DELAY_BUCKETS - 1u) {
+        return max;
+    }
+    return bucket_limit_us(b);
+}
+
+/** \brief  Set text of a value label
+ *
+ * \param[in]   row     row index
+ * \param[in]   text    text
+ */
+static void set_value(int row, const char *text)
+{
+    gtk_label_set_text(GTK_LABEL(value_labels[row]), text);
+}
+
+/** \brief  Show the delay histogram
+ *
+ * \param[in]   stats   statistics
+ */
+static void update_histogram(const joy_poll_stats_t *stats)
+{
+    GString      *text = g_string_new(NULL);
+    uint64_t      peak = 0;
+    unsigned int  b;
+
+    for (b = 0; b < JOY_POLL_DELAY_BUCKETS; b++) {
+        if (stats->delay_hist[b] > peak) {
+            peak = stats->delay_hist[b];
+        }
+    }
+    for (b = 0; b < JOY_POLL_DELAY_BUCKETS; b++) {
+        unsigned int width = 0;
+        unsigned int i;
+
+        if (peak > 0) {
+            width = (unsigned int)(stats->delay_hist[b] * STATS_HIST_BAR_WIDTH / peak);
+        }
+        if (b < JOY_POLL_DELAY_BUCKETS - 1u) {
+            g_string_append_printf(text, "<%6" G_GUINT64_FORMAT " us ",
+                                   bucket_limit_us(b));
+        } else {
+            g_string_append_printf(text, ">=%5" G_GUINT64_FORMAT " us ",
+                                   bucket_limit_us(b - 1u));
+        }
+        for (i = 0; i < width; i++) {
+            g_string_append_c(text, '#');
+        }
+        g_string_append_printf(text, " %" G_GUINT64_FORMAT "\n", stats->delay_hist[b]);
+    }
+    gtk_label_set_text(GTK_LABEL(hist_label), text->str);
+    g_string_free(text, TRUE);
+}
+
+/** \brief  Clear all values
+ */
+static void clear_values(void)
+{
+    int row;
+
+    for (row = 0; row < ROW_COUNT; row++) {
+        set_value(row, "-");
+    }
+    gtk_label_set_text(GTK_LABEL(hist_label), "");
+}
+
+/** \brief  Refresh statistics of the polled device
+ *
+ * \param[in]   data    extra data (unused)
+ *
+ * \return  \c G_SOURCE_CONTINUE
+ */
+static gboolean on_stats_timeout(G_GNUC_UNUSED gpointer data)
+{
+    joy_dev_info_t     *device = event_widget_get_device();
+    joy_poll_stats_t    stats;
+    joy_poll_latency_t  latency;
+    double              interval;
+    uint64_t            other;
+    gchar               text[256];
+
+    if (device == NULL || !joy_poll_get_device_stats(device, &stats)) {
+        if (prev_device != NULL) {
+            clear_values();
+        }
+        prev_device = NULL;
+        return G_SOURCE_CONTINUE;
+    }
+    if (device != prev_device || stats.elapsed_ns < prev_stats.elapsed_ns) {
+        /* new device or reset: rates since opening */
+        memset(&prev_stats, 0, sizeof prev_stats);
+    }
+    interval = (double)(stats.elapsed_ns - prev_stats.elapsed_ns) / 1e9;
+    if (interval <= 0.0) {
+        interval = 1.0;
+    }
+
+    g_snprintf(text, sizeof text, "%" G_GUINT64_FORMAT " (%.0f/s)",
+               stats.events,
+               (double)(stats.events - prev_stats.events) / interval);
+    set_value(ROW_EVENTS, text);
+
+    other = stats.events - stats.events_by_type[EV_KEY] -
+            stats.events_by_type[EV_ABS] - stats.events_by_type[EV_SYN];
+    g_snprintf(text, sizeof text,
+               "%" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT
+               "/%" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT,
+               stats.events_by_type[EV_KEY], stats.events_by_type[EV_ABS],
+               stats.events_by_type[EV_SYN], other);
+    set_value(ROW_TYPES, text);
+
+    g_snprintf(text, sizeof text, "%" G_GUINT64_FORMAT, stats.syn_dropped);
+    set_value(ROW_DROPPED, text);
+
+    g_snprintf(text, sizeof text, "%" G_GUINT64_FORMAT ", avg %.3f ms, max %.3f ms",
+               stats.resyncs,
+               stats.resyncs > 0
+                    ? (double)stats.resync_ns / (double)stats.resyncs / 1e6 : 0.0,
+               (double)stats.resync_ns_max / 1e6);
+    set_value(ROW_RESYNCS, text);
+
+    g_snprintf(text, sizeof text, "%.0f/s, %.1f events/wakeup, max %" G_GUINT64_FORMAT,
+               (double)(stats.wakeups - prev_stats.wakeups) / interval,
+               stats.wakeups > 0 ? (double)stats.events / (double)stats.wakeups : 0.0,
+               stats.wakeup_events_max);
+    set_value(ROW_WAKEUPS, text);
+
+    g_snprintf(text, sizeof text,
+               "%" G_GUINT64_FORMAT " axis, %" G_GUINT64_FORMAT " reports, %"
+               G_GUINT64_FORMAT " flattened (%.0f%% of axis events)",
+               stats.abs_suppressed, stats.syn_suppressed, stats.abs_flattened,
+               stats.events_by_type[EV_ABS] > 0
+                    ? 100.0 * (double)stats.abs_suppressed /
+                      (double)stats.events_by_type[EV_ABS] : 0.0);
+    set_value(ROW_SUPPRESSED, text);
+
+    g_snprintf(text, sizeof text,
+               "%" G_GUINT64_FORMAT " applied, %" G_GUINT64_FORMAT " coalesced",
+               stats.ui_applied, stats.ui_coalesced);
+    set_value(ROW_UI, text);
+
+    g_snprintf(text, sizeof text,
+               "p50 <%" G_GUINT64_FORMAT " us, p99 <%" G_GUINT64_FORMAT
+               " us, max %" G_GUINT64_FORMAT " us (%s clock)",
+               delay_percentile(stats.delay_hist, stats.delay_us_max, 50),
+               delay_percentile(stats.delay_hist, stats.delay_us_max, 99),
+               stats.delay_us_max, joy_poll_clock_name(stats.clock_id));
+    set_value(ROW_DELAY, text);
+    update_histogram(&stats);
+
+    if (joy_poll_get_device_latency(device, &latency) && latency.samples > 0) {
+        g_snprintf(text, sizeof text,
+                   "avg %.1f us, jitter %.1f us, last %" G_GUINT64_FORMAT " us",
+                   latency.average_us, latency.jitter_us, latency.last_us);
+    } else {
+        g_snprintf(text, sizeof text, "-");
+    }
+    set_value(ROW_LATENCY, text);
+
+    if (stats.ff_events > 0 || stats.ff_dropped > 0) {
+        g_snprintf(text, sizeof text,
+                   "%" G_GUINT64_FORMAT " events in %" G_GUINT64_FORMAT
+                   " writes, %" G_GUINT64_FORMAT " dropped, p50 <%" G_GUINT64_FORMAT
+                   " us, max %" G_GUINT64_FORMAT " us",
+                   stats.ff_events, stats.ff_writes, stats.ff_dropped,
+                   delay_percentile(stats.ff_delay_hist, stats.ff_delay_us_max, 50),
+                   stats.ff_delay_us_max);
+    } else {
+        g_snprintf(text, sizeof text, "-");
+    }
+    set_value(ROW_FF, text);
+
+    prev_device = device;
+    prev_stats  = stats;
+    return G_SOURCE_CONTINUE;
+}
+
+/** \brief  Handler for the 'clicked' event of the "Reset" button
+ *
+ * \param[in]   self    button (unused)
+ * \param[in]   data    extra event data (unused)
+ */
+static void on_reset_clicked(G_GNUC_UNUSED GtkButton *self,
+                             G_GNUC_UNUSED gpointer   data)
+{
+    joy_dev_info_t *device = event_widget_get_device();
+
+    if (device != NULL) {
+        joy_poll_reset_device_stats(device);
+        on_stats_timeout(NULL);
+    }
+}
+
+/** \brief  Handler for the 'destroy' event of the stats widget
+ *
+ * \param[in]   self    stats widget (unused)
+ * \param[in]   data    extra event data (unused)
+ */
+static void on_stats_widget_destroy(G_GNUC_UNUSED GtkWidget *self,
+                                    G_GNUC_UNUSED gpointer   data)
+{
+    if (timeout_id > 0) {
+        g_source_remove(timeout_id);
+        timeout_id = 0;
+    }
+    hist_label  = NULL;
+    prev_device = NULL;
+}
+
+
+/** \brief  Create widget showing polling statistics of the polled device
+ *
+ * \return  GtkGrid
+ */
+GtkWidget *stats_widget_new(void)
+{
+    GtkWidget *grid;
+    GtkWidget *label;
+    GtkWidget *reset_btn;
+    int        row;
+
+    grid = gtk_grid_new();
+    gtk_grid_set_column_spacing(GTK_GRID(grid), 16);
+    gtk_grid_set_row_spacing(GTK_GRID(grid), 4);
+    gtk_widget_set_margin_top   (grid,  8);
+    gtk_widget_set_margin_start (grid, 16);
+    gtk_widget_set_margin_end   (grid, 16);
+    gtk_widget_set_margin_bottom(grid,  8);
+
+    label = gtk_label_new(NULL);
+    gtk_label_set_markup(GTK_LABEL(label), "<b>Polling statistics</b>");
+    gtk_widget_set_halign(label, GTK_ALIGN_START);
+    gtk_grid_attach(GTK_GRID(grid), label, 0, 0, 2, 1);
+
+    for (row = 0; row < ROW_COUNT; row++) {
+        label = gtk_label_new(row_titles[row]);
+        gtk_widget_set_halign(label, GTK_ALIGN_START);
+        gtk_widget_set_margin_start(label, 8);
+        gtk_grid_attach(GTK_GRID(grid), label, 0, row + 1, 1, 1);
+
+        value_labels[row] = gtk_label_new("-");
+        gtk_widget_set_halign(value_labels[row], GTK_ALIGN_START);
+        gtk_label_set_selectable(GTK_LABEL(value_labels[row]), TRUE);
+        gtk_grid_attach(GTK_GRID(grid), value_labels[row], 1, row + 1, 1, 1);
+    }
+
+    hist_label = gtk_label_new("");
+    gtk_widget_set_halign(hist_label, GTK_ALIGN_START);
+    gtk_widget_set_margin_start(hist_label, 8);
+    gtk_style_context_add_class(gtk_widget_get_style_context(hist_label), "monospace");
+    gtk_grid_attach(GTK_GRID(grid), hist_label, 0, ROW_COUNT + 1, 2, 1);
+
+    reset_btn = gtk_button_new_with_label("Reset statistics");
+    gtk_widget_set_halign(reset_btn, GTK_ALIGN_START);
+    gtk_grid_attach(GTK_GRID(grid), reset_btn, 0, ROW_COUNT + 2, 2, 1);
+    g_signal_connect(G_OBJECT(reset_btn),
+                     "clicked",
+                     G_CALLBACK(on_reset_clicked),
+                     NULL);
+
+    g_signal_connect(G_OBJECT(grid),
+                     "destroy",
+                     G_CALLBACK(on_stats_widget_destroy),
+                     NULL);
+
+    gtk_widget_show_all(grid);
+    return grid;
+}
+
+
+/** \brief  Start refreshing the statistics
+ *
+ * Called by the event widget when it starts polling a device, so there are
+ * no wakeups while nothing is polled.
+ */
+void stats_widget_start(void)
+{
+    if (hist_label == NULL || timeout_id > 0) {
+        return;
+    }
+    on_stats_timeout(NULL);
+    timeout_id = g_timeout_add(STATS_UPDATE_INTERVAL_MS, on_stats_timeout, NULL);
+}
+
+
+/** \brief  Stop refreshing the statistics and clear them
+ *
+ * Called by the event widget when it stops polling.
+ */
+void stats_widget_stop(void)
+{
+    if (timeout_id > 0) {
+        g_source_remove(timeout_id);
+        timeout_id = 0;
+    }
+    if (hist_label != NULL && prev_device != NULL) {
+        clear_values();
+    }
+    prev_device = NULL;
+}
@@ -0,0 +1,15 @@
+/** \file   stats-widget.h
+ * \brief   Widget showing polling engine statistics of the polled device - header
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+#ifndef STATS_WIDGET_H
+#define STATS_WIDGET_H
+
+#include <gtk/gtk.h>
+
+GtkWidget *stats_widget_new(void);
+void       stats_widget_start(void);
+void       stats_widget_stop(void);
+
+#endif
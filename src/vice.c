@@ -1,7 +1,18 @@
 /*
  * Some functions normally available in VICE
+ *
+ * The lib_*() allocation functions go through an allocator that can be
+ * replaced at init with lib_set_allocator(), for example with the pool
+ * allocator installed by lib_pool_allocator_install(). Allocation calls and
+ * bytes can be counted per category, see lib_alloc_set_counting().
  */
 
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,45 +20,565 @@
 #include "vice.h"
 
 
-void *lib_malloc(size_t size)
+/** \brief  Chunk of pool blocks, the blocks follow the header */
+typedef struct lib_pool_chunk_s {
+    struct lib_pool_chunk_s *next;  /**< next chunk */
+    alignas(max_align_t) unsigned char blocks[];    /**< blocks */
+} lib_pool_chunk_t;
+
+/** \brief  Fixed-size block pool
+ *
+ * Blocks are carved from chunks allocated with malloc() and kept on a free
+ * list when freed, chunks are only released by lib_pool_destroy().
+ */
+struct lib_pool_s {
+    size_t            block_size;       /**< block size, aligned */
+    size_t            blocks_per_chunk; /**< number of blocks per chunk */
+    lib_pool_chunk_t *chunks;           /**< list of chunks */
+    void             *free_list;        /**< list of free blocks, linked
+                                             through their first word */
+    pthread_mutex_t   lock;             /**< lock, the pool is shared by
+                                             threads */
+};
+
+
+static void *default_malloc (size_t size, lib_alloc_category_t category, void *data);
+static void *default_calloc (size_t nmemb, size_t size, lib_alloc_category_t category,
+                             void *data);
+static void *default_realloc(void *ptr, size_t size, lib_alloc_category_t category,
+                             void *data);
+static void  default_free   (void *ptr, void *data);
+
+/** \brief  Allocator using the C library */
+static const lib_allocator_t default_allocator = {
+    default_malloc,
+    default_calloc,
+    default_realloc,
+    default_free,
+    NULL
+};
+
+/** \brief  Current allocator
+ *
+ * Only replaced at init, before other threads allocate.
+ */
+static lib_allocator_t allocator = {
+    default_malloc,
+    default_calloc,
+    default_realloc,
+    default_free,
+    NULL
+};
+
+/** \brief  Names of the allocation categories */
+static const char *category_names[LIB_ALLOC_CATEGORY_COUNT] = {
+    [LIB_ALLOC_DEFAULT]     = "default",
+    [LIB_ALLOC_JOY_DEVICE]  = "joy device",
+    [LIB_ALLOC_JOY_STRING]  = "joy string",
+    [LIB_ALLOC_JOY_SCAN]    = "joy scan",
+    [LIB_ALLOC_JOY_CACHE]   = "joy cache",
+    [LIB_ALLOC_JOY_MAPPING] = "joy mapping"
+};
+
+/** \brief  Count allocations */
+static atomic_bool   counting;
+
+/** \brief  Allocation calls per category */
+static atomic_ulong  count_calls[LIB_ALLOC_CATEGORY_COUNT];
+
+/** \brief  Bytes requested per category */
+static atomic_size_t count_bytes[LIB_ALLOC_CATEGORY_COUNT];
+
+/** \brief  Pools of the pool allocator, smallest block size first */
+static lib_pool_t   *allocator_pools[LIB_POOL_CLASSES_MAX];
+
+/** \brief  Number of pools of the pool allocator, 0 if not installed */
+static size_t        allocator_num_pools;
+
+
+static void *default_malloc(size_t size, lib_alloc_category_t category, void *data)
+{
+    (void)category;
+    (void)data;
+    return malloc(size);
+}
+
+static void *default_calloc(size_t nmemb, size_t size, lib_alloc_category_t category,
+                            void *data)
+{
+    (void)category;
+    (void)data;
+    return calloc(nmemb, size);
+}
+
+static void *default_realloc(void *ptr, size_t size, lib_alloc_category_t category,
+                             void *data)
 {
-    void *ptr = malloc(size);
+    (void)category;
+    (void)data;
+    return realloc(ptr, size);
+}
+
+static void default_free(void *ptr, void *data)
+{
+    (void)data;
+    free(ptr);
+}
+
+/** \brief  Update counters for an allocation
+ *
+ * \param[in]   category    allocation category
+ * \param[in]   size        number of bytes requested
+ */
+static void count_alloc(lib_alloc_category_t category, size_t size)
+{
+    if (atomic_load_explicit(&counting, memory_order_relaxed) &&
+            (unsigned int)category < LIB_ALLOC_CATEGORY_COUNT) {
+        atomic_fetch_add_explicit(&count_calls[category], 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&count_bytes[category], size, memory_order_relaxed);
+    }
+}
+
+
+void *lib_malloc_cat(size_t size, lib_alloc_category_t category)
+{
+    void *ptr = allocator.malloc_fn(size, category, allocator.data);
     if (ptr == NULL) {
         fprintf(stderr, "fatal: failed to allocate %zu bytes.\n", size);
         exit(1);
     }
+    count_alloc(category, size);
     return ptr;
 }
 
-void *lib_calloc(size_t nmemb, size_t size)
+void *lib_calloc_cat(size_t nmemb, size_t size, lib_alloc_category_t category)
 {
-    void *ptr = calloc(nmemb, size);
+    void *ptr = allocator.calloc_fn(nmemb, size, category, allocator.data);
     if (ptr == NULL) {
         fprintf(stderr, "fatal: failed to allocate %zu bytes\n", nmemb * size);
         exit(1);
     }
+    count_alloc(category, nmemb * size);
     return ptr;
 }
 
-void *lib_realloc(void *ptr, size_t size)
+void *lib_realloc_cat(void *ptr, size_t size, lib_alloc_category_t category)
 {
-    void *tmp = realloc(ptr, size);
+    void *tmp = allocator.realloc_fn(ptr, size, category, allocator.data);
     if (tmp == NULL) {
         fprintf(stderr, "fatal: failed to reallocate %zu bytes\n", size);
         exit(1);
     }
+    count_alloc(category, size);
     return tmp;
 }
 
+char *lib_strdup_cat(const char *s, lib_alloc_category_t category)
+{
+    size_t  len = strlen(s);
+    char   *ptr = lib_malloc_cat(len + 1u, category);
+    memcpy(ptr, s, len + 1u);
+    return ptr;
+}
+
+
+void *lib_malloc(size_t size)
+{
+    return lib_malloc_cat(size, LIB_ALLOC_DEFAULT);
+}
+
+void *lib_calloc(size_t nmemb, size_t size)
+{
+    return lib_calloc_cat(nmemb, size, LIB_ALLOC_DEFAULT);
+}
+
+void *lib_realloc(void *ptr, size_t size)
+{
+    return lib_realloc_cat(ptr, size, LIB_ALLOC_DEFAULT);
+}
+
 void lib_free(void *ptr)
 {
-    free(ptr);
+    allocator.free_fn(ptr, allocator.data);
 }
 
 char *lib_strdup(const char *s)
 {
-    size_t  len = strlen(s);
-    char   *ptr = lib_malloc(len + 1u);
-    memcpy(ptr, s, len + 1u);
-    return ptr;
+    return lib_strdup_cat(s, LIB_ALLOC_DEFAULT);
+}
+
+
+/** \brief  Set allocator used by the lib_*() functions
+ *
+ * Must be called at init, before anything is allocated through lib_*() that
+ * is freed later: memory must be freed by the allocator that allocated it.
+ *
+ * \param[in]   new_allocator   allocator, \c NULL restores the default
+ */
+void lib_set_allocator(const lib_allocator_t *new_allocator)
+{
+    allocator = new_allocator != NULL ? *new_allocator : default_allocator;
+}
+
+
+/** \brief  Enable or disable the allocation counters
+ *
+ * \param[in]   enabled enable counting
+ */
+void lib_alloc_set_counting(bool enabled)
+{
+    atomic_store(&counting, enabled);
+}
+
+/** \brief  Get allocation counters of a category
+ *
+ * \param[in]   category    allocation category
+ * \param[out]  stats       counters
+ */
+void lib_alloc_get_stats(lib_alloc_category_t category, lib_alloc_stats_t *stats)
+{
+    if ((unsigned int)category >= LIB_ALLOC_CATEGORY_COUNT) {
+        stats->calls = 0;
+        stats->bytes = 0;
+        return;
+    }
+    stats->calls = atomic_load(&count_calls[category]);
+    stats->bytes = atomic_load(&count_bytes[category]);
+}
+
+/** \brief  Get name of an allocation category
+ *
+ * \param[in]   category    allocation category
+ *
+ * \return  name
+ */
+const char *lib_alloc_category_name(lib_alloc_category_t category)
+{
+    if ((unsigned int)category >= LIB_ALLOC_CATEGORY_COUNT) {
+        return "<?>";
+    }
+    return category_names[category];
+}
+
+/** \brief  Print allocation counters of all categories on stderr
+ *
+ * Not stdout, which carries the stream in headless mode.
+ */
+void lib_alloc_print_stats(void)
+{
+    int c;
+
+    fprintf(stderr, "%-12s %10s %12s\n", "category", "calls", "bytes");
+    for (c = 0; c < LIB_ALLOC_CATEGORY_COUNT; c++) {
+        lib_alloc_stats_t stats;
+
+        lib_alloc_get_stats((lib_alloc_category_t)c, &stats);
+        fprintf(stderr, "%-12s %10lu %12zu\n",
+               lib_alloc_category_name((lib_alloc_category_t)c),
+               stats.calls, stats.bytes);
+    }
+}
+
+
+/** \brief  Create fixed-size block pool
+ *
+ * \param[in]   block_size          size of blocks
+ * \param[in]   blocks_per_chunk    number of blocks to allocate at once
+ *
+ * \return  pool
+ */
+lib_pool_t *lib_pool_new(size_t block_size, size_t blocks_per_chunk)
+{
+    lib_pool_t *pool = malloc(sizeof *pool);
+
+    if (pool == NULL) {
+        fprintf(stderr, "fatal: failed to allocate %zu bytes.\n", sizeof *pool);
+        exit(1);
+    }
+    if (block_size < sizeof(void *)) {
+        block_size = sizeof(void *);
+    }
+    /* keep each block suitably aligned for any object */
+    block_size = (block_size + alignof(max_align_t) - 1u) & ~(alignof(max_align_t) - 1u);
+
+    pool->block_size       = block_size;
+    pool->blocks_per_chunk = blocks_per_chunk > 0 ? blocks_per_chunk : 1u;
+    pool->chunks           = NULL;
+    pool->free_list        = NULL;
+    pthread_mutex_init(&(pool->lock), NULL);
+    return pool;
+}
+
+/** \brief  Allocate block from pool
+ *
+ * \param[in]   pool    pool
+ *
+ * \return  block of at least the block size given to lib_pool_new()
+ */
+void *lib_pool_alloc(lib_pool_t *pool)
+{
+    void *block;
+
+    pthread_mutex_lock(&(pool->lock));
+    if (pool->free_list == NULL) {
+        lib_pool_chunk_t *chunk;
+        size_t            i;
+
+        chunk = malloc(sizeof *chunk + pool->block_size * pool->blocks_per_chunk);
+        if (chunk == NULL) {
+            pthread_mutex_unlock(&(pool->lock));
+            return NULL;
+        }
+        chunk->next  = pool->chunks;
+        pool->chunks = chunk;
+        /* thread the new blocks onto the free list, first block first */
+        for (i = pool->blocks_per_chunk; i > 0; i--) {
+            void *b = chunk->blocks + (i - 1u) * pool->block_size;
+
+            *(void **)b     = pool->free_list;
+            pool->free_list = b;
+        }
+    }
+    block           = pool->free_list;
+    pool->free_list = *(void **)block;
+    pthread_mutex_unlock(&(pool->lock));
+    return block;
+}
+
+/** \brief  Return block to pool
+ *
+ * \param[in]   pool    pool
+ * \param[in]   ptr     block allocated from \a pool, or \c NULL
+ */
+void lib_pool_free(lib_pool_t *pool, void *ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&(pool->lock));
+    *(void **)ptr   = pool->free_list;
+    pool->free_list = ptr;
+    pthread_mutex_unlock(&(pool->lock));
+}
+
+/** \brief  Determine if a pointer is a block of a pool
+ *
+ * \param[in]   pool    pool
+ * \param[in]   ptr     pointer
+ *
+ * \return  \c true if \a ptr was allocated from \a pool
+ */
+bool lib_pool_owns(lib_pool_t *pool, const void *ptr)
+{
+    const lib_pool_chunk_t *chunk;
+    uintptr_t               p = (uintptr_t)ptr;
+    bool                    owned = false;
+
+    pthread_mutex_lock(&(pool->lock));
+    for (chunk = pool->chunks; chunk != NULL; chunk = chunk->next) {
+        uintptr_t start = (uintptr_t)chunk->blocks;
+        uintptr_t end   = start + pool->block_size * pool->blocks_per_chunk;
+
+        if (p >= start && p < end) {
+            owned = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&(pool->lock));
+    return owned;
+}
+
+
+/** \brief  Free pool and all its blocks
+ *
+ * \param[in]   pool    pool
+ */
+void lib_pool_destroy(lib_pool_t *pool)
+{
+    lib_pool_chunk_t *chunk;
+
+    if (pool == NULL) {
+        return;
+    }
+    chunk = pool->chunks;
+    while (chunk != NULL) {
+        lib_pool_chunk_t *next = chunk->next;
+
+        free(chunk);
+        chunk = next;
+    }
+    pthread_mutex_destroy(&(pool->lock));
+    free(pool);
+}
+
+
+/** \brief  Determine if the pool allocator serves a category from its pools
+ *
+ * Only the joystick subsystem, the rest of VICE keeps using malloc().
+ *
+ * \param[in]   category    allocation category
+ *
+ * \return  \c true if pooled
+ */
+static bool pool_allocator_pooled(lib_alloc_category_t category)
+{
+    return category > LIB_ALLOC_DEFAULT && category < LIB_ALLOC_CATEGORY_COUNT;
+}
+
+/** \brief  Find pool of the smallest size class that fits an allocation
+ *
+ * \param[in]   size        number of bytes
+ * \param[in]   category    allocation category
+ *
+ * \return  pool or \c NULL if not served from a pool
+ */
+static lib_pool_t *pool_allocator_find(size_t size, lib_alloc_category_t category)
+{
+    size_t i;
+
+    if (size == 0 || !pool_allocator_pooled(category)) {
+        return NULL;
+    }
+    for (i = 0; i < allocator_num_pools; i++) {
+        if (size <= allocator_pools[i]->block_size) {
+            return allocator_pools[i];
+        }
+    }
+    return NULL;
+}
+
+/** \brief  Find pool a block was allocated from
+ *
+ * \param[in]   ptr     pointer
+ *
+ * \return  pool or \c NULL if allocated with malloc()
+ */
+static lib_pool_t *pool_allocator_owner(const void *ptr)
+{
+    size_t i;
+
+    if (ptr == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < allocator_num_pools; i++) {
+        if (lib_pool_owns(allocator_pools[i], ptr)) {
+            return allocator_pools[i];
+        }
+    }
+    return NULL;
+}
+
+static void *pool_allocator_malloc(size_t size, lib_alloc_category_t category, void *data)
+{
+    lib_pool_t *pool = pool_allocator_find(size, category);
+
+    (void)data;
+    if (pool != NULL) {
+        return lib_pool_alloc(pool);
+    }
+    return malloc(size);
+}
+
+static void *pool_allocator_calloc(size_t nmemb, size_t size, lib_alloc_category_t category,
+                                   void *data)
+{
+    lib_pool_t *pool = NULL;
+
+    (void)data;
+    if (size > 0 && nmemb > 0 && nmemb <= SIZE_MAX / size) {
+        pool = pool_allocator_find(nmemb * size, category);
+    }
+    if (pool != NULL) {
+        void *ptr = lib_pool_alloc(pool);
+
+        if (ptr != NULL) {
+            memset(ptr, 0, nmemb * size);
+        }
+        return ptr;
+    }
+    return calloc(nmemb, size);
+}
+
+static void *pool_allocator_realloc(void *ptr, size_t size, lib_alloc_category_t category,
+                                    void *data)
+{
+    lib_pool_t *pool;
+    void       *tmp;
+
+    if (ptr == NULL) {
+        return pool_allocator_malloc(size, category, data);
+    }
+    pool = pool_allocator_owner(ptr);
+    if (pool == NULL) {
+        /* size of the old block unknown, so it can't move into a pool */
+        return realloc(ptr, size);
+    }
+    if (size > 0 && size <= pool->block_size) {
+        return ptr;
+    }
+    tmp = pool_allocator_malloc(size, category, data);
+    if (tmp != NULL) {
+        memcpy(tmp, ptr, size < pool->block_size ? size : pool->block_size);
+        lib_pool_free(pool, ptr);
+    }
+    return tmp;
+}
+
+static void pool_allocator_free(void *ptr, void *data)
+{
+    lib_pool_t *pool = pool_allocator_owner(ptr);
+
+    (void)data;
+    if (pool != NULL) {
+        lib_pool_free(pool, ptr);
+    } else {
+        free(ptr);
+    }
+}
+
+
+/** \brief  Install allocator serving joystick allocations from pools
+ *
+ * Allocations in the \c LIB_ALLOC_JOY_* categories come from the pool of
+ * the smallest size class they fit in, larger ones and all other categories
+ * from malloc(). Memory allocated before installing can still be freed, the
+ * pools are never destroyed.
+ *
+ * \param[in]   classes     size classes, in increasing block size
+ * \param[in]   num_classes number of size classes, at most
+ *                          \c LIB_POOL_CLASSES_MAX
+ *
+ * \return  \c false if the pool allocator was already installed or the
+ *          classes are invalid
+ */
+bool lib_pool_allocator_install(const lib_pool_class_t *classes, size_t num_classes)
+{
+    lib_allocator_t pool_allocator;
+    size_t          i;
+
+    if (allocator_num_pools > 0) {
+        return false;
+    }
+    if (num_classes == 0 || num_classes > LIB_POOL_CLASSES_MAX) {
+        fprintf(stderr, "error: invalid number of pool size classes: %zu\n", num_classes);
+        return false;
+    }
+    for (i = 1; i < num_classes; i++) {
+        if (classes[i].block_size <= classes[i - 1u].block_size) {
+            fprintf(stderr, "error: pool size classes not in increasing size\n");
+            return false;
+        }
+    }
+    for (i = 0; i < num_classes; i++) {
+        allocator_pools[i] = lib_pool_new(classes[i].block_size, classes[i].blocks_per_chunk);
+    }
+    allocator_num_pools = num_classes;
+
+    pool_allocator.malloc_fn  = pool_allocator_malloc;
+    pool_allocator.calloc_fn  = pool_allocator_calloc;
+    pool_allocator.realloc_fn = pool_allocator_realloc;
+    pool_allocator.free_fn    = pool_allocator_free;
+    pool_allocator.data       = NULL;
+    lib_set_allocator(&pool_allocator);
+    return true;
 }
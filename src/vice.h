@@ -1,12 +1,83 @@
 #ifndef VICE_H
 #define VICE_H
 
+#include <stdbool.h>
 #include <stdlib.h>
 
+/** \brief  Allocation categories
+ *
+ * Used for the allocation counters, and passed to the allocator so it can
+ * treat the joystick subsystem differently from the rest.
+ */
+typedef enum {
+    LIB_ALLOC_DEFAULT = 0,      /**< anything not categorized */
+    LIB_ALLOC_JOY_DEVICE,       /**< joystick device info blocks and arenas */
+    LIB_ALLOC_JOY_STRING,       /**< joystick paths and names */
+    LIB_ALLOC_JOY_SCAN,         /**< joystick scan/probe scratch space */
+    LIB_ALLOC_JOY_CACHE,        /**< joystick capability cache */
+    LIB_ALLOC_JOY_MAPPING,      /**< controller mapping database */
+
+    LIB_ALLOC_CATEGORY_COUNT    /**< number of categories */
+} lib_alloc_category_t;
+
+/** \brief  Allocator used by the lib_*() functions
+ *
+ * The functions must not return \c NULL for non-zero sizes unless out of
+ * memory. \c free_fn gets passed \c NULL pointers as well, and pointers
+ * allocated in any category.
+ */
+typedef struct lib_allocator_s {
+    void *(*malloc_fn) (size_t size, lib_alloc_category_t category, void *data);
+    void *(*calloc_fn) (size_t nmemb, size_t size, lib_alloc_category_t category,
+                        void *data);
+    void *(*realloc_fn)(void *ptr, size_t size, lib_alloc_category_t category,
+                        void *data);
+    void  (*free_fn)   (void *ptr, void *data);
+    void   *data;       /**< passed to the functions */
+} lib_allocator_t;
+
+/** \brief  Allocation counters of a category */
+typedef struct lib_alloc_stats_s {
+    unsigned long calls;    /**< number of (re)allocations */
+    size_t        bytes;    /**< total bytes requested */
+} lib_alloc_stats_t;
+
+/** \brief  Fixed-size block pool */
+typedef struct lib_pool_s lib_pool_t;
+
+/** \brief  Maximum number of size classes of the pool allocator */
+#define LIB_POOL_CLASSES_MAX    4
+
+/** \brief  Size class of the pool allocator */
+typedef struct lib_pool_class_s {
+    size_t block_size;          /**< largest size served from the class */
+    size_t blocks_per_chunk;    /**< number of blocks to allocate at once */
+} lib_pool_class_t;
+
 void *lib_malloc(size_t size);
 void *lib_calloc(size_t nmemb, size_t size);
 void *lib_realloc(void *ptr, size_t size);
 void  lib_free  (void *ptr);
 char *lib_strdup(const char *s);
 
+void *lib_malloc_cat (size_t size, lib_alloc_category_t category);
+void *lib_calloc_cat (size_t nmemb, size_t size, lib_alloc_category_t category);
+void *lib_realloc_cat(void *ptr, size_t size, lib_alloc_category_t category);
+char *lib_strdup_cat (const char *s, lib_alloc_category_t category);
+
+void  lib_set_allocator(const lib_allocator_t *allocator);
+
+void        lib_alloc_set_counting(bool enabled);
+void        lib_alloc_get_stats(lib_alloc_category_t category, lib_alloc_stats_t *stats);
+const char *lib_alloc_category_name(lib_alloc_category_t category);
+void        lib_alloc_print_stats(void);
+
+lib_pool_t *lib_pool_new(size_t block_size, size_t blocks_per_chunk);
+void       *lib_pool_alloc(lib_pool_t *pool);
+void        lib_pool_free(lib_pool_t *pool, void *ptr);
+bool        lib_pool_owns(lib_pool_t *pool, const void *ptr);
+void        lib_pool_destroy(lib_pool_t *pool);
+
+bool        lib_pool_allocator_install(const lib_pool_class_t *classes, size_t num_classes);
+
 #endif